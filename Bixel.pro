@@ -4,14 +4,18 @@
 
 TEMPLATE = app
 INCLUDEPATH += .
-LIBS += -lGL -lGLEW
+LIBS += -lGL -lGLEW -lz
 
 # Input
 SOURCES += src/*.cpp 
 
 HEADERS += src/*.hpp
+
+# Icons and shaders are compiled in, so startup reads no files from res/
+RESOURCES += res/bixel.qrc
 QT += widgets 
 QT += opengl
+CONFIG += c++11
 
 OBJECTS_DIR=src/generated_files
 MOC_DIR=src/generated_files
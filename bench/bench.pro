@@ -0,0 +1,45 @@
+######################################################################
+# Benchmarks for the canvas core. Headless: no Qt, widgets or GL.
+#
+#   cd bench && qmake && make && ./bench > results.json
+#   ./bench --check all
+######################################################################
+
+TEMPLATE = app
+TARGET = bench
+CONFIG += console c++11
+CONFIG -= qt app_bundle
+INCLUDEPATH += ../src
+LIBS += -lz -lpthread
+
+# Input
+SOURCES += *.cpp \
+           ../src/animation.cpp \
+           ../src/bixlfile.cpp \
+           ../src/compositor.cpp \
+           ../src/dirtyregion.cpp \
+           ../src/filterpipeline.cpp \
+           ../src/floodfill.cpp \
+           ../src/history.cpp \
+           ../src/imageimporter.cpp \
+           ../src/indexedimage.cpp \
+           ../src/layerstack.cpp \
+           ../src/lazycanvas.cpp \
+           ../src/mappedbixlfile.cpp \
+           ../src/operationlog.cpp \
+           ../src/pixelbuffer.cpp \
+           ../src/pngexporter.cpp \
+           ../src/quantizer.cpp \
+           ../src/selection.cpp \
+           ../src/sessionclient.cpp \
+           ../src/sessionconnection.cpp \
+           ../src/sessionrelay.cpp \
+           ../src/strokeengine.cpp \
+           ../src/threadpool.cpp \
+           ../src/tiledcanvas.cpp \
+           ../src/tracer.cpp \
+           ../src/transformengine.cpp
+
+HEADERS += *.hpp
+
+OBJECTS_DIR=generated_files
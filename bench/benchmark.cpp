@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "benchmark.hpp"
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+};
+
+/**
+ * @param warmup        Untimed runs before measuring.
+ * @param repetitions   Timed runs; at least one.
+ */
+Benchmark::Benchmark(int warmup, int repetitions) :
+    m_warmup(std::max(0, warmup)), m_repetitions(std::max(1, repetitions)) {
+}
+
+/**
+ * Only operations whose name contains filter are run. Empty runs all.
+ */
+void Benchmark::setFilter(const std::string& filter) {
+    m_filter = filter;
+}
+
+/**
+ * Measures body on a size x size canvas and prints a progress line to
+ * stderr.
+ */
+void Benchmark::run(const std::string& operation, int size, const std::string& pattern,
+                    const Body& setup, const Body& body) {
+    if(!m_filter.empty() && operation.find(m_filter) == std::string::npos) {
+        return;
+    }
+
+    for(int i = 0; i < m_warmup; i++) {
+        if(setup) {
+            setup();
+        }
+        body();
+    }
+
+    std::vector<double> times;
+    for(int i = 0; i < m_repetitions; i++) {
+        if(setup) {
+            setup();
+        }
+        Clock::time_point start = Clock::now();
+        body();
+        times.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+
+    Result result;
+    result.operation = operation;
+    result.pattern = pattern;
+    result.size = size;
+    result.minimum = times.front();
+    result.maximum = times.back();
+    result.median = times.size() % 2 ? times[times.size() / 2]
+                                     : (times[times.size() / 2 - 1] + times[times.size() / 2]) / 2;
+    result.mean = 0;
+    for(size_t i = 0; i < times.size(); i++) {
+        result.mean += times[i] / times.size();
+    }
+    m_results.push_back(result);
+
+    fprintf(stderr, "%-22s %5d %-8s median %10.3f ms  min %10.3f ms\n",
+            operation.c_str(), size, pattern.c_str(), result.median, result.minimum);
+}
+
+/**
+ * Writes every result as one JSON document. Times are in milliseconds;
+ * bixels_per_second is size * size / median.
+ */
+void Benchmark::writeJson(FILE* out) const {
+    fprintf(out, "{\n");
+    fprintf(out, "  \"warmup\": %d,\n", m_warmup);
+    fprintf(out, "  \"repetitions\": %d,\n", m_repetitions);
+    fprintf(out, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+    fprintf(out, "  \"results\": [");
+    for(size_t i = 0; i < m_results.size(); i++) {
+        const Result& result = m_results[i];
+        double bixels = (double) result.size * result.size;
+        fprintf(out, "%s\n    {\"operation\": \"%s\", \"size\": %d, \"pattern\": \"%s\", "
+                     "\"min_ms\": %.6f, \"median_ms\": %.6f, \"mean_ms\": %.6f, \"max_ms\": %.6f, "
+                     "\"bixels_per_second\": %.0f}",
+                i == 0 ? "" : ",", result.operation.c_str(), result.size, result.pattern.c_str(),
+                result.minimum, result.median, result.mean, result.maximum,
+                result.median > 0 ? bixels / (result.median / 1000) : 0.0);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
@@ -0,0 +1,43 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+#include <stdio.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Times operations and reports them as JSON.
+ *
+ * Each run() calls setup and body warm-up times untimed, then
+ * repetitions more times, timing only body. setup is for work that must
+ * be redone before every repetition (restoring a canvas the body
+ * modifies) and should not count.
+ */
+class Benchmark {
+    public:
+        typedef std::function<void()> Body;
+
+        Benchmark(int warmup, int repetitions);
+
+        void setFilter(const std::string& filter);
+        void run(const std::string& operation, int size, const std::string& pattern,
+                 const Body& setup, const Body& body);
+        void writeJson(FILE* out) const;
+
+    private:
+        struct Result {
+            std::string operation;
+            std::string pattern;
+            int size;
+            double minimum;
+            double median;
+            double mean;
+            double maximum;
+        };
+
+        int m_warmup;
+        int m_repetitions;
+        std::string m_filter;
+        std::vector<Result> m_results;
+};
+#endif
@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+#include "checks.hpp"
+#include "bixlfile.hpp"
+#include "mappedbixlfile.hpp"
+#include "lazycanvas.hpp"
+#include "tiledcanvas.hpp"
+#include "layerstack.hpp"
+#include "animation.hpp"
+#include "history.hpp"
+#include "strokeengine.hpp"
+
+namespace {
+    std::atomic<long> allocations(0);
+};
+
+/**
+ * Counts every allocation in the bench, so checks can assert that a
+ * path does not allocate.
+ */
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void* memory = malloc(size ? size : 1);
+    if(!memory) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept {
+    free(memory);
+}
+
+namespace {
+    struct Context {
+        std::string resources;
+        std::string temporary;
+        int failures;
+    };
+
+    typedef void (*Check)(Context& context);
+
+    void fail(Context& context, const char* format, ...) {
+        va_list arguments;
+        va_start(arguments, format);
+        vfprintf(stderr, format, arguments);
+        va_end(arguments);
+        fputc('\n', stderr);
+        context.failures++;
+    }
+
+    bool readFile(const std::string& fileName, std::vector<unsigned char>& data) {
+        FILE* file = fopen(fileName.c_str(), "rb");
+        if(!file) {
+            return false;
+        }
+        unsigned char buffer[65536];
+        size_t count;
+        while((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            data.insert(data.end(), buffer, buffer + count);
+        }
+        fclose(file);
+        return true;
+    }
+
+    /**
+     * love.bixl is a 32x32 v1 file of the word LOVE with a point above
+     * and below it. v1 bixels run down the columns, so reading them row
+     * by row would put the points at the left and right edges.
+     */
+    void checkLoveV1(Context& context) {
+        std::string fileName = context.resources + "/love.bixl";
+        std::vector<unsigned char> original;
+        BixlImage image;
+        if(!readFile(fileName, original) || !BixlFile::read(fileName, image)) {
+            fail(context, "v1_love: cannot read %s", fileName.c_str());
+            return;
+        }
+        if(image.width() != 32 || image.height() != 32) {
+            fail(context, "v1_love: decoded as %d x %d", image.width(), image.height());
+            return;
+        }
+
+        Rgba background = image.pixels.pixel(0, 0);
+        if(image.pixels.pixel(16, 3) == background || image.pixels.pixel(16, 31) == background
+           || image.pixels.pixel(3, 16) != background || image.pixels.pixel(31, 16) != background) {
+            fail(context, "v1_love: decoded transposed");
+        }
+
+        std::vector<unsigned char> encoded;
+        BixlFile::encode(image, encoded, BixlFile::AUTO, 1);
+        if(encoded != original) {
+            fail(context, "v1_love: re-encoding does not reproduce the file");
+        }
+
+        MappedBixlFile mapped;
+        PixelBuffer tiled(image.width(), image.height());
+        if(!mapped.open(fileName)
+           || !mapped.readRegion(0, 0, tiled.width(), tiled.height(), tiled.data(), tiled.stride())
+           || !(tiled == image.pixels)) {
+            fail(context, "v1_love: mapped reader disagrees with BixlFile::read");
+        }
+
+        std::string copy = context.temporary + "/bixel-check-love.bixl";
+        BixlImage reread;
+        if(!BixlFile::write(copy, image) || !BixlFile::read(copy, reread) || !(reread.pixels == image.pixels)) {
+            fail(context, "v1_love: does not survive a round trip through v2");
+        }
+        remove(copy.c_str());
+    }
+
+    /**
+     * A 150x100 image of three overlapping layers: an opaque bottom
+     * layer, a half opaque multiplied one and a hidden one, written as
+     * v3. Every loader must read it as drawn.
+     */
+    void checkLayeredLoaders(Context& context) {
+        BixlImage image(150, 100, 8);
+        image.layers.push_back(Layer("bottom", 150, 100));
+        image.layers.push_back(Layer("multiply", 150, 100));
+        image.layers.push_back(Layer("hidden", 150, 100));
+        image.layers[0].pixels.fill(packRgba(200, 180, 40));
+        image.layers[0].pixels.fillRect(10, 10, 50, 80, packRgba(20, 40, 240));
+        image.layers[1].pixels.fillRect(30, 20, 110, 40, packRgba(120, 255, 120));
+        image.layers[1].opacity = 128;
+        image.layers[1].blendMode = Layer::MULTIPLY;
+        image.layers[2].pixels.fill(packRgba(255, 0, 0));
+        image.layers[2].visible = false;
+
+        std::string fileName = context.temporary + "/bixel-check-layers.bixl";
+        BixlImage expected;
+        if(!BixlFile::write(fileName, image) || !BixlFile::read(fileName, expected)
+           || expected.layers.size() != 3) {
+            fail(context, "v3_loaders: cannot write and read back %s", fileName.c_str());
+            remove(fileName.c_str());
+            return;
+        }
+
+        MappedBixlFile mapped;
+        PixelBuffer region(150, 100);
+        if(!mapped.open(fileName) || mapped.layerCount() != 3
+           || !mapped.readRegion(0, 0, 150, 100, region.data(), region.stride())
+           || !(region == expected.pixels)) {
+            fail(context, "v3_loaders: mapped reader disagrees with BixlFile::read");
+        }
+
+        LazyCanvas lazy;
+        BixlImage lazyImage;
+        if(!lazy.open(fileName)) {
+            fail(context, "v3_loaders: lazy canvas cannot open the file");
+        } else {
+            lazy.prefetch(0, 0, 70, 50);
+            lazy.toImage(lazyImage);
+            if(!(lazyImage.pixels == expected.pixels) || lazyImage.dimension != 8) {
+                fail(context, "v3_loaders: lazy canvas disagrees with BixlFile::read");
+            }
+        }
+
+        TiledCanvas tiled;
+        PixelBuffer tiledPixels;
+        if(!tiled.read(fileName)) {
+            fail(context, "v3_loaders: tiled canvas cannot read the file");
+        } else {
+            tiled.toPixelBuffer(tiledPixels);
+            if(!(tiledPixels == expected.pixels)) {
+                fail(context, "v3_loaders: tiled canvas disagrees with BixlFile::read");
+            }
+        }
+        remove(fileName.c_str());
+    }
+
+    /**
+     * The canvas opens documents through LayerStack::fromImage() and saves
+     * them through toImage(). A layered document painted on and saved
+     * that way must read back with every layer as it was.
+     */
+    void checkLayersSurvive(Context& context) {
+        BixlImage image(150, 100, 8);
+        image.layers.push_back(Layer("bottom", 150, 100));
+        image.layers.push_back(Layer("screen", 150, 100));
+        image.layers[0].pixels.fill(packRgba(200, 180, 40));
+        image.layers[1].pixels.fillRect(30, 20, 110, 40, packRgba(120, 255, 120));
+        image.layers[1].opacity = 100;
+        image.layers[1].blendMode = Layer::SCREEN;
+
+        LayerStack stack(0, 0);
+        stack.fromImage(image);
+        stack.currentPixels().fillRect(0, 0, 20, 20, packRgba(10, 20, 30));
+        stack.setVisible(0, false);
+
+        std::string fileName = context.temporary + "/bixel-check-survive.bixl";
+        BixlImage saved;
+        stack.toImage(saved, 8);
+        BixlImage reopened;
+        if(!BixlFile::write(fileName, saved) || !BixlFile::read(fileName, reopened)) {
+            fail(context, "layers_survive: cannot write and read back %s", fileName.c_str());
+            remove(fileName.c_str());
+            return;
+        }
+        remove(fileName.c_str());
+
+        LayerStack reread(0, 0);
+        reread.fromImage(reopened);
+        if(reread.layerCount() != stack.layerCount()) {
+            fail(context, "layers_survive: %d layers saved, %d read back", stack.layerCount(), reread.layerCount());
+            return;
+        }
+        for(int i = 0; i < stack.layerCount(); i++) {
+            const Layer& before = stack.layer(i);
+            const Layer& after = reread.layer(i);
+            if(after.name != before.name || after.opacity != before.opacity || after.visible != before.visible
+               || after.blendMode != before.blendMode || !(after.pixels == before.pixels)) {
+                fail(context, "layers_survive: layer %d (%s) changed", i, before.name.c_str());
+            }
+        }
+        if(!(reread.flattened() == stack.flattened())) {
+            fail(context, "layers_survive: the composite changed");
+        }
+    }
+
+    /**
+     * The canvas opens animations through Animation::fromImage() and
+     * saves a snapshot of the frames' tiles through BixlFile::writeFrames.
+     * Painting after the snapshot must not reach the file, and every
+     * frame and the frame rate must read back as they were.
+     */
+    void checkFramesSurvive(Context& context) {
+        BixlImage image(100, 80, 8);
+        image.fps = 8;
+        for(int i = 0; i < 3; i++) {
+            image.frames.push_back(PixelBuffer(100, 80, packRgba(30, 60, 90)));
+            image.frames.back().fillRect(10 + i * 20, 10, 16, 16, packRgba(250, 200, 0));
+        }
+        Animation animation;
+        animation.fromImage(image);
+        animation.setCurrentFrame(1);
+        animation.pixels().fillRect(70, 50, 20, 20, packRgba(0, 0, 0));
+        animation.commit();
+
+        std::vector<TiledCanvas> frames;
+        std::vector<PixelBuffer> expected;
+        for(int i = 0; i < animation.frameCount(); i++) {
+            frames.push_back(animation.frame(i));
+            expected.push_back(PixelBuffer());
+            frames.back().toPixelBuffer(expected.back());
+        }
+        animation.pixels().fill(packRgba(255, 0, 0));
+        animation.commit();
+
+        std::string fileName = context.temporary + "/bixel-check-frames.bixl";
+        BixlImage reopened;
+        bool written = BixlFile::writeFrames(fileName, 100, 80, 8, animation.fps(), frames.size(),
+                                             [&frames](int index, PixelBuffer& pixels) {
+            frames[index].toPixelBuffer(pixels);
+        });
+        if(!written || !BixlFile::read(fileName, reopened)) {
+            fail(context, "frames_survive: cannot write and read back %s", fileName.c_str());
+            remove(fileName.c_str());
+            return;
+        }
+        remove(fileName.c_str());
+
+        if(reopened.frames.size() != expected.size() || reopened.fps != 8) {
+            fail(context, "frames_survive: %d frames at 8 fps saved, %d at %d fps read back",
+                 (int) expected.size(), (int) reopened.frames.size(), reopened.fps);
+            return;
+        }
+        for(size_t i = 0; i < expected.size(); i++) {
+            if(!(reopened.frames[i] == expected[i])) {
+                fail(context, "frames_survive: frame %d changed", (int) i);
+            }
+        }
+    }
+
+    /**
+     * A 5000 event stroke wandering over a 512x512 canvas, flushed every
+     * 16 events as a canvas would once per frame.
+     */
+    void paintStroke(StrokeEngine& stroke, PixelBuffer& pixels, History& history) {
+        unsigned int seed = 99;
+        ivec2 bixel(256, 256);
+        stroke.begin(pixels, &history, packRgba(255, 0, 0), bixel);
+        for(int i = 0; i < 5000; i++) {
+            seed = seed * 1103515245 + 12345;
+            bixel.x = std::min(511, std::max(0, bixel.x + (int) ((seed >> 8) % 9) - 4));
+            bixel.y = std::min(511, std::max(0, bixel.y + (int) ((seed >> 20) % 9) - 4));
+            stroke.moveTo(bixel);
+            if(i % 16 == 15) {
+                stroke.flush();
+            }
+        }
+        stroke.end();
+    }
+
+    /**
+     * Once the same stroke has been painted, painting it again with a
+     * History attached allocates only to store its undo step: one copy
+     * each of the step's spans and values, and at most a new block of
+     * the undo list.
+     */
+    void checkStrokeAllocations(Context& context) {
+        PixelBuffer pixels(512, 512);
+        History history;
+        StrokeEngine stroke;
+        stroke.setBrushSize(3);
+        paintStroke(stroke, pixels, history);
+        paintStroke(stroke, pixels, history);
+
+        long before = allocations.load();
+        paintStroke(stroke, pixels, history);
+        long count = allocations.load() - before;
+        if(count > 3) {
+            fail(context, "stroke_allocations: a warm 5000 event stroke allocated %ld times", count);
+        }
+        Selection selection(512, 512);
+        if(!history.undo(pixels, selection)) {
+            fail(context, "stroke_allocations: the stroke left no undo step");
+        }
+    }
+
+    struct Entry {
+        const char* name;
+        Check check;
+    };
+
+    const Entry CHECKS[] = {
+        { "v1_love", checkLoveV1 },
+        { "v3_loaders", checkLayeredLoaders },
+        { "layers_survive", checkLayersSurvive },
+        { "frames_survive", checkFramesSurvive },
+        { "stroke_allocations", checkStrokeAllocations }
+    };
+};
+
+/**
+ * @param filter    Runs the checks whose name contains filter; "all"
+ *                  runs every check.
+ */
+int runChecks(const std::string& filter, const std::string& resourceDirectory,
+              const std::string& temporaryDirectory) {
+    Context context;
+    context.resources = resourceDirectory;
+    context.temporary = temporaryDirectory;
+    context.failures = 0;
+
+    for(size_t i = 0; i < sizeof(CHECKS) / sizeof(CHECKS[0]); i++) {
+        std::string name = CHECKS[i].name;
+        if(filter != "all" && name.find(filter) == std::string::npos) {
+            continue;
+        }
+        int failures = context.failures;
+        CHECKS[i].check(context);
+        fprintf(stderr, "%s: %s\n", name.c_str(), context.failures == failures ? "ok" : "FAILED");
+    }
+    return context.failures;
+}
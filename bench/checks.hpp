@@ -0,0 +1,16 @@
+#ifndef CHECKS_HPP
+#define CHECKS_HPP
+#include <string>
+
+/**
+ * Targeted correctness checks that run next to the benchmarks:
+ *
+ *      bench --check all [--resources DIR] [--temp DIR]
+ *
+ * Unlike the benchmarks, each check asserts a specific property (a
+ * file decodes the right way up, a path does not allocate) and reports
+ * a failure on stderr. Returns the number of failed checks.
+ */
+int runChecks(const std::string& filter, const std::string& resourceDirectory,
+              const std::string& temporaryDirectory);
+#endif
@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include "benchmark.hpp"
+#include "checks.hpp"
+#include "pixelbuffer.hpp"
+#include "selection.hpp"
+#include "history.hpp"
+#include "bixlfile.hpp"
+#include "mappedbixlfile.hpp"
+#include "lazycanvas.hpp"
+#include "tiledcanvas.hpp"
+#include "floodfill.hpp"
+#include "strokeengine.hpp"
+#include "pngexporter.hpp"
+#include "quantizer.hpp"
+#include "indexedimage.hpp"
+#include "imageimporter.hpp"
+#include "transformengine.hpp"
+#include "operationlog.hpp"
+#include "sessionclient.hpp"
+#include "sessionrelay.hpp"
+#include "filterpipeline.hpp"
+#include "threadpool.hpp"
+
+/**
+ * Benchmarks for the canvas core, without widgets or GL:
+ *
+ *      bench [--sizes 32,128,512] [--patterns solid,noise] [--filter open]
+ *            [--warmup N] [--repetitions N] [--temp DIR] [--output FILE]
+ *      bench --check all|NAME [--resources DIR] [--temp DIR]
+ *
+ * Every operation runs on synthetic square canvases of each size and
+ * fill pattern. Progress goes to stderr and the JSON report to stdout
+ * or FILE, so runs can be diffed or compared by a script. --check runs
+ * the checks in checks.cpp instead and exits non-zero if any fail.
+ */
+namespace {
+    // Operations that scale badly (v1 files are 16 bytes per bixel,
+    // scaled exports grow with the square of the scale) stop here.
+    const int HEAVY_SIZE_LIMIT = 2048;
+
+    // Peers and rounds of concurrent edits in session_converge.
+    const int SESSION_PEERS = 4;
+    const int SESSION_ROUNDS = 3;
+    const int SESSION_TIMEOUT = 10000;
+
+    struct Options {
+        std::vector<int> sizes;
+        std::vector<std::string> patterns;
+        std::string filter;
+        std::string check;
+        std::string resourceDirectory;
+        std::string temporaryDirectory;
+        std::string output;
+        int warmup;
+        int repetitions;
+
+        Options() : resourceDirectory("../res/test_files"), temporaryDirectory("/tmp"), warmup(1), repetitions(5) {
+            int defaultSizes[] = { 32, 128, 512, 2048, 8192 };
+            sizes.assign(defaultSizes, defaultSizes + 5);
+            const char* defaultPatterns[] = { "solid", "noise", "stripes", "sparse" };
+            patterns.assign(defaultPatterns, defaultPatterns + 4);
+            if(getenv("TMPDIR")) {
+                temporaryDirectory = getenv("TMPDIR");
+            }
+        }
+    };
+
+    std::vector<std::string> split(const std::string& text) {
+        std::vector<std::string> parts;
+        size_t start = 0;
+        while(start <= text.size()) {
+            size_t comma = text.find(',', start);
+            if(comma == std::string::npos) {
+                comma = text.size();
+            }
+            if(comma > start) {
+                parts.push_back(text.substr(start, comma - start));
+            }
+            start = comma + 1;
+        }
+        return parts;
+    }
+
+    bool parseArguments(int argc, char* argv[], Options& options) {
+        for(int i = 1; i < argc; i++) {
+            std::string argument = argv[i];
+            if(i + 1 >= argc) {
+                return false;
+            }
+            std::string value = argv[++i];
+            if(argument == "--sizes") {
+                options.sizes.clear();
+                std::vector<std::string> sizes = split(value);
+                for(size_t j = 0; j < sizes.size(); j++) {
+                    options.sizes.push_back(atoi(sizes[j].c_str()));
+                }
+            } else if(argument == "--patterns") {
+                options.patterns = split(value);
+            } else if(argument == "--filter") {
+                options.filter = value;
+            } else if(argument == "--warmup") {
+                options.warmup = atoi(value.c_str());
+            } else if(argument == "--repetitions") {
+                options.repetitions = atoi(value.c_str());
+            } else if(argument == "--check") {
+                options.check = value;
+            } else if(argument == "--resources") {
+                options.resourceDirectory = value;
+            } else if(argument == "--temp") {
+                options.temporaryDirectory = value;
+            } else if(argument == "--output") {
+                options.output = value;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * solid:   one opaque color
+     * noise:   every bixel random, the worst case for run length coding
+     * stripes: 8 colors in 8 bixel diagonal bands
+     * sparse:  transparent with a few opaque blocks, like level art
+     */
+    bool makeCanvas(const std::string& pattern, int size, PixelBuffer& pixels) {
+        pixels = PixelBuffer(size, size);
+        unsigned int seed = 12345;
+        for(int y = 0; y < size; y++) {
+            Rgba* row = pixels.row(y);
+            for(int x = 0; x < size; x++) {
+                if(pattern == "solid") {
+                    row[x] = packRgba(88, 140, 126);
+                } else if(pattern == "noise") {
+                    seed = seed * 1103515245 + 12345;
+                    row[x] = seed | 0xFF000000;
+                } else if(pattern == "stripes") {
+                    row[x] = packRgba(((x + y) / 8 % 8) * 32, 100, 200);
+                } else if(pattern == "sparse") {
+                    bool block = (x / 64) % 7 == 3 && (y / 64) % 5 == 2;
+                    row[x] = block ? packRgba(217, 100, 89) : 0;
+                } else {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Runs a relay and SESSION_PEERS peers on one canvas. The first peer
+     * seeds the session with original; then every round, each peer edits
+     * the same rows with its own color and flushes before anyone polls,
+     * so the relay orders batches that peers already applied locally in
+     * another order and peers have to rebase. Exits the bench if the
+     * peers do not end up with identical canvases and selections.
+     */
+    void convergeSession(const std::string& socketPath, const PixelBuffer& original) {
+        SessionRelay relay(socketPath);
+        if(!relay.listen()) {
+            fprintf(stderr, "session_converge: cannot listen on %s\n", socketPath.c_str());
+            exit(1);
+        }
+        std::thread relayThread([&relay]() { relay.run(); });
+
+        int size = original.width();
+        std::vector<PixelBuffer> pixels(SESSION_PEERS);
+        std::vector<Selection> selections(SESSION_PEERS);
+        std::vector<std::unique_ptr<SessionClient> > peers;
+        pixels[0] = original;
+        selections[0].resize(size, size);
+        for(int p = 0; p < SESSION_PEERS; p++) {
+            peers.push_back(std::unique_ptr<SessionClient>(new SessionClient()));
+            if(!peers[p]->join(socketPath, pixels[p], selections[p])) {
+                fprintf(stderr, "session_converge: peer %d could not join\n", p);
+                exit(1);
+            }
+        }
+
+        for(int round = 0; round < SESSION_ROUNDS; round++) {
+            for(int p = 0; p < SESSION_PEERS; p++) {
+                OperationLog& batch = peers[p]->batch();
+                Rgba color = packRgba(p * 60, round * 80, 200);
+                for(int y = round; y < size; y += 3) {
+                    batch.addRun(p * size / 8, y, size / 2, color);
+                }
+                batch.addSelection(0, round, size, p % 2 == 0);
+                batch.apply(pixels[p], selections[p]);
+                peers[p]->flush();
+            }
+            for(int p = 0; p < SESSION_PEERS; p++) {
+                peers[p]->poll(pixels[p], selections[p]);
+            }
+        }
+
+        // Every batch has arrived everywhere once no peer waits for an
+        // acknowledgement and all canvases agree; give up after a while.
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(SESSION_TIMEOUT);
+        bool converged = false;
+        while(!converged && std::chrono::steady_clock::now() < deadline) {
+            std::vector<pollfd> fds;
+            for(int p = 0; p < SESSION_PEERS; p++) {
+                pollfd fd = { peers[p]->fd(), POLLIN, 0 };
+                fds.push_back(fd);
+            }
+            ::poll(fds.data(), fds.size(), 10);
+            converged = true;
+            for(int p = 0; p < SESSION_PEERS; p++) {
+                peers[p]->flush();
+                peers[p]->poll(pixels[p], selections[p]);
+                converged = converged && peers[p]->isJoined() && peers[p]->pendingCount() == 0;
+            }
+            for(int p = 1; p < SESSION_PEERS && converged; p++) {
+                converged = pixels[p] == pixels[0] && selections[p] == selections[0];
+            }
+        }
+
+        peers.clear();
+        relay.stop();
+        relayThread.join();
+        if(!converged) {
+            fprintf(stderr, "session_converge: peers diverged on a %d x %d canvas\n", size, size);
+            exit(1);
+        }
+    }
+
+    void runCanvas(Benchmark& benchmark, ThreadPool& pool, const Options& options,
+                   int size, const std::string& pattern, const PixelBuffer& original) {
+        std::string v1File = options.temporaryDirectory + "/bixel-bench-v1.bixl";
+        std::string v2File = options.temporaryDirectory + "/bixel-bench-v2.bixl";
+        std::string pngFile = options.temporaryDirectory + "/bixel-bench.png";
+        bool heavy = size <= HEAVY_SIZE_LIMIT;
+
+        BixlImage image(size, size, 1);
+        image.pixels = original;
+        PixelBuffer pixels;
+        Benchmark::Body restore = [&pixels, &original]() { pixels = original; };
+
+        //-File I/O-//
+        if(heavy) {
+            benchmark.run("save_v1", size, pattern, 0, [&]() { BixlFile::write(v1File, image, BixlFile::AUTO, 1); });
+        }
+        benchmark.run("save_v2", size, pattern, 0, [&]() { BixlFile::write(v2File, image); });
+        benchmark.run("save_tiled", size, pattern, 0, [&]() {
+            TiledCanvas canvas;
+            canvas.fromPixelBuffer(original);
+            canvas.write(v2File);
+        });
+        BixlFile::write(v2File, image);
+        if(heavy) {
+            BixlFile::write(v1File, image, BixlFile::AUTO, 1);
+            benchmark.run("open_v1", size, pattern, 0, [&]() { BixlImage read; BixlFile::read(v1File, read); });
+        }
+        benchmark.run("open_v2", size, pattern, 0, [&]() { BixlImage read; BixlFile::read(v2File, read); });
+        benchmark.run("open_lazy_viewport", size, pattern, 0, [&]() {
+            LazyCanvas canvas;
+            canvas.open(v2File);
+            canvas.prefetch(0, 0, std::min(size, 256), std::min(size, 256));
+        });
+        benchmark.run("open_tiled", size, pattern, 0, [&]() { TiledCanvas canvas; canvas.read(v2File); });
+
+        //-Painting-//
+        benchmark.run("set_color_at_100k", size, pattern, restore, [&]() {
+            unsigned int seed = 1;
+            for(int i = 0; i < 100000; i++) {
+                seed = seed * 1103515245 + 12345;
+                pixels.setPixel((seed >> 8) % size, (seed >> 20) % size, packRgba(255, 0, 0));
+            }
+        });
+        benchmark.run("stroke_1000", size, pattern, restore, [&]() {
+            History history;
+            StrokeEngine stroke;
+            stroke.setBrushSize(3);
+            stroke.begin(pixels, &history, packRgba(255, 0, 0), ivec2(0, 0));
+            unsigned int seed = 7;
+            for(int i = 0; i < 1000; i++) {
+                seed = seed * 1103515245 + 12345;
+                stroke.moveTo(ivec2((seed >> 8) % size, (seed >> 20) % size));
+                if(i % 16 == 15) {
+                    stroke.flush();
+                }
+            }
+            stroke.end();
+        });
+        benchmark.run("flood_fill", size, pattern, restore, [&]() {
+            History history;
+            FloodFill fill;
+            fill.fill(pixels, size / 2, size / 2, packRgba(1, 2, 3), &history);
+        });
+
+        //-Selection-//
+        Selection selection(size, size);
+        benchmark.run("select_rectangle", size, pattern, [&]() { selection.clear(); }, [&]() {
+            selection.setRect(size / 8, size / 8, size * 3 / 4, size * 3 / 4);
+        });
+        benchmark.run("fill_selected", size, pattern, restore, [&]() {
+            selection.fillPixels(pixels, packRgba(0, 0, 255));
+        });
+
+        //-History-//
+        History history;
+        Selection unused(size, size);
+        benchmark.run("history_step_undo_redo", size, pattern, restore, [&]() {
+            history.touchRect(pixels, 0, 0, size / 2, size / 2);
+            pixels.fillRect(0, 0, size / 2, size / 2, packRgba(0, 255, 0));
+            history.endStep();
+            history.undo(pixels, unused);
+            history.redo(pixels, unused);
+        });
+
+        //-Indexed color-//
+        Quantizer quantizer(&pool);
+        IndexedImage indexed;
+        benchmark.run("quantize_64", size, pattern, 0, [&]() { quantizer.convert(original, 64, indexed); });
+        benchmark.run("recolor_palette", size, pattern, 0, [&]() {
+            indexed.setPaletteColor(0, indexed.palette()[0] ^ 0x00FFFFFF);
+        });
+
+        //-Import-//
+        ImageImporter importer(&pool);
+        PixelBuffer reduced(std::max(1, size / 8), std::max(1, size / 8));
+        benchmark.run("downsample_8x", size, pattern, 0, [&]() {
+            importer.downsample(ImageImporter::Source(original), reduced);
+        });
+
+        //-Transform-//
+        TransformEngine transformer(&pool);
+        PixelBuffer transformed;
+        benchmark.run("rotate_90", size, pattern, 0, [&]() {
+            transformer.transform(original, 0, 0, size, size, TransformEngine::ROTATE_90, transformed);
+        });
+        benchmark.run("flip_horizontal", size, pattern, 0, [&]() {
+            transformer.transform(original, 0, 0, size, size, TransformEngine::FLIP_HORIZONTAL, transformed);
+        });
+
+        //-Filters-//
+        FilterPipeline replacer(&pool);
+        replacer.add(FilterPipeline::Filter::replaceColor(original.pixel(0, 0), packRgba(255, 0, 255)));
+        benchmark.run("filter_replace_color", size, pattern, restore, [&]() {
+            History history;
+            replacer.apply(pixels, 0, &history);
+        });
+        FilterPipeline chain(&pool);
+        chain.add(FilterPipeline::Filter::adjustHsv(30, 1.2f, 0.9f));
+        chain.add(FilterPipeline::Filter::outline(packRgba(0, 0, 0)));
+        chain.add(FilterPipeline::Filter::dropShadow(packRgba(0, 0, 0, 128), 2, 2));
+        benchmark.run("filter_hsv_outline_shadow", size, pattern, restore, [&]() {
+            History history;
+            chain.apply(pixels, 0, &history);
+        });
+        std::vector<Rgba> palette;
+        for(int i = 0; i < 64; i++) {
+            palette.push_back(packRgba((i & 3) * 85, (i >> 2 & 3) * 85, (i >> 4) * 85));
+        }
+        FilterPipeline ditherer(&pool);
+        ditherer.add(FilterPipeline::Filter::dither(palette));
+        benchmark.run("filter_dither_64", size, pattern, restore, [&]() {
+            History history;
+            ditherer.apply(pixels, 0, &history);
+        });
+
+        //-Session-//
+        OperationLog log;
+        std::vector<unsigned char> compressed;
+        benchmark.run("session_encode_canvas", size, pattern, 0, [&]() {
+            log.clear();
+            log.addRect(original, 0, 0, size, size);
+            log.compress(compressed);
+        });
+        Selection shared(size, size);
+        benchmark.run("session_apply_canvas", size, pattern, restore, [&]() { log.apply(pixels, shared); });
+        if(heavy) {
+            std::string socketPath = options.temporaryDirectory + "/bench-session.sock";
+            benchmark.run("session_converge", size, pattern, 0, [&]() { convergeSession(socketPath, original); });
+        }
+
+        //-Export-//
+        PngExporter exporter(&pool);
+        benchmark.run("export_png_x1", size, pattern, 0, [&]() { exporter.exportImage(original, pngFile); });
+        if(heavy) {
+            exporter.setScale(4);
+            benchmark.run("export_png_x4", size, pattern, 0, [&]() { exporter.exportImage(original, pngFile); });
+        }
+
+        remove(v1File.c_str());
+        remove(v2File.c_str());
+        remove(pngFile.c_str());
+    }
+};
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if(!parseArguments(argc, argv, options)) {
+        fprintf(stderr, "usage: bench [--sizes 32,128,...] [--patterns solid,noise,stripes,sparse]\n"
+                        "             [--filter OPERATION] [--warmup N] [--repetitions N]\n"
+                        "             [--temp DIR] [--output FILE]\n"
+                        "       bench --check all|NAME [--resources DIR] [--temp DIR]\n");
+        return 2;
+    }
+
+    if(!options.check.empty()) {
+        return runChecks(options.check, options.resourceDirectory, options.temporaryDirectory) == 0 ? 0 : 1;
+    }
+
+    Benchmark benchmark(options.warmup, options.repetitions);
+    benchmark.setFilter(options.filter);
+    ThreadPool pool;
+
+    for(size_t s = 0; s < options.sizes.size(); s++) {
+        for(size_t p = 0; p < options.patterns.size(); p++) {
+            PixelBuffer original;
+            if(options.sizes[s] <= 0 || !makeCanvas(options.patterns[p], options.sizes[s], original)) {
+                fprintf(stderr, "bad size or pattern: %d %s\n", options.sizes[s], options.patterns[p].c_str());
+                return 2;
+            }
+            runCanvas(benchmark, pool, options, options.sizes[s], options.patterns[p], original);
+        }
+    }
+
+    FILE* out = options.output.empty() ? stdout : fopen(options.output.c_str(), "w");
+    if(!out) {
+        fprintf(stderr, "cannot write %s\n", options.output.c_str());
+        return 1;
+    }
+    benchmark.writeJson(out);
+    if(out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
@@ -1,6 +0,0 @@
-#version 130
-
-uniform vec4 color;
-void main() {
-    gl_FragColor = color;
-}
@@ -0,0 +1,31 @@
+#version 130
+
+uniform sampler2D pixels;
+uniform usampler2D selection;
+uniform vec2 gridSize;
+uniform float mipLevel;
+uniform vec4 backgroundColor;
+uniform vec4 selectionColor;
+uniform vec4 hoverColor;
+uniform ivec2 hoverBixel;
+
+in vec2 gridPosition;
+void main() {
+    ivec2 bixel = min(ivec2(floor(gridPosition)), ivec2(gridSize) - 1);
+    vec4 color;
+    if(mipLevel > 0.0) {
+        color = textureLod(pixels, gridPosition / gridSize, mipLevel);
+    } else {
+        color = texelFetch(pixels, bixel, 0);
+    }
+    vec3 result = mix(backgroundColor.rgb, color.rgb, color.a);
+
+    uint word = texelFetch(selection, ivec2(bixel.x / 32, bixel.y), 0).r;
+    if(((word >> uint(bixel.x % 32)) & 1u) == 1u) {
+        result = mix(result, selectionColor.rgb, selectionColor.a);
+    }
+    if(bixel == hoverBixel) {
+        result = mix(result, hoverColor.rgb, hoverColor.a);
+    }
+    gl_FragColor = vec4(result, 1);
+}
@@ -1,10 +1,13 @@
 #version 130
 
+uniform vec4 quad;
+uniform vec4 gridRect;
+
 in vec2 screenCorner;
-in vec4 color;
-in vec2 squarePosition;
 
-out vec2 squarePosition;
+out vec2 gridPosition;
 void main() {
-    gl_Position.xy = screenCorner;
+    vec2 corner = screenCorner * 0.5 + 0.5;
+    gridPosition = vec2(mix(gridRect.x, gridRect.z, corner.x), mix(gridRect.w, gridRect.y, corner.y));
+    gl_Position = vec4(mix(quad.xy, quad.zw, corner), 0, 1);
 }
@@ -0,0 +1,431 @@
+#include <algorithm>
+#include <unordered_set>
+#include "animation.hpp"
+#include "tracer.hpp"
+
+/**
+ * Creates an animation of one transparent frame.
+ */
+Animation::Animation(int width, int height, int dimension) :
+    m_width(std::max(0, width)), m_height(std::max(0, height)), m_dimension(dimension),
+    m_current(0), m_pixels(m_width, m_height), m_fps(DEFAULT_FPS),
+    m_historyBudget(History::DEFAULT_BYTE_BUDGET), m_revision(0) {
+    addFrame();
+}
+
+int Animation::width() const {
+    return m_width;
+}
+
+int Animation::height() const {
+    return m_height;
+}
+
+int Animation::dimension() const {
+    return m_dimension;
+}
+
+/**
+ * Resizes every frame, keeping the bixels that still fit. Frames are
+ * TiledCanvases, so this costs in proportion to the tiles stored along
+ * the cut rather than to the area; only the current frame is reloaded
+ * in full. Undo histories are cleared, as their steps are for the old
+ * size.
+ */
+void Animation::resize(int width, int height) {
+    commit();
+    m_width = std::max(0, width);
+    m_height = std::max(0, height);
+    for(size_t i = 0; i < m_frames.size(); i++) {
+        m_frames[i].canvas.resize(m_width, m_height);
+        m_frames[i].history.clear();
+    }
+    load();
+}
+
+int Animation::frameCount() const {
+    return m_frames.size();
+}
+
+/**
+ * The stored bixels of frame index. The current frame's are only up to
+ * date after commit().
+ */
+const TiledCanvas& Animation::frame(int index) const {
+    return m_frames[index].canvas;
+}
+
+/**
+ * Inserts a transparent frame at index, or at the end if index is -1,
+ * and makes it current.
+ *
+ * @return  The index of the new frame.
+ */
+int Animation::addFrame(int index) {
+    if(!m_frames.empty()) {
+        commit();
+    }
+    if(index < 0 || index > (int) m_frames.size()) {
+        index = m_frames.size();
+    }
+    Frame frame;
+    frame.canvas = TiledCanvas(m_width, m_height, m_dimension);
+    m_frames.insert(m_frames.begin() + index, frame);
+    m_current = index;
+    splitHistoryBudget();
+    load();
+    return index;
+}
+
+/**
+ * Inserts a copy of frame index after it and makes the copy current.
+ * The copy shares every tile with the original and starts with an empty
+ * history.
+ *
+ * @return  The index of the copy.
+ */
+int Animation::duplicateFrame(int index) {
+    commit();
+    Frame frame;
+    frame.canvas = m_frames[index].canvas;
+    m_frames.insert(m_frames.begin() + index + 1, frame);
+    m_current = index + 1;
+    splitHistoryBudget();
+    load();
+    return m_current;
+}
+
+/**
+ * Removes frame index and its history. The last frame cannot be
+ * removed.
+ */
+void Animation::removeFrame(int index) {
+    if(m_frames.size() <= 1 || index < 0 || index >= (int) m_frames.size()) {
+        return;
+    }
+    commit();
+    m_frames.erase(m_frames.begin() + index);
+    m_current = std::min(m_current > index ? m_current - 1 : m_current, (int) m_frames.size() - 1);
+    splitHistoryBudget();
+    load();
+}
+
+/**
+ * Moves frame from to position to; the current frame moves with it.
+ */
+void Animation::moveFrame(int from, int to) {
+    int count = m_frames.size();
+    if(from < 0 || from >= count || to < 0 || to >= count || from == to) {
+        return;
+    }
+    if(from < to) {
+        std::rotate(m_frames.begin() + from, m_frames.begin() + from + 1, m_frames.begin() + to + 1);
+    } else {
+        std::rotate(m_frames.begin() + to, m_frames.begin() + from, m_frames.begin() + from + 1);
+    }
+    if(m_current == from) {
+        m_current = to;
+    } else if(from < m_current && m_current <= to) {
+        m_current--;
+    } else if(to <= m_current && m_current < from) {
+        m_current++;
+    }
+    m_revision++;
+}
+
+int Animation::currentFrame() const {
+    return m_current;
+}
+
+/**
+ * Commits the frame being edited and loads frame index into pixels().
+ */
+void Animation::setCurrentFrame(int index) {
+    index = std::max(0, std::min((int) m_frames.size() - 1, index));
+    if(index == m_current) {
+        return;
+    }
+    commit();
+    m_current = index;
+    load();
+}
+
+/**
+ * The bixels of the current frame, for painting. They are reloaded when
+ * the current frame changes, so the reference stays valid.
+ */
+PixelBuffer& Animation::pixels() {
+    return m_pixels;
+}
+
+const PixelBuffer& Animation::pixels() const {
+    return m_pixels;
+}
+
+/**
+ * The current frame's history. Its steps apply to pixels().
+ */
+History& Animation::history() {
+    return m_frames[m_current].history;
+}
+
+/**
+ * Stores pixels() into the current frame. Tiles that are unchanged stay
+ * shared, and changed ones are shared with any frame that has the same
+ * bixels there.
+ */
+void Animation::commit() {
+    Tracer::Zone zone("commit_frame");
+    m_frames[m_current].canvas.fromPixelBuffer(m_pixels, m_cache);
+    m_revision++;
+}
+
+int Animation::fps() const {
+    return m_fps;
+}
+
+void Animation::setFps(int fps) {
+    m_fps = std::max(1, std::min(240, fps));
+}
+
+/**
+ * Sets the bytes of undo history kept across all frames.
+ */
+void Animation::setHistoryByteBudget(size_t byteBudget) {
+    m_historyBudget = byteBudget;
+    splitHistoryBudget();
+}
+
+/**
+ * Changes whenever a frame's stored bixels or the frame order change.
+ */
+uint64_t Animation::revision() const {
+    return m_revision;
+}
+
+/**
+ * @return  The number of distinct tiles stored across all frames.
+ */
+size_t Animation::uniqueTileCount() const {
+    std::unordered_set<const Rgba*> tiles;
+    for(size_t i = 0; i < m_frames.size(); i++) {
+        const TiledCanvas& canvas = m_frames[i].canvas;
+        for(int ty = 0; ty < canvas.tilesY(); ty++) {
+            for(int tx = 0; tx < canvas.tilesX(); tx++) {
+                const Rgba* tile = canvas.tile(tx, ty);
+                if(tile) {
+                    tiles.insert(tile);
+                }
+            }
+        }
+    }
+    return tiles.size();
+}
+
+/**
+ * @return  The bytes of bixel data held by the frames, counting each
+ *          shared tile once, plus the frame being edited.
+ */
+size_t Animation::byteSize() const {
+    return uniqueTileCount() * TiledCanvas::TILE_AREA * sizeof(Rgba)
+         + (size_t) m_pixels.width() * m_pixels.height() * sizeof(Rgba);
+}
+
+/**
+ * Writes every frame to one PNG, columns frames to a row, in frame
+ * order. Rows of the sheet are read straight from the frames' tiles as
+ * the exporter asks for them, so the sheet is never built in memory.
+ *
+ * @param columns   Frames per row of the sheet; 0 puts them all in one
+ *                  row. Cells after the last frame are transparent.
+ */
+bool Animation::exportSpriteSheet(PngExporter& exporter, const std::string& fileName, int columns) {
+    commit();
+    int count = m_frames.size();
+    if(columns <= 0 || columns > count) {
+        columns = count;
+    }
+    int rows = (count + columns - 1) / columns;
+    if((int64_t) m_width * columns > 0x7FFFFFFF || (int64_t) m_height * rows > 0x7FFFFFFF) {
+        return false;
+    }
+
+    int width = m_width;
+    int height = m_height;
+    const std::vector<Frame>& frames = m_frames;
+    return exporter.exportRows(width * columns, height * rows, [&frames, width, height, columns](int y, Rgba* row) {
+        int first = y / height * columns;
+        for(int column = 0; column < columns; column++) {
+            Rgba* cell = row + (size_t) column * width;
+            if(first + column < (int) frames.size()) {
+                frames[first + column].canvas.readRegion(0, y % height, width, 1, cell, width);
+            } else {
+                PixelBuffer::fillSpan(cell, width, 0);
+            }
+        }
+    }, fileName);
+}
+
+/**
+ * Opens a .bixl file of any version; files that are not animations
+ * become one frame.
+ */
+bool Animation::read(const std::string& fileName) {
+    Tracer::Zone zone("animation_read");
+    BixlImage image;
+    if(!BixlFile::read(fileName, image)) {
+        return false;
+    }
+    fromImage(image);
+    return true;
+}
+
+/**
+ * Replaces the animation with a decoded document; one that is not an
+ * animation becomes one frame. Frames are stored one by one, sharing
+ * the tiles they have in common, and their bixels are released from
+ * image as they are. The first frame is made current and undo histories
+ * start empty.
+ */
+void Animation::fromImage(BixlImage& image) {
+    if(image.frames.empty()) {
+        image.frames.push_back(PixelBuffer());
+        image.frames.back().swap(image.pixels);
+    }
+
+    m_width = image.frames[0].width();
+    m_height = image.frames[0].height();
+    m_dimension = image.dimension;
+    m_frames.clear();
+    m_cache.clear();
+    m_frames.resize(image.frames.size());
+    for(size_t i = 0; i < image.frames.size(); i++) {
+        m_frames[i].canvas = TiledCanvas(m_width, m_height, m_dimension);
+        m_frames[i].canvas.fromPixelBuffer(image.frames[i], m_cache);
+        image.frames[i] = PixelBuffer();
+    }
+    if(image.fps > 0) {
+        setFps(image.fps);
+    }
+    m_current = 0;
+    splitHistoryBudget();
+    load();
+}
+
+/**
+ * Commits the current frame and saves every frame and the frame rate.
+ * Frames are written one at a time, so saving never needs more than one
+ * more frame's worth of bixels.
+ */
+bool Animation::write(const std::string& fileName) {
+    commit();
+    return BixlFile::writeFrames(fileName, m_width, m_height, m_dimension, m_fps, m_frames.size(),
+                                 [this](int index, PixelBuffer& pixels) {
+        m_frames[index].canvas.toPixelBuffer(pixels);
+    });
+}
+
+//-Private-//
+
+/**
+ * Loads the current frame into m_pixels and marks it all dirty.
+ */
+void Animation::load() {
+    m_frames[m_current].canvas.toPixelBuffer(m_pixels);
+    m_revision++;
+}
+
+void Animation::splitHistoryBudget() {
+    size_t share = m_historyBudget / std::max<size_t>(1, m_frames.size());
+    for(size_t i = 0; i < m_frames.size(); i++) {
+        m_frames[i].history.setByteBudget(share);
+    }
+}
+
+//-AnimationPlayer-//
+
+AnimationPlayer::AnimationPlayer(const Animation& animation) :
+    m_animation(animation), m_playing(false), m_start(0), m_shown(-1), m_shownRevision(0) {
+}
+
+/**
+ * Starts playing from the first frame, drawing it into display, which is
+ * sized to the animation here and must not be resized while playing.
+ *
+ * @param now   A monotonic time in nanoseconds, e.g. Tracer::now().
+ */
+void AnimationPlayer::start(int64_t now, PixelBuffer& display) {
+    display.resize(m_animation.width(), m_animation.height());
+    m_playing = true;
+    m_start = now;
+    m_shown = -1;
+    present(0, display);
+}
+
+void AnimationPlayer::stop() {
+    m_playing = false;
+}
+
+bool AnimationPlayer::isPlaying() const {
+    return m_playing;
+}
+
+/**
+ * Brings display to the frame due at now.
+ *
+ * @return  true if display changed.
+ */
+bool AnimationPlayer::update(int64_t now, PixelBuffer& display) {
+    if(!m_playing) {
+        return false;
+    }
+    int64_t elapsed = std::max<int64_t>(0, now - m_start);
+    int index = elapsed * m_animation.fps() / 1000000000 % m_animation.frameCount();
+    if(index == m_shown && m_shownRevision == m_animation.revision()) {
+        return false;
+    }
+    present(index, display);
+    return true;
+}
+
+/**
+ * The index of the frame on display, or -1 before start().
+ */
+int AnimationPlayer::frame() const {
+    return m_shown;
+}
+
+//-Private-//
+
+/**
+ * Copies into display the tiles of frame index that differ from the
+ * frame shown, or all of them if nothing valid is shown.
+ */
+void AnimationPlayer::present(int index, PixelBuffer& display) {
+    Tracer::Zone zone("present_frame");
+    const TiledCanvas& next = m_animation.frame(index);
+    const TiledCanvas* shown = 0;
+    if(m_shown >= 0 && m_shown < m_animation.frameCount() && m_shownRevision == m_animation.revision()) {
+        shown = &m_animation.frame(m_shown);
+    }
+
+    const int tileSize = TiledCanvas::TILE_SIZE;
+    int copied = 0;
+    for(int ty = 0; ty < next.tilesY(); ty++) {
+        for(int tx = 0; tx < next.tilesX(); tx++) {
+            if(shown && shown->tile(tx, ty) == next.tile(tx, ty)) {
+                continue;
+            }
+            int x = tx * tileSize;
+            int y = ty * tileSize;
+            int width = std::min(tileSize, display.width() - x);
+            int height = std::min(tileSize, display.height() - y);
+            next.readRegion(x, y, width, height, display.row(y) + x, display.stride());
+            display.markDirty(x, y, width, height);
+            copied++;
+        }
+    }
+    Tracer::counter("presented_tiles", copied);
+    m_shown = index;
+    m_shownRevision = m_animation.revision();
+}
@@ -0,0 +1,134 @@
+#ifndef ANIMATION_HPP
+#define ANIMATION_HPP
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "tiledcanvas.hpp"
+#include "history.hpp"
+#include "pngexporter.hpp"
+#include "bixlfile.hpp"
+
+/**
+ * A document made of frames of the same size, played back in order.
+ *
+ * Frames are TiledCanvases whose tiles are shared through one
+ * TiledCanvas::TileCache: a tile that is the same in several frames,
+ * such as the background behind a moving sprite, is stored once
+ * however many frames hold it, so memory grows with what differs
+ * between frames rather than with their number. A duplicated frame
+ * shares all of its tiles until it is painted on.
+ *
+ * The current frame is edited in a PixelBuffer, like a single image, by
+ * the usual brushes and fills. commit() stores it back into its frame,
+ * comparing tile by tile so unchanged tiles stay shared; switching
+ * frames commits first.
+ *
+ * Every frame has its own History, recording the changes made to that
+ * frame, so undo steps back through the edits of the frame on screen.
+ * The history byte budget is split evenly between the frames. Adding,
+ * removing and reordering frames is not undoable.
+ *
+ * Animations are saved as v4 .bixl files with one chunk per frame; see
+ * BixlFile.
+ */
+class Animation {
+    public:
+        static const int DEFAULT_FPS = 12;
+
+        Animation(int width = 0, int height = 0, int dimension = 0);
+
+        int width() const;
+        int height() const;
+        int dimension() const;
+        void resize(int width, int height);
+
+        int frameCount() const;
+        const TiledCanvas& frame(int index) const;
+        int addFrame(int index = -1);
+        int duplicateFrame(int index);
+        void removeFrame(int index);
+        void moveFrame(int from, int to);
+
+        int currentFrame() const;
+        void setCurrentFrame(int index);
+        PixelBuffer& pixels();
+        const PixelBuffer& pixels() const;
+        History& history();
+        void commit();
+
+        int fps() const;
+        void setFps(int fps);
+        void setHistoryByteBudget(size_t byteBudget);
+
+        uint64_t revision() const;
+        size_t uniqueTileCount() const;
+        size_t byteSize() const;
+
+        bool exportSpriteSheet(PngExporter& exporter, const std::string& fileName, int columns = 0);
+        void fromImage(BixlImage& image);
+        bool read(const std::string& fileName);
+        bool write(const std::string& fileName);
+
+    private:
+        struct Frame {
+            TiledCanvas canvas;
+            History history;
+        };
+
+        void load();
+        void splitHistoryBudget();
+
+        int m_width;
+        int m_height;
+        int m_dimension;
+        std::vector<Frame> m_frames;
+        TiledCanvas::TileCache m_cache;
+        int m_current;
+        PixelBuffer m_pixels;
+        int m_fps;
+        size_t m_historyBudget;
+        uint64_t m_revision;
+};
+
+/**
+ * Plays an Animation into a PixelBuffer at its frame rate.
+ *
+ * The frame on screen is worked out from the time since start(), not by
+ * counting updates, so playback keeps to the frame rate however often
+ * update() is called and skips frames rather than drifting when it
+ * falls behind.
+ *
+ * Going from one frame to the next copies only the tiles that differ
+ * between them; since identical tiles are shared, comparing tile
+ * pointers is enough to find them. The copied tiles are marked in the
+ * display's DirtyRegion, so CanvasRenderer::uploadDirtyPixels() sends
+ * just those to the GPU. Nothing is allocated once playback has started.
+ *
+ * The animation must not be edited while it plays; a changed
+ * revision() makes the next update redraw the whole frame.
+ */
+class AnimationPlayer {
+    public:
+        AnimationPlayer(const Animation& animation);
+
+        void start(int64_t now, PixelBuffer& display);
+        void stop();
+        bool isPlaying() const;
+        bool update(int64_t now, PixelBuffer& display);
+        int frame() const;
+
+    private:
+        AnimationPlayer(const AnimationPlayer&);
+        AnimationPlayer& operator=(const AnimationPlayer&);
+
+        void present(int index, PixelBuffer& display);
+
+        const Animation& m_animation;
+        bool m_playing;
+        int64_t m_start;
+        int m_shown;
+        uint64_t m_shownRevision;
+};
+#endif
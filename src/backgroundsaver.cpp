@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include "backgroundsaver.hpp"
+#include "tracer.hpp"
+
+namespace {
+    std::atomic<unsigned> temporaryCount(0);
+
+    /**
+     * Creates an empty file with a name no other save, in this process or
+     * another, is using, beside fileName.
+     *
+     * @return  An open descriptor, or -1.
+     */
+    int createTemporary(const std::string& fileName, std::string& temporary) {
+        for(int attempt = 0; attempt < 100; attempt++) {
+            temporary = fileName + "." + std::to_string(getpid()) + "." + std::to_string(temporaryCount++) + ".tmp";
+            int descriptor = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+            if(descriptor >= 0 || errno != EEXIST) {
+                return descriptor;
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * Flushes the directory holding fileName, so a rename into it
+     * survives a crash.
+     */
+    bool syncDirectory(const std::string& fileName) {
+        size_t slash = fileName.rfind('/');
+        std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : fileName.substr(0, slash));
+        int descriptor = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(descriptor < 0) {
+            return false;
+        }
+        bool success = fsync(descriptor) == 0;
+        ::close(descriptor);
+        return success;
+    }
+};
+
+BackgroundSaver::BackgroundSaver() : m_writing(false), m_stopping(false) {
+    m_thread = std::thread(&BackgroundSaver::run, this);
+}
+
+/**
+ * Finishes every requested save before returning.
+ */
+BackgroundSaver::~BackgroundSaver() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_requestAvailable.notify_all();
+    m_thread.join();
+}
+
+/**
+ * @param callback  Called on the worker thread after each save.
+ */
+void BackgroundSaver::setCallback(const Callback& callback) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_callback = callback;
+}
+
+/**
+ * Queues writer to save fileName and returns at once.
+ *
+ * @param writer    Writes the snapshot to the file name it is passed
+ *                  and returns whether it succeeded. Runs on the worker
+ *                  thread, so it must only use data it owns.
+ * @param tag       Passed back to the callback.
+ */
+void BackgroundSaver::save(const std::string& fileName, const Writer& writer, int tag) {
+    Request request = { fileName, writer, tag };
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        bool replaced = false;
+        for(size_t i = 0; i < m_requests.size() && !replaced; i++) {
+            if(m_requests[i].fileName == fileName) {
+                m_requests[i] = request;
+                replaced = true;
+            }
+        }
+        if(!replaced) {
+            m_requests.push_back(request);
+        }
+    }
+    m_requestAvailable.notify_one();
+}
+
+bool BackgroundSaver::isBusy() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_writing || !m_requests.empty();
+}
+
+void BackgroundSaver::waitForIdle() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this]() { return !m_writing && m_requests.empty(); });
+}
+
+/**
+ * Safely replaces fileName: writer fills a temporary file beside it,
+ * which is flushed to disk and renamed over fileName, and the directory
+ * is flushed so the rename itself is durable. Every call gets its own
+ * temporary file, so saves of the same file never write into each
+ * other's. On failure the temporary file is removed and fileName is
+ * left untouched.
+ */
+bool BackgroundSaver::replaceFile(const std::string& fileName, const Writer& writer) {
+    Tracer::Zone zone("replace_file");
+    std::string temporary;
+    int descriptor = createTemporary(fileName, temporary);
+    if(descriptor < 0) {
+        return false;
+    }
+    bool success = writer(temporary) && fsync(descriptor) == 0;
+    success = (::close(descriptor) == 0) && success;
+    success = success && rename(temporary.c_str(), fileName.c_str()) == 0;
+    if(!success) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return syncDirectory(fileName);
+}
+
+//-Private-//
+
+void BackgroundSaver::run() {
+    Tracer::setThreadName("background saver");
+    while(true) {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_requestAvailable.wait(lock, [this]() { return m_stopping || !m_requests.empty(); });
+            if(m_requests.empty()) {
+                return;
+            }
+            request = m_requests.front();
+            m_requests.pop_front();
+            m_writing = true;
+        }
+
+        bool success = replaceFile(request.fileName, request.writer);
+
+        Callback callback;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            callback = m_callback;
+        }
+        if(callback) {
+            callback(request.fileName, success, request.tag);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_writing = false;
+            if(m_requests.empty()) {
+                m_idle.notify_all();
+            }
+        }
+    }
+}
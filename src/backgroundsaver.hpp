@@ -0,0 +1,62 @@
+#ifndef BACKGROUNDSAVER_HPP
+#define BACKGROUNDSAVER_HPP
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Writes files on a worker thread so saving never blocks the caller.
+ *
+ * A save is a Writer that owns an immutable snapshot of what to save
+ * (captured by value when the save is requested) and writes it to the
+ * file name it is given. The saver hands it a temporary file next to
+ * the target, flushes that to disk, renames it over the target and
+ * flushes the directory, so the target is always either the old or the
+ * new contents, even if the program or the machine dies mid-write.
+ *
+ * Saves run one at a time in request order. A save still waiting for
+ * the worker is replaced by a newer save of the same file. When a save
+ * finishes the callback is called on the worker thread with the tag
+ * given to save(), which callers use to tell whether edits were made
+ * after the snapshot was taken.
+ */
+class BackgroundSaver {
+    public:
+        typedef std::function<bool(const std::string& fileName)> Writer;
+        typedef std::function<void(const std::string& fileName, bool success, int tag)> Callback;
+
+        BackgroundSaver();
+        ~BackgroundSaver();
+
+        void setCallback(const Callback& callback);
+        void save(const std::string& fileName, const Writer& writer, int tag = 0);
+        bool isBusy() const;
+        void waitForIdle();
+
+        static bool replaceFile(const std::string& fileName, const Writer& writer);
+
+    private:
+        BackgroundSaver(const BackgroundSaver&);
+        BackgroundSaver& operator=(const BackgroundSaver&);
+
+        struct Request {
+            std::string fileName;
+            Writer writer;
+            int tag;
+        };
+
+        void run();
+
+        std::thread m_thread;
+        std::deque<Request> m_requests;
+        Callback m_callback;
+        mutable std::mutex m_mutex;
+        std::condition_variable m_requestAvailable;
+        std::condition_variable m_idle;
+        bool m_writing;
+        bool m_stopping;
+};
+#endif
@@ -0,0 +1,354 @@
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include "batchrunner.hpp"
+#include "pngexporter.hpp"
+#include "backgroundsaver.hpp"
+#include "tracer.hpp"
+
+namespace {
+    typedef std::chrono::steady_clock Clock;
+
+    double millisecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    bool endsWith(const std::string& text, const std::string& suffix) {
+        return text.size() >= suffix.size()
+            && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    bool isDirectory(const std::string& path) {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+    }
+
+    /**
+     * Creates every missing directory leading up to the file path.
+     */
+    bool makeParentDirectories(const std::string& path) {
+        for(size_t slash = path.find('/', 1); slash != std::string::npos;
+            slash = path.find('/', slash + 1)) {
+            std::string directory = path.substr(0, slash);
+            if(mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool parseScales(const char* text, std::vector<int>& scales) {
+        scales.clear();
+        while(*text) {
+            char* end;
+            long scale = strtol(text, &end, 10);
+            if(end == text || scale < 1 || scale > 4096 || (*end != ',' && *end != '\0')) {
+                return false;
+            }
+            scales.push_back(scale);
+            text = *end == ',' ? end + 1 : end;
+        }
+        return !scales.empty();
+    }
+};
+
+BatchRunner::Options::Options() :
+    resave(false), encoding(BixlFile::AUTO), stats(false), threadCount(0) {
+}
+
+BatchRunner::Result::Result() :
+    success(false), width(0), height(0), colors(0), transparent(0),
+    readTime(0), filterTime(0), pngTime(0), saveTime(0), totalTime(0) {
+}
+
+BatchRunner::BatchRunner(const Options& options) : m_options(options), m_failures(0) {
+}
+
+/**
+ * Processes every input and prints the per-file report and summary to
+ * stdout, errors to stderr.
+ *
+ * @return  The process exit status.
+ */
+int BatchRunner::run() {
+    Clock::time_point start = Clock::now();
+    if(!m_options.traceFile.empty()) {
+        Tracer::setThreadName("main");
+        Tracer::setEnabled(true);
+    }
+
+    std::vector<Job> jobs;
+    for(size_t i = 0; i < m_options.inputs.size(); i++) {
+        collectJobs(m_options.inputs[i], jobs);
+    }
+
+    ThreadPool pool(m_options.threadCount);
+    std::vector<Result> results(jobs.size());
+    for(size_t i = 0; i < jobs.size(); i++) {
+        pool.submit([this, &jobs, &results, &pool, i]() {
+            Tracer::Zone zone("batch_file");
+            results[i] = process(jobs[i], pool);
+            report(jobs[i], results[i]);
+        });
+    }
+    pool.wait();
+
+    double busyTime = 0;
+    uint64_t bixels = 0;
+    for(size_t i = 0; i < results.size(); i++) {
+        busyTime += results[i].totalTime;
+        bixels += (uint64_t) results[i].width * results[i].height;
+    }
+    printf("%zu files, %d failed, %llu bixels, %d threads, %.1f ms elapsed, %.1f ms summed\n",
+           jobs.size(), m_failures, (unsigned long long) bixels, pool.threadCount(),
+           millisecondsSince(start), busyTime);
+
+    if(!m_options.traceFile.empty() && !Tracer::writeChromeTrace(m_options.traceFile)) {
+        fprintf(stderr, "cannot write trace %s\n", m_options.traceFile.c_str());
+        return 1;
+    }
+    return m_failures == 0 ? 0 : 1;
+}
+
+/**
+ * Entry point for "Bixel --batch"; argv holds the arguments after it.
+ */
+int BatchRunner::main(int argc, char* argv[]) {
+    Options options;
+    if(!parseArguments(argc, argv, options)) {
+        printUsage(stderr);
+        return 2;
+    }
+    BatchRunner runner(options);
+    return runner.run();
+}
+
+/**
+ * @return  false if the arguments are malformed or ask for nothing.
+ */
+bool BatchRunner::parseArguments(int argc, char* argv[], Options& options) {
+    for(int i = 0; i < argc; i++) {
+        std::string argument = argv[i];
+        bool hasValue = i + 1 < argc;
+        if(argument == "--filter" && hasValue) {
+            FilterPipeline::Filter filter;
+            if(!FilterPipeline::Filter::parse(argv[++i], filter)) {
+                return false;
+            }
+            options.filters.push_back(filter);
+        } else if(argument == "--png" && hasValue) {
+            if(!parseScales(argv[++i], options.pngScales)) {
+                return false;
+            }
+        } else if(argument == "--resave") {
+            options.resave = true;
+        } else if(argument == "--encoding" && hasValue) {
+            std::string encoding = argv[++i];
+            if(encoding == "auto") {
+                options.encoding = BixlFile::AUTO;
+            } else if(encoding == "truecolor") {
+                options.encoding = BixlFile::TRUECOLOR;
+            } else if(encoding == "indexed") {
+                options.encoding = BixlFile::INDEXED;
+            } else {
+                return false;
+            }
+        } else if(argument == "--stats") {
+            options.stats = true;
+        } else if((argument == "-o" || argument == "--output") && hasValue) {
+            options.outputDirectory = argv[++i];
+        } else if((argument == "-j" || argument == "--threads") && hasValue) {
+            options.threadCount = atoi(argv[++i]);
+        } else if(argument == "--trace" && hasValue) {
+            options.traceFile = argv[++i];
+        } else if(argument.size() > 1 && argument[0] == '-') {
+            return false;
+        } else {
+            options.inputs.push_back(argument);
+        }
+    }
+    bool anyWork = !options.pngScales.empty() || options.resave || options.stats;
+    return anyWork && !options.inputs.empty();
+}
+
+void BatchRunner::printUsage(FILE* out) {
+    fprintf(out,
+            "usage: Bixel --batch [options] <file or directory>...\n"
+            "\n"
+            "  --filter SPEC        apply a filter before exporting; repeat to chain:\n"
+            "                         replace:FROM:TO, hsv:HUE:SAT:VAL, outline:COLOR,\n"
+            "                         shadow:COLOR:DX:DY, dither:COLOR,...[:SPREAD]\n"
+            "                       with colors as RRGGBB or RRGGBBAA\n"
+            "  --png SCALES         export PNGs, one per comma separated scale (e.g. 1,4,8)\n"
+            "  --resave             rewrite files in the current .bixl format\n"
+            "  --encoding MODE      auto, truecolor or indexed, for --resave\n"
+            "  --stats              report color counts\n"
+            "  -o, --output DIR     write outputs under DIR instead of next to the input\n"
+            "  -j, --threads N      worker threads, default one per core\n"
+            "  --trace FILE         record a Chrome trace (chrome://tracing) to FILE\n");
+}
+
+//-Private-//
+
+void BatchRunner::collectJobs(const std::string& input, std::vector<Job>& jobs) {
+    if(isDirectory(input)) {
+        collectDirectory(input, "", jobs);
+        return;
+    }
+    Job job;
+    job.path = input;
+    size_t slash = input.rfind('/');
+    job.relativeName = input.substr(slash == std::string::npos ? 0 : slash + 1);
+    if(endsWith(job.relativeName, ".bixl")) {
+        job.relativeName.resize(job.relativeName.size() - 5);
+    }
+    jobs.push_back(job);
+}
+
+/**
+ * Adds every .bixl file below directory, in name order so the report
+ * is stable between runs.
+ */
+void BatchRunner::collectDirectory(const std::string& directory, const std::string& prefix,
+                                   std::vector<Job>& jobs) {
+    DIR* dir = opendir(directory.c_str());
+    if(!dir) {
+        fprintf(stderr, "cannot read directory %s\n", directory.c_str());
+        m_failures++;
+        return;
+    }
+    std::vector<std::string> names;
+    while(struct dirent* entry = readdir(dir)) {
+        if(entry->d_name[0] != '.') {
+            names.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    for(size_t i = 0; i < names.size(); i++) {
+        std::string path = directory + "/" + names[i];
+        if(isDirectory(path)) {
+            collectDirectory(path, prefix + names[i] + "/", jobs);
+        } else if(endsWith(names[i], ".bixl")) {
+            Job job;
+            job.path = path;
+            job.relativeName = prefix + names[i].substr(0, names[i].size() - 5);
+            jobs.push_back(job);
+        }
+    }
+}
+
+BatchRunner::Result BatchRunner::process(const Job& job, ThreadPool& pool) {
+    Result result;
+    Clock::time_point start = Clock::now();
+
+    BixlImage image;
+    if(!BixlFile::read(job.path, image)) {
+        result.error = "cannot read file";
+        result.totalTime = millisecondsSince(start);
+        return result;
+    }
+    result.readTime = millisecondsSince(start);
+    result.width = image.width();
+    result.height = image.height();
+
+    if(!m_options.filters.empty()) {
+        Clock::time_point filterStart = Clock::now();
+        FilterPipeline pipeline(&pool);
+        for(size_t i = 0; i < m_options.filters.size(); i++) {
+            pipeline.add(m_options.filters[i]);
+        }
+        pipeline.apply(image.pixels, 0, 0);
+        // The filters saw the image as drawn; resaving keeps that, flattened.
+        image.layers.clear();
+        result.filterTime = millisecondsSince(filterStart);
+    }
+
+    if(m_options.stats) {
+        std::vector<Rgba> colors;
+        colors.reserve((size_t) image.width() * image.height());
+        for(int y = 0; y < image.height(); y++) {
+            const Rgba* row = image.pixels.row(y);
+            for(int x = 0; x < image.width(); x++) {
+                result.transparent += rgbaAlpha(row[x]) == 0;
+            }
+            colors.insert(colors.end(), row, row + image.width());
+        }
+        std::sort(colors.begin(), colors.end());
+        result.colors = std::unique(colors.begin(), colors.end()) - colors.begin();
+    }
+
+    for(size_t i = 0; i < m_options.pngScales.size(); i++) {
+        Clock::time_point pngStart = Clock::now();
+        int scale = m_options.pngScales[i];
+        std::string fileName = outputPath(job, scale == 1 ? ".png" : "@" + std::to_string(scale) + "x.png");
+        PngExporter exporter(&pool);
+        exporter.setScale(scale);
+        if(!makeParentDirectories(fileName) || !exporter.exportImage(image.pixels, fileName)) {
+            result.error = "cannot write " + fileName;
+            result.totalTime = millisecondsSince(start);
+            return result;
+        }
+        result.pngTime += millisecondsSince(pngStart);
+    }
+
+    if(m_options.resave) {
+        Clock::time_point saveStart = Clock::now();
+        std::string fileName = outputPath(job, ".bixl");
+        BixlFile::Encoding encoding = m_options.encoding;
+        if(!makeParentDirectories(fileName)
+           || !BackgroundSaver::replaceFile(fileName, [&image, encoding](const std::string& temporary) {
+                  return BixlFile::write(temporary, image, encoding);
+              })) {
+            result.error = "cannot write " + fileName;
+            result.totalTime = millisecondsSince(start);
+            return result;
+        }
+        result.saveTime = millisecondsSince(saveStart);
+    }
+
+    result.success = true;
+    result.totalTime = millisecondsSince(start);
+    return result;
+}
+
+std::string BatchRunner::outputPath(const Job& job, const std::string& suffix) const {
+    if(m_options.outputDirectory.empty()) {
+        std::string base = job.path;
+        if(endsWith(base, ".bixl")) {
+            base.resize(base.size() - 5);
+        }
+        return base + suffix;
+    }
+    return m_options.outputDirectory + "/" + job.relativeName + suffix;
+}
+
+void BatchRunner::report(const Job& job, const Result& result) {
+    std::lock_guard<std::mutex> lock(m_reportMutex);
+    if(!result.success) {
+        m_failures++;
+        fprintf(stderr, "FAIL  %s: %s\n", job.path.c_str(), result.error.c_str());
+        return;
+    }
+    printf("ok    %s  %dx%d  read %.2f ms", job.path.c_str(), result.width, result.height,
+           result.readTime);
+    if(!m_options.filters.empty()) {
+        printf("  filter %.2f ms", result.filterTime);
+    }
+    if(!m_options.pngScales.empty()) {
+        printf("  png %.2f ms", result.pngTime);
+    }
+    if(m_options.resave) {
+        printf("  save %.2f ms", result.saveTime);
+    }
+    printf("  total %.2f ms", result.totalTime);
+    if(m_options.stats) {
+        printf("  colors %zu  transparent %zu", result.colors, result.transparent);
+    }
+    printf("\n");
+}
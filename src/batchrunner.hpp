@@ -0,0 +1,87 @@
+#ifndef BATCHRUNNER_HPP
+#define BATCHRUNNER_HPP
+#include <stdio.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "bixlfile.hpp"
+#include "filterpipeline.hpp"
+#include "threadpool.hpp"
+
+/**
+ * Headless batch processing of .bixl files, run as
+ *
+ *      Bixel --batch [options] <file or directory>...
+ *
+ * Directories are searched recursively for .bixl files. Every file is
+ * one task on a work-stealing ThreadPool, and the PNG exports inside a
+ * task share the same pool. No widgets or GL context are created, so
+ * it runs without a display.
+ *
+ * One line is printed per file as it finishes, with the time spent in
+ * each step, followed by a summary. The exit status is 0 only if every
+ * file succeeded.
+ */
+class BatchRunner {
+    public:
+        struct Options {
+            std::vector<std::string> inputs;
+            std::string outputDirectory;    ///< Empty writes next to the input
+            std::vector<FilterPipeline::Filter> filters;   ///< Applied in order before any output
+            std::vector<int> pngScales;
+            bool resave;
+            BixlFile::Encoding encoding;
+            bool stats;
+            int threadCount;                ///< 0 uses every core
+            std::string traceFile;          ///< Chrome trace output, empty for none
+
+            Options();
+        };
+
+        BatchRunner(const Options& options);
+
+        int run();
+
+        static int main(int argc, char* argv[]);
+        static bool parseArguments(int argc, char* argv[], Options& options);
+        static void printUsage(FILE* out);
+
+    private:
+        /**
+         * A .bixl file found under one of the inputs. relativeName is the
+         * path below the input directory, without the extension, and
+         * names the outputs.
+         */
+        struct Job {
+            std::string path;
+            std::string relativeName;
+        };
+
+        struct Result {
+            bool success;
+            std::string error;
+            int width;
+            int height;
+            size_t colors;
+            size_t transparent;
+            double readTime;
+            double filterTime;
+            double pngTime;
+            double saveTime;
+            double totalTime;
+
+            Result();
+        };
+
+        void collectJobs(const std::string& input, std::vector<Job>& jobs);
+        void collectDirectory(const std::string& directory, const std::string& prefix,
+                              std::vector<Job>& jobs);
+        Result process(const Job& job, ThreadPool& pool);
+        std::string outputPath(const Job& job, const std::string& suffix) const;
+        void report(const Job& job, const Result& result);
+
+        Options m_options;
+        std::mutex m_reportMutex;
+        int m_failures;
+};
+#endif
@@ -0,0 +1,1073 @@
+#include <stdlib.h>
+#include <string>
+#include <algorithm>
+#include <memory>
+#include "bixelgrid.hpp"
+#include <QTimer>
+#include "bixlfile.hpp"
+#include "pngexporter.hpp"
+#include "tracer.hpp"
+
+//-Public-//
+BixelGrid::BixelGrid(QWidget* parent, ThreadPool* pool) : QGLWidget(QGLFormat(), parent),
+                                                          m_currentTool(MOUSE), m_drawingColor(0, 0, 0),
+                                                          m_dimension(DEFAULT_DIMENSION),
+                                                          m_transform(pool),
+                                                          m_layers(DEFAULT_DIMENSION, DEFAULT_DIMENSION, pool),
+                                                          m_loadedTiles(0),
+                                                          m_selection(DEFAULT_DIMENSION, DEFAULT_DIMENSION),
+                                                          m_hoverIndex(-1, -1),
+                                                          m_selecting(false), m_draggingPaste(false),
+                                                          m_selectionChanged(true),
+                                                          m_selectionTop(0), m_selectionBottom(-1),
+                                                          m_pool(pool),
+                                                          m_sessionWidth(0), m_sessionHeight(0) {
+    setMouseTracking(true);
+    setFocusPolicy(Qt::StrongFocus);
+}
+
+BixelGrid::~BixelGrid() {
+    m_sessionNotifier.reset();
+    makeCurrent();
+    m_renderer.release();
+}
+
+/**
+ * @param tool  The tool mouse input on the grid is used with. HAND and
+ *              ZOOM change the view and are handled by the CanvasWidget.
+ */
+void BixelGrid::changeTool(BixelGrid::DrawTool tool) {
+    m_stroke.end();
+    if(tool != MOUSE && tool != HAND && tool != ZOOM) {
+        commitPaste();
+    }
+    m_currentTool = tool;
+}
+
+BixelGrid::DrawTool BixelGrid::tool() const {
+    return m_currentTool;
+}
+
+void BixelGrid::setDrawingColor(const QColor& color) {
+    m_drawingColor = color;
+}
+
+QColor BixelGrid::drawingColor() const {
+    return m_drawingColor;
+}
+
+/**
+ * @param i     Column of the bixel.
+ * @param j     Row of the bixel.
+ * @return      The bixel on the current layer or frame; transparent black
+ *              outside the grid.
+ */
+QColor BixelGrid::getColorAt(int i, int j) const {
+    const Animation* animation = m_animation.get();
+    const PixelBuffer& pixels = animation ? animation->pixels() : m_layers.layer(m_layers.currentLayer()).pixels;
+    if(!pixels.contains(i, j)) {
+        return QColor(0, 0, 0, 0);
+    }
+    return toQColor(pixels.pixel(i, j));
+}
+
+/**
+ * Colors one bixel of the current layer or frame, recorded in the current undo
+ * step; showEdit() closes the step once a batch of them is done.
+ */
+void BixelGrid::setColorAt(int i, int j, const QColor& color) {
+    PixelBuffer& pixels = editedPixels();
+    if(!pixels.contains(i, j)) {
+        return;
+    }
+    history().touch(pixels, i, j, 1);
+    pixels.setPixel(i, j, toRgba(color));
+    update();
+}
+
+int BixelGrid::gridWidth() const {
+    return m_animation ? m_animation->width() : m_layers.width();
+}
+
+int BixelGrid::gridHeight() const {
+    return m_animation ? m_animation->height() : m_layers.height();
+}
+
+/**
+ * The dimension stored in the document's .bixl header.
+ */
+int BixelGrid::dimension() const {
+    return m_dimension;
+}
+
+/**
+ * Grows the grid by dimension() bixels to the right and bottom.
+ */
+void BixelGrid::increaseDimension() {
+    resizeGrid(gridWidth() + m_dimension, gridHeight() + m_dimension);
+}
+
+/**
+ * Shrinks the grid by dimension() bixels from the right and bottom, down
+ * to dimension() bixels square.
+ */
+void BixelGrid::decreaseDimension() {
+    resizeGrid(std::max(m_dimension, gridWidth() - m_dimension), std::max(m_dimension, gridHeight() - m_dimension));
+}
+
+/**
+ * Resizes the grid, keeping the bixels that still fit, as one undo step.
+ *
+ * A single layer is resized with PixelBuffer::resize() and recorded with
+ * History::resized(), which keeps only the bixels cut off. A stack of
+ * layers is recorded whole, as undo swaps it back. Animations resize
+ * their frames' TiledCanvases and start their histories over.
+ */
+void BixelGrid::resizeGrid(int width, int height) {
+    width = std::max(1, width);
+    height = std::max(1, height);
+    if(width == gridWidth() && height == gridHeight()) {
+        return;
+    }
+    Tracer::Zone zone("resize_grid");
+    m_stroke.end();
+    commitPaste();
+    finishLoading();
+    if(m_animation) {
+        m_animation->resize(width, height);
+        m_selection.resize(width, height);
+    } else if(m_layers.layerCount() == 1) {
+        m_history.resized(m_layers.currentPixels(), width, height, &m_selection);
+        m_layers.resize(width, height);
+        m_layers.invalidate();
+        m_selection.resize(width, height);
+    } else {
+        std::shared_ptr<LayerStack> otherLayers = std::make_shared<LayerStack>(m_layers);
+        std::shared_ptr<Selection> otherSelection = std::make_shared<Selection>(m_selection);
+        otherLayers->resize(width, height);
+        otherSelection->resize(width, height);
+        exchangeLayers(otherLayers, otherSelection);
+    }
+    m_selectionChanged = true;
+    update();
+    emit stateChanged();
+}
+
+/**
+ * Turns or flips the selected bixels, or the whole document when
+ * nothing is selected, as one undo step. A canvas transform turns every
+ * layer. In an animation it turns the current frame only, so quarter
+ * turns of a canvas that is not square are refused there: every frame
+ * has the same size.
+ *
+ * @return  false if nothing was transformed.
+ * @see TransformEngine
+ */
+bool BixelGrid::transform(TransformEngine::Operation operation) {
+    Tracer::Zone zone("transform");
+    m_stroke.end();
+    commitPaste();
+    PixelBuffer& pixels = editedPixels();
+    int x, y, width, height;
+    if(TransformEngine::bounds(m_selection, x, y, width, height)) {
+        if(!m_transform.transformSelection(pixels, m_selection, &history(), operation)) {
+            return false;
+        }
+    } else if(m_animation || m_layers.layerCount() == 1) {
+        if(m_animation && TransformEngine::swapsSides(operation) && gridWidth() != gridHeight()) {
+            return false;
+        }
+        m_transform.transformCanvas(pixels, m_selection, &history(), operation);
+        matchLayerSize();
+    } else {
+        std::shared_ptr<LayerStack> otherLayers = std::make_shared<LayerStack>(m_layers);
+        std::shared_ptr<Selection> otherSelection =
+            std::make_shared<Selection>(TransformEngine::transformMask(m_selection, operation));
+        for(int i = 0; i < otherLayers->layerCount(); i++) {
+            PixelBuffer turned;
+            m_transform.transform(m_layers.pixels(i), 0, 0, gridWidth(), gridHeight(), operation, turned);
+            otherLayers->pixels(i).swap(turned);
+        }
+        otherLayers->resize(otherSelection->width(), otherSelection->height());
+        exchangeLayers(otherLayers, otherSelection);
+    }
+    m_selectionChanged = true;
+    update();
+    emit stateChanged();
+    return true;
+}
+
+/**
+ * Enlarges the selected bixels factor times, or the whole document when
+ * nothing is selected, as one undo step. Like transform(), a canvas
+ * scale is refused for animations.
+ *
+ * @return  false if nothing was scaled, or the result would be larger
+ *          than TransformEngine::MAX_SIZE.
+ */
+bool BixelGrid::scale(int factor) {
+    Tracer::Zone zone("scale");
+    m_stroke.end();
+    commitPaste();
+    PixelBuffer& pixels = editedPixels();
+    int x, y, width, height;
+    if(TransformEngine::bounds(m_selection, x, y, width, height)) {
+        if(!m_transform.scaleSelection(pixels, m_selection, &history(), factor)) {
+            return false;
+        }
+    } else if(m_animation) {
+        return false;
+    } else if(m_layers.layerCount() == 1) {
+        if(!m_transform.scaleCanvas(pixels, m_selection, &m_history, factor)) {
+            return false;
+        }
+        matchLayerSize();
+    } else {
+        if(factor < 2 || gridWidth() > TransformEngine::MAX_SIZE / factor
+           || gridHeight() > TransformEngine::MAX_SIZE / factor) {
+            return false;
+        }
+        std::shared_ptr<LayerStack> otherLayers = std::make_shared<LayerStack>(m_layers);
+        std::shared_ptr<Selection> otherSelection =
+            std::make_shared<Selection>(TransformEngine::scaleMask(m_selection, factor));
+        for(int i = 0; i < otherLayers->layerCount(); i++) {
+            PixelBuffer scaled;
+            m_transform.scale(m_layers.pixels(i), 0, 0, gridWidth(), gridHeight(), factor, scaled);
+            otherLayers->pixels(i).swap(scaled);
+        }
+        otherLayers->resize(otherSelection->width(), otherSelection->height());
+        exchangeLayers(otherLayers, otherSelection);
+    }
+    m_selectionChanged = true;
+    update();
+    emit stateChanged();
+    return true;
+}
+
+/**
+ * @param mirror    StrokeEngine::Mirror flags. Brush and eraser strokes
+ *                  are reflected across the middle of the canvas.
+ */
+void BixelGrid::setMirror(int mirror) {
+    m_stroke.end();
+    m_stroke.setMirror(mirror);
+}
+
+int BixelGrid::mirror() const {
+    return m_stroke.mirror();
+}
+
+/**
+ * The bixels of the current layer, or of the current frame of an
+ * animation. Changes must be recorded in history() and marked dirty as
+ * they are made, then shown with showEdit().
+ */
+PixelBuffer& BixelGrid::pixels() {
+    m_stroke.flush();
+    return editedPixels();
+}
+
+/**
+ * The document as it is shown: every layer composited, or the current
+ * frame.
+ */
+const PixelBuffer& BixelGrid::flattened() {
+    m_stroke.flush();
+    finishLoading();
+    return shownPixels();
+}
+
+Selection& BixelGrid::selection() {
+    return m_selection;
+}
+
+/**
+ * The undo history of the document, or of the current frame of an
+ * animation.
+ */
+History& BixelGrid::history() {
+    return m_animation ? m_animation->history() : m_history;
+}
+
+/**
+ * Closes the undo step of an edit made through pixels(), selection()
+ * and history(), and shows it.
+ */
+void BixelGrid::showEdit() {
+    history().endStep();
+    update();
+    emit stateChanged();
+}
+
+/**
+ * Swaps in pixels, of any size, as the only layer of the document, as
+ * one undo step, with nothing selected; pixels is left empty. The step
+ * keeps the other layers, so undo and redo just swap the two stacks.
+ * An animation is replaced outright with nothing to undo, as its
+ * frames' histories cannot hold a step that replaces them all.
+ */
+void BixelGrid::replacePixels(PixelBuffer& pixels) {
+    m_stroke.end();
+    commitPaste();
+    finishLoading();
+    if(m_animation) {
+        m_animation.reset();
+        m_layers = LayerStack(pixels.width(), pixels.height(), m_pool);
+        m_layers.pixels(0).swap(pixels);
+        m_layers.invalidate();
+        resetEditing();
+        update();
+        emit stateChanged();
+        return;
+    }
+    std::shared_ptr<LayerStack> otherLayers = std::make_shared<LayerStack>(pixels.width(), pixels.height(), m_pool);
+    std::shared_ptr<Selection> otherSelection = std::make_shared<Selection>(pixels.width(), pixels.height());
+    otherLayers->pixels(0).swap(pixels);
+    exchangeLayers(otherLayers, otherSelection);
+    m_selectionChanged = true;
+    update();
+    emit stateChanged();
+}
+
+void BixelGrid::selectAll() {
+    Selection selected(gridWidth(), gridHeight());
+    selected.selectAll();
+    setSelection(selected);
+}
+
+void BixelGrid::deselectAll() {
+    setSelection(Selection(gridWidth(), gridHeight()));
+}
+
+/**
+ * Selects the rectangle with corners point1 and point2, inclusive,
+ * instead of the current selection, as one undo step.
+ */
+void BixelGrid::selectRectangle(ivec2 point1, ivec2 point2) {
+    Selection selected(gridWidth(), gridHeight());
+    int x = std::min(point1.x, point2.x);
+    int y = std::min(point1.y, point2.y);
+    selected.setRect(x, y, abs(point1.x - point2.x) + 1, abs(point1.y - point2.y) + 1);
+    setSelection(selected);
+}
+
+/**
+ * Undoing while a paste floats takes the paste away, which was never
+ * an undo step of its own.
+ */
+void BixelGrid::undo() {
+    m_stroke.end();
+    if(m_paste.isActive()) {
+        cancelPaste();
+        return;
+    }
+    if(history().undo(editedPixels(), m_selection)) {
+        matchLayerSize();
+        m_selectionChanged = true;
+        update();
+        emit stateChanged();
+    }
+}
+
+void BixelGrid::redo() {
+    m_stroke.end();
+    commitPaste();
+    if(history().redo(editedPixels(), m_selection)) {
+        matchLayerSize();
+        m_selectionChanged = true;
+        update();
+        emit stateChanged();
+    }
+}
+
+/**
+ * Floats clip over the bixels with its top left corner at (x, y),
+ * committing a paste that was floating already.
+ */
+void BixelGrid::beginPaste(const std::shared_ptr<const Clip>& clip, int x, int y) {
+    m_stroke.end();
+    commitPaste();
+    m_paste.begin(editedPixels(), clip, x, y);
+    setFocus();
+    update();
+}
+
+/**
+ * Leaves the floating paste where it is, as one undo step.
+ */
+void BixelGrid::commitPaste() {
+    if(!m_paste.isActive()) {
+        return;
+    }
+    m_draggingPaste = false;
+    history().endStep();
+    m_paste.commit(&history());
+    update();
+    emit stateChanged();
+}
+
+/**
+ * Takes the floating paste away, restoring the bixels it covered.
+ */
+void BixelGrid::cancelPaste() {
+    if(!m_paste.isActive()) {
+        return;
+    }
+    m_draggingPaste = false;
+    m_paste.cancel();
+    update();
+}
+
+bool BixelGrid::isPasting() const {
+    return m_paste.isActive();
+}
+
+/**
+ * Replaces the document with a .bixl file of any version. Nothing is
+ * undoable afterwards.
+ *
+ * Single image (v1 and v2) files are only mapped here, through a
+ * MappedBixlFile. Their tiles are decoded as they are first drawn, and
+ * the rest right after the first frame, or as soon as an edit, save or
+ * export needs them; loadFinished() is emitted once all are in.
+ * Layered and animated files are decoded whole and opened through
+ * openImage().
+ *
+ * @return  false if the file could not be read, leaving the document as
+ *          it was.
+ */
+bool BixelGrid::openFile(const std::string& fileName) {
+    Tracer::Zone zone("open");
+    std::unique_ptr<MappedBixlFile> mapped(new MappedBixlFile());
+    if(!mapped->open(fileName) || mapped->version() >= BixlFile::LAYERED_VERSION) {
+        BixlImage image;
+        if(!BixlFile::read(fileName, image)) {
+            Tracer::message("Cannot open %s", fileName.c_str());
+            return false;
+        }
+        openImage(image);
+        return true;
+    }
+    leaveSession();
+    m_stroke.end();
+    cancelPaste();
+    m_dimension = mapped->dimension();
+    m_animation.reset();
+    m_layers = LayerStack(mapped->width(), mapped->height(), m_pool);
+    m_layers.flattened().markDirty(0, 0, m_layers.width(), m_layers.height());
+    m_tileLoaded.assign((size_t) mapped->tilesX() * mapped->tilesY(), false);
+    m_loadedTiles = 0;
+    m_mapped = std::move(mapped);
+    resetEditing();
+    update();
+    return true;
+}
+
+/**
+ * Replaces the document with an image already decoded, such as the one
+ * a DocumentLoader read while the window came up, without reading the
+ * file again. An animation's frames are moved out of image. Nothing is
+ * undoable afterwards.
+ */
+void BixelGrid::openImage(BixlImage& image) {
+    Tracer::Zone zone("open_image");
+    leaveSession();
+    m_stroke.end();
+    cancelPaste();
+    m_mapped.reset();
+    m_dimension = image.dimension;
+    if(image.frames.empty()) {
+        m_animation.reset();
+        m_layers.fromImage(image);
+        m_layers.invalidate();
+    } else {
+        m_animation.reset(new Animation());
+        m_animation->fromImage(image);
+        m_layers = LayerStack(0, 0, m_pool);
+    }
+    resetEditing();
+    update();
+    emit loadFinished();
+}
+
+/**
+ * Decodes the tiles of a mapped document that have not been yet, on the
+ * grid's ThreadPool, and lets go of the file.
+ */
+void BixelGrid::finishLoading() {
+    if(m_mapped) {
+        loadTiles(0, 0, m_layers.width(), m_layers.height());
+    }
+}
+
+/**
+ * Writes the document to fileName, blocking until it is on disk.
+ */
+bool BixelGrid::saveFile(const std::string& fileName) {
+    Tracer::Zone zone("save");
+    return snapshotWriter()(fileName);
+}
+
+/**
+ * Copies the document as it is now and returns a writer that saves the
+ * copy, for BackgroundSaver. Copying is a memcpy of every layer and the
+ * composite, or for an animation a pointer per stored tile of each
+ * frame, which shares the tiles until they are painted on. The encoding
+ * and writing are left to whichever thread calls the writer.
+ * The copy is shared, not duplicated, as the writer is passed around.
+ */
+BackgroundSaver::Writer BixelGrid::snapshotWriter() {
+    Tracer::Zone zone("snapshot");
+    m_stroke.flush();
+    finishLoading();
+    if(m_animation) {
+        m_animation->commit();
+        std::shared_ptr<std::vector<TiledCanvas> > frames = std::make_shared<std::vector<TiledCanvas> >();
+        for(int i = 0; i < m_animation->frameCount(); i++) {
+            frames->push_back(m_animation->frame(i));
+        }
+        int width = m_animation->width();
+        int height = m_animation->height();
+        int dimension = m_dimension;
+        int fps = m_animation->fps();
+        return [frames, width, height, dimension, fps](const std::string& fileName) {
+            return BixlFile::writeFrames(fileName, width, height, dimension, fps, frames->size(),
+                                         [frames](int index, PixelBuffer& pixels) {
+                (*frames)[index].toPixelBuffer(pixels);
+            });
+        };
+    }
+    std::shared_ptr<BixlImage> snapshot = std::make_shared<BixlImage>(0, 0, m_dimension);
+    m_layers.toImage(*snapshot, m_dimension);
+    return [snapshot](const std::string& fileName) {
+        return BixlFile::write(fileName, *snapshot);
+    };
+}
+
+/**
+ * Writes the composited bixels as a PNG, one pixel per bixel, encoded on the grid's
+ * ThreadPool.
+ */
+bool BixelGrid::exportPNG(const std::string& fileName) {
+    Tracer::Zone zone("export_png");
+    m_stroke.flush();
+    finishLoading();
+    PngExporter exporter(m_pool);
+    return exporter.exportImage(shownPixels(), fileName);
+}
+
+/**
+ * Sets the view transform the grid is drawn and clicked through.
+ */
+void BixelGrid::setViewport(const Viewport& viewport) {
+    m_viewport = viewport;
+    m_renderer.setViewport(viewport);
+    update();
+}
+
+/**
+ * Joins the shared editing session served by the relay at socketPath
+ * (bixel --relay socketPath). The first peer's canvas starts the
+ * session; a later peer's is replaced by the session's. Only single
+ * layer documents can be shared. Joining starts a fresh undo history,
+ * and opening a document leaves the session.
+ *
+ * @return  false if the document cannot be shared or no relay answered.
+ * @see SessionClient
+ */
+bool BixelGrid::joinSession(const std::string& socketPath) {
+    m_stroke.end();
+    commitPaste();
+    finishLoading();
+    leaveSession();
+    if(m_animation || m_layers.layerCount() != 1) {
+        return false;
+    }
+    //Edits made before joining go out with the starting canvas
+    m_layers.flattened();
+    if(!m_session.join(socketPath, m_layers.currentPixels(), m_selection)) {
+        return false;
+    }
+    m_history.clear();
+    m_sessionWidth = gridWidth();
+    m_sessionHeight = gridHeight();
+    m_sessionNotifier.reset(new QSocketNotifier(m_session.fd(), QSocketNotifier::Read));
+    QObject::connect(m_sessionNotifier.get(), SIGNAL(activated(int)), this, SLOT(sessionReadable()));
+    update();
+    return true;
+}
+
+/**
+ * Leaves the session, keeping the canvas as it is. Edits not yet sent
+ * are not sent.
+ */
+void BixelGrid::leaveSession() {
+    if(!m_session.isJoined()) {
+        return;
+    }
+    m_sessionNotifier.reset();
+    m_session.leave();
+    emit sessionLeft();
+}
+
+bool BixelGrid::isInSession() const {
+    return m_session.isJoined();
+}
+
+//-Private Slots-//
+
+/**
+ * Batches from other peers are waiting. They are applied in the next
+ * paintGL(); until then the notifier is off, so an idle or hidden
+ * window is not woken over and over.
+ */
+void BixelGrid::sessionReadable() {
+    m_sessionNotifier->setEnabled(false);
+    update();
+}
+
+//-Protected-//
+void BixelGrid::initializeGL() {
+    std::string vertexSource;
+    std::string fragmentSource;
+    if(!CanvasRenderer::readShaderFile(CanvasRenderer::VERTEX_SHADER, vertexSource)
+       || !CanvasRenderer::readShaderFile(CanvasRenderer::FRAGMENT_SHADER, fragmentSource)
+       || !m_renderer.initialize(vertexSource, fragmentSource)) {
+        Tracer::message("BixelGrid: cannot set up the canvas renderer");
+        return;
+    }
+    m_renderer.setViewport(m_viewport);
+    m_renderer.uploadPixels(shownPixels());
+    shownPixels().dirtyRegion().clear();
+    m_selectionChanged = true;
+}
+
+/**
+ * Decodes the tiles of a mapped document that come into view, leaving
+ * the rest for right after this frame. Then uploads the tiles painted
+ * and the selection rows changed since the last frame, and draws. Strokes are flushed here, so however many
+ * mouse events arrive they are drawn once per frame. Each call counts
+ * as a frame in the Tracer's frame time histogram.
+ */
+void BixelGrid::paintGL() {
+    Tracer::Zone zone("paint", true);
+    glClearColor(50 / 255.0f, 50 / 255.0f, 50 / 255.0f, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    m_stroke.flush();
+    if(m_session.isJoined()) {
+        exchangeSessionEdits();
+    }
+    if(m_mapped) {
+        int x = 0, y = 0, width = m_layers.width(), height = m_layers.height();
+        if(m_viewport.viewWidth() > 0 && m_viewport.viewHeight() > 0) {
+            m_viewport.visibleRect(x, y, width, height);
+        }
+        loadTiles(x, y, width, height);
+        if(m_mapped) {
+            QTimer::singleShot(0, this, SLOT(finishLoading()));
+        }
+    }
+    m_renderer.uploadDirtyPixels(shownPixels());
+    if(m_selectionChanged) {
+        m_renderer.uploadSelection(m_selection);
+    } else if(m_selectionTop <= m_selectionBottom) {
+        m_renderer.uploadSelectionRows(m_selection, m_selectionTop, m_selectionBottom - m_selectionTop + 1);
+    }
+    m_selectionChanged = false;
+    m_selectionTop = 0;
+    m_selectionBottom = -1;
+    m_renderer.paint();
+}
+
+void BixelGrid::resizeGL(int width, int height) {
+    glViewport(0, 0, width, height);
+}
+
+void BixelGrid::mousePressEvent(QMouseEvent* event) {
+    ivec2 bixel = convertPositionToBixelIndex(event->x(), event->y());
+    switch(m_currentTool) {
+        //Drags a floating paste, or commits it and starts a selection
+        case MOUSE:
+            m_stroke.end();
+            if(m_paste.isActive() && m_paste.contains(bixel.x, bixel.y)) {
+                m_draggingPaste = true;
+                m_clickIndex = bixel;
+                break;
+            }
+            commitPaste();
+            m_selectionBefore = m_selection;
+            m_selecting = true;
+            m_clickIndex = bixel;
+            m_currentMouseIndex = bixel;
+            if(m_selection.isEmpty()) {
+                markSelectionRows(bixel.y, bixel.y);
+            } else {
+                m_selection.clear();
+                m_selectionChanged = true;
+            }
+            m_selection.setRect(bixel.x, bixel.y, 1, 1);
+            update();
+        break;
+
+        case BRUSH:
+        case ERASER: {
+            Rgba color = m_currentTool == BRUSH ? toRgba(m_drawingColor) : 0;
+            commitPaste();
+            m_stroke.begin(editedPixels(), &history(), color, bixel);
+            update();
+        }
+        break;
+
+        //Stays inside the selection, if there is one
+        case PAINTBUCKET:
+            m_stroke.end();
+            commitPaste();
+            m_fill.setConstraint(m_selection.isEmpty() ? 0 : &m_selection);
+            if(m_fill.fill(editedPixels(), bixel.x, bixel.y, toRgba(m_drawingColor), &history()) > 0) {
+                update();
+                emit stateChanged();
+            }
+        break;
+
+        //Picks the color shown, whichever layers it comes from
+        case EYEDROP:
+            m_stroke.end();
+            finishLoading();
+            if(shownPixels().contains(bixel.x, bixel.y)) {
+                m_drawingColor = toQColor(shownPixels().pixel(bixel.x, bixel.y));
+                emit colorPicked(m_drawingColor);
+            }
+        break;
+
+        default:
+        break;
+    }
+}
+
+/**
+ * Ends a stroke or a rectangle drag, each as one undo step. A dragged
+ * paste keeps floating.
+ */
+void BixelGrid::mouseReleaseEvent(QMouseEvent*) {
+    m_draggingPaste = false;
+    if(m_selecting) {
+        m_selecting = false;
+        history().endStep();
+        history().selectionChanged(m_selectionBefore, m_selection);
+        history().endStep();
+        emit stateChanged();
+    }
+    if(m_stroke.isActive()) {
+        m_stroke.end();
+        update();
+        emit stateChanged();
+    }
+}
+
+/**
+ * Strokes are only queued here and drawn by the next paintGL(). Moving
+ * over a new bixel highlights it, which only changes a uniform.
+ */
+void BixelGrid::mouseMoveEvent(QMouseEvent* event) {
+    ivec2 bixel = convertPositionToBixelIndex(event->x(), event->y());
+    if(bixel != m_hoverIndex) {
+        m_hoverIndex = bixel;
+        m_renderer.setHoverBixel(bixel.x, bixel.y);
+        update();
+    }
+    if(m_selecting) {
+        dragSelection(bixel);
+    }
+    if(m_draggingPaste && bixel != m_clickIndex) {
+        m_paste.moveBy(bixel.x - m_clickIndex.x, bixel.y - m_clickIndex.y);
+        m_clickIndex = bixel;
+        update();
+    }
+    if(m_stroke.isActive()) {
+        m_stroke.moveTo(bixel);
+        update();
+    }
+}
+
+void BixelGrid::leaveEvent(QEvent*) {
+    m_hoverIndex.set(-1, -1);
+    m_renderer.clearHoverBixel();
+    update();
+}
+
+/**
+ * Enter commits a floating paste, Escape cancels it.
+ */
+void BixelGrid::keyPressEvent(QKeyEvent* event) {
+    if(m_paste.isActive() && (event->key() == Qt::Key_Return || event->key() == Qt::Key_Enter)) {
+        commitPaste();
+    } else if(m_paste.isActive() && event->key() == Qt::Key_Escape) {
+        cancelPaste();
+    } else {
+        QGLWidget::keyPressEvent(event);
+    }
+}
+
+//-Private-//
+
+/**
+ * The bixel under a widget position, through the view transform;
+ * positions off the grid give bixels outside it. Until a viewport is
+ * set the grid is stretched over the widget.
+ */
+ivec2 BixelGrid::convertPositionToBixelIndex(int x, int y) const {
+    if(m_viewport.viewWidth() > 0 && m_viewport.viewHeight() > 0) {
+        return m_viewport.toBixel(x + 0.5, y + 0.5);
+    }
+    return StrokeEngine::toBixel(x + 0.5, y + 0.5, width(), height(), gridWidth(), gridHeight());
+}
+
+/**
+ * Moves the far corner of the rectangle being dragged out to bixel.
+ * Only the rows of the old and new rectangles change.
+ */
+void BixelGrid::dragSelection(ivec2 bixel) {
+    if(bixel == m_currentMouseIndex) {
+        return;
+    }
+    ivec2 click = m_clickIndex;
+    ivec2 last = m_currentMouseIndex;
+    m_selection.setRect(std::min(click.x, last.x), std::min(click.y, last.y),
+                        abs(click.x - last.x) + 1, abs(click.y - last.y) + 1, false);
+    m_selection.setRect(std::min(click.x, bixel.x), std::min(click.y, bixel.y),
+                        abs(click.x - bixel.x) + 1, abs(click.y - bixel.y) + 1);
+    m_currentMouseIndex = bixel;
+    markSelectionRows(std::min(click.y, std::min(last.y, bixel.y)), std::max(click.y, std::max(last.y, bixel.y)));
+    update();
+}
+
+/**
+ * Adds rows top to bottom to those uploaded with the next frame.
+ */
+void BixelGrid::markSelectionRows(int top, int bottom) {
+    if(m_selectionTop > m_selectionBottom) {
+        m_selectionTop = top;
+        m_selectionBottom = bottom;
+    } else {
+        m_selectionTop = std::min(m_selectionTop, top);
+        m_selectionBottom = std::max(m_selectionBottom, bottom);
+    }
+}
+
+/**
+ * The buffer edits go to: the current layer, or the current frame.
+ */
+PixelBuffer& BixelGrid::editedPixels() {
+    finishLoading();
+    return m_animation ? m_animation->pixels() : m_layers.currentPixels();
+}
+
+/**
+ * The buffer drawn: the flattened layers, or the current frame. In a
+ * session, the tiles painted since the last call are described to the
+ * other peers first, as flattening forgets which they were.
+ */
+PixelBuffer& BixelGrid::shownPixels() {
+    if(m_animation) {
+        return m_animation->pixels();
+    }
+    if(m_session.isJoined()) {
+        describeEdits(false);
+    }
+    return m_layers.flattened();
+}
+
+/**
+ * Undoing or redoing a resize of a single layer resizes only the layer;
+ * this brings the stack and its composite to the same size.
+ */
+/**
+ * Swaps layers and selection in for the document's own as one undo
+ * step, for edits that change every layer of the stack at once.
+ */
+void BixelGrid::exchangeLayers(const std::shared_ptr<LayerStack>& layers, const std::shared_ptr<Selection>& selection) {
+    History::Action exchange = [this, layers, selection](PixelBuffer&, Selection& current) {
+        std::swap(m_layers, *layers);
+        m_layers.invalidate();
+        std::swap(current, *selection);
+    };
+    exchange(m_layers.currentPixels(), m_selection);
+    m_history.recordAction(exchange, exchange);
+}
+
+void BixelGrid::matchLayerSize() {
+    PixelBuffer& pixels = m_layers.currentPixels();
+    if(!m_animation && (pixels.width() != m_layers.width() || pixels.height() != m_layers.height())) {
+        m_layers.resize(pixels.width(), pixels.height());
+        m_layers.invalidate();
+    }
+}
+
+/**
+ * Decodes the tiles of the mapped document that overlap the rectangle
+ * and were not decoded yet, straight into the only layer, and marks
+ * them dirty. Once every tile is in, the file is closed.
+ */
+void BixelGrid::loadTiles(int x, int y, int width, int height) {
+    const int tileSize = m_mapped->tileSize();
+    const int tilesX = m_mapped->tilesX();
+    int left = std::max(0, x / tileSize);
+    int top = std::max(0, y / tileSize);
+    int right = std::min(tilesX - 1, (x + width - 1) / tileSize);
+    int bottom = std::min(m_mapped->tilesY() - 1, (y + height - 1) / tileSize);
+    std::vector<int> tiles;
+    for(int ty = top; ty <= bottom; ty++) {
+        for(int tx = left; tx <= right; tx++) {
+            if(!m_tileLoaded[ty * tilesX + tx]) {
+                m_tileLoaded[ty * tilesX + tx] = true;
+                tiles.push_back(ty * tilesX + tx);
+            }
+        }
+    }
+    if(!tiles.empty()) {
+        Tracer::Zone zone("load_tiles");
+        PixelBuffer& pixels = m_layers.pixels(0);
+        const MappedBixlFile& file = *m_mapped;
+        std::function<void(int, int)> decodeTiles = [&tiles, &pixels, &file, tilesX, tileSize](int begin, int end) {
+            for(int i = begin; i < end; i++) {
+                int tileX = tiles[i] % tilesX * tileSize;
+                int tileY = tiles[i] / tilesX * tileSize;
+                if(!file.decodeTile(tiles[i] % tilesX, tiles[i] / tilesX, pixels.row(tileY) + tileX, pixels.stride())) {
+                    Tracer::message("Cannot decode tile at %d, %d", tileX, tileY);
+                }
+            }
+        };
+        if(m_pool && tiles.size() > 1) {
+            m_pool->parallelFor(0, tiles.size(), decodeTiles, 1);
+        } else {
+            decodeTiles(0, tiles.size());
+        }
+        for(size_t i = 0; i < tiles.size(); i++) {
+            int tileX = tiles[i] % tilesX * tileSize;
+            int tileY = tiles[i] / tilesX * tileSize;
+            pixels.markDirty(tileX, tileY, std::min(tileSize, pixels.width() - tileX),
+                             std::min(tileSize, pixels.height() - tileY));
+        }
+        m_loadedTiles += tiles.size();
+        Tracer::counter("loaded_tiles", m_loadedTiles);
+    }
+    if(m_loadedTiles == m_tileLoaded.size()) {
+        m_mapped.reset();
+        m_tileLoaded.clear();
+        update();
+        emit loadFinished();
+    }
+}
+
+/**
+ * Replaces the selection as an undo step of its own.
+ */
+void BixelGrid::setSelection(const Selection& selection) {
+    m_stroke.end();
+    commitPaste();
+    history().endStep();
+    history().selectionChanged(m_selection, selection);
+    history().endStep();
+    m_selection = selection;
+    m_selectionChanged = true;
+    update();
+    emit stateChanged();
+}
+
+/**
+ * Starts over with nothing selected and nothing to undo, for a document
+ * that replaced the previous one.
+ */
+void BixelGrid::resetEditing() {
+    m_history.clear();
+    if(m_animation) {
+        m_animation->history().clear();
+    }
+    m_selection.resize(gridWidth(), gridHeight());
+    m_selection.clear();
+    m_selectionChanged = true;
+}
+
+/**
+ * Puts the edits made since the last call in the session's batch, as
+ * the bixels now in every dirty tile of the layer, merged into one
+ * rectangle per run of dirty tiles in a tile row, and a resize first if
+ * the canvas changed size. With selection, the selection rows changed
+ * since the last frame are restated as well. The layer's dirty tiles
+ * are left for LayerStack::flattened(), which must not have consumed
+ * them yet.
+ */
+void BixelGrid::describeEdits(bool selection) {
+    OperationLog& batch = m_session.batch();
+    PixelBuffer& pixels = m_layers.currentPixels();
+    const int width = pixels.width();
+    const int height = pixels.height();
+    if(width != m_sessionWidth || height != m_sessionHeight) {
+        batch.addResize(width, height);
+        pixels.markDirty(0, 0, width, height);
+        m_sessionWidth = width;
+        m_sessionHeight = height;
+    }
+
+    const DirtyRegion& dirty = pixels.dirtyRegion();
+    const int tileSize = DirtyRegion::TILE_SIZE;
+    for(int ty = 0; !dirty.isEmpty() && ty < dirty.tilesY(); ty++) {
+        int y = ty * tileSize;
+        for(int tx = 0; tx < dirty.tilesX(); tx++) {
+            int first = tx;
+            while(tx < dirty.tilesX() && dirty.isTileDirty(tx, ty)) {
+                tx++;
+            }
+            if(tx > first) {
+                int x = first * tileSize;
+                batch.addRect(pixels, x, y, std::min(tx * tileSize, width) - x, std::min(tileSize, height - y));
+            }
+        }
+    }
+
+    if(selection && (m_selectionChanged || m_selectionTop <= m_selectionBottom)) {
+        int top = m_selectionChanged ? 0 : m_selectionTop;
+        int bottom = m_selectionChanged ? m_selection.height() - 1 : m_selectionBottom;
+        for(int y = top; y <= bottom; y++) {
+            batch.addSelection(0, y, m_selection.width(), false);
+            m_selection.forEachSpanInRow(y, [&batch, y](int x, int, int length) {
+                batch.addSelection(x, y, length, true);
+            });
+        }
+    }
+}
+
+/**
+ * Sends this frame's edits to the session and applies the ones other
+ * peers sent. Local edits are described before remote ones are
+ * applied, and the remote bixels are flattened right away, so they are
+ * never sent back as edits of this peer's own.
+ */
+void BixelGrid::exchangeSessionEdits() {
+    Tracer::Zone zone("session_exchange");
+    describeEdits(true);
+    m_session.flush();
+    PixelBuffer& pixels = m_layers.currentPixels();
+    if(m_session.poll(pixels, m_selection)) {
+        if(pixels.width() != m_sessionWidth || pixels.height() != m_sessionHeight) {
+            //Undo steps and a floating paste refer to the old size
+            m_stroke.end();
+            m_paste.commit(0);
+            m_draggingPaste = false;
+            m_history.clear();
+            matchLayerSize();
+            m_sessionWidth = pixels.width();
+            m_sessionHeight = pixels.height();
+        }
+        m_layers.flattened();
+        m_selectionChanged = true;
+        emit stateChanged();
+    }
+    if(!m_session.isJoined()) {
+        m_sessionNotifier.reset();
+        emit sessionLeft();
+    } else {
+        m_sessionNotifier->setEnabled(true);
+    }
+}
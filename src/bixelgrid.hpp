@@ -0,0 +1,191 @@
+#ifndef GLWIDGET_HPP
+#define GLWIDGET_HPP
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <QGLWidget>
+#include <QColor>
+#include <QMouseEvent>
+#include <QKeyEvent>
+#include <QSocketNotifier>
+#include "rgba.hpp"
+#include "ivec2.hpp"
+#include "pixelbuffer.hpp"
+#include "layerstack.hpp"
+#include "animation.hpp"
+#include "mappedbixlfile.hpp"
+#include "selection.hpp"
+#include "history.hpp"
+#include "strokeengine.hpp"
+#include "floodfill.hpp"
+#include "transformengine.hpp"
+#include "clipboard.hpp"
+#include "canvasrenderer.hpp"
+#include "viewport.hpp"
+#include "threadpool.hpp"
+#include "backgroundsaver.hpp"
+#include "sessionclient.hpp"
+
+/**
+ * The canvas: a grid of bixels drawn with OpenGL and edited with the
+ * mouse.
+ *
+ * The bixels live in a LayerStack. Brushes, filters and file I/O work
+ * directly on the current layer's PixelBuffer, a row span at a time;
+ * getColorAt() and setColorAt() are thin wrappers over it for code that
+ * thinks in QColors. Edits are recorded in a History, and paintGL()
+ * draws the flattened layers through a CanvasRenderer as one textured
+ * quad, with the selection and the bixel under the mouse highlighted in
+ * the shader. Each frame recomposites and uploads only the tiles
+ * painted and the selection rows changed since the last. Documents are
+ * opened and saved with all their layers. An animation is held in an
+ * Animation instead, editing the current frame with that frame's
+ * history, and saved with all its frames.
+ * transform() and scale() turn, flip or enlarge the selection, or the
+ * whole document when nothing is selected, through a TransformEngine.
+ * In a shared session, joinSession(), the bixels painted since the
+ * last frame are sent to the other peers from paintGL(), a dirty tile
+ * at a time, and their edits are applied there too.
+ * Zoom and pan are a Viewport transform applied in the shader and to
+ * the mouse; the widget itself always fills the CanvasWidget.
+ *
+ * Code outside the grid may edit pixels() and selection() directly,
+ * recording the change in history(), and then calls showEdit(). A
+ * pasted clip floats over the bixels, dragged with the MOUSE tool,
+ * until commitPaste() (Enter, or clicking elsewhere) makes it one undo
+ * step or cancelPaste() (Escape) takes it away again.
+ */
+class BixelGrid : public QGLWidget {
+    Q_OBJECT
+    public:
+        enum DrawTool { MOUSE,  ///< Used to select Bixels
+                        BRUSH,  ///<  Used to Color Bixels
+                        ERASER, ///< Used to set Bixel color to (0, 0, 0, 0)
+                        EYEDROP, ///< The Eyedrop Tool
+                        HAND, ///< The Hand Tool
+                        PAINTBUCKET, ///< Fills the area of similar color around a Bixel
+                        ZOOM ///< The Zoom Tool
+                      };
+
+        static const int DEFAULT_DIMENSION = 32;
+
+        BixelGrid(QWidget* parent = 0, ThreadPool* pool = 0);
+        ~BixelGrid();
+
+        void changeTool(DrawTool tool);
+        DrawTool tool() const;
+        void setDrawingColor(const QColor& color);
+        QColor drawingColor() const;
+
+        QColor getColorAt(int i, int j) const;
+        void setColorAt(int i, int j, const QColor& color);
+        int gridWidth() const;
+        int gridHeight() const;
+        int dimension() const;
+        void increaseDimension();
+        void decreaseDimension();
+        void resizeGrid(int width, int height);
+        bool transform(TransformEngine::Operation operation);
+        bool scale(int factor);
+        void setMirror(int mirror);
+        int mirror() const;
+
+        PixelBuffer& pixels();
+        const PixelBuffer& flattened();
+        Selection& selection();
+        History& history();
+        void showEdit();
+        void replacePixels(PixelBuffer& pixels);
+
+        void selectAll();
+        void deselectAll();
+        void selectRectangle(ivec2 point1, ivec2 point2);
+        void undo();
+        void redo();
+
+        void beginPaste(const std::shared_ptr<const Clip>& clip, int x, int y);
+        void commitPaste();
+        void cancelPaste();
+        bool isPasting() const;
+
+        bool openFile(const std::string& fileName);
+        void openImage(BixlImage& image);
+        bool saveFile(const std::string& fileName);
+        BackgroundSaver::Writer snapshotWriter();
+        bool exportPNG(const std::string& fileName);
+
+        void setViewport(const Viewport& viewport);
+
+        bool joinSession(const std::string& socketPath);
+        void leaveSession();
+        bool isInSession() const;
+
+    public slots:
+        void finishLoading();
+
+    private slots:
+        void sessionReadable();
+
+    signals:
+        void stateChanged();
+        void loadFinished();
+        void sessionLeft();
+        void colorPicked(const QColor& color);
+
+    protected:
+        void initializeGL();
+        void paintGL();
+        void resizeGL(int width, int height);
+        void mousePressEvent(QMouseEvent* event);
+        void mouseReleaseEvent(QMouseEvent* event);
+        void mouseMoveEvent(QMouseEvent* event);
+        void leaveEvent(QEvent* event);
+        void keyPressEvent(QKeyEvent* event);
+
+    private:
+        PixelBuffer& editedPixels();
+        PixelBuffer& shownPixels();
+        void loadTiles(int x, int y, int width, int height);
+        void matchLayerSize();
+        void exchangeLayers(const std::shared_ptr<LayerStack>& layers, const std::shared_ptr<Selection>& selection);
+        ivec2 convertPositionToBixelIndex(int x, int y) const;
+        void dragSelection(ivec2 bixel);
+        void markSelectionRows(int top, int bottom);
+        void setSelection(const Selection& selection);
+        void resetEditing();
+        void describeEdits(bool selection);
+        void exchangeSessionEdits();
+
+        DrawTool m_currentTool;
+        QColor m_drawingColor;
+        int m_dimension;
+        TransformEngine m_transform;    ///< Outlives the histories it records in
+        LayerStack m_layers;
+        std::unique_ptr<Animation> m_animation;    ///< Set instead of m_layers for animations
+        std::unique_ptr<MappedBixlFile> m_mapped;   ///< Set while a document is still being decoded
+        std::vector<bool> m_tileLoaded;             ///< By tile of m_mapped, row by row
+        size_t m_loadedTiles;
+        Selection m_selection;
+        Selection m_selectionBefore;    ///< The selection when a rectangle drag started
+        ivec2 m_clickIndex;
+        ivec2 m_currentMouseIndex;
+        ivec2 m_hoverIndex;
+        bool m_selecting;
+        bool m_draggingPaste;
+        bool m_selectionChanged;        ///< Not uploaded to the renderer yet
+        int m_selectionTop;             ///< First row changed since the last upload
+        int m_selectionBottom;          ///< Last row changed since the last upload
+        History m_history;
+        StrokeEngine m_stroke;
+        FloodFill m_fill;
+        FloatingPaste m_paste;
+        CanvasRenderer m_renderer;
+        Viewport m_viewport;
+        ThreadPool* m_pool;
+        SessionClient m_session;
+        std::unique_ptr<QSocketNotifier> m_sessionNotifier;
+        int m_sessionWidth;             ///< Canvas size last described to the session
+        int m_sessionHeight;
+};
+#endif
@@ -7,7 +7,27 @@
 #include <QString>
 #include <QFileInfo>
 #include <QPushButton>
+#include <QInputDialog>
+#include <QImageReader>
+#include <QStringList>
+#include <QColorDialog>
+#include <QLineEdit>
+#include <QDir>
 #include <stdio.h>
+#include <algorithm>
+#include "tracer.hpp"
+#include "imageimporter.hpp"
+#include "filterpipeline.hpp"
+
+namespace {
+    //Colors as FilterPipeline::Filter::parse() reads them
+    std::string filterColor(const QColor& color) {
+        char text[9];
+        snprintf(text, sizeof(text), "%02x%02x%02x%02x", color.red(), color.green(), color.blue(), color.alpha());
+        return text;
+    }
+};
+
 BixelWindow::BixelWindow(QWidget* parent, Qt::WindowFlags flags) : QMainWindow(parent, flags), m_fileName(""), m_saveUpToDate(true) {
     QMenuBar* mainMenuBar = this->menuBar();
 
@@ -31,6 +51,11 @@ BixelWindow::BixelWindow(QWidget* parent, Qt::WindowFlags flags) : QMainWindow(p
         open->setShortcut(QKeySequence("Ctrl+o"));
         QObject::connect(open, SIGNAL(triggered()), this, SLOT(open_slot()));
 
+        import_image = fileMenu->addAction("Import Image");
+        this->addAction(import_image);
+        import_image->setShortcut(QKeySequence("Ctrl+i"));
+        QObject::connect(import_image, SIGNAL(triggered()), this, SLOT(import_image_slot()));
+
         export_image = fileMenu->addAction("Export Image");
         this->addAction(export_image);
         export_image->setShortcut(QKeySequence("Ctrl+e"));
@@ -51,13 +76,19 @@ BixelWindow::BixelWindow(QWidget* parent, Qt::WindowFlags flags) : QMainWindow(p
         QObject::connect(redo, SIGNAL(triggered()), this, SIGNAL(redo_signal()));
 
         copy = editMenu->addAction("Copy");
+        this->addAction(copy);
         copy->setShortcut(QKeySequence("Ctrl+c"));
+        QObject::connect(copy, SIGNAL(triggered()), this, SIGNAL(copy_signal()));
 
         cut = editMenu->addAction("Cut");
+        this->addAction(cut);
         cut->setShortcut(QKeySequence("Ctrl+x"));
+        QObject::connect(cut, SIGNAL(triggered()), this, SIGNAL(cut_signal()));
 
         paste = editMenu->addAction("Paste");
+        this->addAction(paste);
         paste->setShortcut(QKeySequence("Ctrl+v"));
+        QObject::connect(paste, SIGNAL(triggered()), this, SIGNAL(paste_signal()));
 
         select_all = editMenu->addAction("Select All");
         this->addAction(select_all);
@@ -69,6 +100,61 @@ BixelWindow::BixelWindow(QWidget* parent, Qt::WindowFlags flags) : QMainWindow(p
         deselect_all->setShortcut(QKeySequence("esc"));
         QObject::connect(deselect_all, SIGNAL(triggered()), this, SIGNAL(deselect_all_signal()));
 
+    QMenu* filterMenu = mainMenuBar->addMenu("Filters");
+        replace_color = filterMenu->addAction("Replace Color");
+        QObject::connect(replace_color, SIGNAL(triggered()), this, SLOT(replace_color_slot()));
+
+        adjust_hsv = filterMenu->addAction("Adjust Hue/Saturation/Value");
+        QObject::connect(adjust_hsv, SIGNAL(triggered()), this, SLOT(adjust_hsv_slot()));
+
+        outline = filterMenu->addAction("Outline");
+        QObject::connect(outline, SIGNAL(triggered()), this, SLOT(outline_slot()));
+
+        drop_shadow = filterMenu->addAction("Drop Shadow");
+        QObject::connect(drop_shadow, SIGNAL(triggered()), this, SLOT(drop_shadow_slot()));
+
+        dither = filterMenu->addAction("Dither to Swatches");
+        QObject::connect(dither, SIGNAL(triggered()), this, SIGNAL(dither_signal()));
+
+    QMenu* imageMenu = mainMenuBar->addMenu("Image");
+        increase_dimension = imageMenu->addAction("Increase Size");
+        QObject::connect(increase_dimension, SIGNAL(triggered()), this, SIGNAL(increase_dimension_signal()));
+
+        decrease_dimension = imageMenu->addAction("Decrease Size");
+        QObject::connect(decrease_dimension, SIGNAL(triggered()), this, SIGNAL(decrease_dimension_signal()));
+
+        QMenu* transformMenu = imageMenu->addMenu("Transform");
+            rotate_clockwise = transformMenu->addAction("Rotate Clockwise");
+            this->addAction(rotate_clockwise);
+            rotate_clockwise->setShortcut(QKeySequence("Ctrl+]"));
+            QObject::connect(rotate_clockwise, SIGNAL(triggered()), this, SIGNAL(rotate_clockwise_signal()));
+
+            rotate_half = transformMenu->addAction("Rotate 180");
+            QObject::connect(rotate_half, SIGNAL(triggered()), this, SIGNAL(rotate_half_signal()));
+
+            rotate_counterclockwise = transformMenu->addAction("Rotate Counterclockwise");
+            this->addAction(rotate_counterclockwise);
+            rotate_counterclockwise->setShortcut(QKeySequence("Ctrl+["));
+            QObject::connect(rotate_counterclockwise, SIGNAL(triggered()), this, SIGNAL(rotate_counterclockwise_signal()));
+
+            flip_horizontal = transformMenu->addAction("Flip Horizontal");
+            QObject::connect(flip_horizontal, SIGNAL(triggered()), this, SIGNAL(flip_horizontal_signal()));
+
+            flip_vertical = transformMenu->addAction("Flip Vertical");
+            QObject::connect(flip_vertical, SIGNAL(triggered()), this, SIGNAL(flip_vertical_signal()));
+
+            scale_up = transformMenu->addAction("Scale 2x");
+            QObject::connect(scale_up, SIGNAL(triggered()), this, SIGNAL(scale_up_signal()));
+
+        QMenu* mirrorMenu = imageMenu->addMenu("Mirror Painting");
+            mirror_horizontal = mirrorMenu->addAction("Left and Right");
+            mirror_horizontal->setCheckable(true);
+            QObject::connect(mirror_horizontal, SIGNAL(toggled(bool)), this, SIGNAL(mirror_horizontal_signal(bool)));
+
+            mirror_vertical = mirrorMenu->addAction("Top and Bottom");
+            mirror_vertical->setCheckable(true);
+            QObject::connect(mirror_vertical, SIGNAL(toggled(bool)), this, SIGNAL(mirror_vertical_signal(bool)));
+
     QMenu* viewMenu = mainMenuBar->addMenu("View");
         QMenu* zoomMenu = viewMenu->addMenu("Zoom");
             zoom_in = zoomMenu->addAction("Zoom in");
@@ -82,8 +168,30 @@ BixelWindow::BixelWindow(QWidget* parent, Qt::WindowFlags flags) : QMainWindow(p
             QObject::connect(zoom_out, SIGNAL(triggered()), this, SIGNAL(zoom_out_signal()));
 
             custom_zoom = zoomMenu->addAction("Custom Zoom");
+            QObject::connect(custom_zoom, SIGNAL(triggered()), this, SLOT(custom_zoom_slot()));
         reset_view = viewMenu->addAction("Reset View");
+        this->addAction(reset_view);
         reset_view->setShortcut(QKeySequence("Ctrl+r"));
+        QObject::connect(reset_view, SIGNAL(triggered()), this, SIGNAL(reset_view_signal()));
+
+    QMenu* sessionMenu = mainMenuBar->addMenu("Session");
+        join_session = sessionMenu->addAction("Join Session");
+        QObject::connect(join_session, SIGNAL(triggered()), this, SLOT(join_session_slot()));
+
+        leave_session = sessionMenu->addAction("Leave Session");
+        leave_session->setEnabled(false);
+        QObject::connect(leave_session, SIGNAL(triggered()), this, SIGNAL(leave_session_signal()));
+
+    QMenu* debugMenu = mainMenuBar->addMenu("Debug");
+        record_trace = debugMenu->addAction("Record Trace");
+        this->addAction(record_trace);
+        record_trace->setCheckable(true);
+        record_trace->setChecked(Tracer::isEnabled());
+        record_trace->setShortcut(QKeySequence("Ctrl+Shift+t"));
+        QObject::connect(record_trace, SIGNAL(toggled(bool)), this, SLOT(record_trace_slot(bool)));
+
+        save_trace = debugMenu->addAction("Save Trace");
+        QObject::connect(save_trace, SIGNAL(triggered()), this, SLOT(save_trace_slot()));
     setWindowTitle(QString("New File"));
 }
 
@@ -96,15 +204,8 @@ BixelWindow::~BixelWindow() {
 }
 
 void BixelWindow::open_slot() {
-    if(!m_saveUpToDate) {
-        QMessageBox currentFileNotSavedDialog(this);
-        currentFileNotSavedDialog.setText("If you continue, you will lose unsaved work. Is this okay?");
-        currentFileNotSavedDialog.addButton(QMessageBox::Ok);
-        currentFileNotSavedDialog.addButton(QMessageBox::Cancel);
-        currentFileNotSavedDialog.exec();
-        if(currentFileNotSavedDialog.clickedButton() == currentFileNotSavedDialog.button(QMessageBox::Cancel)) {
-            return;
-        }
+    if(!discardUnsavedWork()) {
+        return;
     }
     QFileDialog dialog(this);
     dialog.setFileMode(QFileDialog::ExistingFile);
@@ -121,6 +222,68 @@ void BixelWindow::open_slot(std::string fileName) {
         m_saveUpToDate = true;
 }
 
+/**
+ * Asks for an image in any format Qt reads, the grid width to resample
+ * it to and whether to keep its colors, and opens it as a new untitled
+ * document. The height follows the image's aspect ratio. The title is
+ * updated in importFinished().
+ */
+void BixelWindow::import_image_slot() {
+    if(!discardUnsavedWork()) {
+        return;
+    }
+    QStringList patterns;
+    QList<QByteArray> formats = QImageReader::supportedImageFormats();
+    for(int i = 0; i < formats.size(); i++) {
+        patterns << "*." + QString(formats[i]);
+    }
+    QFileDialog dialog(this);
+    dialog.setFileMode(QFileDialog::ExistingFile);
+    dialog.setNameFilter("Images (" + patterns.join(" ") + ")");
+    if(!dialog.exec()) {
+        return;
+    }
+    QString fileName = dialog.selectedFiles()[0];
+    int imageWidth = 0;
+    int imageHeight = 0;
+    if(!ImageImporter::imageSize(fileName.toStdString(), imageWidth, imageHeight)) {
+        QMessageBox::warning(this, "Import failed", "Could not read " + fileName + ".");
+        return;
+    }
+
+    bool ok = false;
+    int width = QInputDialog::getInt(this, "Import Image",
+                                     QString("Grid width (image is %1 x %2):").arg(imageWidth).arg(imageHeight),
+                                     std::min(imageWidth, (int) DEFAULT_IMPORT_WIDTH), 1, imageWidth, 1, &ok);
+    if(!ok) {
+        return;
+    }
+    int height = std::max(1, (int) ((double) imageHeight * width / imageWidth + 0.5));
+
+    QStringList colorModes;
+    colorModes << "Keep image colors" << "Use current swatches";
+    QString colorMode = QInputDialog::getItem(this, "Import Image", "Colors:", colorModes, 0, false, &ok);
+    if(!ok) {
+        return;
+    }
+
+    emit import_image_signal(fileName.toStdString(), width, height, colorMode == colorModes[1]);
+}
+
+/**
+ * Called when an import started by import_image_slot() has replaced the
+ * canvas, or failed and left it as it was.
+ */
+void BixelWindow::importFinished(const QString& fileName, bool success) {
+    if(!success) {
+        QMessageBox::warning(this, "Import failed", "Could not import " + fileName + ".");
+        return;
+    }
+    m_fileName = "";
+    m_saveUpToDate = false;
+    setWindowTitle(QFileInfo(fileName).fileName() + "*");
+}
+
 void BixelWindow::export_image_slot() {
     QStringList filters;
     filters << "All files (*)";
@@ -177,21 +340,167 @@ file extension and use '" + suffix + "' instead?").c_str()));
 
         }
         emit save_as_signal(m_fileName);
-        m_saveUpToDate = true;
-        setWindowTitle(QString(m_fileName.c_str()));
     }
 }
 
+/**
+ * Saving happens in the background; the title and m_saveUpToDate are
+ * updated in saveFinished() once the file has been written.
+ */
 void BixelWindow::save_slot() {
     if(m_fileName != "") {
-        m_saveUpToDate = true;
         emit save_as_signal(m_fileName);
-        setWindowTitle(QString(m_fileName.c_str()));
     } else {
         save_as_slot();
     }
 }
 
+/**
+ * Called when a save started by save_slot() or save_as_slot() has been
+ * written.
+ *
+ * @param upToDate  false if the canvas was edited after the save
+ *                  started, in which case the file is already behind.
+ */
+void BixelWindow::saveFinished(const QString& fileName, bool success, bool upToDate) {
+    if(!success) {
+        QMessageBox::warning(this, "Save failed", "Could not save " + fileName + ".");
+        return;
+    }
+    m_saveUpToDate = upToDate;
+    setWindowTitle(upToDate ? fileName : fileName + "*");
+}
+
+/**
+ * Asks for a color and the color to replace it with everywhere in the
+ * selection.
+ */
+void BixelWindow::replace_color_slot() {
+    QColor from = QColorDialog::getColor(Qt::white, this, "Replace Color", QColorDialog::ShowAlphaChannel);
+    if(!from.isValid()) {
+        return;
+    }
+    QColor to = QColorDialog::getColor(from, this, "Replace With", QColorDialog::ShowAlphaChannel);
+    if(!to.isValid()) {
+        return;
+    }
+    emit filter_signal("replace:" + filterColor(from) + ":" + filterColor(to));
+}
+
+/**
+ * Asks for a hue turn in degrees and factors for saturation and value.
+ */
+void BixelWindow::adjust_hsv_slot() {
+    bool ok = false;
+    double hue = QInputDialog::getDouble(this, "Adjust HSV", "Hue (degrees):", 0, -180, 180, 1, &ok);
+    if(!ok) {
+        return;
+    }
+    double saturation = QInputDialog::getDouble(this, "Adjust HSV", "Saturation (x):", 1, 0, 4, 2, &ok);
+    if(!ok) {
+        return;
+    }
+    double value = QInputDialog::getDouble(this, "Adjust HSV", "Value (x):", 1, 0, 4, 2, &ok);
+    if(!ok) {
+        return;
+    }
+    emit filter_signal(QString("hsv:%1:%2:%3").arg(hue).arg(saturation).arg(value).toStdString());
+}
+
+void BixelWindow::outline_slot() {
+    QColor color = QColorDialog::getColor(Qt::black, this, "Outline", QColorDialog::ShowAlphaChannel);
+    if(color.isValid()) {
+        emit filter_signal("outline:" + filterColor(color));
+    }
+}
+
+/**
+ * Asks for the shadow's color and its offset in bixels.
+ */
+void BixelWindow::drop_shadow_slot() {
+    QColor color = QColorDialog::getColor(QColor(0, 0, 0, 128), this, "Drop Shadow", QColorDialog::ShowAlphaChannel);
+    if(!color.isValid()) {
+        return;
+    }
+    bool ok = false;
+    int radius = FilterPipeline::MAX_RADIUS;
+    int dx = QInputDialog::getInt(this, "Drop Shadow", "Offset right:", 1, -radius, radius, 1, &ok);
+    if(!ok) {
+        return;
+    }
+    int dy = QInputDialog::getInt(this, "Drop Shadow", "Offset down:", 1, -radius, radius, 1, &ok);
+    if(!ok) {
+        return;
+    }
+    emit filter_signal(QString("shadow:%1:%2:%3").arg(filterColor(color).c_str()).arg(dx).arg(dy).toStdString());
+}
+
+/**
+ * Asks for a zoom in percent, 100 showing one bixel per screen pixel.
+ */
+void BixelWindow::custom_zoom_slot() {
+    bool ok = false;
+    double percent = QInputDialog::getDouble(this, "Custom Zoom", "Zoom (%):", 100, 1.5625, 25600, 2, &ok);
+    if(ok) {
+        emit custom_zoom_signal(percent);
+    }
+}
+
+/**
+ * Asks for the socket of a session relay, started with
+ * "bixel --relay <socket>", and joins it. The result comes back in
+ * sessionJoined().
+ */
+void BixelWindow::join_session_slot() {
+    bool ok = false;
+    QString socketPath = QInputDialog::getText(this, "Join Session", "Relay socket:", QLineEdit::Normal,
+                                               QDir::temp().filePath("bixel-session.sock"), &ok);
+    if(ok && !socketPath.isEmpty()) {
+        emit join_session_signal(socketPath.toStdString());
+    }
+}
+
+void BixelWindow::sessionJoined(const QString& socketPath, bool success) {
+    if(!success) {
+        QMessageBox::warning(this, "Join failed", "Could not join the session at " + socketPath
+                             + ". Only documents with one layer and no animation frames can be shared.");
+        return;
+    }
+    join_session->setEnabled(false);
+    leave_session->setEnabled(true);
+}
+
+void BixelWindow::sessionLeft() {
+    join_session->setEnabled(true);
+    leave_session->setEnabled(false);
+}
+
+/**
+ * Starts a fresh trace recording, or stops recording and keeps what was
+ * recorded for save_trace_slot().
+ */
+void BixelWindow::record_trace_slot(bool record) {
+    Tracer::setEnabled(record);
+}
+
+/**
+ * Saves the current recording as Chrome trace JSON, for chrome://tracing
+ * or Perfetto. Recording goes on if it is on.
+ */
+void BixelWindow::save_trace_slot() {
+    QFileDialog dialog(this);
+    dialog.setAcceptMode(QFileDialog::AcceptSave);
+    dialog.setFileMode(QFileDialog::AnyFile);
+    dialog.setDefaultSuffix("json");
+    dialog.setNameFilter("Chrome trace (*.json)");
+    if(dialog.exec()) {
+        QString fileName = dialog.selectedFiles()[0];
+        if(!Tracer::writeChromeTrace(fileName.toStdString())) {
+            QMessageBox::warning(this, "Save failed", "Could not save " + fileName + ".");
+        }
+    }
+}
+
 void BixelWindow::stateChanged() {
     if(m_saveUpToDate) {
         QString fileUnsavedName = windowTitle();
@@ -200,3 +509,22 @@ void BixelWindow::stateChanged() {
     }
     m_saveUpToDate = false;
 }
+
+//-Private-//
+
+/**
+ * Asks before unsaved work is replaced by another document.
+ *
+ * @return  true if there is none, or the user does not mind losing it.
+ */
+bool BixelWindow::discardUnsavedWork() {
+    if(m_saveUpToDate) {
+        return true;
+    }
+    QMessageBox currentFileNotSavedDialog(this);
+    currentFileNotSavedDialog.setText("If you continue, you will lose unsaved work. Is this okay?");
+    currentFileNotSavedDialog.addButton(QMessageBox::Ok);
+    currentFileNotSavedDialog.addButton(QMessageBox::Cancel);
+    currentFileNotSavedDialog.exec();
+    return currentFileNotSavedDialog.clickedButton() != currentFileNotSavedDialog.button(QMessageBox::Cancel);
+}
@@ -16,6 +16,7 @@ class BixelWindow : public QMainWindow {
         QAction* save;
         QAction* save_as;
         QAction* open;
+        QAction* import_image;
         QAction* export_image;
         QAction* preferences;
         QAction* undo;
@@ -28,6 +29,27 @@ class BixelWindow : public QMainWindow {
         QAction* select_all;
         QAction* deselect_all;
 
+        //Filters
+        QAction* replace_color;
+        QAction* adjust_hsv;
+        QAction* outline;
+        QAction* drop_shadow;
+        QAction* dither;
+
+        //Image
+        QAction* increase_dimension;
+        QAction* decrease_dimension;
+        //Image->transform
+        QAction* rotate_clockwise;
+        QAction* rotate_half;
+        QAction* rotate_counterclockwise;
+        QAction* flip_horizontal;
+        QAction* flip_vertical;
+        QAction* scale_up;
+        //Image->mirror
+        QAction* mirror_horizontal;
+        QAction* mirror_vertical;
+
         //View
         QAction* reset_view;
         //View->zoom
@@ -35,16 +57,37 @@ class BixelWindow : public QMainWindow {
         QAction* zoom_out;
         QAction* custom_zoom;
 
+        //Session
+        QAction* join_session;
+        QAction* leave_session;
+
+        //Debug
+        QAction* record_trace;
+        QAction* save_trace;
+
         BixelWindow(QWidget* parent = 0, Qt::WindowFlags flags = 0);
         ~BixelWindow();
 
     public slots:
         void open_slot(std::string fileName);
+        void saveFinished(const QString& fileName, bool success, bool upToDate);
+        void importFinished(const QString& fileName, bool success);
+        void sessionJoined(const QString& socketPath, bool success);
+        void sessionLeft();
     private slots:
         void open_slot();
+        void import_image_slot();
         void save_as_slot();
         void save_slot();
         void export_image_slot();
+        void record_trace_slot(bool record);
+        void save_trace_slot();
+        void custom_zoom_slot();
+        void join_session_slot();
+        void replace_color_slot();
+        void adjust_hsv_slot();
+        void outline_slot();
+        void drop_shadow_slot();
         void stateChanged();
 
     signals:
@@ -53,6 +96,7 @@ class BixelWindow : public QMainWindow {
         void save_signal();
         void save_as_signal(const std::string& fileName);
         void open_signal(const std::string& fileName);
+        void import_image_signal(const std::string& fileName, int width, int height, bool useSwatches);
         void export_image_signal(const std::string& fileName);
         void preferences_signal();
         void undo_signal();
@@ -65,13 +109,39 @@ class BixelWindow : public QMainWindow {
         void select_all_signal();
         void deselect_all_signal();
 
+        //Filters
+        void filter_signal(const std::string& spec);
+        void dither_signal();
+
+        //Image
+        void increase_dimension_signal();
+        void decrease_dimension_signal();
+        //Image->transform
+        void rotate_clockwise_signal();
+        void rotate_half_signal();
+        void rotate_counterclockwise_signal();
+        void flip_horizontal_signal();
+        void flip_vertical_signal();
+        void scale_up_signal();
+        //Image->mirror
+        void mirror_horizontal_signal(bool on);
+        void mirror_vertical_signal(bool on);
+
         //View
         void reset_view_signal();
         //View->zoom
         void zoom_in_signal();
         void zoom_out_signal();
-        void custom_zoom_signal();
+        void custom_zoom_signal(double percent);
+
+        //Session
+        void join_session_signal(const std::string& socketPath);
+        void leave_session_signal();
     private:
+        static const int DEFAULT_IMPORT_WIDTH = 128;
+
+        bool discardUnsavedWork();
+
         std::string m_fileName;
         bool m_saveUpToDate;
 };
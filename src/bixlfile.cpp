@@ -0,0 +1,784 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include "bixlfile.hpp"
+#include "compositor.hpp"
+#include "tracer.hpp"
+
+namespace {
+    const unsigned char MAGIC[4] = { 'B', 'I', 'X', 'L' };
+
+    void appendLE16(std::vector<unsigned char>& out, uint32_t value) {
+        out.push_back(value & 0xFF);
+        out.push_back((value >> 8) & 0xFF);
+    }
+
+    void appendLE32(std::vector<unsigned char>& out, uint32_t value) {
+        out.push_back(value & 0xFF);
+        out.push_back((value >> 8) & 0xFF);
+        out.push_back((value >> 16) & 0xFF);
+        out.push_back((value >> 24) & 0xFF);
+    }
+
+    void storeLE32(std::vector<unsigned char>& out, size_t pos, uint32_t value) {
+        out[pos]     = value & 0xFF;
+        out[pos + 1] = (value >> 8) & 0xFF;
+        out[pos + 2] = (value >> 16) & 0xFF;
+        out[pos + 3] = (value >> 24) & 0xFF;
+    }
+
+    void appendBE32(std::vector<unsigned char>& out, uint32_t value) {
+        out.push_back((value >> 24) & 0xFF);
+        out.push_back((value >> 16) & 0xFF);
+        out.push_back((value >> 8) & 0xFF);
+        out.push_back(value & 0xFF);
+    }
+
+    void appendVarint(std::vector<unsigned char>& out, uint64_t value) {
+        while(value >= 0x80) {
+            out.push_back((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(value);
+    }
+
+    void appendValue(std::vector<unsigned char>& out, uint32_t value, bool indexed) {
+        if(indexed) {
+            out.push_back(value & 0xFF);
+        } else {
+            appendLE32(out, value);
+        }
+    }
+
+    void appendLiteral(std::vector<unsigned char>& out, const std::vector<uint32_t>& values,
+                       size_t begin, size_t end, bool indexed) {
+        if(end <= begin) {
+            return;
+        }
+        appendVarint(out, (uint64_t) (end - begin - 1) << 1);
+        for(size_t i = begin; i < end; i++) {
+            appendValue(out, values[i], indexed);
+        }
+    }
+
+    int clampChannel(int32_t value) {
+        return std::max(0, std::min(255, (int) value));
+    }
+};
+
+BixlImage::BixlImage(int width, int height, int dimension) :
+    dimension(dimension), pixels(width, height), fps(0) {}
+
+int BixlImage::width() const {
+    return pixels.width();
+}
+
+int BixlImage::height() const {
+    return pixels.height();
+}
+
+//-Public-//
+
+/**
+ * Reads a .bixl file of any supported version.
+ *
+ * @param fileName  The file to read.
+ * @param image     Receives the decoded image. Left untouched on failure.
+ *
+ * @return          true if the file was read and decoded successfully.
+ */
+bool BixlFile::read(const std::string& fileName, BixlImage& image) {
+    Tracer::Zone zone("bixl_read");
+    FILE* file = fopen(fileName.c_str(), "rb");
+    if(!file) {
+        return false;
+    }
+
+    std::vector<unsigned char> data;
+    if(fseek(file, 0, SEEK_END) == 0) {
+        long size = ftell(file);
+        if(size > 0) {
+            data.resize(size);
+            fseek(file, 0, SEEK_SET);
+            if(fread(&data[0], 1, size, file) != (size_t) size) {
+                data.clear();
+            }
+        }
+    }
+    fclose(file);
+
+    if(data.empty()) {
+        return false;
+    }
+    return decode(&data[0], data.size(), image);
+}
+
+/**
+ * Writes image to fileName.
+ *
+ * @param encoding  How bixels are stored in a v2 file. Ignored for v1.
+ * @param version   The file format version to write; 1 is only useful
+ *                  for handing files to older builds. Animations are
+ *                  written as v4 and images with layers as v3 unless 1
+ *                  is asked for, which writes pixels.
+ */
+bool BixlFile::write(const std::string& fileName, const BixlImage& image,
+                     Encoding encoding, int version) {
+    Tracer::Zone zone("bixl_write");
+    std::vector<unsigned char> data;
+    encode(image, data, encoding, version);
+
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if(!file) {
+        return false;
+    }
+    bool success = fwrite(&data[0], 1, data.size(), file) == data.size();
+    success = (fclose(file) == 0) && success;
+    return success;
+}
+
+/**
+ * Writes a truecolor v2 file one tile at a time, for canvases too large
+ * to flatten into a BixlImage. Only one tile of bixels and its encoding
+ * are held in memory; the offset table is filled in once every tile has
+ * been written.
+ *
+ * @param reader    Supplies the bixels of each tile.
+ */
+bool BixlFile::writeTiled(const std::string& fileName, int width, int height, int dimension,
+                          const RegionReader& reader) {
+    Tracer::Zone zone("bixl_write_tiled");
+    const int tileSize = DEFAULT_TILE_SIZE;
+    const int tilesX = (width + tileSize - 1) / tileSize;
+    const int tilesY = (height + tileSize - 1) / tileSize;
+
+    std::vector<unsigned char> header;
+    header.insert(header.end(), MAGIC, MAGIC + sizeof(MAGIC));
+    appendLE16(header, 2);
+    appendLE16(header, 0);
+    appendLE32(header, width);
+    appendLE32(header, height);
+    appendLE32(header, dimension);
+    appendLE16(header, tileSize);
+    appendLE16(header, 0);
+    std::vector<unsigned char> offsets(4 * ((size_t) tilesX * tilesY + 1));
+
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if(!file) {
+        return false;
+    }
+    bool success = fwrite(&header[0], 1, header.size(), file) == header.size()
+                && fwrite(&offsets[0], 1, offsets.size(), file) == offsets.size();
+
+    std::vector<Rgba> bixels((size_t) tileSize * tileSize);
+    std::vector<uint32_t> values;
+    std::vector<unsigned char> encoded;
+    size_t written = 0;
+    int tile = 0;
+    for(int ty = 0; ty < tilesY && success; ty++) {
+        for(int tx = 0; tx < tilesX && success; tx++, tile++) {
+            int tileWidth = std::min(tileSize, width - tx * tileSize);
+            int tileHeight = std::min(tileSize, height - ty * tileSize);
+            reader(tx * tileSize, ty * tileSize, tileWidth, tileHeight, &bixels[0]);
+
+            values.assign(bixels.begin(), bixels.begin() + tileWidth * tileHeight);
+            encoded.clear();
+            encodeRuns(values, false, encoded);
+            storeLE32(offsets, 4 * tile, written);
+            success = fwrite(&encoded[0], 1, encoded.size(), file) == encoded.size();
+            written += encoded.size();
+        }
+    }
+    storeLE32(offsets, 4 * tile, written);
+
+    success = success && fseek(file, header.size(), SEEK_SET) == 0
+                      && fwrite(&offsets[0], 1, offsets.size(), file) == offsets.size();
+    success = (fclose(file) == 0) && success;
+    return success;
+}
+
+/**
+ * Writes an animation as a v4 file one frame at a time, so only one
+ * frame is ever held as a PixelBuffer.
+ *
+ * @param reader    Supplies the bixels of each frame.
+ */
+bool BixlFile::writeFrames(const std::string& fileName, int width, int height, int dimension,
+                           int fps, int frameCount, const FrameReader& reader, Encoding encoding) {
+    Tracer::Zone zone("bixl_write_frames");
+    if(frameCount <= 0 || frameCount > MAX_FRAMES) {
+        return false;
+    }
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if(!file) {
+        return false;
+    }
+
+    std::vector<unsigned char> data;
+    appendV4Header(width, height, dimension, fps, frameCount, data);
+    bool success = fwrite(&data[0], 1, data.size(), file) == data.size();
+    PixelBuffer pixels(width, height);
+    for(int i = 0; i < frameCount && success; i++) {
+        reader(i, pixels);
+        data.clear();
+        appendFrame(pixels, dimension, encoding, data);
+        success = fwrite(&data[0], 1, data.size(), file) == data.size();
+    }
+    success = (fclose(file) == 0) && success;
+    return success;
+}
+
+bool BixlFile::decode(const unsigned char* data, size_t size, BixlImage& image) {
+    switch(version(data, size)) {
+        case 1:
+            return decodeV1(data, size, image);
+        case 2:
+            return decodeV2(data, size, image);
+        case 3:
+            return decodeV3(data, size, image);
+        case 4:
+            return decodeV4(data, size, image);
+        default:
+            return false;
+    }
+}
+
+void BixlFile::encode(const BixlImage& image, std::vector<unsigned char>& out,
+                      Encoding encoding, int version) {
+    out.clear();
+    if(version == 1) {
+        encodeV1(image, out);
+    } else if(!image.frames.empty()) {
+        encodeV4(image, out, encoding);
+    } else if(!image.layers.empty()) {
+        encodeV3(image, out, encoding);
+    } else {
+        encodeV2(image, out, encoding);
+    }
+}
+
+/**
+ * Returns the format version of an encoded file, or 0 if data is
+ * not recognizable as a .bixl file. Version 1 files have no magic
+ * number; their first int is a big-endian width which can never
+ * start with 'B'.
+ */
+int BixlFile::version(const unsigned char* data, size_t size) {
+    if(size >= V2_HEADER_SIZE && memcmp(data, MAGIC, sizeof(MAGIC)) == 0) {
+        return readLE16(data + 4);
+    }
+    if(size >= V1_HEADER_SIZE) {
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Collects the distinct colors of image, sorted.
+ *
+ * @return  false if there are more than MAX_PALETTE_SIZE colors, in which
+ *          case palette is left empty.
+ */
+bool BixlFile::extractPalette(const BixlImage& image, std::vector<Rgba>& palette) {
+    palette.clear();
+    std::unordered_map<Rgba, int> seen;
+    Rgba last = 0;
+    bool haveLast = false;
+    for(int y = 0; y < image.height(); y++) {
+        const Rgba* row = image.pixels.row(y);
+        for(int x = 0; x < image.width(); x++) {
+            Rgba color = row[x];
+            if(haveLast && color == last) {
+                continue;
+            }
+            last = color;
+            haveLast = true;
+            if(seen.insert(std::make_pair(color, 0)).second) {
+                palette.push_back(color);
+                if(palette.size() > (size_t) MAX_PALETTE_SIZE) {
+                    palette.clear();
+                    return false;
+                }
+            }
+        }
+    }
+    std::sort(palette.begin(), palette.end());
+    return true;
+}
+
+uint32_t BixlFile::readLE32(const unsigned char* data) {
+    return  (uint32_t) data[0]
+         | ((uint32_t) data[1] << 8)
+         | ((uint32_t) data[2] << 16)
+         | ((uint32_t) data[3] << 24);
+}
+
+uint16_t BixlFile::readLE16(const unsigned char* data) {
+    return data[0] | (data[1] << 8);
+}
+
+uint32_t BixlFile::readBE32(const unsigned char* data) {
+    return ((uint32_t) data[0] << 24)
+         | ((uint32_t) data[1] << 16)
+         | ((uint32_t) data[2] << 8)
+         |  (uint32_t) data[3];
+}
+
+/**
+ * Decodes one run length encoded tile.
+ *
+ * @param out       Receives exactly count colors, or 0 to only check
+ *                  that the runs are well formed.
+ *
+ * @return          false if the runs are malformed, reference a color
+ *                  outside the palette, or do not add up to count.
+ */
+bool BixlFile::decodeRuns(const unsigned char* data, size_t size,
+                          bool indexed, const std::vector<Rgba>& palette,
+                          Rgba* out, size_t count) {
+    const size_t valueSize = indexed ? 1 : 4;
+    size_t pos = 0;
+    size_t written = 0;
+
+    while(written < count) {
+        uint64_t header = 0;
+        int shift = 0;
+        do {
+            if(pos >= size || shift > 56) {
+                return false;
+            }
+            header |= (uint64_t) (data[pos] & 0x7F) << shift;
+            shift += 7;
+        } while(data[pos++] & 0x80);
+
+        bool repeat = header & 1;
+        uint64_t runLength = (header >> 1) + 1;
+        if(runLength > count - written) {
+            return false;
+        }
+
+        size_t values = repeat ? 1 : runLength;
+        if(size - pos < values * valueSize) {
+            return false;
+        }
+        if(!out && !indexed) {
+            pos += values * valueSize;
+            written += runLength;
+            continue;
+        }
+
+        for(size_t v = 0; v < values; v++) {
+            Rgba color;
+            if(indexed) {
+                if(data[pos] >= palette.size()) {
+                    return false;
+                }
+                color = palette[data[pos]];
+            } else {
+                color = readLE32(data + pos);
+            }
+            pos += valueSize;
+
+            if(!out) {
+                written += repeat ? runLength : 1;
+            } else if(repeat) {
+                std::fill(out + written, out + written + runLength, color);
+                written += runLength;
+            } else {
+                out[written++] = color;
+            }
+        }
+    }
+    return true;
+}
+
+//-Private-//
+
+/**
+ * Run length encodes values. Repeats shorter than a run header plus one
+ * value would cost are folded into the surrounding literal runs.
+ */
+void BixlFile::encodeRuns(const std::vector<uint32_t>& values, bool indexed,
+                          std::vector<unsigned char>& out) {
+    const size_t minRepeat = indexed ? 3 : 2;
+    size_t literalStart = 0;
+    size_t i = 0;
+    while(i < values.size()) {
+        size_t j = i + 1;
+        while(j < values.size() && values[j] == values[i]) {
+            j++;
+        }
+
+        if(j - i >= minRepeat) {
+            appendLiteral(out, values, literalStart, i, indexed);
+            appendVarint(out, ((uint64_t) (j - i - 1) << 1) | 1);
+            appendValue(out, values[i], indexed);
+            literalStart = j;
+        }
+        i = j;
+    }
+    appendLiteral(out, values, literalStart, values.size(), indexed);
+}
+
+void BixlFile::encodeV1(const BixlImage& image, std::vector<unsigned char>& out) {
+    out.reserve(V1_HEADER_SIZE + (size_t) image.width() * image.height() * 16);
+    appendBE32(out, image.width());
+    appendBE32(out, image.height());
+    appendBE32(out, image.dimension);
+    //v1 bixels run down each column in turn
+    for(int x = 0; x < image.width(); x++) {
+        for(int y = 0; y < image.height(); y++) {
+            Rgba color = image.pixels.row(y)[x];
+            appendBE32(out, rgbaRed(color));
+            appendBE32(out, rgbaGreen(color));
+            appendBE32(out, rgbaBlue(color));
+            appendBE32(out, rgbaAlpha(color));
+        }
+    }
+}
+
+void BixlFile::encodeV2(const BixlImage& image, std::vector<unsigned char>& out,
+                        Encoding encoding) {
+    std::vector<Rgba> palette;
+    bool indexed = encoding != TRUECOLOR && extractPalette(image, palette);
+
+    std::unordered_map<Rgba, uint32_t> paletteIndex;
+    for(size_t i = 0; i < palette.size(); i++) {
+        paletteIndex[palette[i]] = i;
+    }
+
+    const int tileSize = DEFAULT_TILE_SIZE;
+    const int tilesX = (image.width() + tileSize - 1) / tileSize;
+    const int tilesY = (image.height() + tileSize - 1) / tileSize;
+
+    out.insert(out.end(), MAGIC, MAGIC + sizeof(MAGIC));
+    appendLE16(out, 2);
+    appendLE16(out, indexed ? FLAG_INDEXED : 0);
+    appendLE32(out, image.width());
+    appendLE32(out, image.height());
+    appendLE32(out, image.dimension);
+    appendLE16(out, tileSize);
+    appendLE16(out, palette.size());
+    for(size_t i = 0; i < palette.size(); i++) {
+        appendLE32(out, palette[i]);
+    }
+
+    size_t offsetTable = out.size();
+    out.resize(out.size() + 4 * ((size_t) tilesX * tilesY + 1));
+    size_t tileData = out.size();
+
+    std::vector<uint32_t> values;
+    values.reserve((size_t) tileSize * tileSize);
+    int tile = 0;
+    for(int ty = 0; ty < tilesY; ty++) {
+        for(int tx = 0; tx < tilesX; tx++, tile++) {
+            int x0 = tx * tileSize;
+            int y0 = ty * tileSize;
+            int x1 = std::min(x0 + tileSize, image.width());
+            int y1 = std::min(y0 + tileSize, image.height());
+
+            values.clear();
+            Rgba lastColor = 0;
+            uint32_t lastIndex = 0;
+            for(int y = y0; y < y1; y++) {
+                const Rgba* row = image.pixels.row(y);
+                for(int x = x0; x < x1; x++) {
+                    if(!indexed) {
+                        values.push_back(row[x]);
+                    } else {
+                        if(row[x] != lastColor || values.empty()) {
+                            lastColor = row[x];
+                            lastIndex = paletteIndex[lastColor];
+                        }
+                        values.push_back(lastIndex);
+                    }
+                }
+            }
+
+            storeLE32(out, offsetTable + 4 * tile, out.size() - tileData);
+            encodeRuns(values, indexed, out);
+        }
+    }
+
+    storeLE32(out, offsetTable + 4 * tile, out.size() - tileData);
+}
+
+bool BixlFile::decodeV1(const unsigned char* data, size_t size, BixlImage& image) {
+    int32_t width = readBE32(data);
+    int32_t height = readBE32(data + 4);
+    int32_t dimension = readBE32(data + 8);
+    if(width <= 0 || height <= 0) {
+        return false;
+    }
+
+    uint64_t count = (uint64_t) width * height;
+    if((size - V1_HEADER_SIZE) / 16 < count) {
+        return false;
+    }
+
+    BixlImage decoded(width, height, dimension);
+    const unsigned char* bixel = data + V1_HEADER_SIZE;
+    for(int x = 0; x < width; x++) {
+        for(int y = 0; y < height; y++, bixel += 16) {
+            decoded.pixels.row(y)[x] = packRgba(clampChannel(readBE32(bixel)),
+                                                clampChannel(readBE32(bixel + 4)),
+                                                clampChannel(readBE32(bixel + 8)),
+                                                clampChannel(readBE32(bixel + 12)));
+        }
+    }
+    image.dimension = decoded.dimension;
+    image.pixels.swap(decoded.pixels);
+    image.layers.clear();
+    image.frames.clear();
+    return true;
+}
+
+bool BixlFile::decodeV2(const unsigned char* data, size_t size, BixlImage& image) {
+    uint16_t flags = readLE16(data + 6);
+    int32_t width = readLE32(data + 8);
+    int32_t height = readLE32(data + 12);
+    int32_t dimension = readLE32(data + 16);
+    int tileSize = readLE16(data + 20);
+    size_t paletteSize = readLE16(data + 22);
+    bool indexed = flags & FLAG_INDEXED;
+
+    if(width <= 0 || height <= 0 || tileSize <= 0 || tileSize > MAX_TILE_SIZE
+       || paletteSize > (size_t) MAX_PALETTE_SIZE || (indexed && paletteSize == 0)) {
+        return false;
+    }
+
+    size_t tilesX = (width + tileSize - 1) / tileSize;
+    size_t tilesY = (height + tileSize - 1) / tileSize;
+    size_t offsetTable = V2_HEADER_SIZE + 4 * paletteSize;
+    size_t tileData = offsetTable + 4 * (tilesX * tilesY + 1);
+    if(size < tileData) {
+        return false;
+    }
+
+    std::vector<Rgba> palette(paletteSize);
+    for(size_t i = 0; i < paletteSize; i++) {
+        palette[i] = readLE32(data + V2_HEADER_SIZE + 4 * i);
+    }
+
+    if(!decodeTiles(data + offsetTable, data + tileData, size - tileData, width, height, tileSize,
+                    indexed, palette, 0)) {
+        return false;
+    }
+
+    BixlImage decoded(width, height, dimension);
+    if(!decodeTiles(data + offsetTable, data + tileData, size - tileData, width, height, tileSize,
+                    indexed, palette, &decoded.pixels)) {
+        return false;
+    }
+    image.dimension = decoded.dimension;
+    image.pixels.swap(decoded.pixels);
+    image.layers.clear();
+    image.frames.clear();
+    return true;
+}
+
+/**
+ * Decodes the tiles of a v2 file into pixels, or with pixels 0 only
+ * checks that each tile's runs are well formed and cover the tile
+ * exactly.
+ */
+bool BixlFile::decodeTiles(const unsigned char* offsets, const unsigned char* tileData, size_t tileDataSize,
+                           int width, int height, int tileSize, bool indexed,
+                           const std::vector<Rgba>& palette, PixelBuffer* pixels) {
+    size_t tilesX = (width + tileSize - 1) / tileSize;
+    size_t tilesY = (height + tileSize - 1) / tileSize;
+    std::vector<Rgba> tile;
+    if(pixels) {
+        tile.resize((size_t) std::min(tileSize, width) * std::min(tileSize, height));
+    }
+    for(size_t ty = 0; ty < tilesY; ty++) {
+        for(size_t tx = 0; tx < tilesX; tx++, offsets += 4) {
+            size_t begin = readLE32(offsets);
+            size_t end = readLE32(offsets + 4);
+            if(begin > end || end > tileDataSize) {
+                return false;
+            }
+
+            int x0 = tx * tileSize;
+            int y0 = ty * tileSize;
+            int tileWidth = std::min(tileSize, width - x0);
+            int tileHeight = std::min(tileSize, height - y0);
+            if(!decodeRuns(tileData + begin, end - begin, indexed, palette,
+                           pixels ? &tile[0] : 0, (size_t) tileWidth * tileHeight)) {
+                return false;
+            }
+            if(!pixels) {
+                continue;
+            }
+
+            for(int y = 0; y < tileHeight; y++) {
+                memcpy(pixels->row(y0 + y) + x0,
+                       &tile[(size_t) y * tileWidth], tileWidth * sizeof(Rgba));
+            }
+        }
+    }
+    return true;
+}
+
+void BixlFile::encodeV3(const BixlImage& image, std::vector<unsigned char>& out,
+                        Encoding encoding) {
+    out.insert(out.end(), MAGIC, MAGIC + sizeof(MAGIC));
+    appendLE16(out, LAYERED_VERSION);
+    appendLE16(out, 0);
+    appendLE32(out, image.width());
+    appendLE32(out, image.height());
+    appendLE32(out, image.dimension);
+    appendLE32(out, image.layers.size());
+
+    std::vector<unsigned char> bixels;
+    for(size_t i = 0; i < image.layers.size(); i++) {
+        const Layer& layer = image.layers[i];
+        size_t nameLength = std::min(layer.name.size(), (size_t) 0xFFFF);
+        appendLE16(out, nameLength);
+        out.insert(out.end(), layer.name.begin(), layer.name.begin() + nameLength);
+        out.push_back(layer.opacity);
+        out.push_back(layer.visible ? LAYER_VISIBLE : 0);
+        out.push_back(layer.blendMode);
+        out.push_back(0);
+
+        BixlImage layerImage;
+        layerImage.dimension = image.dimension;
+        layerImage.pixels = layer.pixels;
+        bixels.clear();
+        encodeV2(layerImage, bixels, encoding);
+        appendLE32(out, bixels.size());
+        out.insert(out.end(), bixels.begin(), bixels.end());
+    }
+}
+
+bool BixlFile::decodeV3(const unsigned char* data, size_t size, BixlImage& image) {
+    int32_t width = readLE32(data + 8);
+    int32_t height = readLE32(data + 12);
+    int32_t dimension = readLE32(data + 16);
+    uint32_t layerCount = readLE32(data + 20);
+    if(width <= 0 || height <= 0 || layerCount == 0) {
+        return false;
+    }
+
+    // Layers are checked against the file as they are decoded; the
+    // composite is only made once they all were.
+    BixlImage decoded(0, 0, dimension);
+    size_t pos = V2_HEADER_SIZE;
+    for(uint32_t i = 0; i < layerCount; i++) {
+        if(size - pos < 2) {
+            return false;
+        }
+        size_t nameLength = readLE16(data + pos);
+        pos += 2;
+        if(size - pos < nameLength + 8) {
+            return false;
+        }
+        Layer layer(std::string((const char*) data + pos, nameLength));
+        pos += nameLength;
+        layer.opacity = data[pos];
+        layer.visible = data[pos + 1] & LAYER_VISIBLE;
+        layer.blendMode = data[pos + 2] < Layer::BLEND_MODE_COUNT ? (Layer::BlendMode) data[pos + 2]
+                                                                  : Layer::NORMAL;
+        size_t length = readLE32(data + pos + 4);
+        pos += 8;
+
+        BixlImage layerImage;
+        if(length > size - pos || version(data + pos, length) != 2
+           || !decodeV2(data + pos, length, layerImage)
+           || layerImage.width() != width || layerImage.height() != height) {
+            return false;
+        }
+        pos += length;
+        layer.pixels.swap(layerImage.pixels);
+        decoded.layers.push_back(Layer());
+        std::swap(decoded.layers.back(), layer);
+    }
+
+    decoded.pixels.resize(width, height);
+    Compositor::composite(decoded.layers, 0, 0, width, height, decoded.pixels);
+    image.dimension = decoded.dimension;
+    image.pixels.swap(decoded.pixels);
+    image.layers.swap(decoded.layers);
+    image.frames.clear();
+    return true;
+}
+
+void BixlFile::appendV4Header(int width, int height, int dimension, int fps, int frameCount,
+                              std::vector<unsigned char>& out) {
+    out.insert(out.end(), MAGIC, MAGIC + sizeof(MAGIC));
+    appendLE16(out, ANIMATED_VERSION);
+    appendLE16(out, 0);
+    appendLE32(out, width);
+    appendLE32(out, height);
+    appendLE32(out, dimension);
+    appendLE16(out, frameCount);
+    appendLE16(out, std::max(0, std::min(0xFFFF, fps)));
+}
+
+/**
+ * Appends the chunk of one frame: its size, then the frame as a v2 file.
+ */
+void BixlFile::appendFrame(const PixelBuffer& pixels, int dimension, Encoding encoding,
+                           std::vector<unsigned char>& out) {
+    BixlImage frameImage;
+    frameImage.dimension = dimension;
+    frameImage.pixels = pixels;
+    size_t sizePos = out.size();
+    appendLE32(out, 0);
+    encodeV2(frameImage, out, encoding);
+    storeLE32(out, sizePos, out.size() - sizePos - 4);
+}
+
+/**
+ * Frames past MAX_FRAMES are left out.
+ */
+void BixlFile::encodeV4(const BixlImage& image, std::vector<unsigned char>& out,
+                        Encoding encoding) {
+    int frameCount = std::min(image.frames.size(), (size_t) MAX_FRAMES);
+    appendV4Header(image.width(), image.height(), image.dimension, image.fps, frameCount, out);
+    for(int i = 0; i < frameCount; i++) {
+        appendFrame(image.frames[i], image.dimension, encoding, out);
+    }
+}
+
+bool BixlFile::decodeV4(const unsigned char* data, size_t size, BixlImage& image) {
+    int32_t width = readLE32(data + 8);
+    int32_t height = readLE32(data + 12);
+    int32_t dimension = readLE32(data + 16);
+    int frameCount = readLE16(data + 20);
+    int fps = readLE16(data + 22);
+    if(width <= 0 || height <= 0 || frameCount == 0) {
+        return false;
+    }
+
+    BixlImage decoded(0, 0, dimension);
+    decoded.fps = fps;
+    decoded.frames.reserve(frameCount);
+    size_t pos = V2_HEADER_SIZE;
+    for(int i = 0; i < frameCount; i++) {
+        if(size - pos < 4) {
+            return false;
+        }
+        size_t length = readLE32(data + pos);
+        pos += 4;
+
+        BixlImage frameImage;
+        if(length > size - pos || version(data + pos, length) != 2
+           || !decodeV2(data + pos, length, frameImage)
+           || frameImage.width() != width || frameImage.height() != height) {
+            return false;
+        }
+        pos += length;
+        decoded.frames.push_back(PixelBuffer());
+        decoded.frames.back().swap(frameImage.pixels);
+    }
+
+    decoded.pixels = decoded.frames[0];
+    image.dimension = decoded.dimension;
+    image.pixels.swap(decoded.pixels);
+    image.layers.clear();
+    image.frames.swap(decoded.frames);
+    image.fps = decoded.fps;
+    return true;
+}
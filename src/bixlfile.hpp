@@ -0,0 +1,176 @@
+#ifndef BIXLFILE_HPP
+#define BIXLFILE_HPP
+#include <functional>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "layer.hpp"
+
+/**
+ * Decoded contents of a .bixl file.
+ *
+ * pixels holds the bixels row by row, whatever order the file stored
+ * them in.
+ *
+ * layers is empty unless the file has layers (v3), in which case they
+ * are listed bottom first and pixels holds their composite, so code
+ * that knows nothing of layers still sees the image as drawn.
+ *
+ * frames is likewise empty unless the file is an animation (v4), in
+ * which case they are listed in playback order and pixels holds a copy
+ * of the first one.
+ */
+struct BixlImage {
+    int dimension;
+    PixelBuffer pixels;
+    std::vector<Layer> layers;
+    std::vector<PixelBuffer> frames;
+    int fps;
+
+    BixlImage(int width = 0, int height = 0, int dimension = 0);
+    int width() const;
+    int height() const;
+};
+
+/**
+ * Reads and writes .bixl files.
+ *
+ * Version 1 is the original format: a 12 byte header of big-endian
+ * int32s (width, height, dimension) followed by four big-endian int32s
+ * (r, g, b, a) per bixel. Bixels are stored column by column, so bixel
+ * (x, y) is entry x * height + y.
+ *
+ * Version 2 starts with the magic "BIXL" and a version number. Bixels
+ * are packed as RGBA8 (or as 8 bit indices into a palette when the image
+ * has 256 colors or fewer) and stored in square tiles. Each tile is run
+ * length encoded on its own and located through an offset table, so a
+ * reader can decode any tile without touching the others.
+ *
+ *      offset  size    field
+ *      0       4       magic "BIXL"
+ *      4       2       version (2)
+ *      6       2       flags (FLAG_INDEXED)
+ *      8       4       width
+ *      12      4       height
+ *      16      4       dimension
+ *      20      2       tile size
+ *      22      2       palette size (0 unless FLAG_INDEXED)
+ *      24      4 * n   palette, RGBA8
+ *      ..      4 * t+1 tile offsets, relative to the start of tile data
+ *      ..      ..      tile data
+ *
+ * All v2 integers are little-endian. Tiles are ordered row by row and
+ * their bixels are stored row by row, clipped at the image edge. A tile
+ * is a sequence of runs, each introduced by a LEB128 varint
+ * ((count - 1) << 1 | repeat): a repeat run is followed by one value, a
+ * literal run by count values.
+ *
+ * Version 3 holds layers. Its header is the v2 header with the tile and
+ * palette size fields replaced by the layer count, followed by each
+ * layer, bottom first:
+ *
+ *      size    field
+ *      2       name length n
+ *      n       name, UTF-8
+ *      1       opacity
+ *      1       flags (LAYER_VISIBLE)
+ *      1       blend mode (Layer::BlendMode)
+ *      1       reserved (0)
+ *      4       size s of the layer's bixels
+ *      s       the layer's bixels as a complete v2 file
+ *
+ * Version 4 holds the frames of an animation. Its header is the v2
+ * header with the tile and palette size fields replaced by the number of
+ * frames and the frame rate, followed by one chunk per frame, in
+ * playback order:
+ *
+ *      size    field
+ *      4       size s of the frame's bixels
+ *      s       the frame's bixels as a complete v2 file
+ *
+ * Animations are written as v4, layered images as v3 and everything
+ * else as v2, so files without layers or frames still open in builds
+ * that predate them. An animation's frames have no layers.
+ */
+class BixlFile {
+    public:
+        enum Encoding { AUTO,       ///< Indexed if the image has <= 256 colors
+                        TRUECOLOR,  ///< Always store RGBA8 values
+                        INDEXED     ///< Indexed, falls back to TRUECOLOR if there are too many colors
+                      };
+
+        enum Flags { FLAG_INDEXED = 1 };
+        enum LayerFlags { LAYER_VISIBLE = 1 };
+
+        /**
+         * Reads the width x height bixels at (x, y) into out, packed row
+         * by row.
+         */
+        typedef std::function<void(int x, int y, int width, int height, Rgba* out)> RegionReader;
+
+        /**
+         * Fills pixels, already sized to the animation, with frame index.
+         */
+        typedef std::function<void(int index, PixelBuffer& pixels)> FrameReader;
+
+        static const int CURRENT_VERSION = 2;
+        static const int LAYERED_VERSION = 3;
+        static const int ANIMATED_VERSION = 4;
+        static const int V1_HEADER_SIZE = 12;
+        static const int V2_HEADER_SIZE = 24;
+        static const int DEFAULT_TILE_SIZE = 64;
+        static const int MAX_TILE_SIZE = 1024;
+        static const int MAX_PALETTE_SIZE = 256;
+        static const int MAX_FRAMES = 0xFFFF;
+
+        static bool read(const std::string& fileName, BixlImage& image);
+        static bool write(const std::string& fileName, const BixlImage& image,
+                          Encoding encoding = AUTO, int version = CURRENT_VERSION);
+
+        static bool writeTiled(const std::string& fileName, int width, int height, int dimension,
+                               const RegionReader& reader);
+        static bool writeFrames(const std::string& fileName, int width, int height, int dimension,
+                                int fps, int frameCount, const FrameReader& reader,
+                                Encoding encoding = AUTO);
+
+        static bool decode(const unsigned char* data, size_t size, BixlImage& image);
+        static void encode(const BixlImage& image, std::vector<unsigned char>& out,
+                           Encoding encoding = AUTO, int version = CURRENT_VERSION);
+
+        static int version(const unsigned char* data, size_t size);
+
+        static bool extractPalette(const BixlImage& image, std::vector<Rgba>& palette);
+
+        //-Shared with the lazy loaders-//
+        static uint32_t readLE32(const unsigned char* data);
+        static uint16_t readLE16(const unsigned char* data);
+        static uint32_t readBE32(const unsigned char* data);
+        static bool decodeRuns(const unsigned char* data, size_t size,
+                               bool indexed, const std::vector<Rgba>& palette,
+                               Rgba* out, size_t count);
+
+    private:
+        static void encodeRuns(const std::vector<uint32_t>& values, bool indexed,
+                               std::vector<unsigned char>& out);
+        static void encodeV1(const BixlImage& image, std::vector<unsigned char>& out);
+        static void encodeV2(const BixlImage& image, std::vector<unsigned char>& out,
+                             Encoding encoding);
+        static bool decodeV1(const unsigned char* data, size_t size, BixlImage& image);
+        static bool decodeV2(const unsigned char* data, size_t size, BixlImage& image);
+        static bool decodeTiles(const unsigned char* offsets, const unsigned char* tileData, size_t tileDataSize,
+                                int width, int height, int tileSize, bool indexed,
+                                const std::vector<Rgba>& palette, PixelBuffer* pixels);
+        static void encodeV3(const BixlImage& image, std::vector<unsigned char>& out,
+                             Encoding encoding);
+        static bool decodeV3(const unsigned char* data, size_t size, BixlImage& image);
+        static void appendV4Header(int width, int height, int dimension, int fps, int frameCount,
+                                   std::vector<unsigned char>& out);
+        static void appendFrame(const PixelBuffer& pixels, int dimension, Encoding encoding,
+                                std::vector<unsigned char>& out);
+        static void encodeV4(const BixlImage& image, std::vector<unsigned char>& out,
+                             Encoding encoding);
+        static bool decodeV4(const unsigned char* data, size_t size, BixlImage& image);
+};
+#endif
@@ -0,0 +1,442 @@
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#ifdef QT_CORE_LIB
+#include <QFile>
+#include <QString>
+#endif
+#include "canvasrenderer.hpp"
+#include "programcache.hpp"
+#include "tracer.hpp"
+
+#ifdef QT_CORE_LIB
+const char* const CanvasRenderer::VERTEX_SHADER = ":/shaders/screenShader.vert";
+const char* const CanvasRenderer::FRAGMENT_SHADER = ":/shaders/screenShader.frag";
+#else
+const char* const CanvasRenderer::VERTEX_SHADER = "res/shaders/screenShader.vert";
+const char* const CanvasRenderer::FRAGMENT_SHADER = "res/shaders/screenShader.frag";
+#endif
+
+CanvasRenderer::CanvasRenderer() :
+    m_program(0), m_pixelTexture(0), m_selectionTexture(0),
+    m_quadBuffer(0), m_vertexArray(0),
+    m_textureWidth(0), m_textureHeight(0), m_selectionWidth(0), m_selectionHeight(0),
+    m_mipsStale(true),
+    m_backgroundColor(packRgba(255, 255, 255)),
+    m_selectionColor(packRgba(77, 128, 255, 102)),
+    m_hoverColor(packRgba(255, 255, 255, 64)),
+    m_hoverX(-1), m_hoverY(-1) {}
+
+CanvasRenderer::~CanvasRenderer() {
+    release();
+}
+
+/**
+ * Compiles the canvas shaders and creates the quad and textures.
+ * Must be called with the target context current, e.g. from initializeGL.
+ *
+ * @return  false if GLEW could not be initialized or the shaders failed
+ *          to compile or link. Compiler output goes to Tracer::message.
+ */
+bool CanvasRenderer::initialize(const std::string& vertexSource, const std::string& fragmentSource) {
+    release();
+
+    glewExperimental = GL_TRUE;
+    if(glewInit() != GLEW_OK) {
+        Tracer::message("CanvasRenderer: glewInit failed");
+        return false;
+    }
+    glGetError();
+
+    m_program = ProgramCache::load(vertexSource, fragmentSource);
+    if(!m_program && !linkProgram(vertexSource, fragmentSource)) {
+        return false;
+    }
+
+    static const GLfloat corners[] = { -1, -1,   1, -1,   -1, 1,   1, 1 };
+    glGenVertexArrays(1, &m_vertexArray);
+    glBindVertexArray(m_vertexArray);
+    glGenBuffers(1, &m_quadBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, m_quadBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenTextures(1, &m_pixelTexture);
+    glGenTextures(1, &m_selectionTexture);
+    GLuint textures[] = { m_pixelTexture, m_selectionTexture };
+    for(int i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D, textures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+    glBindTexture(GL_TEXTURE_2D, m_pixelTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    uploadSelection(Selection(1, 1));
+    return true;
+}
+
+void CanvasRenderer::release() {
+    if(m_program) {
+        glDeleteProgram(m_program);
+    }
+    if(m_pixelTexture) {
+        glDeleteTextures(1, &m_pixelTexture);
+    }
+    if(m_selectionTexture) {
+        glDeleteTextures(1, &m_selectionTexture);
+    }
+    if(m_quadBuffer) {
+        glDeleteBuffers(1, &m_quadBuffer);
+    }
+    if(m_vertexArray) {
+        glDeleteVertexArrays(1, &m_vertexArray);
+    }
+    m_program = 0;
+    m_pixelTexture = 0;
+    m_selectionTexture = 0;
+    m_quadBuffer = 0;
+    m_vertexArray = 0;
+    m_textureWidth = 0;
+    m_textureHeight = 0;
+    m_selectionWidth = 0;
+    m_selectionHeight = 0;
+}
+
+bool CanvasRenderer::isInitialized() const {
+    return m_program != 0;
+}
+
+/**
+ * Uploads every bixel of pixels. The rows are read in place through
+ * GL_UNPACK_ROW_LENGTH; the texture is only reallocated when the canvas
+ * size changes.
+ */
+void CanvasRenderer::uploadPixels(const PixelBuffer& pixels) {
+    if(!m_program || pixels.isEmpty()) {
+        return;
+    }
+    glBindTexture(GL_TEXTURE_2D, m_pixelTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, pixels.stride());
+    if(pixels.width() != m_textureWidth || pixels.height() != m_textureHeight) {
+        // Only level 0 exists until paint() needs the mips.
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, pixels.width(), pixels.height(), 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        m_textureWidth = pixels.width();
+        m_textureHeight = pixels.height();
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, pixels.width(), pixels.height(),
+                        GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_mipsStale = true;
+}
+
+/**
+ * Uploads only the parts of pixels marked in its DirtyRegion, then
+ * clears the region. Falls back to a full upload if the canvas changed
+ * size or nothing was uploaded yet.
+ */
+void CanvasRenderer::uploadDirtyPixels(PixelBuffer& pixels) {
+    Tracer::Zone zone("upload_dirty_pixels");
+    if(!m_program || pixels.isEmpty()) {
+        return;
+    }
+    if(pixels.width() != m_textureWidth || pixels.height() != m_textureHeight) {
+        uploadPixels(pixels);
+        pixels.dirtyRegion().clear();
+        return;
+    }
+
+    std::vector<DirtyRegion::Rect> rects;
+    pixels.dirtyRegion().takeRects(rects);
+    if(rects.empty()) {
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, m_pixelTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, pixels.stride());
+    for(size_t i = 0; i < rects.size(); i++) {
+        const DirtyRegion::Rect& rect = rects[i];
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.width, rect.height,
+                        GL_RGBA, GL_UNSIGNED_BYTE, pixels.row(rect.y) + rect.x);
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_mipsStale = true;
+}
+
+/**
+ * Uploads the selection bitmask as-is, as 32 bit unsigned integers.
+ */
+void CanvasRenderer::uploadSelection(const Selection& selection) {
+    if(!m_program) {
+        return;
+    }
+    int width = selection.wordsPerRow() * 2;
+    int height = selection.height();
+    const void* words = selection.words();
+    static const uint32_t empty = 0;
+    if(width == 0 || height == 0) {
+        width = 1;
+        height = 1;
+        words = &empty;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, m_selectionTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    if(width != m_selectionWidth || height != m_selectionHeight) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0,
+                     GL_RED_INTEGER, GL_UNSIGNED_INT, words);
+        m_selectionWidth = width;
+        m_selectionHeight = height;
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height,
+                        GL_RED_INTEGER, GL_UNSIGNED_INT, words);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/**
+ * Uploads rows [y, y + height) of the selection bitmask, for selection
+ * changes confined to a few rows such as a rectangle drag.
+ */
+void CanvasRenderer::uploadSelectionRows(const Selection& selection, int y, int height) {
+    if(!m_program) {
+        return;
+    }
+    int width = selection.wordsPerRow() * 2;
+    if(width != m_selectionWidth || selection.height() != m_selectionHeight) {
+        uploadSelection(selection);
+        return;
+    }
+    y = std::max(0, y);
+    height = std::min(selection.height(), y + height) - y;
+    if(height <= 0) {
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, m_selectionTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, width, height, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                    selection.words() + (size_t) y * selection.wordsPerRow());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/**
+ * Sets the view transform used by paint(). Until a viewport with a
+ * nonzero view size is set the grid is stretched over the whole GL
+ * viewport.
+ */
+void CanvasRenderer::setViewport(const Viewport& viewport) {
+    m_viewport = viewport;
+}
+
+void CanvasRenderer::setBackgroundColor(Rgba color) {
+    m_backgroundColor = color;
+}
+
+/**
+ * The alpha of the selection and hover colors is how strongly they are
+ * mixed over the bixels underneath.
+ */
+void CanvasRenderer::setSelectionColor(Rgba color) {
+    m_selectionColor = color;
+}
+
+void CanvasRenderer::setHoverColor(Rgba color) {
+    m_hoverColor = color;
+}
+
+void CanvasRenderer::setHoverBixel(int x, int y) {
+    m_hoverX = x;
+    m_hoverY = y;
+}
+
+void CanvasRenderer::clearHoverBixel() {
+    m_hoverX = -1;
+    m_hoverY = -1;
+}
+
+/**
+ * Draws the canvas over the whole current viewport.
+ */
+void CanvasRenderer::paint() {
+    Tracer::Zone zone("draw_canvas");
+    if(!m_program || m_textureWidth == 0) {
+        return;
+    }
+
+    // The quad, in normalized device coordinates (left, bottom, right,
+    // top), and the grid area it shows (left, top, right, bottom).
+    float quad[4] = { -1, -1, 1, 1 };
+    float grid[4] = { 0, 0, (float) m_textureWidth, (float) m_textureHeight };
+    int level = 0;
+    const Viewport& view = m_viewport;
+    if(view.viewWidth() > 0 && view.viewHeight() > 0) {
+        int x, y, width, height;
+        if(!view.visibleRect(x, y, width, height)) {
+            return;
+        }
+        vec2 topLeft = view.toScreen(x, y);
+        vec2 bottomRight = view.toScreen(x + width, y + height);
+        topLeft.set(std::max(0.0, topLeft.x), std::max(0.0, topLeft.y));
+        bottomRight.set(std::min((double) view.viewWidth(), bottomRight.x),
+                        std::min((double) view.viewHeight(), bottomRight.y));
+        vec2 gridTopLeft = view.toGrid(topLeft.x, topLeft.y);
+        vec2 gridBottomRight = view.toGrid(bottomRight.x, bottomRight.y);
+
+        quad[0] = topLeft.x / view.viewWidth() * 2 - 1;
+        quad[1] = 1 - bottomRight.y / view.viewHeight() * 2;
+        quad[2] = bottomRight.x / view.viewWidth() * 2 - 1;
+        quad[3] = 1 - topLeft.y / view.viewHeight() * 2;
+        grid[0] = gridTopLeft.x;
+        grid[1] = gridTopLeft.y;
+        grid[2] = gridBottomRight.x;
+        grid[3] = gridBottomRight.y;
+        level = view.mipLevel();
+    }
+
+    int levels = (int) floor(log2((double) std::max(m_textureWidth, m_textureHeight)));
+    level = std::min(level, levels);
+    if(level > 0 && m_mipsStale) {
+        Tracer::Zone zone("generate_mipmaps");
+        glBindTexture(GL_TEXTURE_2D, m_pixelTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        m_mipsStale = false;
+    }
+
+    glUseProgram(m_program);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_pixelTexture);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_selectionTexture);
+
+    glUniform1i(glGetUniformLocation(m_program, "pixels"), 0);
+    glUniform1i(glGetUniformLocation(m_program, "selection"), 1);
+    glUniform2f(glGetUniformLocation(m_program, "gridSize"), m_textureWidth, m_textureHeight);
+    glUniform4fv(glGetUniformLocation(m_program, "quad"), 1, quad);
+    glUniform4fv(glGetUniformLocation(m_program, "gridRect"), 1, grid);
+    glUniform1f(glGetUniformLocation(m_program, "mipLevel"), level);
+    glUniform2i(glGetUniformLocation(m_program, "hoverBixel"), m_hoverX, m_hoverY);
+    setColorUniform(glGetUniformLocation(m_program, "backgroundColor"), m_backgroundColor);
+    setColorUniform(glGetUniformLocation(m_program, "selectionColor"), m_selectionColor);
+    setColorUniform(glGetUniformLocation(m_program, "hoverColor"), m_hoverColor);
+
+    glBindVertexArray(m_vertexArray);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindVertexArray(0);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram(0);
+}
+
+/**
+ * Reads a shader's source. With Qt, fileName may name a compiled-in
+ * resource such as ":/shaders/screenShader.vert".
+ */
+bool CanvasRenderer::readShaderFile(const std::string& fileName, std::string& source) {
+#ifdef QT_CORE_LIB
+    QFile file(QString::fromStdString(fileName));
+    if(!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QByteArray contents = file.readAll();
+    source.assign(contents.constData(), contents.size());
+    return true;
+#else
+    FILE* file = fopen(fileName.c_str(), "rb");
+    if(!file) {
+        return false;
+    }
+    source.clear();
+    char buffer[4096];
+    size_t count;
+    while((count = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        source.append(buffer, count);
+    }
+    fclose(file);
+    return true;
+#endif
+}
+
+//-Private-//
+
+/**
+ * Compiles and links the shaders into m_program, and stores the result
+ * in the ProgramCache for the next run.
+ */
+bool CanvasRenderer::linkProgram(const std::string& vertexSource, const std::string& fragmentSource) {
+    Tracer::Zone zone("link_program");
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    if(!vertexShader || !fragmentShader) {
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+        return false;
+    }
+
+    m_program = glCreateProgram();
+    glAttachShader(m_program, vertexShader);
+    glAttachShader(m_program, fragmentShader);
+    glBindAttribLocation(m_program, 0, "screenCorner");
+    ProgramCache::prepare(m_program);
+    glLinkProgram(m_program);
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(m_program, GL_LINK_STATUS, &linked);
+    if(!linked) {
+        char log[1024];
+        glGetProgramInfoLog(m_program, sizeof(log), 0, log);
+        Tracer::message("CanvasRenderer: link failed: %s", log);
+        release();
+        return false;
+    }
+    ProgramCache::store(m_program, vertexSource, fragmentSource);
+    return true;
+}
+
+GLuint CanvasRenderer::compileShader(GLenum type, const std::string& source) {
+    GLuint shader = glCreateShader(type);
+    const GLchar* text = source.c_str();
+    glShaderSource(shader, 1, &text, 0);
+    glCompileShader(shader);
+
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if(!compiled) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), 0, log);
+        Tracer::message("CanvasRenderer: compile failed: %s", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+void CanvasRenderer::setColorUniform(GLint location, Rgba color) {
+    glUniform4f(location, rgbaRed(color) / 255.0f, rgbaGreen(color) / 255.0f,
+                rgbaBlue(color) / 255.0f, rgbaAlpha(color) / 255.0f);
+}
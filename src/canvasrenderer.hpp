@@ -0,0 +1,83 @@
+#ifndef CANVASRENDERER_HPP
+#define CANVASRENDERER_HPP
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "selection.hpp"
+#include "viewport.hpp"
+
+/**
+ * Draws the whole canvas with one textured quad.
+ *
+ * The bixels live in an RGBA8 texture uploaded straight from the
+ * PixelBuffer rows, and the selection bitmask in an R32UI texture that
+ * the fragment shader tests bit by bit, so a frame is one draw call and
+ * a handful of uniforms no matter how many bixels there are. Hover and
+ * selection highlights are shader overlays rather than extra geometry.
+ *
+ * With a Viewport set, the quad covers only the part of the view where
+ * grid bixels are visible, so zooming in never shades bixels off
+ * screen. Zoomed out views sample a mip level of the bixel texture that
+ * is regenerated on demand after uploads, instead of aliasing level 0.
+ *
+ * The renderer only needs a current OpenGL 3.0 context; it does not
+ * depend on QGLWidget, so it runs just as well in an offscreen (e.g.
+ * Mesa llvmpipe) context as inside BixelGrid::paintGL.
+ */
+class CanvasRenderer {
+    public:
+        CanvasRenderer();
+        ~CanvasRenderer();
+
+        bool initialize(const std::string& vertexSource, const std::string& fragmentSource);
+        void release();
+        bool isInitialized() const;
+
+        void uploadPixels(const PixelBuffer& pixels);
+        void uploadDirtyPixels(PixelBuffer& pixels);
+        void uploadSelection(const Selection& selection);
+        void uploadSelectionRows(const Selection& selection, int y, int height);
+
+        void setViewport(const Viewport& viewport);
+        void setBackgroundColor(Rgba color);
+        void setSelectionColor(Rgba color);
+        void setHoverColor(Rgba color);
+        void setHoverBixel(int x, int y);
+        void clearHoverBixel();
+
+        void paint();
+
+        static const char* const VERTEX_SHADER;
+        static const char* const FRAGMENT_SHADER;
+
+        static bool readShaderFile(const std::string& fileName, std::string& source);
+
+    private:
+        CanvasRenderer(const CanvasRenderer&);
+        CanvasRenderer& operator=(const CanvasRenderer&);
+
+        bool linkProgram(const std::string& vertexSource, const std::string& fragmentSource);
+        static GLuint compileShader(GLenum type, const std::string& source);
+        static void setColorUniform(GLint location, Rgba color);
+
+        GLuint m_program;
+        GLuint m_pixelTexture;
+        GLuint m_selectionTexture;
+        GLuint m_quadBuffer;
+        GLuint m_vertexArray;
+        int m_textureWidth;
+        int m_textureHeight;
+        int m_selectionWidth;
+        int m_selectionHeight;
+        bool m_mipsStale;
+        Viewport m_viewport;
+
+        Rgba m_backgroundColor;
+        Rgba m_selectionColor;
+        Rgba m_hoverColor;
+        int m_hoverX;
+        int m_hoverY;
+};
+#endif
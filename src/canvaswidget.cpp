@@ -1,13 +1,32 @@
 #pragma GCC diagnostic ignored "-Wswitch"
 #include <string>
 #include <stdlib.h>
+#include <math.h>
 #include <sstream>
+#include <memory>
+#include <QDir>
 #include "canvaswidget.hpp"
 #include "bixelwindow.hpp"
+#include "bixlfile.hpp"
+#include "clipmimedata.hpp"
+#include "rgba.hpp"
+#include "tracer.hpp"
 
 //-Public-//
-CanvasWidget::CanvasWidget(QWidget* parent) : QWidget(parent), zoom(1.0), clickPosition(0, 0), m_fileName("") {
-    CanvasWidget::openGLWidget = new BixelGrid(this); 
+namespace {
+    // Zoom factor of one zoom in/out step, one wheel notch or one click
+    // of the zoom tool.
+    const double ZOOM_STEP = 1.4142135623730951;
+
+    // Fraction of the remaining zoom, in log scale, covered per frame of
+    // a smooth zoom.
+    const double ZOOM_EASING = 0.35;
+};
+
+CanvasWidget::CanvasWidget(QWidget* parent) : QWidget(parent), m_zoomTarget(1), clickPosition(0, 0), m_fileName(""),
+                                              m_editGeneration(0), m_autosavedGeneration(0), m_nextSaveId(0),
+                                              m_quantizer(&m_pool), m_importer(&m_pool), m_loader(0), m_painted(false) {
+    CanvasWidget::openGLWidget = new BixelGrid(this, &m_pool);
     openGLWidget->installEventFilter(this);
     QObject::connect(&colorPicker, SIGNAL(currentColorChanged(QColor)), this, SLOT(setCurrentColor(QColor)));
     setCurrentColor(QColor(128, 200, 128));
@@ -16,27 +35,96 @@ CanvasWidget::CanvasWidget(QWidget* parent) : QWidget(parent), zoom(1.0), clickP
     mainWindow = window();
 
     QObject::connect(openGLWidget, SIGNAL(stateChanged()), this, SIGNAL(stateChanged()));
+    QObject::connect(openGLWidget, SIGNAL(stateChanged()), this, SLOT(countEdit()));
+    QObject::connect(openGLWidget, SIGNAL(colorPicked(QColor)), this, SLOT(setCurrentColor(QColor)));
+    QObject::connect(openGLWidget, SIGNAL(loadFinished()), this, SLOT(updatePalette()));
+    QObject::connect(openGLWidget, SIGNAL(sessionLeft()), this, SIGNAL(sessionLeft()));
+
+    //Saves finish on the saver's thread; the queued connection brings
+    //the result back to this one.
+    m_saver.setCallback([this](const std::string& fileName, bool success, int id) {
+        emit saveWritten(QString::fromStdString(fileName), success, id);
+    });
+    QObject::connect(this, SIGNAL(saveWritten(QString, bool, int)),
+                     this, SLOT(finishSave(QString, bool, int)), Qt::QueuedConnection);
+    QObject::connect(&m_autosaveTimer, SIGNAL(timeout()), this, SLOT(autosave()));
+    m_autosaveTimer.start(AUTOSAVE_INTERVAL);
+    QObject::connect(&m_zoomTimer, SIGNAL(timeout()), this, SLOT(stepZoom()));
+    QObject::connect(this, SIGNAL(documentLoaded(QString)), this, SLOT(finishPreload(QString)), Qt::QueuedConnection);
 
     //Handling menu actions//
     QObject::connect(mainWindow, SIGNAL(deselect_all_signal()), this, SLOT(deselectAll()));
     QObject::connect(mainWindow, SIGNAL(select_all_signal()), this, SLOT(selectAll()));
     QObject::connect(mainWindow, SIGNAL(zoom_in_signal()), this, SLOT(zoomIn()));
     QObject::connect(mainWindow, SIGNAL(zoom_out_signal()), this, SLOT(zoomOut()));
+    QObject::connect(mainWindow, SIGNAL(custom_zoom_signal(double)), this, SLOT(setZoomPercent(double)));
+    QObject::connect(mainWindow, SIGNAL(reset_view_signal()), this, SLOT(resetView()));
     QObject::connect(mainWindow, SIGNAL(undo_signal()), this, SLOT(undo()));
     QObject::connect(mainWindow, SIGNAL(redo_signal()), this, SLOT(redo()));
+    QObject::connect(mainWindow, SIGNAL(copy_signal()), this, SLOT(copy()));
+    QObject::connect(mainWindow, SIGNAL(cut_signal()), this, SLOT(cut()));
+    QObject::connect(mainWindow, SIGNAL(paste_signal()), this, SLOT(paste()));
+    QObject::connect(mainWindow, SIGNAL(filter_signal(std::string)), this, SLOT(applyFilter(std::string)));
+    QObject::connect(mainWindow, SIGNAL(dither_signal()), this, SLOT(ditherToSwatches()));
+    QObject::connect(mainWindow, SIGNAL(increase_dimension_signal()), this, SLOT(increaseDimension()));
+    QObject::connect(mainWindow, SIGNAL(decrease_dimension_signal()), this, SLOT(decreaseDimension()));
+    QObject::connect(mainWindow, SIGNAL(rotate_clockwise_signal()), this, SLOT(rotateClockwise()));
+    QObject::connect(mainWindow, SIGNAL(rotate_half_signal()), this, SLOT(rotateHalf()));
+    QObject::connect(mainWindow, SIGNAL(rotate_counterclockwise_signal()), this, SLOT(rotateCounterclockwise()));
+    QObject::connect(mainWindow, SIGNAL(flip_horizontal_signal()), this, SLOT(flipHorizontal()));
+    QObject::connect(mainWindow, SIGNAL(flip_vertical_signal()), this, SLOT(flipVertical()));
+    QObject::connect(mainWindow, SIGNAL(scale_up_signal()), this, SLOT(scaleUp()));
+    QObject::connect(mainWindow, SIGNAL(mirror_horizontal_signal(bool)), this, SLOT(mirrorHorizontal(bool)));
+    QObject::connect(mainWindow, SIGNAL(mirror_vertical_signal(bool)), this, SLOT(mirrorVertical(bool)));
+    QObject::connect(mainWindow, SIGNAL(join_session_signal(std::string)), this, SLOT(joinSession(std::string)));
+    QObject::connect(mainWindow, SIGNAL(leave_session_signal()), this, SLOT(leaveSession()));
     QObject::connect(mainWindow, SIGNAL(open_signal(std::string)), this, SLOT(open(std::string)));
+    QObject::connect(mainWindow, SIGNAL(import_image_signal(std::string, int, int, bool)),
+                     this, SLOT(importImage(std::string, int, int, bool)));
     QObject::connect(mainWindow, SIGNAL(save_as_signal(std::string)), this, SLOT(saveAs(std::string)));
     QObject::connect(mainWindow, SIGNAL(export_image_signal(std::string)), this, SLOT(exportPNG(std::string)));
+    QObject::connect(this, SIGNAL(saveFinished(QString, bool, bool)), mainWindow, SLOT(saveFinished(QString, bool, bool)));
+    QObject::connect(this, SIGNAL(importFinished(QString, bool)), mainWindow, SLOT(importFinished(QString, bool)));
+    QObject::connect(this, SIGNAL(sessionJoined(QString, bool)), mainWindow, SLOT(sessionJoined(QString, bool)));
+    QObject::connect(this, SIGNAL(sessionLeft()), mainWindow, SLOT(sessionLeft()));
 }
 
 CanvasWidget::~CanvasWidget() {
+    //Let saves in flight finish, but not report back to a dead widget.
+    if(m_loader) {
+        m_loader->setCallback(DocumentLoader::Callback());
+    }
+    m_saver.setCallback(BackgroundSaver::Callback());
+    m_saver.waitForIdle();
     delete openGLWidget;
 }
 
+/**
+ * Lets open() use a document the loader started decoding before the
+ * widget existed. Opening a file that is still being decoded finishes
+ * once it is done, without blocking the event loop.
+ */
+void CanvasWidget::setDocumentLoader(DocumentLoader* loader) {
+    m_loader = loader;
+    if(m_loader) {
+        m_loader->setCallback([this](const std::string& fileName) {
+            emit documentLoaded(QString::fromStdString(fileName));
+        });
+    }
+}
+
 int CanvasWidget::getCurrentTool() {
     return currentTool;
 }
 
+/**
+ * The view transform the grid is drawn with. The GL widget always fills
+ * this widget; zoom and pan only change the transform.
+ */
+const Viewport& CanvasWidget::viewport() const {
+    return m_viewport;
+}
+
 //-Public Slots-//
 
 /**
@@ -60,7 +148,6 @@ void CanvasWidget::changeTool(int tool) {
 }
 
 void CanvasWidget::openColorPicker() {
-    fprintf(stderr, "Color Picker Open\n");
     colorPicker.setCurrentColor(currentColor);
     colorPicker.open();
 }
@@ -89,7 +176,12 @@ void CanvasWidget::setCurrentColor(const QColor& color) {
 }
 
 void CanvasWidget::deselectAll() {
-    openGLWidget->deselectAll();
+    //Esc reaches this shortcut before the grid, so it cancels a floating paste here
+    if(openGLWidget->isPasting()) {
+        openGLWidget->cancelPaste();
+    } else {
+        openGLWidget->deselectAll();
+    }
 }
 
 void CanvasWidget::selectAll() {
@@ -97,31 +189,37 @@ void CanvasWidget::selectAll() {
 }
 
 void CanvasWidget::zoomIn() {
-    zoom += 0.1;
-    updateSize();
+    animateZoom(ZOOM_STEP, width() * 0.5, height() * 0.5);
 }
 
 void CanvasWidget::zoomOut() {
-    if(zoom > 0.1) {
-        zoom -= 0.1;
-    }
-    updateSize();
+    animateZoom(1 / ZOOM_STEP, width() * 0.5, height() * 0.5);
 }
 
-//Called directly by resizeEvent
-void CanvasWidget::updateSize() {
-    //QMargins margins = contentsMargins();
-
-    //int maxMargin = std::max(std::max(std::max(margins.left(), margins.right()), margins.top()), margins.bottom());
+/**
+ * @param percent   100 shows one bixel per screen pixel.
+ */
+void CanvasWidget::setZoomPercent(double percent) {
+    m_zoomTimer.stop();
+    m_viewport.setZoom(percent / 100);
+    updateView();
+}
 
-    if(this->width() > this->height()) {
-        openGLWidget->resize(zoom * (this->height()), zoom * (this->height()));
-    } else {
-        openGLWidget->resize(zoom * (this->width()), zoom * (this->width()));
-    }
+/**
+ * Fits the whole grid in the view, centered.
+ */
+void CanvasWidget::resetView() {
+    m_zoomTimer.stop();
+    m_viewport.fit();
+    updateView();
+}
 
-    openGLWidget->move(this->width() * 0.5 - openGLWidget->width() * 0.5,
-                       this->height() * 0.5 - openGLWidget->height() * 0.5);
+//Called directly by resizeEvent. The GL widget always fills this one;
+//zoom and pan are left to the viewport.
+void CanvasWidget::updateSize() {
+    openGLWidget->setGeometry(0, 0, width(), height());
+    m_viewport.setViewSize(width(), height());
+    updateView();
 }
 
 void CanvasWidget::undo() {
@@ -132,13 +230,220 @@ void CanvasWidget::redo() {
     openGLWidget->redo();
 }
 
+/**
+ * Copies the selected bixels to the clipboard, where other applications
+ * find them as an image.
+ */
+void CanvasWidget::copy() {
+    const Selection& selection = openGLWidget->selection();
+    if(selection.isEmpty()) {
+        return;
+    }
+    m_clipboard.copy(openGLWidget->pixels(), selection);
+    ClipMimeData::publish(m_clipboard.clip());
+}
+
+/**
+ * Copies the selected bixels and clears them, as one undo step.
+ */
+void CanvasWidget::cut() {
+    const Selection& selection = openGLWidget->selection();
+    if(selection.isEmpty()) {
+        return;
+    }
+    openGLWidget->commitPaste();
+    m_clipboard.cut(openGLWidget->pixels(), selection, &openGLWidget->history());
+    ClipMimeData::publish(m_clipboard.clip());
+    openGLWidget->showEdit();
+}
+
+/**
+ * Floats the clipboard where it was copied from, until it is committed
+ * in the grid. Images copied in other applications land in the top left
+ * corner.
+ */
+void CanvasWidget::paste() {
+    std::shared_ptr<const Clip> clip = ClipMimeData::fetch();
+    if(!clip) {
+        clip = m_clipboard.clip();
+    }
+    if(!clip) {
+        return;
+    }
+    openGLWidget->beginPaste(clip, clip->x(), clip->y());
+}
+
+/**
+ * Runs a filter written as for FilterPipeline::Filter::parse() over the
+ * selection, or the whole canvas when nothing is selected.
+ */
+bool CanvasWidget::applyFilter(std::string spec) {
+    FilterPipeline::Filter filter;
+    if(!FilterPipeline::Filter::parse(spec, filter)) {
+        return false;
+    }
+    return runFilter(filter);
+}
+
+/**
+ * Dithers the canvas to the colors of the swatch bar.
+ */
+void CanvasWidget::ditherToSwatches() {
+    std::vector<Rgba> palette;
+    for(int i = 0; i < m_swatches.size(); i++) {
+        QRgb color = m_swatches[i];
+        palette.push_back(packRgba(qRed(color), qGreen(color), qBlue(color), qAlpha(color)));
+    }
+    if(!palette.empty()) {
+        runFilter(FilterPipeline::Filter::dither(palette));
+    }
+}
+
+void CanvasWidget::increaseDimension() {
+    openGLWidget->increaseDimension();
+}
+
+void CanvasWidget::decreaseDimension() {
+    openGLWidget->decreaseDimension();
+}
+
+/**
+ * Turns the selection, or the whole canvas when nothing is selected.
+ * @see BixelGrid::transform()
+ */
+void CanvasWidget::rotateClockwise() {
+    openGLWidget->transform(TransformEngine::ROTATE_90);
+}
+
+void CanvasWidget::rotateHalf() {
+    openGLWidget->transform(TransformEngine::ROTATE_180);
+}
+
+void CanvasWidget::rotateCounterclockwise() {
+    openGLWidget->transform(TransformEngine::ROTATE_270);
+}
+
+void CanvasWidget::flipHorizontal() {
+    openGLWidget->transform(TransformEngine::FLIP_HORIZONTAL);
+}
+
+void CanvasWidget::flipVertical() {
+    openGLWidget->transform(TransformEngine::FLIP_VERTICAL);
+}
+
+void CanvasWidget::scaleUp() {
+    openGLWidget->scale(2);
+}
+
+/**
+ * Reflects brush and eraser strokes left to right across the middle of
+ * the canvas while on.
+ */
+void CanvasWidget::mirrorHorizontal(bool on) {
+    int mirror = openGLWidget->mirror();
+    openGLWidget->setMirror(on ? mirror | StrokeEngine::MIRROR_HORIZONTAL : mirror & ~StrokeEngine::MIRROR_HORIZONTAL);
+}
+
+/**
+ * Reflects brush and eraser strokes top to bottom across the middle of
+ * the canvas while on.
+ */
+void CanvasWidget::mirrorVertical(bool on) {
+    int mirror = openGLWidget->mirror();
+    openGLWidget->setMirror(on ? mirror | StrokeEngine::MIRROR_VERTICAL : mirror & ~StrokeEngine::MIRROR_VERTICAL);
+}
+
+/**
+ * Shares the canvas with the peers of the relay at socketPath.
+ * @see BixelGrid::joinSession()
+ */
+void CanvasWidget::joinSession(std::string socketPath) {
+    bool success = openGLWidget->joinSession(socketPath);
+    emit sessionJoined(QString::fromStdString(socketPath), success);
+}
+
+void CanvasWidget::leaveSession() {
+    openGLWidget->leaveSession();
+}
+
 bool CanvasWidget::open(std::string fileName) {
-    return openGLWidget->openFile(fileName);
+    if(m_loader && m_loader->isLoading(fileName)) {
+        //Opened for real from finishPreload()
+        m_pendingFileName = fileName;
+        m_fileName = fileName;
+        return true;
+    }
+    //A copy decoded by the loader is opened as it is, without reading the file again
+    BixlImage preloaded;
+    if(m_loader && m_loader->take(fileName, preloaded)) {
+        openGLWidget->openImage(preloaded);
+    } else if(!openGLWidget->openFile(fileName)) {
+        return false;
+    }
+    m_fileName = fileName;
+    m_autosavedGeneration = m_editGeneration;
+    updateView();
+    return true;
 }
 
+/**
+ * Replaces the canvas with an image file resampled to width x height,
+ * as a new untitled document. The import is one undo step.
+ *
+ * @param useSwatches   Reduce the image to the colors of the swatch bar.
+ * @see ImageImporter
+ */
+bool CanvasWidget::importImage(std::string fileName, int width, int height, bool useSwatches) {
+    //Imported images are opaque, whatever alpha the swatches carry
+    std::vector<Rgba> palette;
+    for(int i = 0; useSwatches && i < m_swatches.size(); i++) {
+        QRgb color = m_swatches[i];
+        palette.push_back(packRgba(qRed(color), qGreen(color), qBlue(color)));
+    }
+    PixelBuffer pixels(width, height);
+    if(!m_importer.import(fileName, width, height, pixels, palette)) {
+        emit importFinished(QString::fromStdString(fileName), false);
+        return false;
+    }
+    openGLWidget->replacePixels(pixels);
+    m_fileName = "";
+    updateView();
+    emit paletteChanged(documentPalette());
+    emit importFinished(QString::fromStdString(fileName), true);
+    return true;
+}
+
+/**
+ * The colors of the swatch bar, for importing with useSwatches.
+ */
+void CanvasWidget::setSwatches(const QVector<QRgb>& colors) {
+    m_swatches = colors;
+}
+
+/**
+ * Saves the canvas to fileName without blocking. The bixels are copied
+ * now, so editing can go on while the copy is encoded and written on
+ * the saver's thread. saveFinished() is emitted when the file is on
+ * disk.
+ *
+ * @see BackgroundSaver
+ */
 void CanvasWidget::saveAs(std::string fileName) {
+    std::string obsoleteAutosave = autosaveFileName();
     m_fileName = fileName;
-    openGLWidget->saveFile(fileName);
+    startSave(fileName, false, obsoleteAutosave);
+}
+
+/**
+ * Saves a copy of the canvas beside the current file (or in the temp
+ * directory for an unsaved canvas) if it changed since the last save
+ * or autosave. Skipped while another save is still being written.
+ */
+void CanvasWidget::autosave() {
+    if(m_editGeneration == m_autosavedGeneration || m_saver.isBusy()) {
+        return;
+    }
+    startSave(autosaveFileName(), true, "");
 }
 
 void CanvasWidget::exportPNG(const std::string& fileName) {
@@ -162,6 +467,12 @@ void CanvasWidget::mousePressEvent(QMouseEvent* event) {
         case BixelGrid::HAND:
             clickPosition.set(event->globalX(), event->globalY());
         break;
+
+        case BixelGrid::ZOOM: {
+            bool out = event->button() == Qt::RightButton || (event->modifiers() & Qt::ShiftModifier);
+            animateZoom(out ? 1 / ZOOM_STEP : ZOOM_STEP, event->x(), event->y());
+        }
+        break;
     }
 }
 
@@ -169,30 +480,207 @@ void CanvasWidget::mouseReleaseEvent(QMouseEvent* ) {}
 
 void CanvasWidget::mouseMoveEvent(QMouseEvent* event) {
     switch(currentTool) {
-        case BixelGrid::HAND:
+        case BixelGrid::HAND: {
             vec2 change = vec2(event->globalX(), event->globalY()) - clickPosition;
-            CanvasWidget::openGLWidget->move(openGLWidget->x() + change.x, openGLWidget->y() + change.y);
+            m_viewport.panBy(change.x, change.y);
             clickPosition.set(event->globalX(), event->globalY());
+            updateView();
+        }
         break;
     }
 }
 
+/**
+ * Zooms around the cursor, one ZOOM_STEP per wheel notch. Touchpads
+ * send fractions of a notch and zoom by fractions of a step.
+ */
+void CanvasWidget::wheelEvent(QWheelEvent* event) {
+    double notches = event->angleDelta().y() / 120.0;
+    if(notches != 0) {
+        animateZoom(pow(ZOOM_STEP, notches), event->x(), event->y());
+    }
+}
+
+//-Private Slots-//
+
+/**
+ * Counts an edit made in the grid, for autosave. Loading a document
+ * into the grid is not an edit. Imports and their undo change the
+ * grid's size, which refits the view.
+ */
+void CanvasWidget::countEdit() {
+    m_editGeneration++;
+    if(openGLWidget->gridWidth() != m_viewport.gridWidth() || openGLWidget->gridHeight() != m_viewport.gridHeight()) {
+        updateView();
+    }
+}
+
+/**
+ * @param id    The PendingSave the result is for. Whether it was an
+ *              autosave is decided by what was asked for, not by the
+ *              file name, which may have changed since.
+ */
+void CanvasWidget::finishSave(const QString& fileName, bool success, int id) {
+    std::map<int, PendingSave>::iterator found = m_pendingSaves.find(id);
+    if(found == m_pendingSaves.end()) {
+        return;
+    }
+    PendingSave save = found->second;
+    // Saves finish in request order; earlier ones of the same file that
+    // have not reported were replaced in the saver's queue.
+    for(std::map<int, PendingSave>::iterator i = m_pendingSaves.begin(); i != found;) {
+        if(i->second.fileName == save.fileName) {
+            i = m_pendingSaves.erase(i);
+        } else {
+            ++i;
+        }
+    }
+    m_pendingSaves.erase(found);
+
+    if(save.autosave) {
+        if(success) {
+            m_autosavedGeneration = save.generation;
+        } else {
+            Tracer::message("Autosave to %s failed", save.fileName.c_str());
+        }
+        return;
+    }
+
+    if(success) {
+        m_autosavedGeneration = save.generation;
+        remove(save.obsoleteAutosave.c_str());
+    }
+    emit saveFinished(fileName, success, save.generation == m_editGeneration);
+}
+
+/**
+ * Offers the colors of a document the grid has finished loading to the
+ * swatch bar. Large documents finish after their first frame is up.
+ */
+void CanvasWidget::updatePalette() {
+    emit paletteChanged(documentPalette());
+}
+
+/**
+ * Opens a document the loader has finished decoding, if open() was
+ * asked for it meanwhile.
+ */
+void CanvasWidget::finishPreload(const QString& fileName) {
+    if(m_pendingFileName == fileName.toStdString()) {
+        m_pendingFileName.clear();
+        open(fileName.toStdString());
+    }
+}
+
+/**
+ * Moves one frame of the way towards the zoom target, in log scale, so
+ * a zoom eases out over a few frames.
+ */
+void CanvasWidget::stepZoom() {
+    double remaining = m_zoomTarget / m_viewport.zoom();
+    if(fabs(log(remaining)) < 0.01) {
+        m_zoomTimer.stop();
+    } else {
+        remaining = pow(remaining, ZOOM_EASING);
+    }
+    m_viewport.zoomAt(remaining, m_zoomAnchor.x, m_zoomAnchor.y);
+    updateView();
+}
+
 //-Private-//
 
+/**
+ * Starts a smooth zoom by factor around (x, y). A zoom already under
+ * way continues from its target, so quick wheel turns add up.
+ */
+void CanvasWidget::animateZoom(double factor, double x, double y) {
+    double start = m_zoomTimer.isActive() ? m_zoomTarget : m_viewport.zoom();
+    m_zoomTarget = std::max(Viewport::minZoom(), std::min(Viewport::maxZoom(), start * factor));
+    m_zoomAnchor.set(x, y);
+    if(!m_zoomTimer.isActive()) {
+        m_zoomTimer.start(ZOOM_FRAME_INTERVAL);
+    }
+}
+
+/**
+ * Hands the grid the current view transform, fitted to the grid again
+ * if the grid changed size.
+ */
+void CanvasWidget::updateView() {
+    m_viewport.setGridSize(openGLWidget->gridWidth(), openGLWidget->gridHeight());
+    openGLWidget->setViewport(m_viewport);
+    emit viewChanged();
+}
+
+/**
+ * Queues a save of a snapshot of the canvas, remembering what it was for
+ * until finishSave() hears back. Only taking the snapshot happens here;
+ * encoding and writing it happen on the saver's thread.
+ */
+void CanvasWidget::startSave(const std::string& fileName, bool autosave, const std::string& obsoleteAutosave) {
+    PendingSave save = { fileName, m_editGeneration, autosave, obsoleteAutosave };
+    int id = m_nextSaveId++;
+    m_pendingSaves[id] = save;
+    m_saver.save(fileName, openGLWidget->snapshotWriter(), id);
+}
+
+/**
+ * The colors of the open document for the swatch bar: its own colors if
+ * it has at most PALETTE_SWATCHES of them, otherwise that many picked
+ * by the quantizer from the grid's bixels. Transparency is left out.
+ */
+QVector<QRgb> CanvasWidget::documentPalette() {
+    std::vector<Rgba> palette = m_quantizer.extractPalette(openGLWidget->flattened(), PALETTE_SWATCHES + 1);
+    QVector<QRgb> swatches;
+    for(size_t i = 0; i < palette.size() && swatches.size() < PALETTE_SWATCHES; i++) {
+        if(rgbaAlpha(palette[i]) != 0) {
+            swatches.append(qRgba(rgbaRed(palette[i]), rgbaGreen(palette[i]),
+                                  rgbaBlue(palette[i]), rgbaAlpha(palette[i])));
+        }
+    }
+    return swatches;
+}
+
+std::string CanvasWidget::autosaveFileName() const {
+    if(m_fileName.empty()) {
+        return QDir::temp().filePath("untitled.bixl.autosave").toStdString();
+    }
+    return m_fileName + ".autosave";
+}
+
 bool CanvasWidget::eventFilter(QObject*, QEvent* event) {
     //-Maybe check if object is child of this class later-//
     switch(event->type()) {
-        case QEvent::MouseButtonPress:
+        case QEvent::MouseButtonPress: {
+            Tracer::Zone zone("mouse_press");
             mousePressEvent((QMouseEvent*) event);
+        }
         break;
 
-        case QEvent::MouseMove:
+        case QEvent::MouseMove: {
+            Tracer::Zone zone("mouse_move");
             mouseMoveEvent((QMouseEvent*) event);
+        }
         break;
 
-        case QEvent::MouseButtonRelease:
+        case QEvent::MouseButtonRelease: {
+            Tracer::Zone zone("mouse_release");
             mouseReleaseEvent((QMouseEvent*) event);
+        }
         break;
+
+        //Signalled once the first frame is on screen and events flow
+        case QEvent::Paint:
+            if(!m_painted) {
+                m_painted = true;
+                QTimer::singleShot(0, this, SIGNAL(firstFramePainted()));
+            }
+        break;
+
+        //Handled here only, or it would reach wheelEvent again through this widget
+        case QEvent::Wheel:
+            wheelEvent((QWheelEvent*) event);
+        return true;
     }
     return false;
 }
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <map>
 #include <QWidget>
 #include <QResizeEvent>
 #include <QString>
@@ -13,10 +14,23 @@
 #include <QMargins>
 #include <QAbstractButton>
 #include <QMouseEvent>
+#include <QWheelEvent>
 #include <QColorDialog>
 #include <QColor>
+#include <QTimer>
+#include <QVector>
 #include "bixelgrid.hpp"
 #include "vec2.hpp"
+#include "backgroundsaver.hpp"
+#include "bixlfile.hpp"
+#include "selection.hpp"
+#include "clipboard.hpp"
+#include "filterpipeline.hpp"
+#include "quantizer.hpp"
+#include "imageimporter.hpp"
+#include "threadpool.hpp"
+#include "documentloader.hpp"
+#include "viewport.hpp"
 
 class CanvasWidget : public QWidget {
     Q_OBJECT
@@ -25,6 +39,8 @@ class CanvasWidget : public QWidget {
         CanvasWidget(QWidget* parent = 0);
         ~CanvasWidget();
         int getCurrentTool();
+        const Viewport& viewport() const;
+        void setDocumentLoader(DocumentLoader* loader);
 
     public slots:
         void changeTool(int tool);
@@ -35,15 +51,46 @@ class CanvasWidget : public QWidget {
         void selectAll();
         void zoomIn();
         void zoomOut();
+        void setZoomPercent(double percent);
+        void resetView();
         void updateSize();
         void undo();
         void redo();
+        void copy();
+        void cut();
+        void paste();
+        bool applyFilter(std::string spec);
+        void ditherToSwatches();
+        void increaseDimension();
+        void decreaseDimension();
+        void rotateClockwise();
+        void rotateHalf();
+        void rotateCounterclockwise();
+        void flipHorizontal();
+        void flipVertical();
+        void scaleUp();
+        void mirrorHorizontal(bool on);
+        void mirrorVertical(bool on);
+        void joinSession(std::string socketPath);
+        void leaveSession();
         bool open(std::string fileName);
+        bool importImage(std::string fileName, int width, int height, bool useSwatches);
+        void setSwatches(const QVector<QRgb>& colors);
         void saveAs(std::string fileName);
+        void autosave();
         void exportPNG(const std::string& fileName);
     signals:
         void colorChanged(const QString& styleSheet);
         void stateChanged();
+        void saveFinished(const QString& fileName, bool success, bool upToDate);
+        void saveWritten(const QString& fileName, bool success, int id);
+        void importFinished(const QString& fileName, bool success);
+        void sessionJoined(const QString& socketPath, bool success);
+        void sessionLeft();
+        void paletteChanged(const QVector<QRgb>& colors);
+        void viewChanged();
+        void documentLoaded(const QString& fileName);
+        void firstFramePainted();
 
     protected:
         void resizeEvent(QResizeEvent* event);
@@ -51,17 +98,62 @@ class CanvasWidget : public QWidget {
         void mousePressEvent(QMouseEvent* event);
         void mouseReleaseEvent(QMouseEvent* event);
         void mouseMoveEvent(QMouseEvent* event);
+        void wheelEvent(QWheelEvent* event);
+
+    private slots:
+        void countEdit();
+        void finishSave(const QString& fileName, bool success, int id);
+        void stepZoom();
+        void finishPreload(const QString& fileName);
+        void updatePalette();
 
     private:
+        static const int AUTOSAVE_INTERVAL = 60 * 1000;
+        static const int PALETTE_SWATCHES = 16;
+        static const int ZOOM_FRAME_INTERVAL = 16;
+
+        /**
+         * A save handed to m_saver, looked up by the id it reports back.
+         */
+        struct PendingSave {
+            std::string fileName;
+            int generation;                 ///< Edit count when the snapshot was taken
+            bool autosave;
+            std::string obsoleteAutosave;   ///< For a user save, the autosave it replaces
+        };
+
         BixelGrid* openGLWidget;
-        float zoom;
+        Viewport m_viewport;
+        double m_zoomTarget;
+        vec2 m_zoomAnchor;
+        QTimer m_zoomTimer;
         QColorDialog colorPicker; 
         BixelGrid::DrawTool currentTool;
         QColor currentColor;
         vec2 clickPosition;
         QWidget* mainWindow;
         std::string m_fileName;
+        BackgroundSaver m_saver;
+        QTimer m_autosaveTimer;
+        int m_editGeneration;
+        int m_autosavedGeneration;
+        std::map<int, PendingSave> m_pendingSaves;
+        int m_nextSaveId;
+        Clipboard m_clipboard;
+        ThreadPool m_pool;
+        Quantizer m_quantizer;
+        ImageImporter m_importer;
+        QVector<QRgb> m_swatches;
+        DocumentLoader* m_loader;
+        std::string m_pendingFileName;
+        bool m_painted;
 
+        void startSave(const std::string& fileName, bool autosave, const std::string& obsoleteAutosave);
+        bool runFilter(const FilterPipeline::Filter& filter);
+        QVector<QRgb> documentPalette();
+        void animateZoom(double factor, double x, double y);
+        void updateView();
+        std::string autosaveFileName() const;
         bool eventFilter(QObject* object, QEvent* event);
 
 };
@@ -0,0 +1,279 @@
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include "clipboard.hpp"
+#include "tracer.hpp"
+
+/**
+ * Takes over pixels, and mask if given, leaving them empty.
+ *
+ * @param x, y  Where the region was copied from.
+ * @param mask  Which bixels of pixels were selected; 0 for all of them.
+ */
+Clip::Clip(int x, int y, PixelBuffer& pixels, Selection* mask) :
+    m_x(x), m_y(y), m_masked(mask != 0) {
+    m_pixels.swap(pixels);
+    if(mask) {
+        m_mask = std::move(*mask);
+    }
+}
+
+int Clip::x() const {
+    return m_x;
+}
+
+int Clip::y() const {
+    return m_y;
+}
+
+int Clip::width() const {
+    return m_pixels.width();
+}
+
+int Clip::height() const {
+    return m_pixels.height();
+}
+
+const PixelBuffer& Clip::pixels() const {
+    return m_pixels;
+}
+
+bool Clip::isMasked() const {
+    return m_masked;
+}
+
+/**
+ * Only meaningful if isMasked().
+ */
+const Selection& Clip::mask() const {
+    return m_mask;
+}
+
+//-Clipboard-//
+
+/**
+ * Copies the selected bixels. Does nothing if nothing is selected.
+ */
+void Clipboard::copy(const PixelBuffer& pixels, const Selection& selection) {
+    std::shared_ptr<const Clip> clip = makeClip(pixels, selection);
+    if(clip) {
+        m_clip = clip;
+    }
+}
+
+/**
+ * Copies the selected bixels and makes them transparent.
+ *
+ * @param history   If given, the cut is recorded as one undo step.
+ */
+void Clipboard::cut(PixelBuffer& pixels, const Selection& selection, History* history) {
+    std::shared_ptr<const Clip> clip = makeClip(pixels, selection);
+    if(!clip) {
+        return;
+    }
+    m_clip = clip;
+    if(history) {
+        history->endStep();
+        history->touchSelection(pixels, selection);
+    }
+    selection.fillPixels(pixels, 0);
+    if(history) {
+        history->endStep();
+    }
+}
+
+/**
+ * Replaces the clipboard's contents, e.g. with a Clip made from an
+ * image on the system clipboard.
+ */
+void Clipboard::setClip(const std::shared_ptr<const Clip>& clip) {
+    m_clip = clip;
+}
+
+std::shared_ptr<const Clip> Clipboard::clip() const {
+    return m_clip;
+}
+
+bool Clipboard::isEmpty() const {
+    return !m_clip;
+}
+
+/**
+ * Copies the selected bixels of pixels into a new Clip the size of the
+ * selection's bounding box. selection must be the size of pixels.
+ *
+ * @return  0 if nothing is selected.
+ */
+std::shared_ptr<const Clip> Clipboard::makeClip(const PixelBuffer& pixels, const Selection& selection) {
+    Tracer::Zone zone("copy");
+    int left = std::numeric_limits<int>::max();
+    int right = -1;
+    int top = -1;
+    int bottom = -1;
+    size_t count = 0;
+    selection.forEachSpan([&](int x, int y, int length) {
+        left = std::min(left, x);
+        right = std::max(right, x + length);
+        top = top < 0 ? y : top;
+        bottom = y + 1;
+        count += length;
+    });
+    if(count == 0) {
+        return std::shared_ptr<const Clip>();
+    }
+
+    int width = right - left;
+    int height = bottom - top;
+    if(count == (size_t) width * height) {
+        PixelBuffer copied(width, height);
+        copied.copyRect(pixels, left, top, width, height, 0, 0);
+        return std::make_shared<const Clip>(left, top, copied);
+    }
+
+    PixelBuffer copied(width, height);
+    Selection mask(width, height);
+    selection.forEachSpan([&](int x, int y, int length) {
+        memcpy(copied.row(y - top) + x - left, pixels.row(y) + x, length * sizeof(Rgba));
+        mask.setSpan(x - left, y - top, length);
+    });
+    return std::make_shared<const Clip>(left, top, copied, &mask);
+}
+
+//-FloatingPaste-//
+
+FloatingPaste::FloatingPaste() : m_pixels(0), m_x(0), m_y(0) {}
+
+/**
+ * Drops clip onto pixels with its top left corner at (x, y), which may
+ * lie outside the canvas. A paste already floating is committed
+ * without history first.
+ */
+void FloatingPaste::begin(PixelBuffer& pixels, const std::shared_ptr<const Clip>& clip, int x, int y) {
+    if(isActive()) {
+        commit(0);
+    }
+    if(!clip) {
+        return;
+    }
+    m_pixels = &pixels;
+    m_clip = clip;
+    m_x = x;
+    m_y = y;
+    m_under = PixelBuffer(clip->width(), clip->height());
+    cover();
+}
+
+void FloatingPaste::moveTo(int x, int y) {
+    if(!isActive() || (x == m_x && y == m_y)) {
+        return;
+    }
+    uncover();
+    m_x = x;
+    m_y = y;
+    cover();
+}
+
+void FloatingPaste::moveBy(int dx, int dy) {
+    moveTo(m_x + dx, m_y + dy);
+}
+
+/**
+ * Leaves the clip where it is.
+ *
+ * @param history   If given, the paste is recorded as one undo step.
+ */
+void FloatingPaste::commit(History* history) {
+    if(!isActive()) {
+        return;
+    }
+    if(history) {
+        // History wants the bixels as they were before the paste.
+        uncover();
+        history->endStep();
+        if(m_clip->isMasked()) {
+            int x0 = m_x;
+            int y0 = m_y;
+            m_clip->mask().forEachSpan([history, this, x0, y0](int x, int y, int length) {
+                history->touch(*m_pixels, x0 + x, y0 + y, length);
+            });
+        } else {
+            history->touchRect(*m_pixels, m_x, m_y, m_clip->width(), m_clip->height());
+        }
+        cover();
+        history->endStep();
+    }
+    m_pixels = 0;
+    m_clip.reset();
+    m_under = PixelBuffer();
+}
+
+/**
+ * Removes the clip and restores what was under it.
+ */
+void FloatingPaste::cancel() {
+    if(!isActive()) {
+        return;
+    }
+    uncover();
+    m_pixels = 0;
+    m_clip.reset();
+    m_under = PixelBuffer();
+}
+
+bool FloatingPaste::isActive() const {
+    return m_pixels != 0;
+}
+
+/**
+ * @return  true if canvas bixel (x, y) is covered by the clip, for
+ *          deciding whether a drag grabs the paste.
+ */
+bool FloatingPaste::contains(int x, int y) const {
+    if(!isActive() || x < m_x || y < m_y || x >= m_x + m_clip->width() || y >= m_y + m_clip->height()) {
+        return false;
+    }
+    return !m_clip->isMasked() || m_clip->mask().contains(x - m_x, y - m_y);
+}
+
+int FloatingPaste::x() const {
+    return m_x;
+}
+
+int FloatingPaste::y() const {
+    return m_y;
+}
+
+//-Private-//
+
+/**
+ * Saves the bixels under the clip and draws the clip over them.
+ */
+void FloatingPaste::cover() {
+    PixelBuffer& pixels = *m_pixels;
+    const Clip& clip = *m_clip;
+    m_under.copyRect(pixels, m_x, m_y, clip.width(), clip.height(), 0, 0);
+    if(!clip.isMasked()) {
+        pixels.copyRect(clip.pixels(), 0, 0, clip.width(), clip.height(), m_x, m_y);
+        return;
+    }
+
+    int x0 = m_x;
+    int y0 = m_y;
+    clip.mask().forEachSpan([&pixels, &clip, x0, y0](int x, int y, int length) {
+        int begin = std::max(0, x0 + x);
+        int end = std::min(pixels.width(), x0 + x + length);
+        if(y0 + y < 0 || y0 + y >= pixels.height() || begin >= end) {
+            return;
+        }
+        memcpy(pixels.row(y0 + y) + begin, clip.pixels().row(y) + begin - x0,
+               (end - begin) * sizeof(Rgba));
+    });
+    pixels.markDirty(m_x, m_y, clip.width(), clip.height());
+}
+
+/**
+ * Puts back the bixels saved by cover().
+ */
+void FloatingPaste::uncover() {
+    m_pixels->copyRect(m_under, 0, 0, m_under.width(), m_under.height(), m_x, m_y);
+}
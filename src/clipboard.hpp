@@ -0,0 +1,99 @@
+#ifndef CLIPBOARD_HPP
+#define CLIPBOARD_HPP
+#include <memory>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "selection.hpp"
+#include "history.hpp"
+
+/**
+ * A copied region: the bixels inside the bounding box of a selection,
+ * and for selections that are not rectangles, a mask of which of them
+ * were selected. Bixels outside the mask are transparent.
+ *
+ * A Clip never changes once made and is handed around as a
+ * shared_ptr<const Clip>, so the clipboard, any number of pastes and
+ * the system clipboard export all share one copy of the bixels.
+ */
+class Clip {
+    public:
+        Clip(int x, int y, PixelBuffer& pixels, Selection* mask = 0);
+
+        int x() const;
+        int y() const;
+        int width() const;
+        int height() const;
+        const PixelBuffer& pixels() const;
+        bool isMasked() const;
+        const Selection& mask() const;
+
+    private:
+        Clip(const Clip&);
+        Clip& operator=(const Clip&);
+
+        int m_x;
+        int m_y;
+        PixelBuffer m_pixels;
+        bool m_masked;
+        Selection m_mask;
+};
+
+/**
+ * Copy and cut for a canvas and its selection.
+ *
+ * A rectangular selection is copied with one memcpy per row. Any other
+ * selection is copied span by span through Selection::forEachSpan(),
+ * which skips unselected bixels a word at a time.
+ */
+class Clipboard {
+    public:
+        void copy(const PixelBuffer& pixels, const Selection& selection);
+        void cut(PixelBuffer& pixels, const Selection& selection, History* history);
+        void setClip(const std::shared_ptr<const Clip>& clip);
+        std::shared_ptr<const Clip> clip() const;
+        bool isEmpty() const;
+
+        static std::shared_ptr<const Clip> makeClip(const PixelBuffer& pixels, const Selection& selection);
+
+    private:
+        std::shared_ptr<const Clip> m_clip;
+};
+
+/**
+ * A pasted Clip that floats above the canvas until it is committed.
+ *
+ * The clip is drawn into the canvas straight away, so it shows up with
+ * the normal dirty-tile uploads, and the bixels it covers are kept
+ * aside; moving it puts them back and covers the new spot. commit()
+ * leaves it where it is as one undo step, cancel() removes it. Masked
+ * clips only cover the bixels inside their mask.
+ */
+class FloatingPaste {
+    public:
+        FloatingPaste();
+
+        void begin(PixelBuffer& pixels, const std::shared_ptr<const Clip>& clip, int x, int y);
+        void moveTo(int x, int y);
+        void moveBy(int dx, int dy);
+        void commit(History* history);
+        void cancel();
+
+        bool isActive() const;
+        bool contains(int x, int y) const;
+        int x() const;
+        int y() const;
+
+    private:
+        FloatingPaste(const FloatingPaste&);
+        FloatingPaste& operator=(const FloatingPaste&);
+
+        void cover();
+        void uncover();
+
+        PixelBuffer* m_pixels;
+        std::shared_ptr<const Clip> m_clip;
+        int m_x;
+        int m_y;
+        PixelBuffer m_under;
+};
+#endif
@@ -0,0 +1,95 @@
+#include <string.h>
+#include <QApplication>
+#include <QBuffer>
+#include <QByteArray>
+#include <QClipboard>
+#include <QImage>
+#include "clipmimedata.hpp"
+#include "tracer.hpp"
+
+namespace {
+    const char* IMAGE_FORMAT = "application/x-qt-image";
+    const char* PNG_FORMAT = "image/png";
+
+    void releaseClip(void* clip) {
+        delete (std::shared_ptr<const Clip>*) clip;
+    }
+
+    /**
+     * Returns an image over the clip's own bixels, which stay alive for
+     * as long as the image or any copy of it does.
+     */
+    QImage wrapClip(const std::shared_ptr<const Clip>& clip) {
+        const PixelBuffer& pixels = clip->pixels();
+        return QImage((const uchar*) pixels.data(), pixels.width(), pixels.height(),
+                      pixels.stride() * sizeof(Rgba), QImage::Format_RGBA8888,
+                      releaseClip, new std::shared_ptr<const Clip>(clip));
+    }
+};
+
+ClipMimeData::ClipMimeData(const std::shared_ptr<const Clip>& clip) : m_clip(clip) {}
+
+std::shared_ptr<const Clip> ClipMimeData::clip() const {
+    return m_clip;
+}
+
+QStringList ClipMimeData::formats() const {
+    return QStringList() << IMAGE_FORMAT << PNG_FORMAT;
+}
+
+bool ClipMimeData::hasFormat(const QString& mimeType) const {
+    return mimeType == IMAGE_FORMAT || mimeType == PNG_FORMAT;
+}
+
+/**
+ * Makes clip the system clipboard's contents.
+ */
+void ClipMimeData::publish(const std::shared_ptr<const Clip>& clip) {
+    if(clip) {
+        QApplication::clipboard()->setMimeData(new ClipMimeData(clip));
+    }
+}
+
+/**
+ * Reads the system clipboard. A Clip this process published comes back
+ * as is; an image from another application is copied into a new Clip.
+ *
+ * @return  0 if the clipboard holds no image.
+ */
+std::shared_ptr<const Clip> ClipMimeData::fetch() {
+    const QMimeData* data = QApplication::clipboard()->mimeData();
+    const ClipMimeData* own = dynamic_cast<const ClipMimeData*>(data);
+    if(own) {
+        return own->clip();
+    }
+    if(!data || !data->hasImage()) {
+        return std::shared_ptr<const Clip>();
+    }
+
+    QImage image = qvariant_cast<QImage>(data->imageData()).convertToFormat(QImage::Format_RGBA8888);
+    if(image.isNull()) {
+        return std::shared_ptr<const Clip>();
+    }
+    PixelBuffer pixels(image.width(), image.height());
+    for(int y = 0; y < image.height(); y++) {
+        memcpy(pixels.row(y), image.constScanLine(y), image.width() * sizeof(Rgba));
+    }
+    return std::make_shared<const Clip>(0, 0, pixels);
+}
+
+//-Protected-//
+
+QVariant ClipMimeData::retrieveData(const QString& mimeType, QVariant::Type) const {
+    if(mimeType == IMAGE_FORMAT) {
+        return QVariant::fromValue(wrapClip(m_clip));
+    }
+    if(mimeType == PNG_FORMAT) {
+        Tracer::Zone zone("clipboard_png");
+        QByteArray png;
+        QBuffer buffer(&png);
+        buffer.open(QIODevice::WriteOnly);
+        wrapClip(m_clip).save(&buffer, "PNG");
+        return png;
+    }
+    return QVariant();
+}
@@ -0,0 +1,36 @@
+#ifndef CLIPMIMEDATA_HPP
+#define CLIPMIMEDATA_HPP
+#include <memory>
+#include <QMimeData>
+#include <QStringList>
+#include <QVariant>
+#include "clipboard.hpp"
+
+/**
+ * Puts a Clip on the system clipboard without converting it.
+ *
+ * Only the shared_ptr is stored. The clip is turned into an image in
+ * retrieveData(), which Qt calls when an application (possibly this
+ * one) actually asks for the clipboard's contents, so copying a large
+ * region costs nothing extra until it is pasted elsewhere. The image
+ * wraps the clip's bixels instead of copying them; PNG data is only
+ * encoded for applications that ask for image/png.
+ */
+class ClipMimeData : public QMimeData {
+    public:
+        ClipMimeData(const std::shared_ptr<const Clip>& clip);
+
+        std::shared_ptr<const Clip> clip() const;
+        QStringList formats() const;
+        bool hasFormat(const QString& mimeType) const;
+
+        static void publish(const std::shared_ptr<const Clip>& clip);
+        static std::shared_ptr<const Clip> fetch();
+
+    protected:
+        QVariant retrieveData(const QString& mimeType, QVariant::Type type) const;
+
+    private:
+        std::shared_ptr<const Clip> m_clip;
+};
+#endif
@@ -0,0 +1,200 @@
+#include <string.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "compositor.hpp"
+
+namespace {
+    // Bixels composited per pass over the layers; the premultiplied
+    // scratch row stays in L1.
+    const int CHUNK = 256;
+
+    /**
+     * v / 255, rounded, for 0 <= v <= 255 * 255.
+     */
+    inline int div255(int v) {
+        v += 128;
+        return (v + (v >> 8)) >> 8;
+    }
+
+    /**
+     * reciprocals[a] is 255 / a in 16.16 fixed point.
+     */
+    std::vector<uint32_t> makeReciprocals() {
+        std::vector<uint32_t> reciprocals(256, 0);
+        for(uint32_t a = 1; a < 256; a++) {
+            reciprocals[a] = (255 * 65536 + a / 2) / a;
+        }
+        return reciprocals;
+    }
+
+#ifdef __SSE2__
+    inline __m128i div255(__m128i v) {
+        v = _mm_add_epi16(v, _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+    }
+
+    /**
+     * Blends two straight source bixels over two premultiplied
+     * destination bixels, each unpacked to 16 bit lanes R, G, B, A.
+     */
+    inline __m128i overPixels(__m128i source, __m128i destination, __m128i opacity, bool fade) {
+        const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+        __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(source, 0xFF), 0xFF);
+        if(fade) {
+            alpha = div255(_mm_mullo_epi16(alpha, opacity));
+        }
+        // Color is scaled by the faded alpha, alpha itself by the opacity.
+        __m128i factor = _mm_or_si128(_mm_andnot_si128(alphaLanes, alpha), _mm_and_si128(alphaLanes, opacity));
+        __m128i premultiplied = div255(_mm_mullo_epi16(source, factor));
+        __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+        return _mm_add_epi16(premultiplied, div255(_mm_mullo_epi16(destination, inverse)));
+    }
+#endif
+};
+
+//-Public-//
+
+/**
+ * Flattens the visible layers over the width x height region at (x, y)
+ * into the same region of out, as straight RGBA. Every layer must be
+ * at least as large as the region. Nothing is marked dirty in out.
+ */
+void Compositor::composite(const std::vector<Layer>& layers, int x, int y, int width, int height,
+                           PixelBuffer& out) {
+    std::vector<const Layer*> visible;
+    for(size_t i = 0; i < layers.size(); i++) {
+        if(layers[i].visible && layers[i].opacity > 0) {
+            visible.push_back(&layers[i]);
+        }
+    }
+
+    if(visible.size() <= 1 && (visible.empty() || visible[0]->isPlain())) {
+        for(int row = y; row < y + height; row++) {
+            if(visible.empty()) {
+                PixelBuffer::fillSpan(out.row(row) + x, width, 0);
+            } else {
+                memcpy(out.row(row) + x, visible[0]->pixels.row(row) + x, width * sizeof(Rgba));
+            }
+        }
+        return;
+    }
+
+    Rgba scratch[CHUNK];
+    for(int row = y; row < y + height; row++) {
+        for(int chunk = x; chunk < x + width; chunk += CHUNK) {
+            int count = std::min(CHUNK, x + width - chunk);
+            std::fill(scratch, scratch + count, 0);
+            for(size_t i = 0; i < visible.size(); i++) {
+                const Layer& layer = *visible[i];
+                blendRow(scratch, layer.pixels.row(row) + chunk, count, layer.opacity, layer.blendMode);
+            }
+            unpremultiplyRow(scratch, out.row(row) + chunk, count);
+        }
+    }
+}
+
+/**
+ * Blends count straight source bixels, faded by opacity, onto
+ * premultiplied destination bixels.
+ */
+void Compositor::blendRow(Rgba* destination, const Rgba* source, int count,
+                          int opacity, Layer::BlendMode mode) {
+    if(mode == Layer::NORMAL) {
+        overRow(destination, source, count, opacity);
+    } else {
+        blendRowScalar(destination, source, count, opacity, mode);
+    }
+}
+
+/**
+ * Converts premultiplied bixels back to straight RGBA. in and out may
+ * be the same.
+ */
+void Compositor::unpremultiplyRow(const Rgba* in, Rgba* out, int count) {
+    static const std::vector<uint32_t> reciprocals = makeReciprocals();
+    for(int i = 0; i < count; i++) {
+        Rgba color = in[i];
+        uint32_t alpha = color >> 24;
+        if(alpha == 255 || alpha == 0) {
+            out[i] = alpha ? color : 0;
+            continue;
+        }
+        uint32_t reciprocal = reciprocals[alpha];
+        out[i] = packRgba(std::min(255u, (rgbaRed(color) * reciprocal + 0x8000) >> 16),
+                          std::min(255u, (rgbaGreen(color) * reciprocal + 0x8000) >> 16),
+                          std::min(255u, (rgbaBlue(color) * reciprocal + 0x8000) >> 16),
+                          alpha);
+    }
+}
+
+//-Private-//
+
+void Compositor::overRow(Rgba* destination, const Rgba* source, int count, int opacity) {
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaMask = _mm_set1_epi32((int) 0xFF000000);
+    const __m128i opacity16 = _mm_set1_epi16(opacity);
+    bool fade = opacity < 255;
+    for(; x + 4 <= count; x += 4) {
+        __m128i four = _mm_loadu_si128((const __m128i*) (source + x));
+        __m128i alpha = _mm_and_si128(four, alphaMask);
+        if(_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero)) == 0xFFFF) {
+            continue;
+        }
+        if(!fade && _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alphaMask)) == 0xFFFF) {
+            _mm_storeu_si128((__m128i*) (destination + x), four);
+            continue;
+        }
+        __m128i below = _mm_loadu_si128((const __m128i*) (destination + x));
+        __m128i low = overPixels(_mm_unpacklo_epi8(four, zero), _mm_unpacklo_epi8(below, zero), opacity16, fade);
+        __m128i high = overPixels(_mm_unpackhi_epi8(four, zero), _mm_unpackhi_epi8(below, zero), opacity16, fade);
+        _mm_storeu_si128((__m128i*) (destination + x), _mm_packus_epi16(low, high));
+    }
+#endif
+    blendRowScalar(destination + x, source + x, count - x, opacity, Layer::NORMAL);
+}
+
+/**
+ * Premultiplied forms of the blend modes, applied to all four channels:
+ *
+ *      NORMAL      s + d * (1 - sa)
+ *      MULTIPLY    s * (1 - da) + d * (1 - sa) + s * d
+ *      SCREEN      s + d - s * d
+ *      ADD         min(1, s + d)
+ */
+void Compositor::blendRowScalar(Rgba* destination, const Rgba* source, int count,
+                                int opacity, Layer::BlendMode mode) {
+    for(int i = 0; i < count; i++) {
+        int sourceAlpha = rgbaAlpha(source[i]);
+        int alpha = opacity == 255 ? sourceAlpha : div255(sourceAlpha * opacity);
+        if(alpha == 0) {
+            continue;
+        }
+        int s[4] = { div255(rgbaRed(source[i]) * alpha), div255(rgbaGreen(source[i]) * alpha),
+                     div255(rgbaBlue(source[i]) * alpha), alpha };
+        int d[4] = { rgbaRed(destination[i]), rgbaGreen(destination[i]),
+                     rgbaBlue(destination[i]), rgbaAlpha(destination[i]) };
+        int o[4];
+        for(int c = 0; c < 4; c++) {
+            switch(mode) {
+                case Layer::MULTIPLY:
+                    o[c] = div255(s[c] * (255 - d[3])) + div255(d[c] * (255 - alpha)) + div255(s[c] * d[c]);
+                break;
+                case Layer::SCREEN:
+                    o[c] = s[c] + d[c] - div255(s[c] * d[c]);
+                break;
+                case Layer::ADD:
+                    o[c] = s[c] + d[c];
+                break;
+                default:
+                    o[c] = s[c] + div255(d[c] * (255 - alpha));
+                break;
+            }
+            o[c] = std::min(255, o[c]);
+        }
+        destination[i] = packRgba(o[0], o[1], o[2], o[3]);
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef COMPOSITOR_HPP
+#define COMPOSITOR_HPP
+#include <vector>
+#include "rgba.hpp"
+#include "layer.hpp"
+#include "pixelbuffer.hpp"
+
+/**
+ * Flattens layers into one image.
+ *
+ * Layers hold straight RGBA, but blending is done in premultiplied
+ * form, where "over" is dst = src + dst * (1 - src alpha) on all four
+ * channels alike with no division. composite() accumulates a row of
+ * the result premultiplied in a small stack buffer, blending the layers
+ * onto it bottom to top, and converts it back to straight RGBA once at
+ * the end.
+ *
+ * NORMAL uses an SSE2 kernel that blends four bixels per iteration in
+ * 16 bit lanes, and skips runs of four fully transparent bixels and
+ * copies runs of four opaque ones without arithmetic. The other blend
+ * modes are scalar.
+ */
+class Compositor {
+    public:
+        static void composite(const std::vector<Layer>& layers, int x, int y, int width, int height,
+                              PixelBuffer& out);
+
+        static void blendRow(Rgba* destination, const Rgba* source, int count,
+                             int opacity, Layer::BlendMode mode);
+        static void unpremultiplyRow(const Rgba* in, Rgba* out, int count);
+
+    private:
+        static void overRow(Rgba* destination, const Rgba* source, int count, int opacity);
+        static void blendRowScalar(Rgba* destination, const Rgba* source, int count,
+                                   int opacity, Layer::BlendMode mode);
+};
+#endif
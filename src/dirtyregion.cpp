@@ -0,0 +1,132 @@
+#include <algorithm>
+#include "dirtyregion.hpp"
+
+DirtyRegion::DirtyRegion(int width, int height) :
+    m_width(0), m_height(0), m_tilesX(0), m_tilesY(0), m_dirtyTiles(0) {
+    resize(width, height);
+}
+
+/**
+ * Changes the size of the tracked canvas. Everything is dirty afterwards.
+ */
+void DirtyRegion::resize(int width, int height) {
+    m_width = std::max(0, width);
+    m_height = std::max(0, height);
+    m_tilesX = (m_width + TILE_SIZE - 1) / TILE_SIZE;
+    m_tilesY = (m_height + TILE_SIZE - 1) / TILE_SIZE;
+    m_tiles.assign((size_t) m_tilesX * m_tilesY, 0);
+    m_dirtyTiles = 0;
+    markAll();
+}
+
+/**
+ * Marks the rectangle dirty, clipped to the canvas.
+ */
+void DirtyRegion::markRect(int x, int y, int width, int height) {
+    int x0 = std::max(0, x);
+    int y0 = std::max(0, y);
+    int x1 = std::min(m_width, x + width);
+    int y1 = std::min(m_height, y + height);
+    if(x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    for(int ty = y0 / TILE_SIZE; ty <= (y1 - 1) / TILE_SIZE; ty++) {
+        unsigned char* row = &m_tiles[(size_t) ty * m_tilesX];
+        for(int tx = x0 / TILE_SIZE; tx <= (x1 - 1) / TILE_SIZE; tx++) {
+            m_dirtyTiles += !row[tx];
+            row[tx] = 1;
+        }
+    }
+}
+
+void DirtyRegion::markAll() {
+    std::fill(m_tiles.begin(), m_tiles.end(), 1);
+    m_dirtyTiles = m_tiles.size();
+}
+
+void DirtyRegion::clear() {
+    std::fill(m_tiles.begin(), m_tiles.end(), 0);
+    m_dirtyTiles = 0;
+}
+
+bool DirtyRegion::isEmpty() const {
+    return m_dirtyTiles == 0;
+}
+
+bool DirtyRegion::isTileDirty(int tx, int ty) const {
+    return m_tiles[(size_t) ty * m_tilesX + tx] != 0;
+}
+
+size_t DirtyRegion::dirtyTileCount() const {
+    return m_dirtyTiles;
+}
+
+int DirtyRegion::tilesX() const {
+    return m_tilesX;
+}
+
+int DirtyRegion::tilesY() const {
+    return m_tilesY;
+}
+
+/**
+ * Replaces rects with rectangles covering every dirty tile, clipped to
+ * the canvas, and clears the region.
+ *
+ * Runs of dirty tiles in a tile row become one rectangle, and identical
+ * runs in consecutive tile rows are merged. When more than half of the
+ * tiles are dirty a single rectangle covering the canvas is returned,
+ * since one large upload beats many medium ones.
+ */
+void DirtyRegion::takeRects(std::vector<Rect>& rects) {
+    rects.clear();
+    if(m_dirtyTiles == 0) {
+        return;
+    }
+    if(m_dirtyTiles * 2 > m_tiles.size()) {
+        Rect all = { 0, 0, m_width, m_height };
+        rects.push_back(all);
+        clear();
+        return;
+    }
+
+    std::vector<size_t> open;
+    std::vector<size_t> stillOpen;
+    for(int ty = 0; ty < m_tilesY; ty++) {
+        stillOpen.clear();
+        const unsigned char* row = &m_tiles[(size_t) ty * m_tilesX];
+        int tx = 0;
+        while(tx < m_tilesX) {
+            if(!row[tx]) {
+                tx++;
+                continue;
+            }
+            int begin = tx;
+            while(tx < m_tilesX && row[tx]) {
+                tx++;
+            }
+
+            Rect rect;
+            rect.x = begin * TILE_SIZE;
+            rect.y = ty * TILE_SIZE;
+            rect.width = std::min(m_width, tx * TILE_SIZE) - rect.x;
+            rect.height = std::min(m_height, (ty + 1) * TILE_SIZE) - rect.y;
+
+            size_t index = rects.size();
+            for(size_t i = 0; i < open.size(); i++) {
+                Rect& above = rects[open[i]];
+                if(above.x == rect.x && above.width == rect.width) {
+                    above.height += rect.height;
+                    index = open[i];
+                    break;
+                }
+            }
+            if(index == rects.size()) {
+                rects.push_back(rect);
+            }
+            stillOpen.push_back(index);
+        }
+        open.swap(stillOpen);
+    }
+    clear();
+}
@@ -0,0 +1,55 @@
+#ifndef DIRTYREGION_HPP
+#define DIRTYREGION_HPP
+#include <vector>
+#include <stddef.h>
+
+/**
+ * Tracks which parts of a canvas changed since they were last consumed,
+ * at the granularity of TILE_SIZE x TILE_SIZE tiles.
+ *
+ * Marking is a couple of divisions and a byte store, cheap enough to do
+ * on every setPixel. takeRects() turns the dirty tiles into a few
+ * merged rectangles for partial texture uploads and resets the region.
+ */
+class DirtyRegion {
+    public:
+        struct Rect {
+            int x;
+            int y;
+            int width;
+            int height;
+        };
+
+        static const int TILE_SIZE = 64;
+
+        DirtyRegion(int width = 0, int height = 0);
+
+        void resize(int width, int height);
+        void markPixel(int x, int y);
+        void markRect(int x, int y, int width, int height);
+        void markAll();
+        void clear();
+
+        bool isEmpty() const;
+        bool isTileDirty(int tx, int ty) const;
+        size_t dirtyTileCount() const;
+        int tilesX() const;
+        int tilesY() const;
+
+        void takeRects(std::vector<Rect>& rects);
+
+    private:
+        int m_width;
+        int m_height;
+        int m_tilesX;
+        int m_tilesY;
+        size_t m_dirtyTiles;
+        std::vector<unsigned char> m_tiles;
+};
+
+inline void DirtyRegion::markPixel(int x, int y) {
+    unsigned char& tile = m_tiles[(size_t) (y / TILE_SIZE) * m_tilesX + x / TILE_SIZE];
+    m_dirtyTiles += !tile;
+    tile = 1;
+}
+#endif
@@ -0,0 +1,108 @@
+#include "documentloader.hpp"
+#include "tracer.hpp"
+
+DocumentLoader::DocumentLoader() : m_success(false), m_finished(false) {}
+
+/**
+ * Waits for a decode in flight; its image is dropped.
+ */
+DocumentLoader::~DocumentLoader() {
+    if(m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+/**
+ * Starts decoding fileName, dropping any image not yet taken.
+ */
+void DocumentLoader::start(const std::string& fileName) {
+    if(m_thread.joinable()) {
+        m_thread.join();
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_fileName = fileName;
+    m_image = BixlImage();
+    m_success = false;
+    m_finished = false;
+    m_thread = std::thread(&DocumentLoader::run, this);
+}
+
+/**
+ * @param callback  Called with the file name once it is decoded, on the
+ *                  loader's thread, or on this one if it already is.
+ */
+void DocumentLoader::setCallback(const Callback& callback) {
+    std::string finishedName;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_callback = callback;
+        if(m_finished && !m_fileName.empty()) {
+            finishedName = m_fileName;
+        }
+    }
+    if(callback && !finishedName.empty()) {
+        callback(finishedName);
+    }
+}
+
+/**
+ * @return  true if fileName is still being decoded.
+ */
+bool DocumentLoader::isLoading(const std::string& fileName) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_finished && !m_fileName.empty() && m_fileName == fileName;
+}
+
+/**
+ * Waits for the decode of fileName to finish and moves its image out.
+ *
+ * @return  false if fileName was not started or could not be read.
+ */
+bool DocumentLoader::take(const std::string& fileName, BixlImage& image) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_fileName.empty() || m_fileName != fileName) {
+            return false;
+        }
+    }
+    Tracer::Zone zone("wait_document");
+    if(m_thread.joinable()) {
+        m_thread.join();
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    bool success = m_success;
+    if(success) {
+        image = std::move(m_image);
+    }
+    m_fileName.clear();
+    m_image = BixlImage();
+    return success;
+}
+
+//-Private-//
+
+void DocumentLoader::run() {
+    Tracer::setThreadName("document loader");
+    std::string fileName;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        fileName = m_fileName;
+    }
+    BixlImage image;
+    bool success;
+    {
+        Tracer::Zone zone("preload_document");
+        success = BixlFile::read(fileName, image);
+    }
+    Callback callback;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_image = std::move(image);
+        m_success = success;
+        m_finished = true;
+        callback = m_callback;
+    }
+    if(callback) {
+        callback(fileName);
+    }
+}
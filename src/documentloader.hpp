@@ -0,0 +1,46 @@
+#ifndef DOCUMENTLOADER_HPP
+#define DOCUMENTLOADER_HPP
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "bixlfile.hpp"
+
+/**
+ * Decodes one .bixl file on a thread of its own, so the document named
+ * on the command line is read while the window and GL context are
+ * still being created.
+ *
+ * start() returns at once. The callback, if set, is called on the
+ * loader's thread once the file is decoded, or right away from
+ * setCallback() if it already is. take() waits for the decode and hands
+ * over the image; after that the loader is idle and can be started
+ * again.
+ */
+class DocumentLoader {
+    public:
+        typedef std::function<void(const std::string& fileName)> Callback;
+
+        DocumentLoader();
+        ~DocumentLoader();
+
+        void start(const std::string& fileName);
+        void setCallback(const Callback& callback);
+        bool isLoading(const std::string& fileName) const;
+        bool take(const std::string& fileName, BixlImage& image);
+
+    private:
+        DocumentLoader(const DocumentLoader&);
+        DocumentLoader& operator=(const DocumentLoader&);
+
+        void run();
+
+        mutable std::mutex m_mutex;
+        std::thread m_thread;
+        std::string m_fileName;
+        BixlImage m_image;
+        bool m_success;
+        bool m_finished;
+        Callback m_callback;
+};
+#endif
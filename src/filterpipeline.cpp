@@ -0,0 +1,656 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "filterpipeline.hpp"
+#include "tracer.hpp"
+
+namespace {
+    // Entries in a band's cache of mapped colors, a power of two.
+    const int CACHE_SIZE = 1 << 10;
+
+    const int BAYER[4][4] = {
+        {  0,  8,  2, 10 },
+        { 12,  4, 14,  6 },
+        {  3, 11,  1,  9 },
+        { 15,  7, 13,  5 }
+    };
+
+    const Rgba ALPHA_MASK = 0xFF000000;
+
+    inline uint32_t hashColor(Rgba color) {
+        return (color * 0x9E3779B1u) >> 22;
+    }
+
+    inline int clampChannel(int value) {
+        return value < 0 ? 0 : (value > 255 ? 255 : value);
+    }
+
+    inline bool isTransparent(Rgba color) {
+        return (color & ALPHA_MASK) == 0;
+    }
+
+#ifdef __SSE2__
+    inline __m128i load(const Rgba* p) {
+        return _mm_loadu_si128((const __m128i*) p);
+    }
+
+    inline void store(Rgba* p, __m128i v) {
+        _mm_storeu_si128((__m128i*) p, v);
+    }
+
+    /**
+     * All ones in the lanes whose alpha is 0.
+     */
+    inline __m128i transparentLanes(__m128i v) {
+        return _mm_cmpeq_epi32(_mm_and_si128(v, _mm_set1_epi32((int) ALPHA_MASK)), _mm_setzero_si128());
+    }
+
+    inline __m128i select(__m128i mask, __m128i a, __m128i b) {
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    }
+#endif
+
+    /**
+     * Reads a hex color, RRGGBB or RRGGBBAA with an optional leading #.
+     */
+    bool parseColor(const std::string& text, Rgba& color) {
+        std::string digits = !text.empty() && text[0] == '#' ? text.substr(1) : text;
+        if((digits.size() != 6 && digits.size() != 8)
+           || digits.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+            return false;
+        }
+        unsigned long value = strtoul(digits.c_str(), 0, 16);
+        if(digits.size() == 6) {
+            value = value << 8 | 0xFF;
+        }
+        color = packRgba(value >> 24, value >> 16, value >> 8, value);
+        return true;
+    }
+
+    bool parseNumber(const std::string& text, double& number) {
+        char* end;
+        number = strtod(text.c_str(), &end);
+        return !text.empty() && *end == '\0';
+    }
+
+    std::vector<std::string> split(const std::string& text, char separator) {
+        std::vector<std::string> parts;
+        size_t start = 0;
+        while(true) {
+            size_t found = text.find(separator, start);
+            parts.push_back(text.substr(start, found - start));
+            if(found == std::string::npos) {
+                return parts;
+            }
+            start = found + 1;
+        }
+    }
+};
+
+FilterPipeline::Filter::Filter() :
+    type(REPLACE_COLOR), from(0), color(0), hue(0), saturation(1), value(1), dx(0), dy(0), spread(32) {
+}
+
+/**
+ * @return  How many rows above and below each bixel the filter reads.
+ */
+int FilterPipeline::Filter::radius() const {
+    switch(type) {
+        case OUTLINE:
+            return 1;
+        case DROP_SHADOW:
+            return std::min((int) MAX_RADIUS, std::max(abs(dx), abs(dy)));
+        default:
+            return 0;
+    }
+}
+
+FilterPipeline::Filter FilterPipeline::Filter::replaceColor(Rgba from, Rgba to) {
+    Filter filter;
+    filter.type = REPLACE_COLOR;
+    filter.from = from;
+    filter.color = to;
+    return filter;
+}
+
+/**
+ * @param hue           Degrees to turn the hue by.
+ * @param saturation    Factor for the saturation.
+ * @param value         Factor for the value (brightness).
+ */
+FilterPipeline::Filter FilterPipeline::Filter::adjustHsv(float hue, float saturation, float value) {
+    Filter filter;
+    filter.type = ADJUST_HSV;
+    filter.hue = hue;
+    filter.saturation = saturation;
+    filter.value = value;
+    return filter;
+}
+
+/**
+ * A one bixel outline around opaque shapes, touching them edge to edge.
+ */
+FilterPipeline::Filter FilterPipeline::Filter::outline(Rgba color) {
+    Filter filter;
+    filter.type = OUTLINE;
+    filter.color = color;
+    return filter;
+}
+
+/**
+ * @param dx, dy    Offset of the shadow, at most MAX_RADIUS each way.
+ */
+FilterPipeline::Filter FilterPipeline::Filter::dropShadow(Rgba color, int dx, int dy) {
+    Filter filter;
+    filter.type = DROP_SHADOW;
+    filter.color = color;
+    filter.dx = std::max(-(int) MAX_RADIUS, std::min((int) MAX_RADIUS, dx));
+    filter.dy = std::max(-(int) MAX_RADIUS, std::min((int) MAX_RADIUS, dy));
+    return filter;
+}
+
+/**
+ * @param spread    How far, per channel, a 4 x 4 Bayer threshold moves
+ *                  a color before it is matched to the palette; about
+ *                  the distance between neighbouring palette colors.
+ */
+FilterPipeline::Filter FilterPipeline::Filter::dither(const std::vector<Rgba>& palette, int spread) {
+    Filter filter;
+    filter.type = DITHER;
+    filter.palette = palette;
+    filter.spread = std::max(0, std::min(255, spread));
+    return filter;
+}
+
+/**
+ * Reads a filter written as one of
+ *
+ *      replace:FROM:TO
+ *      hsv:HUE:SATURATION:VALUE
+ *      outline:COLOR
+ *      shadow:COLOR:DX:DY
+ *      dither:COLOR,COLOR,...[:SPREAD]
+ *
+ * with colors as hex RRGGBB or RRGGBBAA, for batch runs and scripts.
+ */
+bool FilterPipeline::Filter::parse(const std::string& text, Filter& filter) {
+    std::vector<std::string> parts = split(text, ':');
+    const std::string& name = parts[0];
+    Rgba first, second;
+    double numbers[3];
+    if(name == "replace" && parts.size() == 3) {
+        if(!parseColor(parts[1], first) || !parseColor(parts[2], second)) {
+            return false;
+        }
+        filter = replaceColor(first, second);
+    } else if(name == "hsv" && parts.size() == 4) {
+        for(int i = 0; i < 3; i++) {
+            if(!parseNumber(parts[i + 1], numbers[i])) {
+                return false;
+            }
+        }
+        filter = adjustHsv(numbers[0], numbers[1], numbers[2]);
+    } else if(name == "outline" && parts.size() == 2) {
+        if(!parseColor(parts[1], first)) {
+            return false;
+        }
+        filter = outline(first);
+    } else if(name == "shadow" && parts.size() == 4) {
+        if(!parseColor(parts[1], first) || !parseNumber(parts[2], numbers[0]) || !parseNumber(parts[3], numbers[1])
+           || fabs(numbers[0]) > MAX_RADIUS || fabs(numbers[1]) > MAX_RADIUS) {
+            return false;
+        }
+        filter = dropShadow(first, (int) numbers[0], (int) numbers[1]);
+    } else if(name == "dither" && (parts.size() == 2 || parts.size() == 3)) {
+        std::vector<std::string> colors = split(parts[1], ',');
+        std::vector<Rgba> palette(colors.size());
+        for(size_t i = 0; i < colors.size(); i++) {
+            if(!parseColor(colors[i], palette[i])) {
+                return false;
+            }
+        }
+        numbers[0] = 32;
+        if(parts.size() == 3 && !parseNumber(parts[2], numbers[0])) {
+            return false;
+        }
+        filter = dither(palette, (int) numbers[0]);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @param pool  Threads to filter bands on; the pipeline makes its own if
+ *              none is given.
+ */
+FilterPipeline::FilterPipeline(ThreadPool* pool) : m_pool(pool), m_ownsPool(pool == 0), m_halo(0) {
+    if(m_ownsPool) {
+        m_pool = new ThreadPool();
+    }
+}
+
+FilterPipeline::~FilterPipeline() {
+    if(m_ownsPool) {
+        delete m_pool;
+    }
+}
+
+/**
+ * Appends filter to the chain; filters run in the order added.
+ */
+void FilterPipeline::add(const Filter& filter) {
+    m_filters.push_back(filter);
+}
+
+void FilterPipeline::clear() {
+    m_filters.clear();
+}
+
+bool FilterPipeline::isEmpty() const {
+    return m_filters.empty();
+}
+
+const std::vector<FilterPipeline::Filter>& FilterPipeline::filters() const {
+    return m_filters;
+}
+
+/**
+ * Runs the chain over pixels as one undo step.
+ *
+ * @param selection     Bixels to change; 0, or an empty selection, changes
+ *                      the whole canvas.
+ * @param history       Receives the step; may be 0.
+ * @return              The number of bixels changed.
+ */
+size_t FilterPipeline::apply(PixelBuffer& pixels, const Selection* selection, History* history) {
+    if(m_filters.empty() || pixels.isEmpty()) {
+        return 0;
+    }
+    Tracer::Zone zone("apply_filters");
+    if(selection && selection->isEmpty()) {
+        selection = 0;
+    }
+    m_halo = 0;
+    for(size_t i = 0; i < m_filters.size(); i++) {
+        m_halo += m_filters[i].radius();
+    }
+
+    int width = pixels.width();
+    int height = pixels.height();
+    int bandCount = (height + BAND_ROWS - 1) / BAND_ROWS;
+    int wave = std::max(2, m_pool->threadCount() * 2);
+    m_bands.resize(wave);
+    std::vector<Rgba> kept;
+    std::vector<Rgba> nextKept;
+    int keptY = 0;
+    size_t changed = 0;
+    if(history) {
+        history->endStep();
+    }
+
+    for(int first = 0; first < bandCount; first += wave) {
+        int last = std::min(bandCount, first + wave);
+        m_pool->parallelFor(first, last, [&](int begin, int end) {
+            for(int b = begin; b < end; b++) {
+                process(pixels, kept, keptY, b * BAND_ROWS, std::min(height, (b + 1) * BAND_ROWS), m_bands[b - first]);
+            }
+        }, 1);
+
+        // Keep the rows the next wave reads above its first band, as they
+        // are before this wave is written. Rows of earlier waves among
+        // them are in kept already.
+        int waveEnd = std::min(height, last * BAND_ROWS);
+        int nextKeptY = std::max(0, waveEnd - m_halo);
+        int keptRows = (int) (kept.size() / width);
+        nextKept.resize((size_t) (waveEnd - nextKeptY) * width);
+        for(int y = nextKeptY; y < waveEnd; y++) {
+            const Rgba* row = y >= keptY && y < keptY + keptRows ? &kept[(size_t) (y - keptY) * width] : pixels.row(y);
+            memcpy(&nextKept[(size_t) (y - nextKeptY) * width], row, width * sizeof(Rgba));
+        }
+
+        for(int b = first; b < last; b++) {
+            const Band& band = m_bands[b - first];
+            const Rgba* output = &band.rows[band.output][(size_t) m_halo * width];
+            for(int y = b * BAND_ROWS; y < std::min(height, (b + 1) * BAND_ROWS); y++, output += width) {
+                changed += commit(pixels, selection, history, y, output);
+            }
+        }
+        kept.swap(nextKept);
+        keptY = nextKeptY;
+    }
+
+    if(history) {
+        history->endStep();
+    }
+    Tracer::counter("filtered_bixels", changed);
+    return changed;
+}
+
+/**
+ * Turns the hue of color by hue degrees and scales its saturation and
+ * value, keeping alpha.
+ */
+Rgba FilterPipeline::adjustHsv(Rgba color, float hue, float saturation, float value) {
+    const float unit = 1 / 255.0f;
+    float r = rgbaRed(color) * unit;
+    float g = rgbaGreen(color) * unit;
+    float b = rgbaBlue(color) * unit;
+    float high = std::max(r, std::max(g, b));
+    float low = std::min(r, std::min(g, b));
+    float delta = high - low;
+
+    float h = 0;
+    if(delta > 0) {
+        if(high == r) {
+            h = (g - b) / delta;
+        } else if(high == g) {
+            h = (b - r) / delta + 2;
+        } else {
+            h = (r - g) / delta + 4;
+        }
+    }
+    h += hue * (1 / 60.0f);
+    h -= floorf(h * (1 / 6.0f)) * 6;
+    float s = high > 0 ? std::min(1.0f, delta / high * saturation) : 0;
+    float v = std::min(1.0f, high * value);
+
+    // Each channel falls from v by up to v * s as it moves away from its
+    // own hue, 5 sectors past h for red, 3 for green and 1 for blue.
+    float channels[3];
+    for(int i = 0; i < 3; i++) {
+        float k = h + 5 - 2 * i;
+        k = k >= 6 ? k - 6 : k;
+        float fall = std::max(0.0f, std::min(1.0f, std::min(k, 4 - k)));
+        channels[i] = (v - v * s * fall) * 255 + 0.5f;
+    }
+    return packRgba(clampChannel((int) channels[0]), clampChannel((int) channels[1]), clampChannel((int) channels[2]),
+                    rgbaAlpha(color));
+}
+
+//-Private-//
+
+/**
+ * Runs the chain over rows y0 to y1 in band's scratch rows. Rows at or
+ * past keptY that are still in kept are read from there, the rest from
+ * pixels; rows off the canvas read as transparent.
+ */
+void FilterPipeline::process(const PixelBuffer& pixels, const std::vector<Rgba>& kept, int keptY,
+                             int y0, int y1, Band& band) const {
+    Tracer::Zone zone("filter_band");
+    int width = pixels.width();
+    int height = pixels.height();
+    int top = y0 - m_halo;
+    int rowCount = y1 - y0 + 2 * m_halo;
+    int keptRows = (int) (kept.size() / width);
+    for(int i = 0; i < 2; i++) {
+        band.rows[i].resize((size_t) rowCount * width);
+    }
+    for(int i = 0; i < rowCount; i++) {
+        int y = top + i;
+        Rgba* row = &band.rows[0][(size_t) i * width];
+        if(y < 0 || y >= height) {
+            PixelBuffer::fillSpan(row, width, 0);
+            PixelBuffer::fillSpan(&band.rows[1][(size_t) i * width], width, 0);
+        } else if(y >= keptY && y < keptY + keptRows) {
+            memcpy(row, &kept[(size_t) (y - keptY) * width], width * sizeof(Rgba));
+        } else {
+            memcpy(row, pixels.row(y), width * sizeof(Rgba));
+        }
+    }
+
+    // Rows [first, last) hold valid input for the next filter; only the
+    // ones on the canvas are ever written.
+    int first = 0;
+    int last = rowCount;
+    int onCanvas = std::max(0, -top);
+    int offCanvas = std::min(rowCount, height - top);
+    int current = 0;
+    for(size_t f = 0; f < m_filters.size(); f++) {
+        const Filter& filter = m_filters[f];
+        int radius = filter.radius();
+        std::vector<Rgba>& in = band.rows[current];
+        std::vector<Rgba>& out = band.rows[1 - current];
+        int begin = std::max(first + radius, onCanvas);
+        int end = std::min(last - radius, offCanvas);
+        if(filter.type == Filter::ADJUST_HSV || filter.type == Filter::DITHER) {
+            band.cache.resize(CACHE_SIZE * 2);
+            Rgba zero = mapColor(filter, 0);
+            for(int i = 0; i < CACHE_SIZE; i++) {
+                band.cache[i * 2] = 0;
+                band.cache[i * 2 + 1] = zero;
+            }
+        }
+        for(int i = begin; i < end; i++) {
+            Rgba* row = &in[(size_t) i * width];
+            switch(filter.type) {
+                case Filter::REPLACE_COLOR:
+                    replaceRow(row, width, filter.from, filter.color);
+                break;
+
+                case Filter::ADJUST_HSV:
+                case Filter::DITHER:
+                    mapRow(filter, row, width, top + i, band.cache);
+                break;
+
+                case Filter::OUTLINE:
+                    outlineRow(row - width, row, row + width, &out[(size_t) i * width], width, filter.color);
+                break;
+
+                case Filter::DROP_SHADOW:
+                    shadowRow(row, row - (ptrdiff_t) filter.dy * width, &out[(size_t) i * width], width,
+                              filter.dx, filter.color);
+                break;
+            }
+        }
+        if(radius > 0) {
+            current = 1 - current;
+            first += radius;
+            last -= radius;
+        }
+    }
+    band.output = current;
+}
+
+/**
+ * Writes the bixels of row that differ from row y of pixels and are
+ * selected, touching them in history first.
+ *
+ * @return  The number of bixels written.
+ */
+size_t FilterPipeline::commit(PixelBuffer& pixels, const Selection* selection, History* history,
+                              int y, const Rgba* row) {
+    Rgba* target = pixels.row(y);
+    size_t changed = 0;
+    auto commitSpan = [&](int begin, int end) {
+        end = std::min(end, pixels.width());
+        int x = nextChange(target, row, begin, end);
+        while(x < end) {
+            int runEnd = nextSame(target, row, x, end);
+            if(history) {
+                history->touch(pixels, x, y, runEnd - x);
+            }
+            memcpy(target + x, row + x, (runEnd - x) * sizeof(Rgba));
+            pixels.markDirty(x, y, runEnd - x, 1);
+            changed += runEnd - x;
+            x = nextChange(target, row, runEnd, end);
+        }
+    };
+    if(selection) {
+        if(y < selection->height()) {
+            selection->forEachSpanInRow(y, [&](int x, int, int length) { commitSpan(x, x + length); });
+        }
+    } else {
+        commitSpan(0, pixels.width());
+    }
+    return changed;
+}
+
+void FilterPipeline::replaceRow(Rgba* row, int width, Rgba from, Rgba to) {
+    int x = 0;
+#ifdef __SSE2__
+    __m128i match = _mm_set1_epi32((int) from);
+    __m128i replacement = _mm_set1_epi32((int) to);
+    for(; x + 4 <= width; x += 4) {
+        __m128i v = load(row + x);
+        store(row + x, select(_mm_cmpeq_epi32(v, match), replacement, v));
+    }
+#endif
+    for(; x < width; x++) {
+        if(row[x] == from) {
+            row[x] = to;
+        }
+    }
+}
+
+/**
+ * A transparent bixel with an opaque one left, right, above or below it
+ * becomes color. Bixels past the ends of the row count as transparent.
+ */
+void FilterPipeline::outlineRow(const Rgba* above, const Rgba* row, const Rgba* below, Rgba* out,
+                                int width, Rgba color) {
+    auto outline = [&](int x) {
+        bool edge = (x > 0 && !isTransparent(row[x - 1])) || (x + 1 < width && !isTransparent(row[x + 1]))
+                 || !isTransparent(above[x]) || !isTransparent(below[x]);
+        out[x] = isTransparent(row[x]) && edge ? color : row[x];
+    };
+    if(width > 0) {
+        outline(0);
+    }
+    int x = 1;
+#ifdef __SSE2__
+    __m128i outlineColor = _mm_set1_epi32((int) color);
+    for(; x + 5 <= width; x += 4) {
+        __m128i center = load(row + x);
+        __m128i clear = _mm_and_si128(transparentLanes(load(row + x - 1)), transparentLanes(load(row + x + 1)));
+        clear = _mm_and_si128(clear, _mm_and_si128(transparentLanes(load(above + x)), transparentLanes(load(below + x))));
+        __m128i edge = _mm_andnot_si128(clear, transparentLanes(center));
+        store(out + x, select(edge, outlineColor, center));
+    }
+#endif
+    for(; x < width; x++) {
+        outline(x);
+    }
+}
+
+/**
+ * A transparent bixel whose source, dx bixels to the left in the source
+ * row, is opaque becomes color.
+ */
+void FilterPipeline::shadowRow(const Rgba* row, const Rgba* source, Rgba* out, int width, int dx, Rgba color) {
+    int begin = std::max(0, dx);
+    int end = std::min(width, width + dx);
+    auto shadow = [&](int x) {
+        bool cast = x >= begin && x < end && !isTransparent(source[x - dx]);
+        out[x] = isTransparent(row[x]) && cast ? color : row[x];
+    };
+    int x = 0;
+    for(; x < begin; x++) {
+        shadow(x);
+    }
+#ifdef __SSE2__
+    __m128i shadowColor = _mm_set1_epi32((int) color);
+    for(; x + 4 <= end; x += 4) {
+        __m128i center = load(row + x);
+        __m128i cast = _mm_andnot_si128(transparentLanes(load(source + x - dx)), transparentLanes(center));
+        store(out + x, select(cast, shadowColor, center));
+    }
+#endif
+    for(; x < width; x++) {
+        shadow(x);
+    }
+}
+
+/**
+ * Maps every visible bixel of row through the filter's color function,
+ * looking colors up in cache first. Dithering moves each color by its
+ * Bayer threshold before the lookup.
+ */
+void FilterPipeline::mapRow(const Filter& filter, Rgba* row, int width, int y, std::vector<Rgba>& cache) {
+    bool dithering = filter.type == Filter::DITHER;
+    if(dithering && filter.palette.empty()) {
+        return;
+    }
+    for(int x = 0; x < width; x++) {
+        Rgba key = row[x];
+        if(isTransparent(key)) {
+            continue;
+        }
+        if(dithering) {
+            int offset = (BAYER[y & 3][x & 3] * 2 + 1) * filter.spread / 32 - filter.spread / 2;
+            key = packRgba(clampChannel(rgbaRed(key) + offset), clampChannel(rgbaGreen(key) + offset),
+                           clampChannel(rgbaBlue(key) + offset), rgbaAlpha(key));
+        }
+        Rgba* entry = &cache[hashColor(key) * 2];
+        if(entry[0] != key) {
+            entry[0] = key;
+            entry[1] = mapColor(filter, key);
+        }
+        row[x] = entry[1];
+    }
+}
+
+/**
+ * The color function of ADJUST_HSV and DITHER filters. Dithering takes
+ * the palette color nearest in red, green and blue, keeping alpha.
+ */
+Rgba FilterPipeline::mapColor(const Filter& filter, Rgba key) {
+    if(filter.type == Filter::ADJUST_HSV) {
+        return adjustHsv(key, filter.hue, filter.saturation, filter.value);
+    }
+    if(filter.palette.empty()) {
+        return key;
+    }
+    Rgba best = filter.palette[0];
+    int bestDistance = -1;
+    for(size_t i = 0; i < filter.palette.size(); i++) {
+        Rgba color = filter.palette[i];
+        int dr = rgbaRed(color) - rgbaRed(key);
+        int dg = rgbaGreen(color) - rgbaGreen(key);
+        int db = rgbaBlue(color) - rgbaBlue(key);
+        int distance = dr * dr + dg * dg + db * db;
+        if(bestDistance < 0 || distance < bestDistance) {
+            best = color;
+            bestDistance = distance;
+        }
+    }
+    return (best & ~ALPHA_MASK) | (key & ALPHA_MASK);
+}
+
+/**
+ * @return  The first x from x to end where a and b differ, or end.
+ */
+int FilterPipeline::nextChange(const Rgba* a, const Rgba* b, int x, int end) {
+#ifdef __SSE2__
+    for(; x + 4 <= end; x += 4) {
+        if(_mm_movemask_epi8(_mm_cmpeq_epi32(load(a + x), load(b + x))) != 0xFFFF) {
+            break;
+        }
+    }
+#endif
+    while(x < end && a[x] == b[x]) {
+        x++;
+    }
+    return x;
+}
+
+/**
+ * @return  The first x from x to end where a and b are equal, or end.
+ */
+int FilterPipeline::nextSame(const Rgba* a, const Rgba* b, int x, int end) {
+#ifdef __SSE2__
+    for(; x + 4 <= end; x += 4) {
+        if(_mm_movemask_epi8(_mm_cmpeq_epi32(load(a + x), load(b + x))) != 0) {
+            break;
+        }
+    }
+#endif
+    while(x < end && a[x] != b[x]) {
+        x++;
+    }
+    return x;
+}
@@ -0,0 +1,110 @@
+#ifndef FILTERPIPELINE_HPP
+#define FILTERPIPELINE_HPP
+#include <string>
+#include <vector>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "selection.hpp"
+#include "history.hpp"
+#include "threadpool.hpp"
+
+/**
+ * Runs a chain of filters over the whole canvas or the selected bixels.
+ *
+ * The canvas is cut into bands of BAND_ROWS rows, processed in parallel.
+ * A band copies its rows, plus as many rows above and below as the
+ * chain's neighbourhood filters reach, into a scratch buffer and runs
+ * every filter over it in turn: per bixel filters in place, the others
+ * into a second scratch buffer. Chaining filters therefore never makes
+ * a copy of the canvas. Color replacement, outlines and shadows work
+ * on 4 bixels at a time with SSE2; HSV adjustment and dithering, which
+ * map colors rather than bixels, remember recent colors per band.
+ *
+ * Finished bands are written back in order by the calling thread, one
+ * wave of bands at a time, and only the bixels that changed, and are
+ * selected, are touched in the history, so an application is one small
+ * undo step. The last rows of a wave are kept before they are written,
+ * because the next wave's filters still read them.
+ *
+ * Filters see the result of the filter before them on every bixel; the
+ * selection only limits which bixels are written.
+ */
+class FilterPipeline {
+    public:
+        struct Filter {
+            enum Type {
+                REPLACE_COLOR,  ///< from becomes color
+                ADJUST_HSV,     ///< hue turned by hue degrees, saturation and value scaled
+                OUTLINE,        ///< Transparent bixels next to opaque ones become color
+                DROP_SHADOW,    ///< Transparent bixels dx, dy from opaque ones become color
+                DITHER          ///< Ordered dither to palette, spread wide
+            };
+
+            Type type;
+            Rgba from;
+            Rgba color;
+            float hue;
+            float saturation;
+            float value;
+            int dx;
+            int dy;
+            int spread;
+            std::vector<Rgba> palette;
+
+            Filter();
+            int radius() const;
+
+            static Filter replaceColor(Rgba from, Rgba to);
+            static Filter adjustHsv(float hue, float saturation, float value);
+            static Filter outline(Rgba color);
+            static Filter dropShadow(Rgba color, int dx, int dy);
+            static Filter dither(const std::vector<Rgba>& palette, int spread = 32);
+            static bool parse(const std::string& text, Filter& filter);
+        };
+
+        static const int BAND_ROWS = 32;
+        static const int MAX_RADIUS = 16;
+
+        FilterPipeline(ThreadPool* pool = 0);
+        ~FilterPipeline();
+
+        void add(const Filter& filter);
+        void clear();
+        bool isEmpty() const;
+        const std::vector<Filter>& filters() const;
+
+        size_t apply(PixelBuffer& pixels, const Selection* selection, History* history);
+
+        static Rgba adjustHsv(Rgba color, float hue, float saturation, float value);
+
+    private:
+        struct Band {
+            std::vector<Rgba> rows[2];
+            std::vector<Rgba> cache;
+            int output;     ///< Which of rows holds the result
+        };
+
+        FilterPipeline(const FilterPipeline&);
+        FilterPipeline& operator=(const FilterPipeline&);
+
+        void process(const PixelBuffer& pixels, const std::vector<Rgba>& kept, int keptY,
+                     int y0, int y1, Band& band) const;
+        static size_t commit(PixelBuffer& pixels, const Selection* selection, History* history,
+                             int y, const Rgba* row);
+
+        static void replaceRow(Rgba* row, int width, Rgba from, Rgba to);
+        static void outlineRow(const Rgba* above, const Rgba* row, const Rgba* below, Rgba* out,
+                               int width, Rgba color);
+        static void shadowRow(const Rgba* row, const Rgba* source, Rgba* out, int width, int dx, Rgba color);
+        static void mapRow(const Filter& filter, Rgba* row, int width, int y, std::vector<Rgba>& cache);
+        static Rgba mapColor(const Filter& filter, Rgba key);
+        static int nextChange(const Rgba* a, const Rgba* b, int x, int end);
+        static int nextSame(const Rgba* a, const Rgba* b, int x, int end);
+
+        ThreadPool* m_pool;
+        bool m_ownsPool;
+        std::vector<Filter> m_filters;
+        int m_halo;
+        std::vector<Band> m_bands;
+};
+#endif
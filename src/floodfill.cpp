@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <algorithm>
+#include "floodfill.hpp"
+#include "tracer.hpp"
+
+namespace {
+    int channelDistance(Rgba a, Rgba b) {
+        int distance = 0;
+        for(int shift = 0; shift < 32; shift += 8) {
+            distance = std::max(distance, abs((int) ((a >> shift) & 0xFF) - (int) ((b >> shift) & 0xFF)));
+        }
+        return distance;
+    }
+};
+
+FloodFill::FloodFill() :
+    m_connectivity(FOUR), m_tolerance(0), m_constraint(0), m_seed(0) {
+}
+
+/**
+ * FOUR joins bixels through edges only, EIGHT through corners as well.
+ */
+void FloodFill::setConnectivity(Connectivity connectivity) {
+    m_connectivity = connectivity;
+}
+
+FloodFill::Connectivity FloodFill::connectivity() const {
+    return m_connectivity;
+}
+
+/**
+ * @param tolerance     The largest per channel difference from the seed
+ *                      color, 0 (exact) to 255 (everything).
+ */
+void FloodFill::setTolerance(int tolerance) {
+    m_tolerance = std::max(0, std::min(255, tolerance));
+}
+
+int FloodFill::tolerance() const {
+    return m_tolerance;
+}
+
+/**
+ * Keeps fills inside constraint, usually the current selection. 0
+ * removes the constraint. The selection must outlive the fills.
+ */
+void FloodFill::setConstraint(const Selection* constraint) {
+    m_constraint = constraint;
+}
+
+/**
+ * Finds the region a fill started at (x, y) would cover.
+ *
+ * @param region    Receives the region, resized to the canvas.
+ *
+ * @return          false if (x, y) is off the canvas or outside the
+ *                  constraint, leaving region empty.
+ */
+bool FloodFill::findRegion(const PixelBuffer& pixels, int x, int y, Selection& region) {
+    region.resize(pixels.width(), pixels.height());
+    region.clear();
+    if(!pixels.contains(x, y) || (m_constraint && !m_constraint->contains(x, y))) {
+        return false;
+    }
+
+    m_seed = pixels.pixel(x, y);
+    m_stack.clear();
+
+    scanRow(pixels, region, x, x, y);
+
+    int reach = m_connectivity == EIGHT ? 1 : 0;
+    while(!m_stack.empty()) {
+        Span span = m_stack.back();
+        m_stack.pop_back();
+        int scanLeft = std::max(0, span.left - reach);
+        int scanRight = std::min(pixels.width() - 1, span.right + reach);
+        if(span.y > 0) {
+            scanRow(pixels, region, scanLeft, scanRight, span.y - 1);
+        }
+        if(span.y + 1 < pixels.height()) {
+            scanRow(pixels, region, scanLeft, scanRight, span.y + 1);
+        }
+    }
+    return true;
+}
+
+/**
+ * Fills the region around (x, y) with color.
+ *
+ * @param history   If given, the fill is recorded as one undo step.
+ *
+ * @return          The number of bixels filled.
+ */
+size_t FloodFill::fill(PixelBuffer& pixels, int x, int y, Rgba color, History* history) {
+    Tracer::Zone zone("flood_fill");
+    if(!findRegion(pixels, x, y, m_region)) {
+        return 0;
+    }
+    if(m_tolerance == 0 && m_seed == color) {
+        return 0;
+    }
+
+    if(history) {
+        history->endStep();
+        history->touchSelection(pixels, m_region);
+    }
+    m_region.fillPixels(pixels, color);
+    if(history) {
+        history->endStep();
+    }
+    return m_region.count();
+}
+
+//-Private-//
+
+inline bool FloodFill::isSimilar(Rgba color) const {
+    return color == m_seed || (m_tolerance > 0 && channelDistance(color, m_seed) <= m_tolerance);
+}
+
+inline bool FloodFill::matches(const PixelBuffer& pixels, const Selection& region, int x, int y) const {
+    return isSimilar(pixels.row(y)[x]) && !region.contains(x, y)
+        && (!m_constraint || m_constraint->contains(x, y));
+}
+
+/**
+ * Adds the spans of row y that touch [left, right] to the region and
+ * pushes them. Bixels already in the region are skipped a word at a
+ * time.
+ */
+void FloodFill::scanRow(const PixelBuffer& pixels, Selection& region, int left, int right, int y) {
+    const Rgba* row = pixels.row(y);
+    int x = left;
+    while(x <= right) {
+        if(region.contains(x, y)) {
+            x = region.nextUnselected(x, y);
+            continue;
+        }
+        if(!matches(pixels, region, x, y)) {
+            x++;
+            continue;
+        }
+
+        // Spans in the region are maximal, so a run can only continue
+        // left of where the scan started, and it ends at the next bixel
+        // already in the region or outside the constraint.
+        int start = x;
+        if(x == left) {
+            while(start > 0 && matches(pixels, region, start - 1, y)) {
+                start--;
+            }
+        }
+        int limit = region.nextSelected(x, y);
+        if(m_constraint) {
+            limit = std::min(limit, m_constraint->nextUnselected(x, y));
+        }
+        int end = x + 1;
+        while(end < limit && isSimilar(row[end])) {
+            end++;
+        }
+        region.setSpan(start, y, end - start);
+        m_stack.push_back(Span { start, end - 1, y });
+        x = end + 1;
+    }
+}
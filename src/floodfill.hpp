@@ -0,0 +1,56 @@
+#ifndef FLOODFILL_HPP
+#define FLOODFILL_HPP
+#include <vector>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "selection.hpp"
+#include "history.hpp"
+
+/**
+ * Scanline flood fill, the engine behind the PAINTBUCKET tool.
+ *
+ * The region grows a row span at a time: a span is extended left and
+ * right as far as the colors match, then the rows above and below are
+ * scanned over its extent for new spans, which go on an explicit stack.
+ * The region found so far is kept in a Selection, which doubles as the
+ * visited set, so every bixel is tested a bounded number of times and
+ * memory is one bit per bixel plus the stack, never a recursion.
+ *
+ * A bixel matches when every channel is within tolerance() of the seed
+ * bixel. With a constraint set (see setConstraint()) the region never
+ * leaves that selection.
+ */
+class FloodFill {
+    public:
+        enum Connectivity { FOUR = 4, EIGHT = 8 };
+
+        FloodFill();
+
+        void setConnectivity(Connectivity connectivity);
+        Connectivity connectivity() const;
+        void setTolerance(int tolerance);
+        int tolerance() const;
+        void setConstraint(const Selection* constraint);
+
+        bool findRegion(const PixelBuffer& pixels, int x, int y, Selection& region);
+        size_t fill(PixelBuffer& pixels, int x, int y, Rgba color, History* history = 0);
+
+    private:
+        struct Span {
+            int left;
+            int right;  ///< Inclusive
+            int y;
+        };
+
+        bool isSimilar(Rgba color) const;
+        bool matches(const PixelBuffer& pixels, const Selection& region, int x, int y) const;
+        void scanRow(const PixelBuffer& pixels, Selection& region, int left, int right, int y);
+
+        Connectivity m_connectivity;
+        int m_tolerance;
+        const Selection* m_constraint;
+        Rgba m_seed;
+        std::vector<Span> m_stack;
+        Selection m_region;
+};
+#endif
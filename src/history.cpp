@@ -0,0 +1,349 @@
+#include <algorithm>
+#include "history.hpp"
+#include "tracer.hpp"
+
+History::Step::Step() :
+    resize(false), widthBefore(0), heightBefore(0), widthAfter(0), heightAfter(0) {}
+
+size_t History::Step::byteSize() const {
+    return sizeof(Step)
+         + spans.size() * sizeof(Span)
+         + values.size() * sizeof(Rgba)
+         + selectionFlips.size() * sizeof(Selection::Run);
+}
+
+bool History::Step::isEmpty() const {
+    return !resize && !undoAction && spans.empty() && selectionFlips.empty();
+}
+
+/**
+ * Empties the step, keeping the capacity of its buffers.
+ */
+void History::Step::clear() {
+    spans.clear();
+    values.clear();
+    selectionFlips.clear();
+    resize = false;
+    widthBefore = heightBefore = widthAfter = heightAfter = 0;
+    undoAction = Action();
+    redoAction = Action();
+}
+
+History::History(size_t byteBudget) : m_byteBudget(byteBudget), m_byteSize(0) {}
+
+/**
+ * Sets the most memory, in bytes, that undo and redo steps may use.
+ * Oldest steps are dropped immediately if the history is already larger.
+ */
+void History::setByteBudget(size_t byteBudget) {
+    m_byteBudget = byteBudget;
+    evict();
+}
+
+size_t History::byteBudget() const {
+    return m_byteBudget;
+}
+
+size_t History::byteSize() const {
+    return m_byteSize;
+}
+
+void History::clear() {
+    m_undo.clear();
+    m_redo.clear();
+    m_current.clear();
+    clearCovered();
+    m_byteSize = 0;
+}
+
+/**
+ * Saves the current values of length bixels starting at (x, y) so they
+ * can be restored on undo. Must be called before the bixels are changed.
+ * Parts of the span already touched in the current step are skipped.
+ */
+void History::touch(const PixelBuffer& pixels, int x, int y, int length) {
+    if(y < 0 || y >= pixels.height()) {
+        return;
+    }
+    int begin = std::max(0, x);
+    int end = std::min(pixels.width(), x + length);
+    if(begin >= end) {
+        return;
+    }
+
+    if((int) m_covered.size() < pixels.height()) {
+        m_covered.resize(pixels.height());
+    }
+    std::vector<Range>& covered = m_covered[y];
+    if(covered.empty()) {
+        m_coveredRows.push_back(y);
+    }
+    std::vector<Range>::iterator first = covered.begin();
+    while(first != covered.end() && first->end < begin) {
+        first++;
+    }
+
+    Range merged = { begin, end };
+    int cursor = begin;
+    std::vector<Range>::iterator last = first;
+    while(last != covered.end() && last->begin <= end) {
+        if(last->begin > cursor) {
+            storeSpan(pixels, cursor, y, last->begin - cursor);
+        }
+        cursor = std::max(cursor, last->end);
+        merged.begin = std::min(merged.begin, last->begin);
+        merged.end = std::max(merged.end, last->end);
+        last++;
+    }
+    if(cursor < end) {
+        storeSpan(pixels, cursor, y, end - cursor);
+    }
+
+    first = covered.erase(first, last);
+    covered.insert(first, merged);
+}
+
+void History::touchRect(const PixelBuffer& pixels, int x, int y, int width, int height) {
+    for(int row = std::max(0, y); row < std::min(pixels.height(), y + height); row++) {
+        touch(pixels, x, row, width);
+    }
+}
+
+/**
+ * Touches every selected bixel, for edits such as fills that write
+ * through the selection.
+ */
+void History::touchSelection(const PixelBuffer& pixels, const Selection& selection) {
+    m_current.values.reserve(m_current.values.size() + selection.count());
+    selection.forEachSpan([this, &pixels](int x, int y, int length) {
+        touch(pixels, x, y, length);
+    });
+}
+
+/**
+ * Records a selection change as the runs of bixels whose membership
+ * flipped. before and after must have the same size.
+ */
+void History::selectionChanged(const Selection& before, const Selection& after) {
+    before.differenceRuns(after, m_flips);
+    m_current.selectionFlips.insert(m_current.selectionFlips.end(), m_flips.begin(), m_flips.end());
+}
+
+/**
+ * Records that the canvas is about to be resized to newWidth x newHeight.
+ * Only the bixels that fall outside the new size are saved, and with
+ * selection, the selected runs among them. A resize is always a step of
+ * its own; undo and redo resize the selection along with the canvas.
+ */
+void History::resized(const PixelBuffer& pixels, int newWidth, int newHeight, const Selection* selection) {
+    endStep();
+
+    Step& step = m_current;
+    step.resize = true;
+    step.widthBefore = pixels.width();
+    step.heightBefore = pixels.height();
+    step.widthAfter = newWidth;
+    step.heightAfter = newHeight;
+
+    for(int y = 0; y < pixels.height(); y++) {
+        if(y >= newHeight) {
+            storeSpan(pixels, 0, y, pixels.width());
+        } else if(newWidth < pixels.width()) {
+            storeSpan(pixels, newWidth, y, pixels.width() - newWidth);
+        }
+    }
+    for(int y = 0; selection && y < selection->height(); y++) {
+        selection->forEachSpanInRow(y, [&](int x, int, int length) {
+            int end = x + length;
+            x = y >= newHeight ? x : std::max(x, newWidth);
+            if(x < end) {
+                Selection::Run run = { x, y, end - x };
+                step.selectionFlips.push_back(run);
+            }
+        });
+    }
+    endStep();
+}
+
+/**
+ * Records an edit that was just applied as a step of its own, undone
+ * and redone by calling undo or redo on the canvas and selection. Both
+ * must stay valid as long as the history holds the step.
+ */
+void History::recordAction(const Action& undo, const Action& redo) {
+    endStep();
+    m_current.undoAction = undo;
+    m_current.redoAction = redo;
+    endStep();
+}
+
+/**
+ * Closes the current step, making it a single entry for undo().
+ * Does nothing if nothing was recorded since the last step.
+ */
+void History::endStep() {
+    clearCovered();
+    if(m_current.isEmpty()) {
+        return;
+    }
+    push(m_current);
+    m_current.clear();
+}
+
+bool History::canUndo() const {
+    return !m_undo.empty() || !m_current.isEmpty();
+}
+
+bool History::canRedo() const {
+    return !m_redo.empty() && m_current.isEmpty();
+}
+
+size_t History::undoCount() const {
+    return m_undo.size() + (m_current.isEmpty() ? 0 : 1);
+}
+
+size_t History::redoCount() const {
+    return m_redo.size();
+}
+
+/**
+ * Reverts the most recent step.
+ *
+ * @return  false if there was nothing to undo.
+ */
+bool History::undo(PixelBuffer& pixels, Selection& selection) {
+    Tracer::Zone zone("undo");
+    endStep();
+    if(m_undo.empty()) {
+        return false;
+    }
+
+    Step& step = m_undo.back();
+    if(step.undoAction) {
+        step.undoAction(pixels, selection);
+    } else if(step.resize) {
+        pixels.resize(step.widthBefore, step.heightBefore);
+        selection.resize(step.widthBefore, step.heightBefore);
+        for(size_t i = 0; i < step.spans.size(); i++) {
+            const Span& span = step.spans[i];
+            std::copy(step.values.begin() + span.offset,
+                      step.values.begin() + span.offset + span.length,
+                      pixels.row(span.y) + span.x);
+            pixels.markDirty(span.x, span.y, span.length, 1);
+        }
+    } else {
+        swapSpans(step, pixels);
+    }
+    flipSelection(step, selection);
+
+    m_redo.push_back(Step());
+    std::swap(m_redo.back(), step);
+    m_undo.pop_back();
+    return true;
+}
+
+/**
+ * Reapplies the most recently undone step.
+ *
+ * @return  false if there was nothing to redo.
+ */
+bool History::redo(PixelBuffer& pixels, Selection& selection) {
+    Tracer::Zone zone("redo");
+    endStep();
+    if(m_redo.empty()) {
+        return false;
+    }
+
+    Step& step = m_redo.back();
+    if(step.redoAction) {
+        step.redoAction(pixels, selection);
+    } else if(step.resize) {
+        // The flips are the selected runs cut off by the resize.
+        flipSelection(step, selection);
+        pixels.resize(step.widthAfter, step.heightAfter);
+        selection.resize(step.widthAfter, step.heightAfter);
+    } else {
+        swapSpans(step, pixels);
+    }
+    if(!step.resize) {
+        flipSelection(step, selection);
+    }
+
+    m_undo.push_back(Step());
+    std::swap(m_undo.back(), step);
+    m_redo.pop_back();
+    return true;
+}
+
+//-Private-//
+
+void History::storeSpan(const PixelBuffer& pixels, int x, int y, int length) {
+    std::vector<Span>& spans = m_current.spans;
+    if(!spans.empty() && spans.back().y == y && spans.back().x + spans.back().length == x) {
+        // Continues the last span, whose values are the last stored
+        spans.back().length += length;
+    } else {
+        Span span = { x, y, length, m_current.values.size() };
+        spans.push_back(span);
+    }
+    const Rgba* row = pixels.row(y) + x;
+    m_current.values.insert(m_current.values.end(), row, row + length);
+}
+
+/**
+ * Forgets which bixels the current step has touched, keeping the
+ * buffers of the rows that were used.
+ */
+void History::clearCovered() {
+    for(size_t i = 0; i < m_coveredRows.size(); i++) {
+        m_covered[m_coveredRows[i]].clear();
+    }
+    m_coveredRows.clear();
+}
+
+/**
+ * Exchanges the stored bixels of step with the canvas. Spans within a
+ * step never overlap, so the same call serves undo and redo.
+ */
+void History::swapSpans(Step& step, PixelBuffer& pixels) {
+    for(size_t i = 0; i < step.spans.size(); i++) {
+        const Span& span = step.spans[i];
+        if(span.y >= pixels.height() || span.x + span.length > pixels.width()) {
+            continue;
+        }
+        std::swap_ranges(step.values.begin() + span.offset,
+                         step.values.begin() + span.offset + span.length,
+                         pixels.row(span.y) + span.x);
+        pixels.markDirty(span.x, span.y, span.length, 1);
+    }
+}
+
+void History::flipSelection(const Step& step, Selection& selection) {
+    for(size_t i = 0; i < step.selectionFlips.size(); i++) {
+        const Selection::Run& run = step.selectionFlips[i];
+        selection.flipSpan(run.x, run.y, run.length);
+    }
+}
+
+/**
+ * Moves a copy of step, sized to fit, onto the undo list. step keeps
+ * its buffers for the next recording.
+ */
+void History::push(const Step& step) {
+    for(size_t i = 0; i < m_redo.size(); i++) {
+        m_byteSize -= m_redo[i].byteSize();
+    }
+    m_redo.clear();
+
+    m_undo.push_back(step);
+    m_byteSize += m_undo.back().byteSize();
+    evict();
+    Tracer::counter("history_bytes", m_byteSize);
+}
+
+void History::evict() {
+    while(m_byteSize > m_byteBudget && m_undo.size() > 1) {
+        m_byteSize -= m_undo.front().byteSize();
+        m_undo.pop_front();
+    }
+}
@@ -0,0 +1,113 @@
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+#include <deque>
+#include <functional>
+#include <vector>
+#include <stddef.h>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "selection.hpp"
+
+/**
+ * Undo/redo history that stores what an edit changed instead of a copy
+ * of the whole canvas.
+ *
+ * An edit is recorded by calling touch() on every span of bixels
+ * *before* writing to it, and selectionChanged() when the selection
+ * changes, then closing the step with endStep(). Only the first touch
+ * of a bixel within a step saves its old value, so brushing back and
+ * forth over the same bixels costs nothing extra.
+ *
+ * Stored bixels are swapped with the canvas on undo and swapped back on
+ * redo, and selection changes are kept as runs of flipped bixels,
+ * so both directions cost time proportional to the size of the change.
+ *
+ * Edits that can be reversed exactly by computation, such as rotating
+ * the whole canvas, are recorded with recordAction() as a pair of
+ * functions instead of stored bixels, however large the canvas.
+ *
+ * When the recorded steps exceed the byte budget the oldest ones are
+ * dropped. The most recent step is always kept.
+ *
+ * The step being recorded and the record of which bixels it has
+ * touched keep their buffers between steps, so once they have grown to
+ * the size of a typical edit, recording allocates only when a step is
+ * closed and copied into the undo list.
+ */
+class History {
+    public:
+        typedef std::function<void(PixelBuffer& pixels, Selection& selection)> Action;
+
+        static const size_t DEFAULT_BYTE_BUDGET = 256 * 1024 * 1024;
+
+        History(size_t byteBudget = DEFAULT_BYTE_BUDGET);
+
+        void setByteBudget(size_t byteBudget);
+        size_t byteBudget() const;
+        size_t byteSize() const;
+        void clear();
+
+        void touch(const PixelBuffer& pixels, int x, int y, int length);
+        void touchRect(const PixelBuffer& pixels, int x, int y, int width, int height);
+        void touchSelection(const PixelBuffer& pixels, const Selection& selection);
+        void selectionChanged(const Selection& before, const Selection& after);
+        void resized(const PixelBuffer& pixels, int newWidth, int newHeight, const Selection* selection = 0);
+        void recordAction(const Action& undo, const Action& redo);
+        void endStep();
+
+        bool canUndo() const;
+        bool canRedo() const;
+        size_t undoCount() const;
+        size_t redoCount() const;
+
+        bool undo(PixelBuffer& pixels, Selection& selection);
+        bool redo(PixelBuffer& pixels, Selection& selection);
+
+    private:
+        struct Span {
+            int x;
+            int y;
+            int length;
+            size_t offset;  ///< Index of the first stored value in Step::values
+        };
+
+        struct Range {
+            int begin;
+            int end;
+        };
+
+        struct Step {
+            std::vector<Span> spans;
+            std::vector<Rgba> values;
+            std::vector<Selection::Run> selectionFlips;
+            bool resize;
+            int widthBefore;
+            int heightBefore;
+            int widthAfter;
+            int heightAfter;
+            Action undoAction;
+            Action redoAction;
+
+            Step();
+            size_t byteSize() const;
+            bool isEmpty() const;
+            void clear();
+        };
+
+        void storeSpan(const PixelBuffer& pixels, int x, int y, int length);
+        void clearCovered();
+        void swapSpans(Step& step, PixelBuffer& pixels);
+        void flipSelection(const Step& step, Selection& selection);
+        void push(const Step& step);
+        void evict();
+
+        std::deque<Step> m_undo;
+        std::deque<Step> m_redo;
+        Step m_current;
+        std::vector<std::vector<Range> > m_covered;  ///< Touched ranges of each row in m_current
+        std::vector<int> m_coveredRows;              ///< Rows with entries in m_covered
+        std::vector<Selection::Run> m_flips;
+        size_t m_byteBudget;
+        size_t m_byteSize;
+};
+#endif
@@ -0,0 +1,302 @@
+#include <math.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef QT_GUI_LIB
+#include <QImage>
+#include <QImageReader>
+#include <QString>
+#endif
+#include "imageimporter.hpp"
+#include "indexedimage.hpp"
+#include "quantizer.hpp"
+#include "tracer.hpp"
+
+namespace {
+    // Rows of the grid per task; fewer and the source rows shared by
+    // neighbouring chunks are reduced too often.
+    const int MIN_CHUNK_ROWS = 4;
+
+    inline int toChannel(float value) {
+        return std::min(255, (int) (value + 0.5f));
+    }
+
+#ifdef __SSE2__
+    /**
+     * Unpacks one pixel to float lanes in memory order, premultiplied
+     * and scaled so every pixel's alpha lane is 255 * alpha.
+     */
+    inline __m128 loadPixel(uint32_t pixel, bool premultiplied) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i lanes = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero), zero);
+        __m128 value = _mm_cvtepi32_ps(lanes);
+        if(premultiplied) {
+            return _mm_mul_ps(value, _mm_set1_ps(255));
+        }
+        const __m128 colorLanes = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+        __m128 alpha = _mm_shuffle_ps(value, value, _MM_SHUFFLE(3, 3, 3, 3));
+        __m128 factor = _mm_or_ps(_mm_and_ps(colorLanes, alpha), _mm_set_ps(255, 0, 0, 0));
+        return _mm_mul_ps(value, factor);
+    }
+#else
+    inline void addPixel(uint32_t pixel, bool premultiplied, float weight, float* sum) {
+        float alpha = (float) (pixel >> 24);
+        float colorFactor = weight * (premultiplied ? 255 : alpha);
+        sum[0] += colorFactor * (pixel & 0xFF);
+        sum[1] += colorFactor * ((pixel >> 8) & 0xFF);
+        sum[2] += colorFactor * ((pixel >> 16) & 0xFF);
+        sum[3] += weight * 255 * alpha;
+    }
+#endif
+};
+
+/**
+ * @param bytesPerLine      Distance between the starts of rows.
+ * @param swapRedBlue       true for pixels stored B, G, R, A in memory,
+ *                          like QImage::Format_ARGB32 on little-endian
+ *                          hosts.
+ * @param premultiplied     true if color is already multiplied by alpha.
+ */
+ImageImporter::Source::Source(const uint8_t* data, int width, int height, size_t bytesPerLine,
+                              bool swapRedBlue, bool premultiplied) :
+    data(data), width(width), height(height), bytesPerLine(bytesPerLine),
+    swapRedBlue(swapRedBlue), premultiplied(premultiplied) {
+}
+
+ImageImporter::Source::Source(const PixelBuffer& pixels) :
+    data((const uint8_t*) pixels.data()), width(pixels.width()), height(pixels.height()),
+    bytesPerLine(pixels.stride() * sizeof(Rgba)), swapRedBlue(false), premultiplied(false) {
+}
+
+/**
+ * @param pool  Threads to resample on; the importer makes its own if
+ *              none is given.
+ */
+ImageImporter::ImageImporter(ThreadPool* pool) : m_pool(pool), m_ownsPool(pool == 0) {
+    if(m_ownsPool) {
+        m_pool = new ThreadPool();
+    }
+}
+
+ImageImporter::~ImageImporter() {
+    if(m_ownsPool) {
+        delete m_pool;
+    }
+}
+
+/**
+ * Resamples source to the size of out with the area filter, replacing
+ * every bixel of out. Works in either direction, though enlarging just
+ * repeats source pixels, blending the ones cut by bixel edges.
+ */
+void ImageImporter::downsample(const Source& source, PixelBuffer& out) {
+    Tracer::Zone zone("downsample");
+    int width = out.width();
+    int height = out.height();
+    if(out.isEmpty()) {
+        return;
+    }
+    if(source.data == 0 || source.width <= 0 || source.height <= 0) {
+        out.fill(0);
+        return;
+    }
+
+    const std::vector<Span> columns = spans(source.width, width);
+    const std::vector<Span> rows = spans(source.height, height);
+    // Turns a summed alpha lane back into an alpha: every bixel covers
+    // the same area of source.
+    const float alphaScale = (float) (1 / (255.0 * source.width / width * source.height / height));
+
+    m_pool->parallelFor(0, height, [&](int begin, int end) {
+        std::vector<float> reduced((size_t) width * 4);
+        std::vector<float> sums((size_t) width * 4);
+        int reducedRow = -1;
+        for(int y = begin; y < end; y++) {
+            std::fill(sums.begin(), sums.end(), 0.0f);
+            const Span& span = rows[y];
+            for(int sourceY = span.first; sourceY <= span.last; sourceY++) {
+                if(sourceY != reducedRow) {
+                    reduceRow((const uint32_t*) (source.data + sourceY * source.bytesPerLine), columns,
+                              source.premultiplied, &reduced[0]);
+                    reducedRow = sourceY;
+                }
+                float weight = sourceY == span.first ? span.firstWeight
+                             : sourceY == span.last ? span.lastWeight : 1.0f;
+                for(size_t i = 0; i < sums.size(); i++) {
+                    sums[i] += weight * reduced[i];
+                }
+            }
+
+            Rgba* row = out.row(y);
+            for(int x = 0; x < width; x++) {
+                const float* sum = &sums[(size_t) x * 4];
+                if(!(sum[3] > 0)) {
+                    row[x] = 0;
+                    continue;
+                }
+                float unpremultiply = 255 / sum[3];
+                int first = toChannel(sum[0] * unpremultiply);
+                int third = toChannel(sum[2] * unpremultiply);
+                row[x] = packRgba(source.swapRedBlue ? third : first, toChannel(sum[1] * unpremultiply),
+                                  source.swapRedBlue ? first : third, toChannel(sum[3] * alphaScale));
+            }
+        }
+    }, MIN_CHUNK_ROWS);
+    out.markDirty(0, 0, width, height);
+}
+
+/**
+ * Maps every bixel to the nearest color of palette. Transparent bixels
+ * stay transparent even if palette has no transparent color.
+ */
+void ImageImporter::reduceColors(PixelBuffer& pixels, const std::vector<Rgba>& palette) {
+    if(palette.empty() || pixels.isEmpty()) {
+        return;
+    }
+    std::vector<Rgba> colors(palette);
+    if(std::find(colors.begin(), colors.end(), (Rgba) 0) == colors.end()
+       && (int) colors.size() < IndexedImage::MAX_COLORS) {
+        colors.push_back(0);
+    }
+    Quantizer quantizer(m_pool);
+    IndexedImage indexed;
+    quantizer.quantize(pixels, colors, indexed);
+    indexed.toPixelBuffer(pixels);
+}
+
+#ifdef QT_GUI_LIB
+/**
+ * Reads only the header of an image file.
+ *
+ * @return  false if Qt cannot read the file.
+ */
+bool ImageImporter::imageSize(const std::string& fileName, int& width, int& height) {
+    QImageReader reader(QString::fromStdString(fileName));
+    QSize size = reader.size();
+    if(!size.isValid()) {
+        return false;
+    }
+    width = size.width();
+    height = size.height();
+    return true;
+}
+
+/**
+ * Decodes any image Qt can read and resamples it to width x height into
+ * out, reduced to palette if one is given. Decoded pixels in the usual
+ * 32 bit formats are resampled where they are; others are converted to
+ * ARGB32 first.
+ *
+ * @return  false, leaving out unchanged, if the file cannot be read.
+ */
+bool ImageImporter::import(const std::string& fileName, int width, int height, PixelBuffer& out,
+                           const std::vector<Rgba>& palette) {
+    Tracer::Zone zone("import_image");
+    QImage image;
+    {
+        Tracer::Zone decodeZone("decode_image");
+        QImageReader reader(QString::fromStdString(fileName));
+        reader.setAutoTransform(true);
+        if(!reader.read(&image)) {
+            Tracer::message("Could not read %s: %s", fileName.c_str(),
+                            reader.errorString().toStdString().c_str());
+            return false;
+        }
+    }
+
+    bool swapRedBlue = true;
+    bool premultiplied = false;
+    switch(image.format()) {
+        case QImage::Format_RGB32:
+        case QImage::Format_ARGB32:
+        break;
+
+        case QImage::Format_ARGB32_Premultiplied:
+            premultiplied = true;
+        break;
+
+        case QImage::Format_RGBX8888:
+        case QImage::Format_RGBA8888:
+            swapRedBlue = false;
+        break;
+
+        case QImage::Format_RGBA8888_Premultiplied:
+            swapRedBlue = false;
+            premultiplied = true;
+        break;
+
+        default:
+            image = image.convertToFormat(QImage::Format_ARGB32);
+        break;
+    }
+
+    PixelBuffer pixels(std::max(0, width), std::max(0, height));
+    downsample(Source(image.constBits(), image.width(), image.height(), image.bytesPerLine(),
+                      swapRedBlue, premultiplied), pixels);
+    reduceColors(pixels, palette);
+    out.swap(pixels);
+    return true;
+}
+#endif
+
+//-Private-//
+
+/**
+ * Splits sourceSize pixels evenly over size bixels.
+ *
+ * @return  For each bixel, the first and last pixels it overlaps and
+ *          how much of each it covers. Pixels in between are covered
+ *          whole. A bixel within one pixel has only firstWeight.
+ */
+std::vector<ImageImporter::Span> ImageImporter::spans(int sourceSize, int size) {
+    std::vector<Span> result(size);
+    double scale = (double) sourceSize / size;
+    for(int i = 0; i < size; i++) {
+        double left = i * scale;
+        double right = (i + 1) * scale;
+        Span& span = result[i];
+        span.first = std::min(sourceSize - 1, (int) floor(left));
+        span.last = std::max(span.first, std::min(sourceSize - 1, (int) ceil(right) - 1));
+        if(span.first == span.last) {
+            span.firstWeight = (float) (right - left);
+            span.lastWeight = 0;
+        } else {
+            span.firstWeight = (float) (span.first + 1 - left);
+            span.lastWeight = (float) (right - span.last);
+        }
+    }
+    return result;
+}
+
+/**
+ * Sums a row of pixels into columns.size() weighted, premultiplied
+ * float quadruples in out, in the pixels' own channel order.
+ */
+void ImageImporter::reduceRow(const uint32_t* in, const std::vector<Span>& columns, bool premultiplied,
+                              float* out) {
+    for(size_t c = 0; c < columns.size(); c++) {
+        const Span& span = columns[c];
+#ifdef __SSE2__
+        __m128 sum = _mm_mul_ps(loadPixel(in[span.first], premultiplied), _mm_set1_ps(span.firstWeight));
+        for(int x = span.first + 1; x < span.last; x++) {
+            sum = _mm_add_ps(sum, loadPixel(in[x], premultiplied));
+        }
+        if(span.last > span.first) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(loadPixel(in[span.last], premultiplied),
+                                             _mm_set1_ps(span.lastWeight)));
+        }
+        _mm_storeu_ps(out + c * 4, sum);
+#else
+        float* sum = out + c * 4;
+        sum[0] = sum[1] = sum[2] = sum[3] = 0;
+        addPixel(in[span.first], premultiplied, span.firstWeight, sum);
+        for(int x = span.first + 1; x < span.last; x++) {
+            addPixel(in[x], premultiplied, 1, sum);
+        }
+        if(span.last > span.first) {
+            addPixel(in[span.last], premultiplied, span.lastWeight, sum);
+        }
+#endif
+    }
+}
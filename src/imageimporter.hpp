@@ -0,0 +1,75 @@
+#ifndef IMAGEIMPORTER_HPP
+#define IMAGEIMPORTER_HPP
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "threadpool.hpp"
+
+/**
+ * Brings images of any size into a grid of a chosen size.
+ *
+ * Resampling is an area filter: each bixel becomes the average of the
+ * part of the image it covers, with partly covered source pixels
+ * weighted by the fraction covered. Colors are averaged premultiplied
+ * by alpha, so transparent pixels do not darken their neighbours. The
+ * filter is separable. Each source row is first reduced to the width
+ * of the grid, four channels at a time in SSE2 float lanes, and the
+ * reduced rows are then summed into the bixel rows they overlap. Rows
+ * of the grid are spread over the thread pool in chunks; a chunk only
+ * reads the source rows it covers.
+ *
+ * A Source describes pixels in place, so a decoded QImage in any of
+ * the common 32 bit formats is read without being converted first.
+ *
+ * With a palette, the result is mapped to its nearest colors through
+ * Quantizer; transparent bixels stay transparent.
+ */
+class ImageImporter {
+    public:
+        struct Source {
+            const uint8_t* data;
+            int width;
+            int height;
+            size_t bytesPerLine;
+            bool swapRedBlue;
+            bool premultiplied;
+
+            Source(const uint8_t* data = 0, int width = 0, int height = 0, size_t bytesPerLine = 0,
+                   bool swapRedBlue = false, bool premultiplied = false);
+            Source(const PixelBuffer& pixels);
+        };
+
+        ImageImporter(ThreadPool* pool = 0);
+        ~ImageImporter();
+
+        void downsample(const Source& source, PixelBuffer& out);
+        void reduceColors(PixelBuffer& pixels, const std::vector<Rgba>& palette);
+
+#ifdef QT_GUI_LIB
+        static bool imageSize(const std::string& fileName, int& width, int& height);
+        bool import(const std::string& fileName, int width, int height, PixelBuffer& out,
+                    const std::vector<Rgba>& palette = std::vector<Rgba>());
+#endif
+
+    private:
+        ImageImporter(const ImageImporter&);
+        ImageImporter& operator=(const ImageImporter&);
+
+        struct Span {
+            int first;
+            int last;
+            float firstWeight;
+            float lastWeight;
+        };
+
+        static std::vector<Span> spans(int sourceSize, int size);
+        static void reduceRow(const uint32_t* in, const std::vector<Span>& columns, bool premultiplied,
+                              float* out);
+
+        ThreadPool* m_pool;
+        bool m_ownsPool;
+};
+#endif
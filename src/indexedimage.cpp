@@ -0,0 +1,234 @@
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+#include "indexedimage.hpp"
+
+/**
+ * Creates an image of index 0 everywhere and an empty palette, so every
+ * bixel reads as transparent until colors are added.
+ */
+IndexedImage::IndexedImage(int width, int height) :
+    m_width(std::max(0, width)), m_height(std::max(0, height)),
+    m_indices((size_t) m_width * m_height, 0), m_dirty(m_width, m_height), m_paletteDirty(true) {
+}
+
+int IndexedImage::width() const {
+    return m_width;
+}
+
+int IndexedImage::height() const {
+    return m_height;
+}
+
+bool IndexedImage::isEmpty() const {
+    return m_width == 0 || m_height == 0;
+}
+
+/**
+ * Changes the size, keeping the overlap. New bixels are index 0.
+ */
+void IndexedImage::resize(int width, int height) {
+    width = std::max(0, width);
+    height = std::max(0, height);
+    std::vector<uint8_t> indices((size_t) width * height, 0);
+    int copyWidth = std::min(width, m_width);
+    for(int y = 0; copyWidth > 0 && y < std::min(height, m_height); y++) {
+        memcpy(&indices[(size_t) y * width], row(y), copyWidth);
+    }
+    m_indices.swap(indices);
+    m_width = width;
+    m_height = height;
+    m_dirty.resize(width, height);
+    m_dirty.markAll();
+}
+
+/**
+ * Sets the bixels of a rectangle, clipped to the image, to index.
+ */
+void IndexedImage::fillRect(int x, int y, int width, int height, uint8_t index) {
+    int x0 = std::max(0, x);
+    int y0 = std::max(0, y);
+    int x1 = std::min(m_width, x + width);
+    int y1 = std::min(m_height, y + height);
+    if(x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    for(int py = y0; py < y1; py++) {
+        memset(row(py) + x0, index, x1 - x0);
+    }
+    markDirty(x0, y0, x1 - x0, y1 - y0);
+}
+
+/**
+ * @return  The color of bixel (x, y); indices past the end of the
+ *          palette are transparent.
+ */
+Rgba IndexedImage::color(int x, int y) const {
+    uint8_t i = index(x, y);
+    return i < m_palette.size() ? m_palette[i] : 0;
+}
+
+int IndexedImage::paletteSize() const {
+    return m_palette.size();
+}
+
+const std::vector<Rgba>& IndexedImage::palette() const {
+    return m_palette;
+}
+
+/**
+ * Replaces the palette; only its first MAX_COLORS entries are kept.
+ * Bixels keep their indices.
+ */
+void IndexedImage::setPalette(const std::vector<Rgba>& palette) {
+    m_palette.assign(palette.begin(), palette.begin() + std::min(palette.size(), (size_t) MAX_COLORS));
+    m_paletteDirty = true;
+}
+
+/**
+ * Recolors every bixel of the given index. Costs the same whatever the
+ * size of the image.
+ */
+void IndexedImage::setPaletteColor(int index, Rgba color) {
+    if(index < 0 || index >= (int) m_palette.size() || m_palette[index] == color) {
+        return;
+    }
+    m_palette[index] = color;
+    m_paletteDirty = true;
+}
+
+/**
+ * Appends color to the palette, unless it is already there.
+ *
+ * @return  The color's index, or -1 if the palette is full.
+ */
+int IndexedImage::addColor(Rgba color) {
+    int found = findColor(color);
+    if(found >= 0) {
+        return found;
+    }
+    if(m_palette.size() >= (size_t) MAX_COLORS) {
+        return -1;
+    }
+    m_palette.push_back(color);
+    m_paletteDirty = true;
+    return m_palette.size() - 1;
+}
+
+/**
+ * @return  The first index of color in the palette, or -1.
+ */
+int IndexedImage::findColor(Rgba color) const {
+    std::vector<Rgba>::const_iterator found = std::find(m_palette.begin(), m_palette.end(), color);
+    return found == m_palette.end() ? -1 : found - m_palette.begin();
+}
+
+/**
+ * @return  The index of the palette color closest to color, by squared
+ *          distance over all four channels, or -1 if the palette is
+ *          empty. Used when painting a color the palette lacks.
+ */
+int IndexedImage::nearestColor(Rgba color) const {
+    int best = -1;
+    int bestDistance = 0;
+    for(size_t i = 0; i < m_palette.size(); i++) {
+        int dr = rgbaRed(color) - rgbaRed(m_palette[i]);
+        int dg = rgbaGreen(color) - rgbaGreen(m_palette[i]);
+        int db = rgbaBlue(color) - rgbaBlue(m_palette[i]);
+        int da = rgbaAlpha(color) - rgbaAlpha(m_palette[i]);
+        int distance = dr * dr + dg * dg + db * db + da * da;
+        if(best < 0 || distance < bestDistance) {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+/**
+ * Expands the image to RGBA, for saving, exporting and the tools that
+ * only work in full color.
+ */
+void IndexedImage::toPixelBuffer(PixelBuffer& pixels) const {
+    Rgba table[MAX_COLORS] = { 0 };
+    std::copy(m_palette.begin(), m_palette.end(), table);
+    pixels.resize(m_width, m_height);
+    for(int y = 0; y < m_height; y++) {
+        const uint8_t* in = row(y);
+        Rgba* out = pixels.row(y);
+        for(int x = 0; x < m_width; x++) {
+            out[x] = table[in[x]];
+        }
+    }
+    pixels.markDirty(0, 0, m_width, m_height);
+}
+
+/**
+ * Converts pixels without loss, with the palette sorted by value. For
+ * images with more colors, see Quantizer.
+ *
+ * @return  false, leaving the image unchanged, if pixels has more than
+ *          MAX_COLORS colors.
+ */
+bool IndexedImage::fromPixelBuffer(const PixelBuffer& pixels) {
+    std::unordered_map<Rgba, int> lookup;
+    std::vector<Rgba> palette;
+    Rgba last = 0;
+    bool haveLast = false;
+    for(int y = 0; y < pixels.height(); y++) {
+        const Rgba* in = pixels.row(y);
+        for(int x = 0; x < pixels.width(); x++) {
+            if(haveLast && in[x] == last) {
+                continue;
+            }
+            last = in[x];
+            haveLast = true;
+            if(lookup.insert(std::make_pair(in[x], 0)).second) {
+                palette.push_back(in[x]);
+                if(palette.size() > (size_t) MAX_COLORS) {
+                    return false;
+                }
+            }
+        }
+    }
+    std::sort(palette.begin(), palette.end());
+    for(size_t i = 0; i < palette.size(); i++) {
+        lookup[palette[i]] = i;
+    }
+
+    *this = IndexedImage(pixels.width(), pixels.height());
+    m_palette = palette;
+    for(int y = 0; y < m_height; y++) {
+        const Rgba* in = pixels.row(y);
+        uint8_t* out = row(y);
+        for(int x = 0; x < m_width;) {
+            uint8_t i = lookup[in[x]];
+            int run = x + 1;
+            while(run < m_width && in[run] == in[x]) {
+                run++;
+            }
+            memset(out + x, i, run - x);
+            x = run;
+        }
+    }
+    m_dirty.markAll();
+    return true;
+}
+
+/**
+ * The bixels whose indices changed since the last upload.
+ */
+DirtyRegion& IndexedImage::dirtyRegion() {
+    return m_dirty;
+}
+
+/**
+ * true if the palette changed since the last upload.
+ */
+bool IndexedImage::isPaletteDirty() const {
+    return m_paletteDirty;
+}
+
+void IndexedImage::setPaletteDirty(bool dirty) {
+    m_paletteDirty = dirty;
+}
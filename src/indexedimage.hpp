@@ -0,0 +1,84 @@
+#ifndef INDEXEDIMAGE_HPP
+#define INDEXEDIMAGE_HPP
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "dirtyregion.hpp"
+
+/**
+ * A canvas in indexed color: one 8 bit palette index per bixel and a
+ * table of up to 256 colors.
+ *
+ * Bixels only refer to colors, so changing a palette entry recolors
+ * every bixel that uses it without touching any of them.
+ *
+ * As with PixelBuffer, index changes made through the image's methods
+ * are recorded in dirtyRegion(), and writes through row() must be
+ * reported with markDirty(). Palette changes set isPaletteDirty().
+ */
+class IndexedImage {
+    public:
+        static const int MAX_COLORS = 256;
+
+        IndexedImage(int width = 0, int height = 0);
+
+        int width() const;
+        int height() const;
+        bool isEmpty() const;
+        void resize(int width, int height);
+
+        uint8_t* row(int y);
+        const uint8_t* row(int y) const;
+        uint8_t index(int x, int y) const;
+        void setIndex(int x, int y, uint8_t index);
+        void fillRect(int x, int y, int width, int height, uint8_t index);
+        Rgba color(int x, int y) const;
+
+        int paletteSize() const;
+        const std::vector<Rgba>& palette() const;
+        void setPalette(const std::vector<Rgba>& palette);
+        void setPaletteColor(int index, Rgba color);
+        int addColor(Rgba color);
+        int findColor(Rgba color) const;
+        int nearestColor(Rgba color) const;
+
+        void toPixelBuffer(PixelBuffer& pixels) const;
+        bool fromPixelBuffer(const PixelBuffer& pixels);
+
+        void markDirty(int x, int y, int width, int height);
+        DirtyRegion& dirtyRegion();
+        bool isPaletteDirty() const;
+        void setPaletteDirty(bool dirty);
+
+    private:
+        int m_width;
+        int m_height;
+        std::vector<uint8_t> m_indices;
+        std::vector<Rgba> m_palette;
+        DirtyRegion m_dirty;
+        bool m_paletteDirty;
+};
+
+inline uint8_t* IndexedImage::row(int y) {
+    return &m_indices[(size_t) y * m_width];
+}
+
+inline const uint8_t* IndexedImage::row(int y) const {
+    return &m_indices[(size_t) y * m_width];
+}
+
+inline uint8_t IndexedImage::index(int x, int y) const {
+    return m_indices[(size_t) y * m_width + x];
+}
+
+inline void IndexedImage::setIndex(int x, int y, uint8_t index) {
+    m_indices[(size_t) y * m_width + x] = index;
+    m_dirty.markPixel(x, y);
+}
+
+inline void IndexedImage::markDirty(int x, int y, int width, int height) {
+    m_dirty.markRect(x, y, width, height);
+}
+#endif
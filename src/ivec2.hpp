@@ -0,0 +1,44 @@
+#ifndef IVEC2_HPP
+#define IVEC2_HPP
+
+/**
+ * An integer point, used for bixel indices. Unlike vec2 it is exact and
+ * passed by value, so converting positions to bixels never allocates.
+ */
+class ivec2 {
+    public:
+        int x;
+        int y;
+        ivec2(int x = 0, int y = 0);
+        void set(int x, int y);
+
+        ivec2 operator+(const ivec2 &b) const;
+        ivec2 operator-(const ivec2 &b) const;
+        bool operator==(const ivec2 &b) const;
+        bool operator!=(const ivec2 &b) const;
+};
+
+inline ivec2::ivec2(int x, int y) : x(x), y(y) {
+}
+
+inline void ivec2::set(int x, int y) {
+    this->x = x;
+    this->y = y;
+}
+
+inline ivec2 ivec2::operator+(const ivec2 &b) const {
+    return ivec2(x + b.x, y + b.y);
+}
+
+inline ivec2 ivec2::operator-(const ivec2 &b) const {
+    return ivec2(x - b.x, y - b.y);
+}
+
+inline bool ivec2::operator==(const ivec2 &b) const {
+    return x == b.x && y == b.y;
+}
+
+inline bool ivec2::operator!=(const ivec2 &b) const {
+    return !(*this == b);
+}
+#endif
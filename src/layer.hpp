@@ -0,0 +1,38 @@
+#ifndef LAYER_HPP
+#define LAYER_HPP
+#include <string>
+#include "pixelbuffer.hpp"
+
+/**
+ * One layer of a document: straight (not premultiplied) RGBA bixels and
+ * how they are composited onto the layers below.
+ *
+ * @see Compositor
+ * @see LayerStack
+ */
+struct Layer {
+    enum BlendMode { NORMAL,    ///< Porter-Duff source over
+                     MULTIPLY,
+                     SCREEN,
+                     ADD,
+                     BLEND_MODE_COUNT
+                   };
+
+    std::string name;
+    PixelBuffer pixels;
+    int opacity;            ///< 0 to 255, applied on top of each bixel's alpha
+    bool visible;
+    BlendMode blendMode;
+
+    Layer(const std::string& name = "", int width = 0, int height = 0) :
+        name(name), pixels(width, height), opacity(255), visible(true), blendMode(NORMAL) {}
+
+    /**
+     * @return  true if the layer composites onto transparent as its own
+     *          bixels, unchanged.
+     */
+    bool isPlain() const {
+        return visible && opacity == 255 && blendMode == NORMAL;
+    }
+};
+#endif
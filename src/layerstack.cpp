@@ -0,0 +1,285 @@
+#include <algorithm>
+#include "layerstack.hpp"
+#include "compositor.hpp"
+#include "tracer.hpp"
+
+namespace {
+    // Below this many stale tiles compositing stays on the calling
+    // thread; handing a few tiles to the pool costs more than it saves.
+    const int PARALLEL_TILES = 16;
+};
+
+/**
+ * Creates a stack with one transparent layer.
+ *
+ * @param pool  Recompositing of many tiles is spread over it; may be 0.
+ */
+LayerStack::LayerStack(int width, int height, ThreadPool* pool) :
+    m_width(std::max(0, width)), m_height(std::max(0, height)), m_current(0),
+    m_flattened(m_width, m_height), m_stale(m_width, m_height), m_pool(pool) {
+    m_layers.push_back(Layer("Layer 1", m_width, m_height));
+}
+
+int LayerStack::width() const {
+    return m_width;
+}
+
+int LayerStack::height() const {
+    return m_height;
+}
+
+/**
+ * Resizes every layer, keeping the bixels that still fit.
+ */
+void LayerStack::resize(int width, int height) {
+    m_width = std::max(0, width);
+    m_height = std::max(0, height);
+    for(size_t i = 0; i < m_layers.size(); i++) {
+        m_layers[i].pixels.resize(m_width, m_height);
+    }
+    m_flattened.resize(m_width, m_height);
+    m_stale.resize(m_width, m_height);
+}
+
+int LayerStack::layerCount() const {
+    return m_layers.size();
+}
+
+const Layer& LayerStack::layer(int index) const {
+    return m_layers[index];
+}
+
+/**
+ * The bixels of layer index, for painting. Writes through row() must
+ * be reported with markDirty() or flattened() will not see them.
+ */
+PixelBuffer& LayerStack::pixels(int index) {
+    return m_layers[index].pixels;
+}
+
+/**
+ * Inserts a transparent layer at index, or on top if index is -1, and
+ * makes it current.
+ *
+ * @return  The index of the new layer.
+ */
+int LayerStack::addLayer(const std::string& name, int index) {
+    if(index < 0 || index > (int) m_layers.size()) {
+        index = m_layers.size();
+    }
+    m_layers.insert(m_layers.begin() + index, Layer(name, m_width, m_height));
+    m_current = index;
+    // A transparent layer changes nothing until it is painted on, unless
+    // it is the only one.
+    m_layers[index].pixels.dirtyRegion().clear();
+    return index;
+}
+
+/**
+ * Removes layer index. The last layer cannot be removed.
+ */
+void LayerStack::removeLayer(int index) {
+    if(m_layers.size() <= 1 || index < 0 || index >= (int) m_layers.size()) {
+        return;
+    }
+    m_layers.erase(m_layers.begin() + index);
+    m_current = std::min(m_current, (int) m_layers.size() - 1);
+    invalidate();
+}
+
+/**
+ * Moves layer from to position to; the current layer moves with it.
+ */
+void LayerStack::moveLayer(int from, int to) {
+    int count = m_layers.size();
+    if(from < 0 || from >= count || to < 0 || to >= count || from == to) {
+        return;
+    }
+    Layer moved;
+    std::swap(moved, m_layers[from]);
+    m_layers.erase(m_layers.begin() + from);
+    m_layers.insert(m_layers.begin() + to, Layer());
+    std::swap(m_layers[to], moved);
+    if(m_current == from) {
+        m_current = to;
+    } else if(from < m_current && m_current <= to) {
+        m_current--;
+    } else if(to <= m_current && m_current < from) {
+        m_current++;
+    }
+    invalidate();
+}
+
+void LayerStack::setName(int index, const std::string& name) {
+    m_layers[index].name = name;
+}
+
+/**
+ * @param opacity   0 (invisible) to 255 (as painted).
+ */
+void LayerStack::setOpacity(int index, int opacity) {
+    opacity = std::max(0, std::min(255, opacity));
+    if(m_layers[index].opacity != opacity) {
+        m_layers[index].opacity = opacity;
+        invalidate();
+    }
+}
+
+void LayerStack::setVisible(int index, bool visible) {
+    if(m_layers[index].visible != visible) {
+        m_layers[index].visible = visible;
+        invalidate();
+    }
+}
+
+void LayerStack::setBlendMode(int index, Layer::BlendMode mode) {
+    if(m_layers[index].blendMode != mode) {
+        m_layers[index].blendMode = mode;
+        invalidate();
+    }
+}
+
+int LayerStack::currentLayer() const {
+    return m_current;
+}
+
+void LayerStack::setCurrentLayer(int index) {
+    m_current = std::max(0, std::min((int) m_layers.size() - 1, index));
+}
+
+/**
+ * The layer that brushes, the eraser and fills paint on. Erasing
+ * writes transparent bixels here, so the layers below show through.
+ */
+PixelBuffer& LayerStack::currentPixels() {
+    return m_layers[m_current].pixels;
+}
+
+/**
+ * Brings the cached composite up to date and returns it. Only tiles
+ * painted on since the last call are recomposited; they are marked in
+ * the result's DirtyRegion.
+ */
+PixelBuffer& LayerStack::flattened() {
+    collectDirtyTiles();
+    if(m_stale.isEmpty()) {
+        return m_flattened;
+    }
+    Tracer::Zone zone("flatten");
+
+    const int tileSize = DirtyRegion::TILE_SIZE;
+    std::vector<int> tiles;
+    tiles.reserve(m_stale.dirtyTileCount());
+    for(int ty = 0; ty < m_stale.tilesY(); ty++) {
+        for(int tx = 0; tx < m_stale.tilesX(); tx++) {
+            if(m_stale.isTileDirty(tx, ty)) {
+                tiles.push_back(ty * m_stale.tilesX() + tx);
+                m_flattened.markDirty(tx * tileSize, ty * tileSize, tileSize, tileSize);
+            }
+        }
+    }
+    m_stale.clear();
+
+    int tilesX = m_stale.tilesX();
+    std::function<void(int, int)> compositeTiles = [this, &tiles, tilesX, tileSize](int begin, int end) {
+        for(int i = begin; i < end; i++) {
+            int x = tiles[i] % tilesX * tileSize;
+            int y = tiles[i] / tilesX * tileSize;
+            Compositor::composite(m_layers, x, y, std::min(tileSize, m_width - x),
+                                  std::min(tileSize, m_height - y), m_flattened);
+        }
+    };
+    if(m_pool && tiles.size() >= (size_t) PARALLEL_TILES) {
+        m_pool->parallelFor(0, tiles.size(), compositeTiles, PARALLEL_TILES / 4);
+    } else {
+        compositeTiles(0, tiles.size());
+    }
+    Tracer::counter("flattened_tiles", tiles.size());
+    return m_flattened;
+}
+
+/**
+ * Marks the whole composite stale, for changes that affect every tile.
+ */
+void LayerStack::invalidate() {
+    m_stale.markAll();
+}
+
+/**
+ * Fills image for saving. A single plain layer is stored as the image's
+ * bixels alone; otherwise image.layers holds a copy of every layer and
+ * image.pixels the composite.
+ */
+void LayerStack::toImage(BixlImage& image, int dimension) {
+    image.dimension = dimension;
+    image.pixels = flattened();
+    image.layers.clear();
+    if(m_layers.size() > 1 || !m_layers[0].isPlain()) {
+        image.layers = m_layers;
+    }
+}
+
+/**
+ * Replaces the stack with the contents of image. An image without
+ * layers becomes a single layer.
+ */
+void LayerStack::fromImage(const BixlImage& image) {
+    m_width = image.width();
+    m_height = image.height();
+    m_layers.clear();
+    if(image.layers.empty()) {
+        m_layers.push_back(Layer("Layer 1"));
+        m_layers[0].pixels = image.pixels;
+    } else {
+        m_layers = image.layers;
+    }
+    m_current = m_layers.size() - 1;
+    m_flattened = PixelBuffer(m_width, m_height);
+    m_stale.resize(m_width, m_height);
+}
+
+/**
+ * Opens a .bixl file of any version.
+ *
+ * @param dimension     Receives the file's dimension; may be 0.
+ */
+bool LayerStack::read(const std::string& fileName, int* dimension) {
+    BixlImage image;
+    if(!BixlFile::read(fileName, image)) {
+        return false;
+    }
+    fromImage(image);
+    if(dimension) {
+        *dimension = image.dimension;
+    }
+    return true;
+}
+
+bool LayerStack::write(const std::string& fileName, int dimension, BixlFile::Encoding encoding) {
+    BixlImage image;
+    toImage(image, dimension);
+    return BixlFile::write(fileName, image, encoding);
+}
+
+//-Private-//
+
+/**
+ * Moves the tiles painted on any layer into m_stale.
+ */
+void LayerStack::collectDirtyTiles() {
+    const int tileSize = DirtyRegion::TILE_SIZE;
+    for(size_t i = 0; i < m_layers.size(); i++) {
+        DirtyRegion& dirty = m_layers[i].pixels.dirtyRegion();
+        if(dirty.isEmpty()) {
+            continue;
+        }
+        for(int ty = 0; ty < dirty.tilesY(); ty++) {
+            for(int tx = 0; tx < dirty.tilesX(); tx++) {
+                if(dirty.isTileDirty(tx, ty)) {
+                    m_stale.markRect(tx * tileSize, ty * tileSize, tileSize, tileSize);
+                }
+            }
+        }
+        dirty.clear();
+    }
+}
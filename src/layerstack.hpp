@@ -0,0 +1,71 @@
+#ifndef LAYERSTACK_HPP
+#define LAYERSTACK_HPP
+#include <string>
+#include <vector>
+#include "layer.hpp"
+#include "pixelbuffer.hpp"
+#include "dirtyregion.hpp"
+#include "bixlfile.hpp"
+#include "threadpool.hpp"
+
+/**
+ * The layers of a document, bottom first, and a cached flattened image
+ * of them.
+ *
+ * Painting goes straight into a layer's PixelBuffer, whose DirtyRegion
+ * records the tiles it touched. flattened() gathers those tiles from
+ * every layer and recomposites only them, so a brush stroke on one
+ * layer of a deep stack costs a few tiles of compositing per frame, not
+ * the whole canvas. Changing a layer's opacity, visibility, blend mode
+ * or order recomposites everything.
+ *
+ * The flattened image's own DirtyRegion marks the tiles that were
+ * recomposited, for CanvasRenderer::uploadDirtyPixels().
+ *
+ * A document with a single plain layer is saved as a v2 .bixl file, so
+ * older builds can open it; anything else is saved as v3.
+ */
+class LayerStack {
+    public:
+        LayerStack(int width = 0, int height = 0, ThreadPool* pool = 0);
+
+        int width() const;
+        int height() const;
+        void resize(int width, int height);
+
+        int layerCount() const;
+        const Layer& layer(int index) const;
+        PixelBuffer& pixels(int index);
+
+        int addLayer(const std::string& name, int index = -1);
+        void removeLayer(int index);
+        void moveLayer(int from, int to);
+        void setName(int index, const std::string& name);
+        void setOpacity(int index, int opacity);
+        void setVisible(int index, bool visible);
+        void setBlendMode(int index, Layer::BlendMode mode);
+
+        int currentLayer() const;
+        void setCurrentLayer(int index);
+        PixelBuffer& currentPixels();
+
+        PixelBuffer& flattened();
+        void invalidate();
+
+        void toImage(BixlImage& image, int dimension);
+        void fromImage(const BixlImage& image);
+        bool read(const std::string& fileName, int* dimension = 0);
+        bool write(const std::string& fileName, int dimension, BixlFile::Encoding encoding = BixlFile::AUTO);
+
+    private:
+        void collectDirtyTiles();
+
+        int m_width;
+        int m_height;
+        std::vector<Layer> m_layers;
+        int m_current;
+        PixelBuffer m_flattened;
+        DirtyRegion m_stale;
+        ThreadPool* m_pool;
+};
+#endif
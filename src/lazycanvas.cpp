@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <string.h>
+#include "lazycanvas.hpp"
+#include "tracer.hpp"
+
+LazyCanvas::LazyCanvas() : m_loadedTiles(0) {}
+
+/**
+ * Maps fileName without decoding any bixels.
+ *
+ * @return  false if the file is missing or not a valid .bixl file.
+ */
+bool LazyCanvas::open(const std::string& fileName) {
+    close();
+    if(!m_file.open(fileName)) {
+        return false;
+    }
+    m_tiles.resize((size_t) m_file.tilesX() * m_file.tilesY());
+    return true;
+}
+
+void LazyCanvas::close() {
+    m_file.close();
+    m_tiles.clear();
+    m_loadedTiles = 0;
+}
+
+int LazyCanvas::width() const {
+    return m_file.width();
+}
+
+int LazyCanvas::height() const {
+    return m_file.height();
+}
+
+int LazyCanvas::dimension() const {
+    return m_file.dimension();
+}
+
+int LazyCanvas::tileSize() const {
+    return m_file.tileSize();
+}
+
+/**
+ * @return  The bixel at (x, y), or transparent outside the canvas.
+ */
+Rgba LazyCanvas::pixel(int x, int y) {
+    if(x < 0 || y < 0 || x >= width() || y >= height()) {
+        return 0;
+    }
+    int size = tileSize();
+    return tile(x / size, y / size)[(y % size) * size + (x % size)];
+}
+
+/**
+ * Writes a bixel; writes outside the canvas are ignored.
+ */
+void LazyCanvas::setPixel(int x, int y, Rgba color) {
+    if(x < 0 || y < 0 || x >= width() || y >= height()) {
+        return;
+    }
+    int size = tileSize();
+    tile(x / size, y / size)[(y % size) * size + (x % size)] = color;
+}
+
+/**
+ * Decodes every tile overlapping the bixel rectangle [x0, x1) x [y0, y1),
+ * typically the part of the canvas that is about to be drawn.
+ */
+void LazyCanvas::prefetch(int x0, int y0, int x1, int y1) {
+    int size = tileSize();
+    x0 = std::max(0, x0);
+    y0 = std::max(0, y0);
+    x1 = std::min(width(), x1);
+    y1 = std::min(height(), y1);
+    for(int ty = y0 / size; ty * size < y1; ty++) {
+        for(int tx = x0 / size; tx * size < x1; tx++) {
+            tile(tx, ty);
+        }
+    }
+}
+
+/**
+ * Returns tile (tx, ty) as tileSize() x tileSize() bixels, decoding it on
+ * first use. Bixels of edge tiles that fall outside the canvas are
+ * transparent. A tile that fails to decode comes back transparent too,
+ * so a damaged file still opens.
+ */
+Rgba* LazyCanvas::tile(int tx, int ty) {
+    std::vector<Rgba>& tile = m_tiles[(size_t) ty * m_file.tilesX() + tx];
+    if(tile.empty()) {
+        Tracer::Zone zone("decode_tile");
+        int size = tileSize();
+        tile.assign((size_t) size * size, 0);
+        if(!m_file.decodeTile(tx, ty, &tile[0], size)) {
+            std::fill(tile.begin(), tile.end(), 0);
+        }
+        m_loadedTiles++;
+    }
+    return &tile[0];
+}
+
+bool LazyCanvas::isTileLoaded(int tx, int ty) const {
+    return !m_tiles[(size_t) ty * m_file.tilesX() + tx].empty();
+}
+
+size_t LazyCanvas::loadedTileCount() const {
+    return m_loadedTiles;
+}
+
+/**
+ * Flattens the canvas for saving. Tiles that were never loaded are
+ * decoded straight from the mapping without being cached.
+ */
+void LazyCanvas::toImage(BixlImage& image) const {
+    image = BixlImage(width(), height(), dimension());
+    int size = tileSize();
+    for(int ty = 0; ty < m_file.tilesY(); ty++) {
+        for(int tx = 0; tx < m_file.tilesX(); tx++) {
+            Rgba* out = image.pixels.row(ty * size) + tx * size;
+            const std::vector<Rgba>& tile = m_tiles[(size_t) ty * m_file.tilesX() + tx];
+            if(tile.empty()) {
+                m_file.decodeTile(tx, ty, out, image.pixels.stride());
+                continue;
+            }
+            int columns = std::min(size, width() - tx * size);
+            int rows = std::min(size, height() - ty * size);
+            for(int y = 0; y < rows; y++) {
+                memcpy(out + (size_t) y * image.pixels.stride(), &tile[(size_t) y * size],
+                       columns * sizeof(Rgba));
+            }
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef LAZYCANVAS_HPP
+#define LAZYCANVAS_HPP
+#include <string>
+#include <vector>
+#include "rgba.hpp"
+#include "bixlfile.hpp"
+#include "mappedbixlfile.hpp"
+
+/**
+ * Canvas contents backed by a MappedBixlFile.
+ *
+ * Tiles are decoded the first time they are drawn (prefetch()) or edited
+ * (setPixel()), so opening a file costs one header parse and one empty
+ * slot per tile no matter how large the canvas is. Tiles that are never
+ * looked at never leave the page cache. Files of every version open;
+ * a layered file's tiles are its layers composited.
+ */
+class LazyCanvas {
+    public:
+        LazyCanvas();
+
+        bool open(const std::string& fileName);
+        void close();
+
+        int width() const;
+        int height() const;
+        int dimension() const;
+        int tileSize() const;
+
+        Rgba pixel(int x, int y);
+        void setPixel(int x, int y, Rgba color);
+
+        void prefetch(int x0, int y0, int x1, int y1);
+        Rgba* tile(int tx, int ty);
+        bool isTileLoaded(int tx, int ty) const;
+        size_t loadedTileCount() const;
+
+        void toImage(BixlImage& image) const;
+
+    private:
+        MappedBixlFile m_file;
+        std::vector<std::vector<Rgba> > m_tiles;
+        size_t m_loadedTiles;
+};
+#endif
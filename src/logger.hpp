@@ -1,12 +0,0 @@
-#ifndef OLILOGGER_HPP
-#define OLILOGGER_HPP
-#include <string>
-namespace olilog {
-    void log(std::string 
-                #ifdef LOG 
-                log 
-                #endif
-                );
-};
-
-#endif
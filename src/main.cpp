@@ -1,9 +1,16 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "bixelgrid.hpp"
 #include "canvaswidget.hpp"
 #include "vec2.hpp"
 #include "bixelwindow.hpp"
-#include "swatch.hpp"
+#include "swatchbar.hpp"
+#include "batchrunner.hpp"
+#include "tracer.hpp"
+#include "documentloader.hpp"
+#include "programcache.hpp"
+#include "sessionrelay.hpp"
 
 #include <QApplication>
 #include <QWidget>
@@ -22,11 +29,43 @@
 #include <QKeySequence>
 #include <QMainWindow>
 #include <QMenuBar>
+#include <QDir>
+#include <QStandardPaths>
 
 int main(int args, char *argv[]) {
+    // Batch mode runs before QApplication exists, so it needs no display.
+    if(args >= 2 && strcmp(argv[1], "--batch") == 0) {
+        return BatchRunner::main(args - 2, argv + 2);
+    }
+    // So does the relay of a shared editing session.
+    if(args >= 2 && strcmp(argv[1], "--relay") == 0) {
+        return SessionRelay::main(args - 2, argv + 2);
+    }
+
+    // BIXEL_TRACE=1 records from startup; see Debug > Record Trace.
+    Tracer::setThreadName("main");
+    Tracer::setEnabled(getenv("BIXEL_TRACE") != 0);
+    int64_t startTime = Tracer::now();
+
+    // --startup-time prints the time to the first interactive frame and quits.
+    bool measureStartup = args >= 2 && strcmp(argv[1], "--startup-time") == 0;
+    int documentArgument = measureStartup ? 2 : 1;
+    const char* documentName = args > documentArgument ? argv[documentArgument] : 0;
+
+    // The document is decoded while the window and GL context come up.
+    DocumentLoader loader;
+    if(documentName) {
+        loader.start(documentName);
+    }
+
     QApplication app(args, argv);
     app.setApplicationName("Bixel");
 
+    QString programCache = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/programs";
+    if(QDir().mkpath(programCache)) {
+        ProgramCache::setDirectory(programCache.toStdString());
+    }
+
     BixelWindow* mainWindow = new BixelWindow();
 
     QWidget* centralWidget = new QWidget();
@@ -46,7 +85,7 @@ int main(int args, char *argv[]) {
 
                 QPushButton* mouse = new QPushButton();
                 mouse->setShortcut(QKeySequence("q"));
-                mouse->setIcon(QIcon("res/icons/mouse.png"));
+                mouse->setIcon(QIcon(":/icons/mouse.png"));
                 mouse->setCheckable(true);
                 mouse->setFixedHeight(30);
                 mouse->click();
@@ -56,7 +95,7 @@ int main(int args, char *argv[]) {
 
                 QPushButton* paintBrush = new QPushButton();
                 paintBrush->setShortcut(QKeySequence("a"));
-                paintBrush->setIcon(QIcon("res/icons/paintbrush.png"));
+                paintBrush->setIcon(QIcon(":/icons/paintbrush.png"));
                 paintBrush->setCheckable(true);
                 paintBrush->setFixedHeight(30);
                 toolBar->addWidget(paintBrush);
@@ -65,16 +104,25 @@ int main(int args, char *argv[]) {
 
                 QPushButton* eraser = new QPushButton();
                 eraser->setShortcut(QKeySequence("z"));
-                eraser->setIcon(QIcon("res/icons/eraser.png"));
+                eraser->setIcon(QIcon(":/icons/eraser.png"));
                 eraser->setCheckable(true);
                 eraser->setFixedHeight(30);
                 toolBar->addWidget(eraser);
                 tools->addButton(eraser);
                 tools->setId(eraser, BixelGrid::ERASER);
 
+                QPushButton* paintBucket = new QPushButton();
+                paintBucket->setShortcut(QKeySequence("g"));
+                paintBucket->setIcon(QIcon(":/icons/paintbucket.png"));
+                paintBucket->setCheckable(true);
+                paintBucket->setFixedHeight(30);
+                toolBar->addWidget(paintBucket);
+                tools->addButton(paintBucket);
+                tools->setId(paintBucket, BixelGrid::PAINTBUCKET);
+
                 QPushButton* eyeDrop = new QPushButton();
                 //eyeDrop->setShortcut(QKeySequence("z"));
-                eyeDrop->setIcon(QIcon("res/icons/eyedrop.png"));
+                eyeDrop->setIcon(QIcon(":/icons/eyedrop.png"));
                 eyeDrop->setCheckable(true);
                 eyeDrop->setFixedHeight(30);
                 toolBar->addWidget(eyeDrop);
@@ -83,7 +131,7 @@ int main(int args, char *argv[]) {
 
                 QPushButton* hand = new QPushButton();
                 hand->setShortcut(QKeySequence("h"));
-                hand->setIcon(QIcon("res/icons/hand.png"));
+                hand->setIcon(QIcon(":/icons/hand.png"));
                 hand->setCheckable(true);
                 hand->setFixedHeight(30);
                 toolBar->addWidget(hand);
@@ -92,7 +140,7 @@ int main(int args, char *argv[]) {
 
                 QPushButton* zoom = new QPushButton();
                 //zoom->setShortcut(QKeySequence(""));
-                zoom->setIcon(QIcon("res/icons/zoom.png"));
+                zoom->setIcon(QIcon(":/icons/zoom.png"));
                 zoom->setCheckable(true);
                 zoom->setFixedHeight(30);
                 toolBar->addWidget(zoom);
@@ -107,25 +155,8 @@ int main(int args, char *argv[]) {
 
                 toolBar->addSeparator();
 
-                Swatch* swatch_1 = new Swatch();
-                swatch_1->setColor(0x588C7E);
-                toolBar->addWidget(swatch_1);
-
-                Swatch* swatch_2 = new Swatch();
-                swatch_2->setColor(0xF2E394);
-                toolBar->addWidget(swatch_2);
-
-                Swatch* swatch_3 = new Swatch();
-                swatch_3->setColor(0xF2AE72);
-                toolBar->addWidget(swatch_3);
-
-                Swatch* swatch_4 = new Swatch();
-                swatch_4->setColor(0xD96459);
-                toolBar->addWidget(swatch_4);
-
-                Swatch* swatch_5 = new Swatch();
-                swatch_5->setColor(0x8C4646);
-                toolBar->addWidget(swatch_5);
+                SwatchBar* swatches = new SwatchBar();
+                toolBar->addWidget(swatches);
 
             boxLayout->addWidget(toolBar);
 
@@ -139,16 +170,26 @@ int main(int args, char *argv[]) {
             QObject::connect(canvas, SIGNAL(colorChanged(QString)), paintColor, SLOT(setStyleSheet(QString)));
             QObject::connect(canvas, SIGNAL(stateChanged()), mainWindow, SLOT(stateChanged()));
 
-            QObject::connect(swatch_1, SIGNAL(swatchPicked(QColor)), canvas, SLOT(setCurrentColor(QColor)));
-            QObject::connect(swatch_2, SIGNAL(swatchPicked(QColor)), canvas, SLOT(setCurrentColor(QColor)));
-            QObject::connect(swatch_3, SIGNAL(swatchPicked(QColor)), canvas, SLOT(setCurrentColor(QColor)));
-            QObject::connect(swatch_4, SIGNAL(swatchPicked(QColor)), canvas, SLOT(setCurrentColor(QColor)));
-            QObject::connect(swatch_5, SIGNAL(swatchPicked(QColor)), canvas, SLOT(setCurrentColor(QColor)));
+            QObject::connect(swatches, SIGNAL(swatchPicked(QColor)), canvas, SLOT(setCurrentColor(QColor)));
+            QObject::connect(canvas, SIGNAL(paletteChanged(QVector<QRgb>)), swatches, SLOT(setColors(QVector<QRgb>)));
+            QObject::connect(swatches, SIGNAL(colorsChanged(QVector<QRgb>)), canvas, SLOT(setSwatches(QVector<QRgb>)));
+            canvas->setSwatches(swatches->colors());
 
             canvas->setCurrentColor(QColor(128, 200, 128));
-            if(args >= 2) {
-                mainWindow->open_slot(argv[1]);
+            canvas->setDocumentLoader(&loader);
+            if(documentName) {
+                mainWindow->open_slot(documentName);
             }
+
+            QObject::connect(canvas, &CanvasWidget::firstFramePainted, [=]() {
+                double milliseconds = (Tracer::now() - startTime) / 1e6;
+                Tracer::counter("startup_ms", milliseconds);
+                Tracer::message("First interactive frame after %.1f ms", milliseconds);
+                if(measureStartup) {
+                    printf("%.1f\n", milliseconds);
+                    QApplication::quit();
+                }
+            });
         centralWidget->setLayout(boxLayout);
 
     mainWindow->showMaximized();
@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mappedbixlfile.hpp"
+#include "bixlfile.hpp"
+#include "compositor.hpp"
+
+namespace {
+    int channelV1(const unsigned char* data) {
+        return std::max(0, std::min(255, (int) (int32_t) BixlFile::readBE32(data)));
+    }
+};
+
+MappedBixlFile::MappedBixlFile() :
+    m_data(0), m_size(0), m_version(0), m_width(0), m_height(0), m_dimension(0),
+    m_tileSize(BixlFile::DEFAULT_TILE_SIZE) {}
+
+MappedBixlFile::~MappedBixlFile() {
+    close();
+}
+
+/**
+ * Maps fileName and reads its header. No bixels are decoded.
+ *
+ * The mapping keeps the file's contents alive even if the file is
+ * replaced by a rename, but truncating or rewriting the file in place
+ * while it is mapped is not safe.
+ *
+ * @return  false if the file cannot be mapped or is not a valid .bixl file.
+ */
+bool MappedBixlFile::open(const std::string& fileName) {
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size <= 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(mapping == MAP_FAILED) {
+        return false;
+    }
+    madvise(mapping, info.st_size, MADV_RANDOM);
+
+    m_data = (const unsigned char*) mapping;
+    m_size = info.st_size;
+    if(!parseHeader()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedBixlFile::close() {
+    if(m_data) {
+        munmap((void*) m_data, m_size);
+    }
+    m_data = 0;
+    m_size = 0;
+    m_version = 0;
+    m_width = 0;
+    m_height = 0;
+    m_dimension = 0;
+    m_chunks.clear();
+}
+
+bool MappedBixlFile::isOpen() const {
+    return m_data != 0;
+}
+
+int MappedBixlFile::version() const {
+    return m_version;
+}
+
+int MappedBixlFile::width() const {
+    return m_width;
+}
+
+int MappedBixlFile::height() const {
+    return m_height;
+}
+
+int MappedBixlFile::dimension() const {
+    return m_dimension;
+}
+
+int MappedBixlFile::tileSize() const {
+    return m_tileSize;
+}
+
+int MappedBixlFile::tilesX() const {
+    return (m_width + m_tileSize - 1) / m_tileSize;
+}
+
+int MappedBixlFile::tilesY() const {
+    return (m_height + m_tileSize - 1) / m_tileSize;
+}
+
+/**
+ * @return  The number of layers in a v3 file, 1 for the other versions.
+ */
+int MappedBixlFile::layerCount() const {
+    return m_version == BixlFile::LAYERED_VERSION ? (int) m_chunks.size() : 1;
+}
+
+/**
+ * Decodes tile (tx, ty) into out. Edge tiles are clipped to the image,
+ * so only min(tileSize, width - tx * tileSize) columns are written.
+ *
+ * @param outStride     Distance between rows of out, in bixels.
+ *
+ * @return              false if the tile is out of range or corrupt.
+ */
+bool MappedBixlFile::decodeTile(int tx, int ty, Rgba* out, int outStride) const {
+    if(!m_data || tx < 0 || ty < 0 || tx >= tilesX() || ty >= tilesY()) {
+        return false;
+    }
+
+    int x0 = tx * m_tileSize;
+    int y0 = ty * m_tileSize;
+    int width = std::min(m_tileSize, m_width - x0);
+    int height = std::min(m_tileSize, m_height - y0);
+
+    if(m_version == 1) {
+        return decodeTileV1(x0, y0, width, height, out, outStride);
+    }
+    if(m_version == BixlFile::LAYERED_VERSION) {
+        return decodeTileV3(tx, ty, width, height, out, outStride);
+    }
+    return decodeTileV2(m_chunks[0], tx, ty, width, height, out, outStride);
+}
+
+/**
+ * Decodes an arbitrary rectangle, touching only the tiles it overlaps.
+ * The rectangle must lie inside the image.
+ */
+bool MappedBixlFile::readRegion(int x, int y, int width, int height, Rgba* out, int outStride) const {
+    if(x < 0 || y < 0 || width < 0 || height < 0 || x + width > m_width || y + height > m_height) {
+        return false;
+    }
+
+    std::vector<Rgba> tile((size_t) m_tileSize * m_tileSize);
+    for(int ty = y / m_tileSize; ty * m_tileSize < y + height; ty++) {
+        for(int tx = x / m_tileSize; tx * m_tileSize < x + width; tx++) {
+            if(!decodeTile(tx, ty, &tile[0], m_tileSize)) {
+                return false;
+            }
+            int x0 = std::max(x, tx * m_tileSize);
+            int y0 = std::max(y, ty * m_tileSize);
+            int x1 = std::min(x + width, (tx + 1) * m_tileSize);
+            int y1 = std::min(y + height, (ty + 1) * m_tileSize);
+            for(int row = y0; row < y1; row++) {
+                memcpy(out + (size_t) (row - y) * outStride + (x0 - x),
+                       &tile[(size_t) (row - ty * m_tileSize) * m_tileSize + (x0 - tx * m_tileSize)],
+                       (x1 - x0) * sizeof(Rgba));
+            }
+        }
+    }
+    return true;
+}
+
+//-Private-//
+
+bool MappedBixlFile::parseHeader() {
+    m_version = BixlFile::version(m_data, m_size);
+
+    if(m_version == 1) {
+        m_width = (int32_t) BixlFile::readBE32(m_data);
+        m_height = (int32_t) BixlFile::readBE32(m_data + 4);
+        m_dimension = (int32_t) BixlFile::readBE32(m_data + 8);
+        m_tileSize = BixlFile::DEFAULT_TILE_SIZE;
+        return m_width > 0 && m_height > 0
+            && (m_size - BixlFile::V1_HEADER_SIZE) / 16 >= (uint64_t) m_width * m_height;
+    }
+
+    if(m_version == 2) {
+        m_chunks.resize(1);
+        return parseV2Header(0, m_size, m_chunks[0]);
+    }
+
+    if(m_version == BixlFile::LAYERED_VERSION) {
+        return parseV3Header();
+    }
+
+    if(m_version == BixlFile::ANIMATED_VERSION) {
+        // The first frame's chunk is a complete v2 file
+        size_t first = BixlFile::V2_HEADER_SIZE + 4;
+        if(BixlFile::readLE16(m_data + 20) == 0 || m_size < first) {
+            return false;
+        }
+        size_t length = BixlFile::readLE32(m_data + first - 4);
+        m_chunks.resize(1);
+        return length <= m_size - first && BixlFile::version(m_data + first, length) == 2
+            && parseV2Header(first, length, m_chunks[0]);
+    }
+    return false;
+}
+
+/**
+ * Reads the header of the v2 file that is size bytes at base into
+ * chunk, and sets the image size and tile size from it.
+ */
+bool MappedBixlFile::parseV2Header(size_t base, size_t size, Chunk& chunk) {
+    const unsigned char* header = m_data + base;
+    chunk.indexed = BixlFile::readLE16(header + 6) & BixlFile::FLAG_INDEXED;
+    m_width = (int32_t) BixlFile::readLE32(header + 8);
+    m_height = (int32_t) BixlFile::readLE32(header + 12);
+    m_dimension = (int32_t) BixlFile::readLE32(header + 16);
+    m_tileSize = BixlFile::readLE16(header + 20);
+    size_t paletteSize = BixlFile::readLE16(header + 22);
+    if(size < (size_t) BixlFile::V2_HEADER_SIZE || m_width <= 0 || m_height <= 0 || m_tileSize <= 0
+       || m_tileSize > BixlFile::MAX_TILE_SIZE || paletteSize > (size_t) BixlFile::MAX_PALETTE_SIZE) {
+        return false;
+    }
+
+    chunk.offsetTable = base + BixlFile::V2_HEADER_SIZE + 4 * paletteSize;
+    chunk.tileData = chunk.offsetTable + 4 * ((size_t) tilesX() * tilesY() + 1);
+    chunk.end = base + size;
+    if(chunk.tileData > chunk.end) {
+        return false;
+    }
+
+    chunk.palette.resize(paletteSize);
+    for(size_t i = 0; i < paletteSize; i++) {
+        chunk.palette[i] = BixlFile::readLE32(header + BixlFile::V2_HEADER_SIZE + 4 * i);
+    }
+    chunk.opacity = 255;
+    chunk.visible = true;
+    chunk.blendMode = Layer::NORMAL;
+    return !chunk.indexed || paletteSize > 0;
+}
+
+/**
+ * Reads the layer table of a v3 file, and the header of each layer's
+ * v2 file, which must all match the size in the main header.
+ */
+bool MappedBixlFile::parseV3Header() {
+    int width = (int32_t) BixlFile::readLE32(m_data + 8);
+    int height = (int32_t) BixlFile::readLE32(m_data + 12);
+    int dimension = (int32_t) BixlFile::readLE32(m_data + 16);
+    uint32_t layerCount = BixlFile::readLE32(m_data + 20);
+    if(width <= 0 || height <= 0 || layerCount == 0) {
+        return false;
+    }
+
+    int tileSize = 0;
+    size_t pos = BixlFile::V2_HEADER_SIZE;
+    for(uint32_t i = 0; i < layerCount; i++) {
+        if(m_size - pos < 2) {
+            return false;
+        }
+        size_t nameLength = BixlFile::readLE16(m_data + pos);
+        pos += 2;
+        if(m_size - pos < nameLength + 8) {
+            return false;
+        }
+        pos += nameLength;
+        const unsigned char* info = m_data + pos;
+        size_t length = BixlFile::readLE32(info + 4);
+        pos += 8;
+
+        m_chunks.push_back(Chunk());
+        Chunk& chunk = m_chunks.back();
+        if(length > m_size - pos || BixlFile::version(m_data + pos, length) != 2
+           || !parseV2Header(pos, length, chunk) || m_width != width || m_height != height
+           || (tileSize != 0 && m_tileSize != tileSize)) {
+            return false;
+        }
+        tileSize = m_tileSize;
+        chunk.opacity = info[0];
+        chunk.visible = info[1] & BixlFile::LAYER_VISIBLE;
+        chunk.blendMode = info[2] < Layer::BLEND_MODE_COUNT ? (Layer::BlendMode) info[2] : Layer::NORMAL;
+        pos += length;
+    }
+    m_dimension = dimension;
+    return true;
+}
+
+bool MappedBixlFile::decodeTileV1(int x0, int y0, int width, int height, Rgba* out, int outStride) const {
+    //v1 bixels are stored column by column
+    for(int x = 0; x < width; x++) {
+        const unsigned char* bixel = m_data + BixlFile::V1_HEADER_SIZE
+                                   + ((size_t) (x0 + x) * m_height + y0) * 16;
+        Rgba* column = out + x;
+        for(int y = 0; y < height; y++, bixel += 16) {
+            column[(size_t) y * outStride] = packRgba(channelV1(bixel), channelV1(bixel + 4),
+                                                      channelV1(bixel + 8), channelV1(bixel + 12));
+        }
+    }
+    return true;
+}
+
+bool MappedBixlFile::decodeTileV2(const Chunk& chunk, int tx, int ty, int width, int height,
+                                  Rgba* out, int outStride) const {
+    const unsigned char* offset = m_data + chunk.offsetTable + 4 * ((size_t) ty * tilesX() + tx);
+    size_t begin = BixlFile::readLE32(offset);
+    size_t end = BixlFile::readLE32(offset + 4);
+    if(begin > end || end > chunk.end - chunk.tileData) {
+        return false;
+    }
+
+    const unsigned char* runs = m_data + chunk.tileData + begin;
+    if(width == outStride) {
+        return BixlFile::decodeRuns(runs, end - begin, chunk.indexed, chunk.palette,
+                                    out, (size_t) width * height);
+    }
+
+    std::vector<Rgba> tile((size_t) width * height);
+    if(!BixlFile::decodeRuns(runs, end - begin, chunk.indexed, chunk.palette, &tile[0], tile.size())) {
+        return false;
+    }
+    for(int y = 0; y < height; y++) {
+        memcpy(out + (size_t) y * outStride, &tile[(size_t) y * width], width * sizeof(Rgba));
+    }
+    return true;
+}
+
+/**
+ * Decodes the tile from each visible layer and composites them. Hidden
+ * layers are not decoded.
+ */
+bool MappedBixlFile::decodeTileV3(int tx, int ty, int width, int height, Rgba* out, int outStride) const {
+    std::vector<Layer> layers(m_chunks.size());
+    for(size_t i = 0; i < m_chunks.size(); i++) {
+        const Chunk& chunk = m_chunks[i];
+        Layer& layer = layers[i];
+        layer.opacity = chunk.opacity;
+        layer.visible = chunk.visible;
+        layer.blendMode = chunk.blendMode;
+        if(!chunk.visible || chunk.opacity == 0) {
+            continue;
+        }
+        layer.pixels = PixelBuffer(width, height);
+        if(!decodeTileV2(chunk, tx, ty, width, height, layer.pixels.data(), layer.pixels.stride())) {
+            return false;
+        }
+    }
+
+    PixelBuffer composite(width, height);
+    Compositor::composite(layers, 0, 0, width, height, composite);
+    for(int y = 0; y < height; y++) {
+        memcpy(out + (size_t) y * outStride, composite.row(y), width * sizeof(Rgba));
+    }
+    return true;
+}
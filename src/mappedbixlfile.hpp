@@ -0,0 +1,83 @@
+#ifndef MAPPEDBIXLFILE_HPP
+#define MAPPEDBIXLFILE_HPP
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include "rgba.hpp"
+#include "layer.hpp"
+
+/**
+ * A read-only, memory-mapped view of a .bixl file.
+ *
+ * open() only maps the file and parses the header, so it takes the same
+ * time for an 8x8 sprite as for a 16k canvas. Bixels are decoded a tile
+ * at a time by decodeTile(), which only touches the pages of that tile.
+ *
+ * v2 files are tiled on disk and each tile is decoded independently.
+ * v1 files have no tiles, but their bixels sit at fixed offsets, so
+ * the same tile grid is read straight out of the mapping. Animations
+ * (v4) read as their first frame, which is stored as a v2 file. Layered
+ * files (v3) read as drawn: each layer is a v2 file, and a tile is
+ * decoded from every layer and composited. Their layers must share one
+ * tile size, as they do in every file BixlFile writes.
+ *
+ * decodeTile() is const and may be called from several threads at once.
+ */
+class MappedBixlFile {
+    public:
+        MappedBixlFile();
+        ~MappedBixlFile();
+
+        bool open(const std::string& fileName);
+        void close();
+        bool isOpen() const;
+
+        int version() const;
+        int width() const;
+        int height() const;
+        int dimension() const;
+        int tileSize() const;
+        int tilesX() const;
+        int tilesY() const;
+        int layerCount() const;
+
+        bool decodeTile(int tx, int ty, Rgba* out, int outStride) const;
+        bool readRegion(int x, int y, int width, int height, Rgba* out, int outStride) const;
+
+    private:
+        MappedBixlFile(const MappedBixlFile&);
+        MappedBixlFile& operator=(const MappedBixlFile&);
+
+        /**
+         * Where the tiles of one embedded v2 file are, and for a layer of
+         * a v3 file, how it is composited.
+         */
+        struct Chunk {
+            bool indexed;
+            std::vector<Rgba> palette;
+            size_t offsetTable;
+            size_t tileData;
+            size_t end;
+            int opacity;
+            bool visible;
+            Layer::BlendMode blendMode;
+        };
+
+        bool parseHeader();
+        bool parseV2Header(size_t base, size_t size, Chunk& chunk);
+        bool parseV3Header();
+        bool decodeTileV1(int x0, int y0, int width, int height, Rgba* out, int outStride) const;
+        bool decodeTileV2(const Chunk& chunk, int tx, int ty, int width, int height,
+                          Rgba* out, int outStride) const;
+        bool decodeTileV3(int tx, int ty, int width, int height, Rgba* out, int outStride) const;
+
+        const unsigned char* m_data;
+        size_t m_size;
+        int m_version;
+        int m_width;
+        int m_height;
+        int m_dimension;
+        int m_tileSize;
+        std::vector<Chunk> m_chunks;
+};
+#endif
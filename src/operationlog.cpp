@@ -0,0 +1,325 @@
+#include <string.h>
+#include <algorithm>
+#include <zlib.h>
+#include "operationlog.hpp"
+#include "tracer.hpp"
+
+namespace {
+    // Largest canvas side a RESIZE may ask for.
+    const int MAX_SIZE = 1 << 15;
+
+    // Bytes deflated to decide whether a large batch is worth deflating.
+    const size_t PROBE_SIZE = 64 * 1024;
+
+    inline uint32_t zigzag(int value) {
+        return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+    }
+
+    inline int unzigzag(uint32_t value) {
+        return (int) (value >> 1) ^ -(int) (value & 1);
+    }
+};
+
+OperationLog::OperationLog() : m_lastY(0), m_lastEnd(0), m_lastColor(0) {}
+
+/**
+ * Empties the batch, keeping its capacity.
+ */
+void OperationLog::clear() {
+    m_data.clear();
+    m_lastY = 0;
+    m_lastEnd = 0;
+    m_lastColor = 0;
+}
+
+bool OperationLog::isEmpty() const {
+    return m_data.empty();
+}
+
+/**
+ * Adds length bixels of color starting at (x, y).
+ */
+void OperationLog::addRun(int x, int y, int length, Rgba color) {
+    if(length > 0) {
+        begin(PIXELS, x, y, length, color);
+    }
+}
+
+/**
+ * Adds the current values of length bixels of pixels starting at (x, y),
+ * clipped to the canvas, as runs of equal color. Call after the edit.
+ */
+void OperationLog::addPixels(const PixelBuffer& pixels, int x, int y, int length) {
+    if(y < 0 || y >= pixels.height()) {
+        return;
+    }
+    int end = std::min(pixels.width(), x + length);
+    x = std::max(0, x);
+    const Rgba* row = pixels.row(y);
+    while(x < end) {
+        int runEnd = x + 1;
+        while(runEnd < end && row[runEnd] == row[x]) {
+            runEnd++;
+        }
+        if(runEnd - x > 1) {
+            begin(PIXELS, x, y, runEnd - x, row[x]);
+            x = runEnd;
+            continue;
+        }
+        // Single bixels up to the next run of two or more go in one literal.
+        int literalEnd = runEnd;
+        while(literalEnd + 1 < end && row[literalEnd + 1] != row[literalEnd]) {
+            literalEnd++;
+        }
+        if(literalEnd + 1 == end) {
+            literalEnd = end;
+        }
+        begin(LITERAL, x, y, literalEnd - x, 0);
+        size_t used = m_data.size();
+        m_data.resize(used + (size_t) (literalEnd - x) * 4);
+        unsigned char* out = &m_data[used];
+        for(int i = x; i < literalEnd; i++, out += 4) {
+            out[0] = (unsigned char) row[i];
+            out[1] = (unsigned char) (row[i] >> 8);
+            out[2] = (unsigned char) (row[i] >> 16);
+            out[3] = (unsigned char) (row[i] >> 24);
+        }
+        x = literalEnd;
+    }
+}
+
+void OperationLog::addRect(const PixelBuffer& pixels, int x, int y, int width, int height) {
+    for(int row = std::max(0, y); row < std::min(pixels.height(), y + height); row++) {
+        addPixels(pixels, x, row, width);
+    }
+}
+
+void OperationLog::addSelection(int x, int y, int length, bool selected) {
+    if(length > 0) {
+        begin(selected ? SELECT : DESELECT, x, y, length, 0);
+    }
+}
+
+/**
+ * Adds the runs whose membership differs between before and after, each
+ * set to its state in after. Both must have the same size.
+ */
+void OperationLog::addSelectionChange(const Selection& before, const Selection& after) {
+    std::vector<Selection::Run> runs;
+    before.differenceRuns(after, runs);
+    for(size_t i = 0; i < runs.size(); i++) {
+        addSelection(runs[i].x, runs[i].y, runs[i].length, after.contains(runs[i].x, runs[i].y));
+    }
+}
+
+/**
+ * Adds the whole canvas and selection, so that applying the batch to any
+ * canvas makes it a copy of this one.
+ */
+void OperationLog::addSnapshot(const PixelBuffer& pixels, const Selection& selection) {
+    Tracer::Zone zone("log_snapshot");
+    addResize(pixels.width(), pixels.height());
+    addRect(pixels, 0, 0, pixels.width(), pixels.height());
+    for(int y = 0; y < selection.height(); y++) {
+        addSelection(0, y, selection.width(), false);
+    }
+    selection.forEachSpan([this](int x, int y, int length) { addSelection(x, y, length, true); });
+}
+
+void OperationLog::addResize(int width, int height) {
+    m_data.push_back(RESIZE);
+    putVarint(width);
+    putVarint(height);
+}
+
+const std::vector<unsigned char>& OperationLog::data() const {
+    return m_data;
+}
+
+/**
+ * Replaces the batch with encoded operations, as received from a peer.
+ */
+void OperationLog::assign(const unsigned char* data, size_t size) {
+    clear();
+    m_data.assign(data, data + size);
+}
+
+/**
+ * Applies every operation in order. Runs are clipped to the canvas and
+ * only the bixels written are marked dirty.
+ *
+ * @return  false if the batch is malformed; operations before the bad
+ *          one have been applied.
+ */
+bool OperationLog::apply(PixelBuffer& pixels, Selection& selection) const {
+    Tracer::Zone zone("apply_operations");
+    const unsigned char* in = m_data.data();
+    const unsigned char* end = in + m_data.size();
+    int64_t lastY = 0;
+    int64_t lastEnd = 0;
+    Rgba lastColor = 0;
+    while(in < end) {
+        int tag = *in++;
+        int type = tag & TYPE_MASK;
+        uint32_t a, b;
+        if(type == RESIZE) {
+            if(!getVarint(in, end, a) || !getVarint(in, end, b) || a > (uint32_t) MAX_SIZE || b > (uint32_t) MAX_SIZE) {
+                return false;
+            }
+            if((int) a != pixels.width() || (int) b != pixels.height()) {
+                pixels.resize(a, b);
+                pixels.markDirty(0, 0, a, b);
+            }
+            if((int) a != selection.width() || (int) b != selection.height()) {
+                selection.resize(a, b);
+            }
+            continue;
+        }
+        if(type > LITERAL) {
+            return false;
+        }
+
+        if(!(tag & SAME_ROW)) {
+            if(!getVarint(in, end, a)) {
+                return false;
+            }
+            lastY += unzigzag(a);
+        }
+        if(!getVarint(in, end, a) || !getVarint(in, end, b) || b == 0 || b > (uint32_t) MAX_SIZE) {
+            return false;
+        }
+        int64_t x = lastEnd + unzigzag(a);
+        lastEnd = x + b;
+        if(type == PIXELS && !(tag & SAME_COLOR)) {
+            if(end - in < 4) {
+                return false;
+            }
+            lastColor = (Rgba) in[0] | (Rgba) in[1] << 8 | (Rgba) in[2] << 16 | (Rgba) in[3] << 24;
+            in += 4;
+        }
+        const unsigned char* literal = in;
+        if(type == LITERAL) {
+            if((size_t) (end - in) < (size_t) b * 4) {
+                return false;
+            }
+            in += (size_t) b * 4;
+        }
+
+        bool drawing = type == PIXELS || type == LITERAL;
+        int width = drawing ? pixels.width() : selection.width();
+        int height = drawing ? pixels.height() : selection.height();
+        if(lastY < 0 || lastY >= height) {
+            continue;
+        }
+        int x0 = (int) std::max<int64_t>(0, x);
+        int x1 = (int) std::min<int64_t>(width, lastEnd);
+        if(x0 >= x1) {
+            continue;
+        }
+        if(type == PIXELS) {
+            PixelBuffer::fillSpan(pixels.row(lastY) + x0, x1 - x0, lastColor);
+            pixels.markDirty(x0, lastY, x1 - x0, 1);
+        } else if(type == LITERAL) {
+            Rgba* row = pixels.row(lastY);
+            for(int i = x0; i < x1; i++) {
+                const unsigned char* bytes = literal + (size_t) (i - x) * 4;
+                row[i] = (Rgba) bytes[0] | (Rgba) bytes[1] << 8 | (Rgba) bytes[2] << 16 | (Rgba) bytes[3] << 24;
+            }
+            pixels.markDirty(x0, lastY, x1 - x0, 1);
+        } else {
+            selection.setSpan(x0, lastY, x1 - x0, type == SELECT);
+        }
+    }
+    return true;
+}
+
+/**
+ * Deflates the batch into out, at a level fast enough to run every frame.
+ * Large batches are probed first, so ones made mostly of noisy literals
+ * are not deflated for nothing.
+ *
+ * @return  false, leaving out empty, if the batch does not get smaller.
+ */
+bool OperationLog::compress(std::vector<unsigned char>& out) const {
+    Tracer::Zone zone("compress_operations");
+    out.clear();
+    if(m_data.size() > PROBE_SIZE) {
+        std::vector<unsigned char> probe(compressBound(PROBE_SIZE));
+        uLongf probed = probe.size();
+        if(compress2(probe.data(), &probed, m_data.data(), PROBE_SIZE, 1) != Z_OK
+           || probed > PROBE_SIZE / 8 * 7) {
+            return false;
+        }
+    }
+    uLongf size = compressBound(m_data.size());
+    out.resize(size);
+    if(compress2(out.data(), &size, m_data.data(), m_data.size(), 1) != Z_OK || size >= m_data.size()) {
+        out.clear();
+        return false;
+    }
+    out.resize(size);
+    return true;
+}
+
+/**
+ * Replaces the batch with the inflated data written by compress().
+ *
+ * @param rawSize   Size of the batch before compression.
+ */
+bool OperationLog::decompress(const unsigned char* data, size_t size, size_t rawSize) {
+    Tracer::Zone zone("decompress_operations");
+    clear();
+    m_data.resize(rawSize);
+    uLongf written = rawSize;
+    if(uncompress(m_data.data(), &written, data, size) != Z_OK || written != rawSize) {
+        m_data.clear();
+        return false;
+    }
+    return true;
+}
+
+//-Private-//
+
+void OperationLog::begin(Type type, int x, int y, int length, Rgba color) {
+    int tag = type;
+    if(y == m_lastY) {
+        tag |= SAME_ROW;
+    }
+    if(type == PIXELS && color == m_lastColor) {
+        tag |= SAME_COLOR;
+    }
+    m_data.push_back(tag);
+    if(!(tag & SAME_ROW)) {
+        putVarint(zigzag(y - m_lastY));
+    }
+    putVarint(zigzag(x - m_lastEnd));
+    putVarint(length);
+    if(type == PIXELS && !(tag & SAME_COLOR)) {
+        unsigned char bytes[4] = { (unsigned char) color, (unsigned char) (color >> 8),
+                                   (unsigned char) (color >> 16), (unsigned char) (color >> 24) };
+        m_data.insert(m_data.end(), bytes, bytes + 4);
+        m_lastColor = color;
+    }
+    m_lastY = y;
+    m_lastEnd = x + length;
+}
+
+void OperationLog::putVarint(uint32_t value) {
+    while(value >= 0x80) {
+        m_data.push_back((unsigned char) (value | 0x80));
+        value >>= 7;
+    }
+    m_data.push_back((unsigned char) value);
+}
+
+bool OperationLog::getVarint(const unsigned char*& in, const unsigned char* end, uint32_t& value) {
+    value = 0;
+    for(int shift = 0; shift < 35 && in < end; shift += 7) {
+        unsigned char byte = *in++;
+        value |= (uint32_t) (byte & 0x7F) << shift;
+        if(!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
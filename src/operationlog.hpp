@@ -0,0 +1,66 @@
+#ifndef OPERATIONLOG_HPP
+#define OPERATIONLOG_HPP
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "selection.hpp"
+
+/**
+ * A batch of canvas edits encoded compactly for a shared session: runs
+ * of one color, literal runs of differing colors, runs of selection set
+ * or cleared, and canvas resizes.
+ *
+ * Every operation states the result, not the change, so applying a
+ * batch twice, or re-applying one after another batch, leaves the same
+ * canvas as applying them once in order.
+ *
+ * Operations are delta coded. Each starts with a tag byte holding the
+ * type and flags for "same row" and "same color as the last run"; rows
+ * are stored as the difference from the previous operation's row, x as
+ * the difference from the end of the previous run, both zig-zag varints,
+ * and colors as 4 raw bytes only when they change. A stroke costs a few
+ * bytes per row; a large region of one color costs a few bytes per row
+ * too. Bixels that differ from their neighbours are stored as literals,
+ * 4 bytes each. compress() deflates big batches on top of that.
+ */
+class OperationLog {
+    public:
+        enum Type { PIXELS = 0, SELECT = 1, DESELECT = 2, RESIZE = 3, LITERAL = 4 };
+
+        OperationLog();
+
+        void clear();
+        bool isEmpty() const;
+
+        void addRun(int x, int y, int length, Rgba color);
+        void addPixels(const PixelBuffer& pixels, int x, int y, int length);
+        void addRect(const PixelBuffer& pixels, int x, int y, int width, int height);
+        void addSelection(int x, int y, int length, bool selected);
+        void addSelectionChange(const Selection& before, const Selection& after);
+        void addSnapshot(const PixelBuffer& pixels, const Selection& selection);
+        void addResize(int width, int height);
+
+        const std::vector<unsigned char>& data() const;
+        void assign(const unsigned char* data, size_t size);
+        bool apply(PixelBuffer& pixels, Selection& selection) const;
+
+        bool compress(std::vector<unsigned char>& out) const;
+        bool decompress(const unsigned char* data, size_t size, size_t rawSize);
+
+    private:
+        static const int TYPE_MASK = 7;
+        static const int SAME_ROW = 8;
+        static const int SAME_COLOR = 16;
+
+        void begin(Type type, int x, int y, int length, Rgba color);
+        void putVarint(uint32_t value);
+        static bool getVarint(const unsigned char*& in, const unsigned char* end, uint32_t& value);
+
+        std::vector<unsigned char> m_data;
+        int m_lastY;
+        int m_lastEnd;
+        Rgba m_lastColor;
+};
+#endif
@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <new>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "pixelbuffer.hpp"
+
+namespace {
+    const int STRIDE_MULTIPLE = PixelBuffer::ALIGNMENT / sizeof(Rgba);
+
+    Rgba* allocatePixels(size_t count) {
+        if(count == 0) {
+            return 0;
+        }
+        void* memory = 0;
+        if(posix_memalign(&memory, PixelBuffer::ALIGNMENT, count * sizeof(Rgba)) != 0) {
+            throw std::bad_alloc();
+        }
+        return (Rgba*) memory;
+    }
+};
+
+PixelBuffer::PixelBuffer() : m_width(0), m_height(0), m_stride(0), m_data(0) {}
+
+PixelBuffer::PixelBuffer(int width, int height, Rgba fillColor) :
+    m_width(0), m_height(0), m_stride(0), m_data(0) {
+    resize(width, height, fillColor);
+}
+
+PixelBuffer::PixelBuffer(const PixelBuffer& other) :
+    m_width(other.m_width), m_height(other.m_height), m_stride(other.m_stride),
+    m_data(allocatePixels((size_t) other.m_stride * other.m_height)), m_dirty(other.m_dirty) {
+    if(m_data) {
+        memcpy(m_data, other.m_data, byteCount());
+    }
+}
+
+PixelBuffer::PixelBuffer(PixelBuffer&& other) :
+    m_width(other.m_width), m_height(other.m_height), m_stride(other.m_stride),
+    m_data(other.m_data), m_dirty(std::move(other.m_dirty)) {
+    other.m_width = 0;
+    other.m_height = 0;
+    other.m_stride = 0;
+    other.m_data = 0;
+}
+
+PixelBuffer::~PixelBuffer() {
+    free(m_data);
+}
+
+PixelBuffer& PixelBuffer::operator=(PixelBuffer other) {
+    swap(other);
+    return *this;
+}
+
+bool PixelBuffer::operator==(const PixelBuffer& other) const {
+    if(m_width != other.m_width || m_height != other.m_height) {
+        return false;
+    }
+    for(int y = 0; y < m_height; y++) {
+        if(memcmp(row(y), other.row(y), m_width * sizeof(Rgba)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PixelBuffer::operator!=(const PixelBuffer& other) const {
+    return !(*this == other);
+}
+
+void PixelBuffer::swap(PixelBuffer& other) {
+    std::swap(m_width, other.m_width);
+    std::swap(m_height, other.m_height);
+    std::swap(m_stride, other.m_stride);
+    std::swap(m_data, other.m_data);
+    std::swap(m_dirty, other.m_dirty);
+}
+
+int PixelBuffer::width() const {
+    return m_width;
+}
+
+int PixelBuffer::height() const {
+    return m_height;
+}
+
+/**
+ * The distance between the starts of two rows, in bixels. Always a
+ * multiple of ALIGNMENT / sizeof(Rgba).
+ */
+int PixelBuffer::stride() const {
+    return m_stride;
+}
+
+bool PixelBuffer::isEmpty() const {
+    return m_width == 0 || m_height == 0;
+}
+
+size_t PixelBuffer::byteCount() const {
+    return (size_t) m_stride * m_height * sizeof(Rgba);
+}
+
+DirtyRegion& PixelBuffer::dirtyRegion() {
+    return m_dirty;
+}
+
+const DirtyRegion& PixelBuffer::dirtyRegion() const {
+    return m_dirty;
+}
+
+Rgba* PixelBuffer::data() {
+    return m_data;
+}
+
+const Rgba* PixelBuffer::data() const {
+    return m_data;
+}
+
+/**
+ * Changes the size of the buffer, keeping the bixels that fall inside
+ * both the old and the new size. New bixels are set to fillColor. A
+ * buffer that already has the size is left as it is.
+ */
+void PixelBuffer::resize(int width, int height, Rgba fillColor) {
+    width = std::max(0, width);
+    height = std::max(0, height);
+    if(width == m_width && height == m_height) {
+        return;
+    }
+    int stride = (width + STRIDE_MULTIPLE - 1) / STRIDE_MULTIPLE * STRIDE_MULTIPLE;
+
+    PixelBuffer resized;
+    resized.m_width = width;
+    resized.m_height = height;
+    resized.m_stride = stride;
+    resized.m_data = allocatePixels((size_t) stride * height);
+    resized.m_dirty.resize(width, height);
+
+    int keepWidth = std::min(width, m_width);
+    int keepHeight = std::min(height, m_height);
+    for(int y = 0; y < height; y++) {
+        Rgba* destination = resized.row(y);
+        int kept = 0;
+        if(y < keepHeight) {
+            memcpy(destination, row(y), keepWidth * sizeof(Rgba));
+            kept = keepWidth;
+        }
+        fillSpan(destination + kept, width - kept, fillColor);
+        fillSpan(destination + width, stride - width, 0);
+    }
+    swap(resized);
+}
+
+void PixelBuffer::fill(Rgba color) {
+    fillRect(0, 0, m_width, m_height, color);
+}
+
+/**
+ * Fills the given rectangle, clipped to the buffer.
+ */
+void PixelBuffer::fillRect(int x, int y, int width, int height, Rgba color) {
+    int x0 = std::max(0, x);
+    int y0 = std::max(0, y);
+    int x1 = std::min(m_width, x + width);
+    int y1 = std::min(m_height, y + height);
+    if(x0 >= x1) {
+        return;
+    }
+    for(int row = y0; row < y1; row++) {
+        fillSpan(this->row(row) + x0, x1 - x0, color);
+    }
+    m_dirty.markRect(x0, y0, x1 - x0, y1 - y0);
+}
+
+/**
+ * Copies a width x height block of source starting at (sourceX, sourceY)
+ * to (x, y) in this buffer, one memcpy per row. The block is clipped to
+ * both buffers. source may be this buffer only if the areas do not overlap.
+ */
+void PixelBuffer::copyRect(const PixelBuffer& source, int sourceX, int sourceY,
+                           int width, int height, int x, int y) {
+    if(sourceX < 0) { width += sourceX; x -= sourceX; sourceX = 0; }
+    if(sourceY < 0) { height += sourceY; y -= sourceY; sourceY = 0; }
+    if(x < 0) { width += x; sourceX -= x; x = 0; }
+    if(y < 0) { height += y; sourceY -= y; y = 0; }
+    width = std::min(width, std::min(source.m_width - sourceX, m_width - x));
+    height = std::min(height, std::min(source.m_height - sourceY, m_height - y));
+    if(width <= 0 || height <= 0) {
+        return;
+    }
+    for(int row = 0; row < height; row++) {
+        memcpy(this->row(y + row) + x, source.row(sourceY + row) + sourceX, width * sizeof(Rgba));
+    }
+    m_dirty.markRect(x, y, width, height);
+}
+
+/**
+ * Sets count bixels starting at span to color, using 16 byte stores once
+ * the span is aligned.
+ */
+void PixelBuffer::fillSpan(Rgba* span, size_t count, Rgba color) {
+#ifdef __SSE2__
+    while(count > 0 && ((size_t) span & 15) != 0) {
+        *span++ = color;
+        count--;
+    }
+    __m128i four = _mm_set1_epi32(color);
+    for(; count >= 4; count -= 4, span += 4) {
+        _mm_store_si128((__m128i*) span, four);
+    }
+#endif
+    for(; count > 0; count--) {
+        *span++ = color;
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef PIXELBUFFER_HPP
+#define PIXELBUFFER_HPP
+#include <stddef.h>
+#include "rgba.hpp"
+#include "dirtyregion.hpp"
+
+/**
+ * A contiguous grid of packed RGBA8 bixels.
+ *
+ * Rows start on ALIGNMENT byte boundaries and are stride() bixels apart,
+ * so whole rows can be handed to SIMD loops, memcpy and glTexSubImage2D
+ * without repacking. Bixels past width() in a row are padding and are
+ * kept transparent.
+ *
+ * row() is the fast path: everything that walks the canvas should take
+ * a row span and loop over it rather than call pixel()/setPixel().
+ *
+ * Every change made through the buffer's own methods is recorded in
+ * dirtyRegion(); code that writes through row() or data() must report
+ * what it wrote with markDirty() so partial uploads pick it up.
+ */
+class PixelBuffer {
+    public:
+        static const int ALIGNMENT = 64;
+
+        PixelBuffer();
+        PixelBuffer(int width, int height, Rgba fillColor = 0);
+        PixelBuffer(const PixelBuffer& other);
+        PixelBuffer(PixelBuffer&& other);
+        ~PixelBuffer();
+
+        PixelBuffer& operator=(PixelBuffer other);
+        bool operator==(const PixelBuffer& other) const;
+        bool operator!=(const PixelBuffer& other) const;
+        void swap(PixelBuffer& other);
+
+        int width() const;
+        int height() const;
+        int stride() const;
+        bool isEmpty() const;
+        bool contains(int x, int y) const;
+        size_t byteCount() const;
+
+        Rgba* data();
+        const Rgba* data() const;
+        Rgba* row(int y);
+        const Rgba* row(int y) const;
+
+        Rgba pixel(int x, int y) const;
+        void setPixel(int x, int y, Rgba color);
+
+        void resize(int width, int height, Rgba fillColor = 0);
+        void fill(Rgba color);
+        void fillRect(int x, int y, int width, int height, Rgba color);
+        void copyRect(const PixelBuffer& source, int sourceX, int sourceY,
+                      int width, int height, int x, int y);
+
+        void markDirty(int x, int y, int width, int height);
+        DirtyRegion& dirtyRegion();
+        const DirtyRegion& dirtyRegion() const;
+
+        static void fillSpan(Rgba* span, size_t count, Rgba color);
+
+    private:
+        int m_width;
+        int m_height;
+        int m_stride;
+        Rgba* m_data;
+        DirtyRegion m_dirty;
+};
+
+inline Rgba* PixelBuffer::row(int y) {
+    return m_data + (size_t) y * m_stride;
+}
+
+inline const Rgba* PixelBuffer::row(int y) const {
+    return m_data + (size_t) y * m_stride;
+}
+
+inline Rgba PixelBuffer::pixel(int x, int y) const {
+    return m_data[(size_t) y * m_stride + x];
+}
+
+inline void PixelBuffer::setPixel(int x, int y, Rgba color) {
+    m_data[(size_t) y * m_stride + x] = color;
+    m_dirty.markPixel(x, y);
+}
+
+inline void PixelBuffer::markDirty(int x, int y, int width, int height) {
+    m_dirty.markRect(x, y, width, height);
+}
+
+inline bool PixelBuffer::contains(int x, int y) const {
+    return x >= 0 && y >= 0 && x < m_width && y < m_height;
+}
+#endif
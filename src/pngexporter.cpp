@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "pngexporter.hpp"
+#include "tracer.hpp"
+
+namespace {
+    const size_t TARGET_BAND_BYTES = 4 * 1024 * 1024;
+
+    enum PngFilter { FILTER_SUB = 1, FILTER_UP = 2 };
+
+    struct Band {
+        std::vector<unsigned char> compressed;
+        uLong adler;
+        size_t rawSize;
+        int firstRow;
+        int lastRow;
+        std::atomic<bool> claimed;  ///< Set by whichever thread encodes the band
+        bool ready;
+        bool failed;
+
+        Band() : adler(1), rawSize(0), firstRow(0), lastRow(0), claimed(false), ready(false), failed(false) {}
+    };
+
+    void putBE32(unsigned char* out, uint32_t value) {
+        out[0] = value >> 24;
+        out[1] = value >> 16;
+        out[2] = value >> 8;
+        out[3] = value;
+    }
+
+    bool writeChunk(FILE* file, const char* type, const unsigned char* data, size_t size) {
+        unsigned char header[8];
+        putBE32(header, size);
+        memcpy(header + 4, type, 4);
+        uLong crc = crc32(0, header + 4, 4);
+        if(size > 0) {
+            crc = crc32(crc, data, size);
+        }
+        unsigned char trailer[4];
+        putBE32(trailer, crc);
+        return fwrite(header, 1, 8, file) == 8
+            && (size == 0 || fwrite(data, 1, size, file) == size)
+            && fwrite(trailer, 1, 4, file) == 4;
+    }
+
+    /**
+     * Scales, filters and deflates source rows [firstSourceRow,
+     * lastSourceRow) into a raw deflate block that ends on a byte boundary, so
+     * blocks from different bands can be concatenated.
+     */
+    void encodeBand(Band& band, const PngExporter::RowReader& reader, int width, int scale,
+                    int firstSourceRow, int lastSourceRow, bool last, int level) {
+        size_t scaledWidth = (size_t) width * scale;
+        size_t rowBytes = 1 + scaledWidth * 4;
+        std::vector<unsigned char> raw(rowBytes * scale * (lastSourceRow - firstSourceRow));
+        std::vector<Rgba> source(width);
+        std::vector<Rgba> scaled(scaledWidth);
+
+        unsigned char* out = raw.data();
+        for(int y = firstSourceRow; y < lastSourceRow; y++) {
+            reader(y, source.data());
+            PngExporter::scaleRow(source.data(), width, scale, scaled.data());
+
+            const unsigned char* bytes = (const unsigned char*) scaled.data();
+            out[0] = FILTER_SUB;
+            memcpy(out + 1, bytes, std::min<size_t>(4, scaledWidth * 4));
+            for(size_t i = 4; i < scaledWidth * 4; i++) {
+                out[1 + i] = bytes[i] - bytes[i - 4];
+            }
+            out += rowBytes;
+
+            for(int repeat = 1; repeat < scale; repeat++) {
+                out[0] = FILTER_UP;
+                memset(out + 1, 0, rowBytes - 1);
+                out += rowBytes;
+            }
+        }
+
+        band.rawSize = raw.size();
+        band.adler = adler32(1, raw.data(), raw.size());
+
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+        if(deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            band.failed = true;
+            return;
+        }
+        band.compressed.resize(deflateBound(&stream, raw.size()) + 16);
+        stream.next_in = raw.data();
+        stream.avail_in = raw.size();
+        stream.next_out = band.compressed.data();
+        stream.avail_out = band.compressed.size();
+        int result = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        band.failed = last ? result != Z_STREAM_END : (result != Z_OK || stream.avail_in != 0);
+        band.compressed.resize(band.compressed.size() - stream.avail_out);
+        deflateEnd(&stream);
+    }
+};
+
+/**
+ * @param pool  Threads to encode on. If 0 the exporter creates its own.
+ */
+PngExporter::PngExporter(ThreadPool* pool) :
+    m_pool(pool), m_ownsPool(pool == 0), m_scale(1), m_compressionLevel(Z_DEFAULT_COMPRESSION) {
+    if(m_ownsPool) {
+        m_pool = new ThreadPool();
+    }
+}
+
+PngExporter::~PngExporter() {
+    if(m_ownsPool) {
+        delete m_pool;
+    }
+}
+
+/**
+ * Each bixel becomes a scale x scale block of pixels.
+ */
+void PngExporter::setScale(int scale) {
+    m_scale = std::max(1, scale);
+}
+
+int PngExporter::scale() const {
+    return m_scale;
+}
+
+/**
+ * zlib level, 0 (store) to 9 (smallest). Lower levels export faster.
+ */
+void PngExporter::setCompressionLevel(int level) {
+    m_compressionLevel = level;
+}
+
+bool PngExporter::exportImage(const PixelBuffer& pixels, const std::string& fileName) {
+    const PixelBuffer* source = &pixels;
+    return exportRows(pixels.width(), pixels.height(), [source](int y, Rgba* row) {
+        memcpy(row, source->row(y), source->width() * sizeof(Rgba));
+    }, fileName);
+}
+
+/**
+ * Exports a width x height canvas whose rows come from reader, which
+ * lets tiled or memory-mapped canvases export without being flattened.
+ *
+ * @return  false if the file could not be written or the scaled size
+ *          does not fit in a PNG.
+ */
+bool PngExporter::exportRows(int width, int height, const RowReader& reader, const std::string& fileName) {
+    Tracer::Zone zone("png_export");
+    uint64_t scaledWidth = (uint64_t) width * m_scale;
+    uint64_t scaledHeight = (uint64_t) height * m_scale;
+    if(width <= 0 || height <= 0 || scaledWidth > 0x7FFFFFFF || scaledHeight > 0x7FFFFFFF) {
+        return false;
+    }
+
+    FILE* file = fopen(fileName.c_str(), "wb");
+    if(!file) {
+        return false;
+    }
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    unsigned char header[13];
+    putBE32(header, scaledWidth);
+    putBE32(header + 4, scaledHeight);
+    header[8] = 8;      // bit depth
+    header[9] = 6;      // RGBA
+    header[10] = 0;     // deflate
+    header[11] = 0;     // adaptive filtering
+    header[12] = 0;     // not interlaced
+    static const unsigned char zlibHeader[2] = { 0x78, 0x9C };
+
+    bool success = fwrite(signature, 1, 8, file) == 8
+                && writeChunk(file, "IHDR", header, sizeof(header))
+                && writeChunk(file, "IDAT", zlibHeader, sizeof(zlibHeader));
+
+    size_t scaledRowBytes = (1 + scaledWidth * 4) * m_scale;
+    int rowsPerBand = std::max<size_t>(1, TARGET_BAND_BYTES / scaledRowBytes);
+    int bandCount = (height + rowsPerBand - 1) / rowsPerBand;
+    int window = m_pool->threadCount() * 2;
+
+    std::vector<std::shared_ptr<Band> > bands(bandCount);
+    std::mutex mutex;
+    std::condition_variable bandReady;
+    int submitted = 0;
+    uLong adler = adler32(0, 0, 0);
+
+    // A band is encoded by whichever thread claims it first: a pool
+    // worker, or this thread while it waits for the bands in order.
+    int scale = m_scale;
+    int level = m_compressionLevel;
+    std::function<void(Band&)> encode = [&reader, &mutex, &bandReady, width, height, scale, level](Band& band) {
+        if(band.claimed.exchange(true)) {
+            return;
+        }
+        encodeBand(band, reader, width, scale, band.firstRow, band.lastRow, band.lastRow == height, level);
+        std::lock_guard<std::mutex> lock(mutex);
+        band.ready = true;
+        bandReady.notify_all();
+    };
+
+    for(int i = 0; i < bandCount; i++) {
+        while(submitted < bandCount && submitted < i + window) {
+            std::shared_ptr<Band> band = std::make_shared<Band>();
+            bands[submitted] = band;
+            band->firstRow = submitted * rowsPerBand;
+            band->lastRow = std::min(height, band->firstRow + rowsPerBand);
+            m_pool->submit([band, encode]() { encode(*band); });
+            submitted++;
+        }
+
+        // Encode band i here if no worker has started it, rather than
+        // block: the export may itself be running on a worker of m_pool.
+        // Unrelated tasks in the pool are left alone, so their time is
+        // not charged to this export. Once band i is claimed, the wait is
+        // bounded by the thread encoding it.
+        encode(*bands[i]);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            bandReady.wait(lock, [&]() { return bands[i]->ready; });
+        }
+        Band& band = *bands[i];
+        success = success && !band.failed
+               && writeChunk(file, "IDAT", band.compressed.data(), band.compressed.size());
+        adler = adler32_combine(adler, band.adler, band.rawSize);
+        bands[i].reset();
+    }
+
+    unsigned char trailer[4];
+    putBE32(trailer, adler);
+    success = success && writeChunk(file, "IDAT", trailer, sizeof(trailer))
+                      && writeChunk(file, "IEND", 0, 0);
+    success = (fclose(file) == 0) && success;
+    return success;
+}
+
+/**
+ * Nearest-neighbour upscales one row: every bixel of in is repeated
+ * scale times in out, which must hold width * scale bixels.
+ */
+void PngExporter::scaleRow(const Rgba* in, int width, int scale, Rgba* out) {
+    if(scale == 1) {
+        memcpy(out, in, width * sizeof(Rgba));
+        return;
+    }
+
+    int x = 0;
+#ifdef __SSE2__
+    if(scale == 2) {
+        for(; x + 4 <= width; x += 4, out += 8) {
+            __m128i four = _mm_loadu_si128((const __m128i*) (in + x));
+            _mm_storeu_si128((__m128i*) out, _mm_unpacklo_epi32(four, four));
+            _mm_storeu_si128((__m128i*) (out + 4), _mm_unpackhi_epi32(four, four));
+        }
+    } else if(scale % 4 == 0) {
+        for(; x + 4 <= width; x += 4) {
+            __m128i four = _mm_loadu_si128((const __m128i*) (in + x));
+            __m128i lanes[4] = { _mm_shuffle_epi32(four, 0x00), _mm_shuffle_epi32(four, 0x55),
+                                 _mm_shuffle_epi32(four, 0xAA), _mm_shuffle_epi32(four, 0xFF) };
+            for(int lane = 0; lane < 4; lane++) {
+                for(int i = 0; i < scale; i += 4, out += 4) {
+                    _mm_storeu_si128((__m128i*) out, lanes[lane]);
+                }
+            }
+        }
+    }
+#endif
+    for(; x < width; x++) {
+        std::fill(out, out + scale, in[x]);
+        out += scale;
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef PNGEXPORTER_HPP
+#define PNGEXPORTER_HPP
+#include <functional>
+#include <string>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "threadpool.hpp"
+
+/**
+ * Writes a canvas to a PNG file at an integer scale, on the CPU.
+ *
+ * The scaled image is never built in memory. The canvas is cut into
+ * bands of rows; worker threads upscale a band (nearest neighbour,
+ * SIMD replicated), PNG-filter it and deflate it into an independent
+ * block, and the calling thread appends finished bands to the file in
+ * order, as IDAT chunks of one zlib stream. Only a few bands are in
+ * flight at once, so memory stays bounded whatever the output size.
+ *
+ * Rows that repeat the row above (every row but the first of each
+ * scaled bixel row) use the Up filter and compress to almost nothing.
+ */
+class PngExporter {
+    public:
+        /**
+         * Reads source row y into row. Called from worker threads.
+         */
+        typedef std::function<void(int y, Rgba* row)> RowReader;
+
+        PngExporter(ThreadPool* pool = 0);
+        ~PngExporter();
+
+        void setScale(int scale);
+        int scale() const;
+        void setCompressionLevel(int level);
+
+        bool exportImage(const PixelBuffer& pixels, const std::string& fileName);
+        bool exportRows(int width, int height, const RowReader& reader, const std::string& fileName);
+
+        static void scaleRow(const Rgba* in, int width, int scale, Rgba* out);
+
+    private:
+        PngExporter(const PngExporter&);
+        PngExporter& operator=(const PngExporter&);
+
+        ThreadPool* m_pool;
+        bool m_ownsPool;
+        int m_scale;
+        int m_compressionLevel;
+};
+#endif
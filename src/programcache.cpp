@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "programcache.hpp"
+#include "tracer.hpp"
+
+namespace {
+    std::string cacheDirectory;
+};
+
+/**
+ * @param directory     Where binaries are kept; it must exist. Empty
+ *                      turns the cache off.
+ */
+void ProgramCache::setDirectory(const std::string& directory) {
+    cacheDirectory = directory;
+}
+
+std::string ProgramCache::directory() {
+    return cacheDirectory;
+}
+
+/**
+ * @return  true if a directory is set and the current context can save
+ *          and restore program binaries. Needs a current context.
+ */
+bool ProgramCache::isAvailable() {
+    if(cacheDirectory.empty()) {
+        return false;
+    }
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    // Contexts without ARB_get_program_binary reject the query.
+    glGetError();
+    return formats > 0;
+}
+
+/**
+ * Restores the program linked from these sources in an earlier run.
+ *
+ * @return  A linked program, or 0 if there is none cached or the driver
+ *          refused it.
+ */
+GLuint ProgramCache::load(const std::string& vertexSource, const std::string& fragmentSource) {
+    if(!isAvailable()) {
+        return 0;
+    }
+    Tracer::Zone zone("load_program_binary");
+    FILE* file = fopen(fileName(vertexSource, fragmentSource).c_str(), "rb");
+    if(!file) {
+        return 0;
+    }
+    uint32_t header[HEADER_SIZE / 4];
+    std::vector<unsigned char> binary;
+    bool valid = fread(header, 1, HEADER_SIZE, file) == (size_t) HEADER_SIZE
+              && header[0] == MAGIC && header[1] == VERSION && header[3] > 0;
+    if(valid) {
+        binary.resize(header[3]);
+        valid = fread(&binary[0], 1, binary.size(), file) == binary.size();
+    }
+    fclose(file);
+    if(!valid) {
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, (GLenum) header[2], &binary[0], binary.size());
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if(!linked) {
+        Tracer::message("ProgramCache: driver rejected a cached program");
+        glDeleteProgram(program);
+        glGetError();
+        return 0;
+    }
+    return program;
+}
+
+/**
+ * Asks the driver to keep a retrievable binary of program. Call before
+ * linking a program that will be passed to store().
+ */
+void ProgramCache::prepare(GLuint program) {
+    if(isAvailable()) {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+}
+
+/**
+ * Saves a linked program for load() to find in later runs.
+ */
+bool ProgramCache::store(GLuint program, const std::string& vertexSource, const std::string& fragmentSource) {
+    if(!isAvailable()) {
+        return false;
+    }
+    Tracer::Zone zone("store_program_binary");
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0) {
+        return false;
+    }
+    std::vector<unsigned char> binary(length);
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program, length, &written, &format, &binary[0]);
+    if(written <= 0) {
+        return false;
+    }
+
+    std::string name = fileName(vertexSource, fragmentSource);
+    std::string temporary = name + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if(!file) {
+        return false;
+    }
+    uint32_t header[HEADER_SIZE / 4] = { MAGIC, VERSION, format, (uint32_t) written };
+    bool success = fwrite(header, 1, HEADER_SIZE, file) == (size_t) HEADER_SIZE
+                && fwrite(&binary[0], 1, written, file) == (size_t) written;
+    success = fclose(file) == 0 && success;
+    success = success && rename(temporary.c_str(), name.c_str()) == 0;
+    if(!success) {
+        remove(temporary.c_str());
+    }
+    return success;
+}
+
+//-Private-//
+
+std::string ProgramCache::fileName(const std::string& vertexSource, const std::string& fragmentSource) {
+    const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    uint64_t key = hash(0xCBF29CE484222325ull, vertexSource.data(), vertexSource.size() + 1);
+    key = hash(key, fragmentSource.data(), fragmentSource.size() + 1);
+    for(int i = 0; i < 3; i++) {
+        const char* text = (const char*) glGetString(strings[i]);
+        if(text) {
+            key = hash(key, text, strlen(text) + 1);
+        }
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long) key);
+    return cacheDirectory + "/" + name;
+}
+
+/**
+ * 64 bit FNV-1a, continued from seed.
+ */
+uint64_t ProgramCache::hash(uint64_t seed, const char* data, size_t size) {
+    for(size_t i = 0; i < size; i++) {
+        seed = (seed ^ (unsigned char) data[i]) * 0x100000001B3ull;
+    }
+    return seed;
+}
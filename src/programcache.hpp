@@ -0,0 +1,39 @@
+#ifndef PROGRAMCACHE_HPP
+#define PROGRAMCACHE_HPP
+#include <GL/glew.h>
+#include <stdint.h>
+#include <string>
+
+/**
+ * Keeps linked GL programs on disk between runs, so a warm start skips
+ * compiling and linking shaders.
+ *
+ * Programs are stored with glGetProgramBinary under a name hashed from
+ * their sources and the GL vendor, renderer and version strings, so a
+ * driver update or an edited shader misses the cache instead of loading
+ * a stale binary. A binary the driver still refuses is ignored and
+ * replaced after the next link. Files are written beside their final
+ * name and renamed into place, so a crash never leaves a torn entry.
+ *
+ * Nothing is cached until setDirectory() is called, or on drivers that
+ * offer no program binary formats.
+ */
+class ProgramCache {
+    public:
+        static void setDirectory(const std::string& directory);
+        static std::string directory();
+        static bool isAvailable();
+
+        static GLuint load(const std::string& vertexSource, const std::string& fragmentSource);
+        static void prepare(GLuint program);
+        static bool store(GLuint program, const std::string& vertexSource, const std::string& fragmentSource);
+
+    private:
+        static const uint32_t MAGIC = 0x43505842;   // "BXPC"
+        static const uint32_t VERSION = 1;
+        static const int HEADER_SIZE = 16;
+
+        static std::string fileName(const std::string& vertexSource, const std::string& fragmentSource);
+        static uint64_t hash(uint64_t seed, const char* data, size_t size);
+};
+#endif
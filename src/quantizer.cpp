@@ -0,0 +1,437 @@
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <unordered_set>
+#include "quantizer.hpp"
+#include "tracer.hpp"
+
+namespace {
+    const int CHANNEL_LEVELS = 1 << Quantizer::HISTOGRAM_BITS;
+    const int BIN_COUNT = 1 << (Quantizer::HISTOGRAM_BITS * 4);
+
+    // Partial histograms are BIN_COUNT counters each; past this many,
+    // the memory and the merge cost more than the extra threads save.
+    const int MAX_HISTOGRAMS = 8;
+
+    // Entries in the per-chunk cache of nearest colors, a power of two.
+    const int CACHE_SIZE = 1 << 15;
+
+    // Slots in the table of exact palette colors, a power of two at
+    // least twice IndexedImage::MAX_COLORS.
+    const int EXACT_SLOTS = 512;
+
+    inline int channel(uint32_t key, int c) {
+        return (key >> (c * Quantizer::HISTOGRAM_BITS)) & (CHANNEL_LEVELS - 1);
+    }
+
+    inline uint32_t hashColor(Rgba color) {
+        return (color * 0x9E3779B1u) >> 23;
+    }
+
+    /**
+     * Open addressed map from the colors of a palette to their first
+     * index.
+     */
+    struct ExactTable {
+        Rgba colors[EXACT_SLOTS];
+        int indices[EXACT_SLOTS];
+
+        ExactTable(const std::vector<Rgba>& palette) {
+            std::fill(indices, indices + EXACT_SLOTS, -1);
+            for(size_t i = 0; i < palette.size(); i++) {
+                uint32_t slot = hashColor(palette[i]);
+                while(indices[slot] >= 0 && colors[slot] != palette[i]) {
+                    slot = (slot + 1) & (EXACT_SLOTS - 1);
+                }
+                if(indices[slot] < 0) {
+                    colors[slot] = palette[i];
+                    indices[slot] = i;
+                }
+            }
+        }
+
+        int find(Rgba color) const {
+            for(uint32_t slot = hashColor(color); indices[slot] >= 0; slot = (slot + 1) & (EXACT_SLOTS - 1)) {
+                if(colors[slot] == color) {
+                    return indices[slot];
+                }
+            }
+            return -1;
+        }
+    };
+};
+
+//-Public-//
+
+/**
+ * @param pool  Runs the histogram, k-means and mapping passes; if 0 the
+ *              quantizer makes its own.
+ */
+Quantizer::Quantizer(ThreadPool* pool) :
+    m_pool(pool), m_ownsPool(pool == 0), m_refinePasses(DEFAULT_REFINE_PASSES) {
+    if(m_ownsPool) {
+        m_pool = new ThreadPool();
+    }
+}
+
+Quantizer::~Quantizer() {
+    if(m_ownsPool) {
+        delete m_pool;
+    }
+}
+
+/**
+ * Sets the number of k-means passes run after median cut; 0 leaves the
+ * median cut colors as they are.
+ */
+void Quantizer::setRefinePasses(int passes) {
+    m_refinePasses = std::max(0, passes);
+}
+
+/**
+ * Picks at most colors colors to represent pixels. If pixels has that
+ * few colors they are returned exactly, sorted by value. Otherwise
+ * transparency, if there is any, gets the first entry.
+ */
+std::vector<Rgba> Quantizer::extractPalette(const PixelBuffer& pixels, int colors) {
+    Tracer::Zone zone("extract_palette");
+    colors = std::max(1, std::min((int) IndexedImage::MAX_COLORS, colors));
+    std::vector<Rgba> palette;
+    if(exactColors(pixels, colors, palette)) {
+        return palette;
+    }
+
+    std::vector<Bin> bins;
+    uint64_t transparent = 0;
+    histogram(pixels, bins, transparent);
+    int available = colors - (transparent > 0 ? 1 : 0);
+    if(available > 0 && !bins.empty()) {
+        medianCut(bins, available, palette);
+        refine(bins, palette);
+    }
+    if(transparent > 0) {
+        palette.insert(palette.begin(), 0);
+    }
+    return palette;
+}
+
+/**
+ * Maps every bixel of pixels to the nearest color of palette, which
+ * becomes out's palette. Bixels whose color is in the palette keep it
+ * exactly.
+ */
+void Quantizer::quantize(const PixelBuffer& pixels, const std::vector<Rgba>& palette, IndexedImage& out) {
+    Tracer::Zone zone("quantize");
+    out = IndexedImage(pixels.width(), pixels.height());
+    out.setPalette(palette);
+    if(palette.empty() || out.isEmpty()) {
+        return;
+    }
+    const std::vector<Rgba>& colors = out.palette();
+    const ExactTable exact(colors);
+    int width = pixels.width();
+
+    m_pool->parallelFor(0, pixels.height(), [&](int begin, int end) {
+        std::vector<uint32_t> cachedKeys(CACHE_SIZE, 0xFFFFFFFF);
+        std::vector<uint8_t> cachedIndices(CACHE_SIZE, 0);
+        Rgba last = 0;
+        uint8_t lastIndex = 0;
+        bool haveLast = false;
+        for(int y = begin; y < end; y++) {
+            const Rgba* in = pixels.row(y);
+            uint8_t* indices = out.row(y);
+            for(int x = 0; x < width; x++) {
+                Rgba color = in[x];
+                if(!haveLast || color != last) {
+                    int found = exact.find(rgbaAlpha(color) == 0 ? 0 : color);
+                    if(found < 0) {
+                        uint32_t key = binKey(color);
+                        uint32_t slot = (key ^ (key >> 12)) & (CACHE_SIZE - 1);
+                        if(cachedKeys[slot] != key) {
+                            cachedKeys[slot] = key;
+                            cachedIndices[slot] = nearest(colors, binColor(key));
+                        }
+                        found = cachedIndices[slot];
+                    }
+                    last = color;
+                    lastIndex = found;
+                    haveLast = true;
+                }
+                indices[x] = lastIndex;
+            }
+        }
+    }, 64);
+    out.dirtyRegion().markAll();
+}
+
+/**
+ * Converts pixels to an indexed image of at most colors colors.
+ */
+void Quantizer::convert(const PixelBuffer& pixels, int colors, IndexedImage& out) {
+    quantize(pixels, extractPalette(pixels, colors), out);
+}
+
+//-Private-//
+
+/**
+ * Packs the top HISTOGRAM_BITS of each channel, red lowest. Transparent
+ * colors are counted apart and never binned.
+ */
+inline uint32_t Quantizer::binKey(Rgba color) {
+    const int drop = 8 - HISTOGRAM_BITS;
+    return  (uint32_t) (rgbaRed(color) >> drop)
+         | ((uint32_t) (rgbaGreen(color) >> drop) << HISTOGRAM_BITS)
+         | ((uint32_t) (rgbaBlue(color) >> drop) << (HISTOGRAM_BITS * 2))
+         | ((uint32_t) (rgbaAlpha(color) >> drop) << (HISTOGRAM_BITS * 3));
+}
+
+/**
+ * The color a bin stands for. Levels are stretched over 0..255 so the
+ * top bin is fully opaque and the bottom one black.
+ */
+inline Rgba Quantizer::binColor(uint32_t key) {
+    int c[4];
+    for(int i = 0; i < 4; i++) {
+        int level = channel(key, i);
+        c[i] = level * 255 / (CHANNEL_LEVELS - 1);
+    }
+    return packRgba(c[0], c[1], c[2], c[3]);
+}
+
+inline int Quantizer::distance(Rgba a, Rgba b) {
+    int dr = rgbaRed(a) - rgbaRed(b);
+    int dg = rgbaGreen(a) - rgbaGreen(b);
+    int db = rgbaBlue(a) - rgbaBlue(b);
+    int da = rgbaAlpha(a) - rgbaAlpha(b);
+    return dr * dr + dg * dg + db * db + da * da;
+}
+
+int Quantizer::nearest(const std::vector<Rgba>& palette, Rgba color) {
+    int best = 0;
+    int bestDistance = distance(palette[0], color);
+    for(size_t i = 1; i < palette.size() && bestDistance > 0; i++) {
+        int d = distance(palette[i], color);
+        if(d < bestDistance) {
+            best = i;
+            bestDistance = d;
+        }
+    }
+    return best;
+}
+
+/**
+ * Collects the distinct colors of pixels, sorted.
+ *
+ * @return  false as soon as there are more than colors of them.
+ */
+bool Quantizer::exactColors(const PixelBuffer& pixels, int colors, std::vector<Rgba>& palette) {
+    std::unordered_set<Rgba> seen;
+    palette.clear();
+    Rgba last = 0;
+    bool haveLast = false;
+    for(int y = 0; y < pixels.height(); y++) {
+        const Rgba* row = pixels.row(y);
+        for(int x = 0; x < pixels.width(); x++) {
+            if(haveLast && row[x] == last) {
+                continue;
+            }
+            last = row[x];
+            haveLast = true;
+            if(seen.insert(last).second) {
+                palette.push_back(last);
+                if(palette.size() > (size_t) colors) {
+                    palette.clear();
+                    return false;
+                }
+            }
+        }
+    }
+    std::sort(palette.begin(), palette.end());
+    return true;
+}
+
+/**
+ * Counts the bixels of pixels per bin, each chunk of rows into its own
+ * partial histogram, then sums the partials, also in parallel.
+ *
+ * @param bins          Receives the occupied bins.
+ * @param transparent   Receives the number of transparent bixels.
+ */
+void Quantizer::histogram(const PixelBuffer& pixels, std::vector<Bin>& bins, uint64_t& transparent) {
+    int parts = std::max(1, std::min(MAX_HISTOGRAMS, m_pool->threadCount() + 1));
+    int rowsPerPart = (pixels.height() + parts - 1) / parts;
+    std::vector<std::vector<uint32_t> > partials(parts);
+    std::vector<uint64_t> transparentCounts(parts, 0);
+
+    m_pool->parallelFor(0, parts, [&](int begin, int end) {
+        for(int part = begin; part < end; part++) {
+            std::vector<uint32_t>& counts = partials[part];
+            counts.assign(BIN_COUNT, 0);
+            int last = std::min(pixels.height(), (part + 1) * rowsPerPart);
+            for(int y = part * rowsPerPart; y < last; y++) {
+                const Rgba* row = pixels.row(y);
+                for(int x = 0; x < pixels.width(); x++) {
+                    if(rgbaAlpha(row[x]) == 0) {
+                        transparentCounts[part]++;
+                    } else {
+                        counts[binKey(row[x])]++;
+                    }
+                }
+            }
+        }
+    });
+
+    m_pool->parallelFor(0, BIN_COUNT, [&](int begin, int end) {
+        for(int part = 1; part < parts; part++) {
+            for(int bin = begin; bin < end; bin++) {
+                partials[0][bin] += partials[part][bin];
+            }
+        }
+    }, 4096);
+
+    bins.clear();
+    transparent = 0;
+    for(int part = 0; part < parts; part++) {
+        transparent += transparentCounts[part];
+    }
+    const std::vector<uint32_t>& counts = partials[0];
+    for(int bin = 0; bin < BIN_COUNT; bin++) {
+        if(counts[bin] != 0) {
+            Bin entry = { (uint32_t) bin, counts[bin] };
+            bins.push_back(entry);
+        }
+    }
+    Tracer::counter("histogram_bins", bins.size());
+}
+
+/**
+ * Splits bins into at most colors boxes, each time cutting the box with
+ * the most bixels times extent in two of equal weight across its
+ * longest channel, and returns the weighted mean color of each box.
+ * Reorders bins.
+ */
+void Quantizer::medianCut(std::vector<Bin>& bins, int colors, std::vector<Rgba>& palette) {
+    std::vector<Box> boxes;
+    Box all = { 0, (int) bins.size(), 0, 0, 0 };
+    measure(bins, all);
+    boxes.push_back(all);
+
+    while((int) boxes.size() < colors) {
+        int chosen = -1;
+        uint64_t bestScore = 0;
+        for(size_t i = 0; i < boxes.size(); i++) {
+            uint64_t score = boxes[i].count * boxes[i].range;
+            if(boxes[i].end - boxes[i].begin > 1 && score > bestScore) {
+                chosen = i;
+                bestScore = score;
+            }
+        }
+        if(chosen < 0) {
+            break;
+        }
+
+        Box box = boxes[chosen];
+        int c = box.longestChannel;
+        std::sort(bins.begin() + box.begin, bins.begin() + box.end, [c](const Bin& a, const Bin& b) {
+            return channel(a.key, c) < channel(b.key, c);
+        });
+        uint64_t half = box.count / 2;
+        uint64_t below = 0;
+        int split = box.begin;
+        while(split < box.end - 1 && below + bins[split].count <= half) {
+            below += bins[split].count;
+            split++;
+        }
+        split = std::max(split, box.begin + 1);
+
+        Box low = { box.begin, split, 0, 0, 0 };
+        Box high = { split, box.end, 0, 0, 0 };
+        measure(bins, low);
+        measure(bins, high);
+        boxes[chosen] = low;
+        boxes.push_back(high);
+    }
+
+    palette.clear();
+    for(size_t i = 0; i < boxes.size(); i++) {
+        uint64_t sums[4] = { 0, 0, 0, 0 };
+        for(int b = boxes[i].begin; b < boxes[i].end; b++) {
+            Rgba color = binColor(bins[b].key);
+            sums[0] += (uint64_t) rgbaRed(color) * bins[b].count;
+            sums[1] += (uint64_t) rgbaGreen(color) * bins[b].count;
+            sums[2] += (uint64_t) rgbaBlue(color) * bins[b].count;
+            sums[3] += (uint64_t) rgbaAlpha(color) * bins[b].count;
+        }
+        uint64_t n = boxes[i].count;
+        palette.push_back(packRgba((sums[0] + n / 2) / n, (sums[1] + n / 2) / n,
+                                   (sums[2] + n / 2) / n, (sums[3] + n / 2) / n));
+    }
+}
+
+/**
+ * Runs weighted k-means passes over the bins: each bin goes to its
+ * nearest palette color, then each color moves to the mean of its bins.
+ * Colors that win no bins stay where they are.
+ */
+void Quantizer::refine(const std::vector<Bin>& bins, std::vector<Rgba>& palette) {
+    size_t colors = palette.size();
+    for(int pass = 0; pass < m_refinePasses; pass++) {
+        std::vector<uint64_t> sums(colors * 5, 0);
+        std::mutex mutex;
+        m_pool->parallelFor(0, bins.size(), [&](int begin, int end) {
+            std::vector<uint64_t> local(colors * 5, 0);
+            for(int b = begin; b < end; b++) {
+                Rgba color = binColor(bins[b].key);
+                uint64_t* entry = &local[nearest(palette, color) * 5];
+                entry[0] += (uint64_t) rgbaRed(color) * bins[b].count;
+                entry[1] += (uint64_t) rgbaGreen(color) * bins[b].count;
+                entry[2] += (uint64_t) rgbaBlue(color) * bins[b].count;
+                entry[3] += (uint64_t) rgbaAlpha(color) * bins[b].count;
+                entry[4] += bins[b].count;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            for(size_t i = 0; i < local.size(); i++) {
+                sums[i] += local[i];
+            }
+        }, 256);
+
+        bool moved = false;
+        for(size_t i = 0; i < colors; i++) {
+            uint64_t n = sums[i * 5 + 4];
+            if(n == 0) {
+                continue;
+            }
+            Rgba mean = packRgba((sums[i * 5] + n / 2) / n, (sums[i * 5 + 1] + n / 2) / n,
+                                 (sums[i * 5 + 2] + n / 2) / n, (sums[i * 5 + 3] + n / 2) / n);
+            moved = moved || mean != palette[i];
+            palette[i] = mean;
+        }
+        if(!moved) {
+            break;
+        }
+    }
+}
+
+/**
+ * Fills in the weight and longest channel of box from its bins.
+ */
+void Quantizer::measure(const std::vector<Bin>& bins, Box& box) {
+    int low[4] = { CHANNEL_LEVELS, CHANNEL_LEVELS, CHANNEL_LEVELS, CHANNEL_LEVELS };
+    int high[4] = { -1, -1, -1, -1 };
+    box.count = 0;
+    for(int b = box.begin; b < box.end; b++) {
+        box.count += bins[b].count;
+        for(int c = 0; c < 4; c++) {
+            low[c] = std::min(low[c], channel(bins[b].key, c));
+            high[c] = std::max(high[c], channel(bins[b].key, c));
+        }
+    }
+    box.longestChannel = 0;
+    box.range = 0;
+    for(int c = 0; c < 4; c++) {
+        if(high[c] - low[c] > box.range) {
+            box.longestChannel = c;
+            box.range = high[c] - low[c];
+        }
+    }
+}
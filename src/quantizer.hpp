@@ -0,0 +1,74 @@
+#ifndef QUANTIZER_HPP
+#define QUANTIZER_HPP
+#include <vector>
+#include <stdint.h>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "indexedimage.hpp"
+#include "threadpool.hpp"
+
+/**
+ * Reduces full color canvases to a palette, for indexed color mode.
+ *
+ * An image that already has few enough colors keeps them exactly. For
+ * anything else a histogram of colors cut to HISTOGRAM_BITS per channel
+ * is built in parallel, one partial histogram per chunk of rows, and
+ * median cut splits its occupied bins into boxes of similar weight
+ * along their longest channel. A few weighted k-means passes over the
+ * bins, also in parallel, then pull each color to the center of the
+ * bins nearest to it.
+ *
+ * Mapping bixels to the palette runs on chunks of rows in parallel.
+ * Colors in the palette map to themselves exactly through a small hash
+ * table; any other color takes the nearest palette color of its bin,
+ * remembered in a cache per chunk, so the palette is searched about
+ * once per bin rather than once per bixel. Transparent bixels keep a
+ * palette entry of their own.
+ */
+class Quantizer {
+    public:
+        static const int HISTOGRAM_BITS = 5;
+        static const int DEFAULT_REFINE_PASSES = 3;
+
+        Quantizer(ThreadPool* pool = 0);
+        ~Quantizer();
+
+        void setRefinePasses(int passes);
+
+        std::vector<Rgba> extractPalette(const PixelBuffer& pixels, int colors);
+        void quantize(const PixelBuffer& pixels, const std::vector<Rgba>& palette, IndexedImage& out);
+        void convert(const PixelBuffer& pixels, int colors, IndexedImage& out);
+
+    private:
+        Quantizer(const Quantizer&);
+        Quantizer& operator=(const Quantizer&);
+
+        struct Bin {
+            uint32_t key;
+            uint32_t count;
+        };
+
+        struct Box {
+            int begin;
+            int end;
+            uint64_t count;
+            int longestChannel;
+            int range;
+        };
+
+        static uint32_t binKey(Rgba color);
+        static Rgba binColor(uint32_t key);
+        static int distance(Rgba a, Rgba b);
+        static int nearest(const std::vector<Rgba>& palette, Rgba color);
+
+        bool exactColors(const PixelBuffer& pixels, int colors, std::vector<Rgba>& palette);
+        void histogram(const PixelBuffer& pixels, std::vector<Bin>& bins, uint64_t& transparent);
+        void medianCut(std::vector<Bin>& bins, int colors, std::vector<Rgba>& palette);
+        void refine(const std::vector<Bin>& bins, std::vector<Rgba>& palette);
+        static void measure(const std::vector<Bin>& bins, Box& box);
+
+        ThreadPool* m_pool;
+        bool m_ownsPool;
+        int m_refinePasses;
+};
+#endif
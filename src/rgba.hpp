@@ -0,0 +1,38 @@
+#ifndef RGBA_HPP
+#define RGBA_HPP
+#include <stdint.h>
+
+/**
+ * A single bixel color packed as RGBA8.
+ *
+ * Red lives in the lowest byte, so on little-endian hosts the bytes in
+ * memory read R, G, B, A -- the same layout GL_RGBA/GL_UNSIGNED_BYTE
+ * and QImage::Format_RGBA8888 expect.
+ */
+typedef uint32_t Rgba;
+
+inline Rgba packRgba(int r, int g, int b, int a = 255) {
+    return  ((Rgba) (r & 0xFF))
+         | (((Rgba) (g & 0xFF)) << 8)
+         | (((Rgba) (b & 0xFF)) << 16)
+         | (((Rgba) (a & 0xFF)) << 24);
+}
+
+inline int rgbaRed(Rgba color)   { return color & 0xFF; }
+inline int rgbaGreen(Rgba color) { return (color >> 8) & 0xFF; }
+inline int rgbaBlue(Rgba color)  { return (color >> 16) & 0xFF; }
+inline int rgbaAlpha(Rgba color) { return (color >> 24) & 0xFF; }
+
+#ifdef QT_GUI_LIB
+#include <QColor>
+
+inline Rgba toRgba(const QColor& color) {
+    return packRgba(color.red(), color.green(), color.blue(), color.alpha());
+}
+
+inline QColor toQColor(Rgba color) {
+    return QColor(rgbaRed(color), rgbaGreen(color), rgbaBlue(color), rgbaAlpha(color));
+}
+#endif
+
+#endif
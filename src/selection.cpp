@@ -0,0 +1,332 @@
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "selection.hpp"
+
+namespace {
+    /**
+     * Bits [begin, end) of a word, 0 <= begin < end <= 64.
+     */
+    uint64_t bitRange(int begin, int end) {
+        uint64_t upper = end == 64 ? ~(uint64_t) 0 : (((uint64_t) 1 << end) - 1);
+        return upper & (~(uint64_t) 0 << begin);
+    }
+};
+
+Selection::Selection(int width, int height) : m_width(0), m_height(0), m_wordsPerRow(0) {
+    resize(width, height);
+}
+
+int Selection::width() const {
+    return m_width;
+}
+
+int Selection::height() const {
+    return m_height;
+}
+
+int Selection::wordsPerRow() const {
+    return m_wordsPerRow;
+}
+
+/**
+ * The raw bitmask, wordsPerRow() words per row. Bit x % 64 of word x / 64
+ * is bixel x; on little-endian hosts that is also bit x % 32 of the
+ * 32 bit word x / 32, which is how the renderer samples it.
+ */
+const uint64_t* Selection::words() const {
+    return m_words.data();
+}
+
+/**
+ * Resizes the selection, keeping the bits that fall inside both sizes.
+ */
+void Selection::resize(int width, int height) {
+    width = std::max(0, width);
+    height = std::max(0, height);
+    int wordsPerRow = (width + 63) / 64;
+
+    std::vector<uint64_t> words((size_t) wordsPerRow * height, 0);
+    int keepWords = std::min(wordsPerRow, m_wordsPerRow);
+    for(int y = 0; y < std::min(height, m_height); y++) {
+        std::copy(row(y), row(y) + keepWords, &words[(size_t) y * wordsPerRow]);
+    }
+
+    m_width = width;
+    m_height = height;
+    m_wordsPerRow = wordsPerRow;
+    m_words.swap(words);
+    clearPadding();
+}
+
+void Selection::set(int x, int y, bool selected) {
+    if(x < 0 || y < 0 || x >= m_width || y >= m_height) {
+        return;
+    }
+    uint64_t bit = (uint64_t) 1 << (x & 63);
+    if(selected) {
+        row(y)[x >> 6] |= bit;
+    } else {
+        row(y)[x >> 6] &= ~bit;
+    }
+}
+
+/**
+ * Selects or deselects length bixels starting at (x, y), clipped to the
+ * selection. Whole words in the middle of the span are written at once.
+ */
+void Selection::setSpan(int x, int y, int length, bool selected) {
+    int begin = std::max(0, x);
+    int end = std::min(m_width, x + length);
+    if(y < 0 || y >= m_height || begin >= end) {
+        return;
+    }
+
+    uint64_t* words = row(y);
+    int firstWord = begin >> 6;
+    int lastWord = (end - 1) >> 6;
+    for(int word = firstWord; word <= lastWord; word++) {
+        uint64_t mask = bitRange(word == firstWord ? begin & 63 : 0,
+                                 word == lastWord ? ((end - 1) & 63) + 1 : 64);
+        if(selected) {
+            words[word] |= mask;
+        } else {
+            words[word] &= ~mask;
+        }
+    }
+}
+
+void Selection::flipSpan(int x, int y, int length) {
+    int begin = std::max(0, x);
+    int end = std::min(m_width, x + length);
+    if(y < 0 || y >= m_height || begin >= end) {
+        return;
+    }
+
+    uint64_t* words = row(y);
+    int firstWord = begin >> 6;
+    int lastWord = (end - 1) >> 6;
+    for(int word = firstWord; word <= lastWord; word++) {
+        words[word] ^= bitRange(word == firstWord ? begin & 63 : 0,
+                                word == lastWord ? ((end - 1) & 63) + 1 : 64);
+    }
+}
+
+void Selection::setRect(int x, int y, int width, int height, bool selected) {
+    for(int row = std::max(0, y); row < std::min(m_height, y + height); row++) {
+        setSpan(x, row, width, selected);
+    }
+}
+
+void Selection::clear() {
+    std::fill(m_words.begin(), m_words.end(), 0);
+}
+
+void Selection::selectAll() {
+    std::fill(m_words.begin(), m_words.end(), ~(uint64_t) 0);
+    clearPadding();
+}
+
+void Selection::invert() {
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i ones = _mm_set1_epi32(-1);
+    for(; i + 2 <= m_words.size(); i += 2) {
+        __m128i* words = (__m128i*) &m_words[i];
+        _mm_storeu_si128(words, _mm_xor_si128(_mm_loadu_si128(words), ones));
+    }
+#endif
+    for(; i < m_words.size(); i++) {
+        m_words[i] = ~m_words[i];
+    }
+    clearPadding();
+}
+
+/**
+ * The boolean operations require other to have the same size.
+ */
+void Selection::unite(const Selection& other) {
+    combine(other, UNITE);
+}
+
+void Selection::intersect(const Selection& other) {
+    combine(other, INTERSECT);
+}
+
+void Selection::subtract(const Selection& other) {
+    combine(other, SUBTRACT);
+}
+
+void Selection::exclusiveOr(const Selection& other) {
+    combine(other, EXCLUSIVE_OR);
+}
+
+bool Selection::isEmpty() const {
+    for(size_t i = 0; i < m_words.size(); i++) {
+        if(m_words[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t Selection::count() const {
+    size_t total = 0;
+    for(size_t i = 0; i < m_words.size(); i++) {
+        total += __builtin_popcountll(m_words[i]);
+    }
+    return total;
+}
+
+bool Selection::operator==(const Selection& other) const {
+    return m_width == other.m_width && m_height == other.m_height && m_words == other.m_words;
+}
+
+bool Selection::operator!=(const Selection& other) const {
+    return !(*this == other);
+}
+
+/**
+ * Returns the first selected x >= x in row y, or width() if there is none.
+ */
+int Selection::nextSelected(int x, int y) const {
+    if(x >= m_width) {
+        return m_width;
+    }
+    const uint64_t* words = row(y);
+    int word = x >> 6;
+    uint64_t bits = words[word] & (~(uint64_t) 0 << (x & 63));
+    while(!bits) {
+        if(++word >= m_wordsPerRow) {
+            return m_width;
+        }
+        bits = words[word];
+    }
+    return (word << 6) + __builtin_ctzll(bits);
+}
+
+/**
+ * Returns the first unselected x >= x in row y, or width() if there is none.
+ */
+int Selection::nextUnselected(int x, int y) const {
+    if(x >= m_width) {
+        return m_width;
+    }
+    const uint64_t* words = row(y);
+    int word = x >> 6;
+    uint64_t bits = ~words[word] & (~(uint64_t) 0 << (x & 63));
+    while(!bits) {
+        if(++word >= m_wordsPerRow) {
+            return m_width;
+        }
+        bits = ~words[word];
+    }
+    return std::min(m_width, (word << 6) + __builtin_ctzll(bits));
+}
+
+void Selection::toRuns(std::vector<Run>& runs) const {
+    runs.clear();
+    forEachSpan([&runs](int x, int y, int length) {
+        Run run = { x, y, length };
+        runs.push_back(run);
+    });
+}
+
+void Selection::fromRuns(const std::vector<Run>& runs) {
+    clear();
+    for(size_t i = 0; i < runs.size(); i++) {
+        setSpan(runs[i].x, runs[i].y, runs[i].length);
+    }
+}
+
+/**
+ * Collects the runs of bixels that are selected in exactly one of this
+ * selection and other, which must have the same size. Words that are
+ * equal in both are skipped without looking at their bits.
+ */
+void Selection::differenceRuns(const Selection& other, std::vector<Run>& runs) const {
+    runs.clear();
+    int wordsPerRow = std::min(m_wordsPerRow, other.m_wordsPerRow);
+    for(int y = 0; y < std::min(m_height, other.m_height); y++) {
+        const uint64_t* a = row(y);
+        const uint64_t* b = other.row(y);
+        Run run = { 0, y, 0 };
+        for(int word = 0; word < wordsPerRow; word++) {
+            uint64_t bits = a[word] ^ b[word];
+            int base = word << 6;
+            while(bits) {
+                int begin = __builtin_ctzll(bits);
+                uint64_t rest = ~bits & (~(uint64_t) 0 << begin);
+                int end = rest ? __builtin_ctzll(rest) : 64;
+
+                if(run.length > 0 && run.x + run.length == base + begin) {
+                    run.length += end - begin;
+                } else {
+                    if(run.length > 0) {
+                        runs.push_back(run);
+                    }
+                    run.x = base + begin;
+                    run.length = end - begin;
+                }
+                bits &= end == 64 ? 0 : (~(uint64_t) 0 << end);
+            }
+        }
+        if(run.length > 0) {
+            runs.push_back(run);
+        }
+    }
+}
+
+/**
+ * Sets every selected bixel of pixels to color, one span fill per run.
+ */
+void Selection::fillPixels(PixelBuffer& pixels, Rgba color) const {
+    int width = std::min(m_width, pixels.width());
+    forEachSpan([&pixels, color, width](int x, int y, int length) {
+        if(y < pixels.height() && x < width) {
+            PixelBuffer::fillSpan(pixels.row(y) + x, std::min(length, width - x), color);
+            pixels.markDirty(x, y, length, 1);
+        }
+    });
+}
+
+//-Private-//
+
+void Selection::combine(const Selection& other, Operation operation) {
+    size_t count = std::min(m_words.size(), other.m_words.size());
+    uint64_t* words = m_words.data();
+    const uint64_t* others = other.m_words.data();
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 2 <= count; i += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i*) (words + i));
+        __m128i b = _mm_loadu_si128((const __m128i*) (others + i));
+        switch(operation) {
+            case UNITE:         a = _mm_or_si128(a, b);     break;
+            case INTERSECT:     a = _mm_and_si128(a, b);    break;
+            case SUBTRACT:      a = _mm_andnot_si128(b, a); break;
+            case EXCLUSIVE_OR:  a = _mm_xor_si128(a, b);    break;
+        }
+        _mm_storeu_si128((__m128i*) (words + i), a);
+    }
+#endif
+    for(; i < count; i++) {
+        switch(operation) {
+            case UNITE:         words[i] |= others[i];  break;
+            case INTERSECT:     words[i] &= others[i];  break;
+            case SUBTRACT:      words[i] &= ~others[i]; break;
+            case EXCLUSIVE_OR:  words[i] ^= others[i];  break;
+        }
+    }
+}
+
+void Selection::clearPadding() {
+    if(m_width % 64 == 0) {
+        return;
+    }
+    uint64_t mask = bitRange(0, m_width % 64);
+    for(int y = 0; y < m_height; y++) {
+        row(y)[m_wordsPerRow - 1] &= mask;
+    }
+}
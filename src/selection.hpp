@@ -0,0 +1,119 @@
+#ifndef SELECTION_HPP
+#define SELECTION_HPP
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+
+/**
+ * A set of selected bixels stored as one bit per bixel.
+ *
+ * Every row starts on a fresh 64 bit word, so rectangle operations touch
+ * whole words in the middle of a row and boolean operations between two
+ * selections of the same size are plain SIMD loops over the word array.
+ * A 4096x4096 canvas needs 2MB, and selecting all of it is a memset.
+ *
+ * Bits past width() in the last word of a row are always zero.
+ *
+ * forEachSpan() visits maximal runs of selected bixels row by row,
+ * skipping empty words 64 bixels at a time; toRuns()/fromRuns() convert
+ * to and from the equivalent row-run form, which is the compact
+ * representation for sparse selections (history, clipboard, sessions).
+ */
+class Selection {
+    public:
+        struct Run {
+            int x;
+            int y;
+            int length;
+        };
+
+        Selection(int width = 0, int height = 0);
+
+        int width() const;
+        int height() const;
+        int wordsPerRow() const;
+        const uint64_t* words() const;
+        void resize(int width, int height);
+
+        bool contains(int x, int y) const;
+        void set(int x, int y, bool selected = true);
+        void setSpan(int x, int y, int length, bool selected = true);
+        void flipSpan(int x, int y, int length);
+        void setRect(int x, int y, int width, int height, bool selected = true);
+
+        void clear();
+        void selectAll();
+        void invert();
+        void unite(const Selection& other);
+        void intersect(const Selection& other);
+        void subtract(const Selection& other);
+        void exclusiveOr(const Selection& other);
+
+        bool isEmpty() const;
+        size_t count() const;
+        bool operator==(const Selection& other) const;
+        bool operator!=(const Selection& other) const;
+
+        int nextSelected(int x, int y) const;
+        int nextUnselected(int x, int y) const;
+        template<typename Visitor> void forEachSpan(Visitor visit) const;
+        template<typename Visitor> void forEachSpanInRow(int y, Visitor visit) const;
+
+        void toRuns(std::vector<Run>& runs) const;
+        void fromRuns(const std::vector<Run>& runs);
+        void differenceRuns(const Selection& other, std::vector<Run>& runs) const;
+
+        void fillPixels(PixelBuffer& pixels, Rgba color) const;
+
+    private:
+        enum Operation { UNITE, INTERSECT, SUBTRACT, EXCLUSIVE_OR };
+
+        void combine(const Selection& other, Operation operation);
+        void clearPadding();
+        uint64_t* row(int y);
+        const uint64_t* row(int y) const;
+
+        int m_width;
+        int m_height;
+        int m_wordsPerRow;
+        std::vector<uint64_t> m_words;
+};
+
+inline bool Selection::contains(int x, int y) const {
+    if(x < 0 || y < 0 || x >= m_width || y >= m_height) {
+        return false;
+    }
+    return (row(y)[x >> 6] >> (x & 63)) & 1;
+}
+
+inline uint64_t* Selection::row(int y) {
+    return m_words.data() + (size_t) y * m_wordsPerRow;
+}
+
+inline const uint64_t* Selection::row(int y) const {
+    return m_words.data() + (size_t) y * m_wordsPerRow;
+}
+
+/**
+ * Calls visit(x, y, length) once for every run of selected bixels,
+ * top to bottom, left to right.
+ */
+template<typename Visitor>
+void Selection::forEachSpan(Visitor visit) const {
+    for(int y = 0; y < m_height; y++) {
+        forEachSpanInRow(y, visit);
+    }
+}
+
+template<typename Visitor>
+void Selection::forEachSpanInRow(int y, Visitor visit) const {
+    int x = nextSelected(0, y);
+    while(x < m_width) {
+        int end = nextUnselected(x, y);
+        visit(x, y, end - x);
+        x = nextSelected(end, y);
+    }
+}
+#endif
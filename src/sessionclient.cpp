@@ -0,0 +1,214 @@
+#include <poll.h>
+#include <string.h>
+#include "sessionclient.hpp"
+#include "tracer.hpp"
+
+SessionClient::SessionClient() : m_peer(0) {}
+
+/**
+ * Connects to the relay at socketPath and waits for its WELCOME. The
+ * first peer of a session sends pixels and selection as the starting
+ * canvas; later ones receive the session's canvas through poll().
+ *
+ * @return  false if no relay answered within JOIN_TIMEOUT milliseconds.
+ */
+bool SessionClient::join(const std::string& socketPath, const PixelBuffer& pixels, const Selection& selection) {
+    Tracer::Zone zone("join_session");
+    leave();
+    m_connection.reset(SessionConnection::connectTo(socketPath));
+    while(m_connection.isOpen() && !m_connection.next(m_message)) {
+        pollfd fd = { m_connection.fd(), POLLIN, 0 };
+        if(::poll(&fd, 1, JOIN_TIMEOUT) <= 0 || !m_connection.receive()) {
+            m_connection.close();
+        }
+    }
+    if(!m_connection.isOpen() || m_message.header.type != SessionConnection::WELCOME) {
+        m_connection.close();
+        return false;
+    }
+    m_peer = m_message.header.peer;
+    Tracer::message("SessionClient: joined as peer %u after batch %u", m_peer, m_message.header.sequence);
+    if(m_message.header.flags & SessionConnection::SEED) {
+        seed(pixels, selection);
+    }
+    return true;
+}
+
+/**
+ * Disconnects, dropping unsent and unacknowledged batches. The canvas
+ * keeps every edit applied so far.
+ */
+void SessionClient::leave() {
+    m_connection.close();
+    m_batch.clear();
+    m_pending.clear();
+    m_peer = 0;
+}
+
+bool SessionClient::isJoined() const {
+    return m_connection.isOpen();
+}
+
+uint32_t SessionClient::peerId() const {
+    return m_peer;
+}
+
+/**
+ * @return  The socket, to wake the event loop when batches arrive, or -1.
+ */
+int SessionClient::fd() const {
+    return m_connection.fd();
+}
+
+/**
+ * @return  Batches sent but not yet acknowledged by the relay.
+ */
+size_t SessionClient::pendingCount() const {
+    return m_pending.size();
+}
+
+/**
+ * @return  The operations for the current frame.
+ */
+OperationLog& SessionClient::batch() {
+    return m_batch;
+}
+
+/**
+ * Sends the current batch, deflated if it is large, and finishes
+ * sending earlier ones the socket did not take at once. A batch that
+ * would not fit in one message is dropped rather than sent for the
+ * relay to refuse.
+ *
+ * @return  true if a batch was sent.
+ */
+bool SessionClient::flush() {
+    if(!m_connection.isOpen()) {
+        m_batch.clear();
+        return false;
+    }
+    if(m_batch.isEmpty()) {
+        m_connection.flush();
+        return false;
+    }
+    Tracer::Zone zone("session_flush");
+    const std::vector<unsigned char>& raw = m_batch.data();
+    if(raw.size() > SessionConnection::MAX_PAYLOAD) {
+        Tracer::message("SessionClient: dropped a batch of %zu bytes, too large to send", raw.size());
+        m_batch.clear();
+        return false;
+    }
+    SessionConnection::Header header;
+    memset(&header, 0, sizeof(header));
+    header.type = SessionConnection::BATCH;
+    header.peer = m_peer;
+    header.rawSize = raw.size();
+    header.size = raw.size();
+    const unsigned char* payload = raw.data();
+    if(raw.size() >= COMPRESS_THRESHOLD) {
+        if(m_batch.compress(m_compressed)) {
+            header.flags = SessionConnection::COMPRESSED;
+            header.size = m_compressed.size();
+            payload = m_compressed.data();
+        }
+    }
+    Tracer::counter("session_batch_bytes", header.size);
+    bool sent = m_connection.send(header, payload);
+    m_pending.push_back(std::move(m_batch));
+    m_batch = OperationLog();
+    return sent;
+}
+
+/**
+ * Applies the batches that have arrived from the relay, without
+ * waiting. Losing the relay leaves the session.
+ *
+ * @return  true if pixels or selection changed.
+ */
+bool SessionClient::poll(PixelBuffer& pixels, Selection& selection) {
+    if(!m_connection.isOpen()) {
+        return false;
+    }
+    bool connected = m_connection.receive();
+    bool changed = false;
+    bool stale = false;
+    while(m_connection.next(m_message)) {
+        if(m_message.header.type != SessionConnection::BATCH) {
+            continue;
+        }
+        if(m_message.header.peer == m_peer && !m_pending.empty()) {
+            // Our own batch, already applied; re-apply it if remote ones
+            // ordered before it were applied since.
+            if(stale) {
+                rebase(pixels, selection);
+                stale = false;
+            }
+            m_pending.pop_front();
+            continue;
+        }
+        if(!decode(m_message, m_incoming) || !m_incoming.apply(pixels, selection)) {
+            Tracer::message("SessionClient: dropped a malformed batch %u", m_message.header.sequence);
+            continue;
+        }
+        changed = true;
+        stale = !m_pending.empty();
+    }
+    if(stale) {
+        rebase(pixels, selection);
+    }
+    if(!connected) {
+        Tracer::message("SessionClient: relay closed the session");
+        leave();
+    }
+    return changed;
+}
+
+//-Private-//
+
+/**
+ * Sends pixels and selection as the session's starting canvas, split
+ * into batches of about SEED_BATCH_BYTES so that no message comes near
+ * SessionConnection::MAX_PAYLOAD however large the canvas is. Operations
+ * state results, so the batches set the same canvas as one snapshot.
+ */
+void SessionClient::seed(const PixelBuffer& pixels, const Selection& selection) {
+    Tracer::Zone zone("session_seed");
+    int width = pixels.width();
+    m_batch.addResize(width, pixels.height());
+    for(int y = 0; y < pixels.height(); y++) {
+        m_batch.addRect(pixels, 0, y, width, 1);
+        if(m_batch.data().size() >= SEED_BATCH_BYTES) {
+            flush();
+        }
+    }
+    for(int y = 0; y < selection.height(); y++) {
+        m_batch.addSelection(0, y, selection.width(), false);
+        selection.forEachSpanInRow(y, [this, y](int x, int, int length) {
+            m_batch.addSelection(x, y, length, true);
+        });
+        if(m_batch.data().size() >= SEED_BATCH_BYTES) {
+            flush();
+        }
+    }
+    flush();
+}
+
+bool SessionClient::decode(const SessionConnection::Message& message, OperationLog& log) {
+    if(message.header.flags & SessionConnection::COMPRESSED) {
+        return message.header.rawSize <= SessionConnection::MAX_PAYLOAD
+            && log.decompress(message.payload.data(), message.payload.size(), message.header.rawSize);
+    }
+    log.assign(message.payload.data(), message.payload.size());
+    return true;
+}
+
+/**
+ * Applies the pending batches again, on top of remote ones the relay
+ * ordered before them.
+ */
+void SessionClient::rebase(PixelBuffer& pixels, Selection& selection) {
+    Tracer::Zone zone("session_rebase");
+    for(size_t i = 0; i < m_pending.size(); i++) {
+        m_pending[i].apply(pixels, selection);
+    }
+}
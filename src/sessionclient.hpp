@@ -0,0 +1,66 @@
+#ifndef SESSIONCLIENT_HPP
+#define SESSIONCLIENT_HPP
+#include <stdint.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "pixelbuffer.hpp"
+#include "selection.hpp"
+#include "operationlog.hpp"
+#include "sessionconnection.hpp"
+
+/**
+ * A peer in a shared editing session, driven from the canvas's frame
+ * timer without threads or blocking.
+ *
+ * Local edits are applied to the canvas at once and described in
+ * batch(), for instance with batch().addPixels() for every span a stroke
+ * wrote. flush(), once per frame, sends the batch to the relay and keeps
+ * it as pending until the relay sends it back. poll() applies the
+ * batches other peers sent, marking only the bixels they write dirty.
+ *
+ * The relay puts all batches in one order and every peer must end up
+ * as if it had applied them in that order. A local batch is applied
+ * early, before remote batches the relay ordered ahead of it, so after
+ * those arrive the pending batches are applied again on top. Operations
+ * state results, so this gives the same canvas as the relay's order.
+ *
+ * Undo stays local: it is an edit like any other and must be put in the
+ * batch like one.
+ */
+class SessionClient {
+    public:
+        static const int JOIN_TIMEOUT = 2000;
+        static const size_t COMPRESS_THRESHOLD = 4096;
+        static const size_t SEED_BATCH_BYTES = 1 << 20;
+
+        SessionClient();
+
+        bool join(const std::string& socketPath, const PixelBuffer& pixels, const Selection& selection);
+        void leave();
+        bool isJoined() const;
+        uint32_t peerId() const;
+        int fd() const;
+        size_t pendingCount() const;
+
+        OperationLog& batch();
+        bool flush();
+        bool poll(PixelBuffer& pixels, Selection& selection);
+
+    private:
+        SessionClient(const SessionClient&);
+        SessionClient& operator=(const SessionClient&);
+
+        void seed(const PixelBuffer& pixels, const Selection& selection);
+        bool decode(const SessionConnection::Message& message, OperationLog& log);
+        void rebase(PixelBuffer& pixels, Selection& selection);
+
+        SessionConnection m_connection;
+        uint32_t m_peer;
+        OperationLog m_batch;
+        std::deque<OperationLog> m_pending;
+        std::vector<unsigned char> m_compressed;
+        SessionConnection::Message m_message;
+        OperationLog m_incoming;
+};
+#endif
@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "sessionconnection.hpp"
+
+namespace {
+    const size_t READ_CHUNK = 64 * 1024;
+
+    // Consumed bytes at the front of a buffer are dropped once there
+    // are this many of them.
+    const size_t COMPACT_THRESHOLD = 1024 * 1024;
+
+    static_assert(sizeof(SessionConnection::Header) == 20, "Header must have no padding");
+
+    bool setNonBlocking(int fd) {
+        int flags = fcntl(fd, F_GETFL);
+        return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0
+            && fcntl(fd, F_SETFD, FD_CLOEXEC) == 0;
+    }
+
+    bool makeAddress(const std::string& path, sockaddr_un& address) {
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if(path.empty() || path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+};
+
+/**
+ * @param fd    A connected socket to take over, or -1.
+ */
+SessionConnection::SessionConnection(int fd) : m_fd(-1), m_inputOffset(0), m_outputOffset(0) {
+    reset(fd);
+}
+
+SessionConnection::~SessionConnection() {
+    close();
+}
+
+/**
+ * Closes the current socket, dropping anything queued, and takes over fd.
+ */
+void SessionConnection::reset(int fd) {
+    close();
+    m_fd = fd;
+}
+
+void SessionConnection::close() {
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+    m_fd = -1;
+    m_input.clear();
+    m_inputOffset = 0;
+    m_output.clear();
+    m_outputOffset = 0;
+}
+
+bool SessionConnection::isOpen() const {
+    return m_fd >= 0;
+}
+
+int SessionConnection::fd() const {
+    return m_fd;
+}
+
+/**
+ * Reads everything that has arrived, without waiting.
+ *
+ * @return  false if the other end hung up or the socket failed; the
+ *          connection is closed then, but messages already received can
+ *          still be taken with next().
+ */
+bool SessionConnection::receive() {
+    if(m_fd < 0) {
+        return false;
+    }
+    while(true) {
+        size_t used = m_input.size();
+        m_input.resize(used + READ_CHUNK);
+        ssize_t count = ::recv(m_fd, &m_input[used], READ_CHUNK, 0);
+        m_input.resize(used + std::max<ssize_t>(0, count));
+        if(count > 0) {
+            continue;
+        }
+        if(count < 0 && errno == EINTR) {
+            continue;
+        }
+        if(count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+}
+
+/**
+ * Takes the oldest complete message received.
+ *
+ * @return  false if there is none yet. A header announcing more than
+ *          MAX_PAYLOAD bytes closes the connection.
+ */
+bool SessionConnection::next(Message& message) {
+    size_t available = m_input.size() - m_inputOffset;
+    if(available < sizeof(Header)) {
+        return false;
+    }
+    memcpy(&message.header, &m_input[m_inputOffset], sizeof(Header));
+    if(message.header.size > MAX_PAYLOAD) {
+        close();
+        return false;
+    }
+    if(available < sizeof(Header) + message.header.size) {
+        return false;
+    }
+    const unsigned char* payload = &m_input[m_inputOffset + sizeof(Header)];
+    message.payload.assign(payload, payload + message.header.size);
+    m_inputOffset += sizeof(Header) + message.header.size;
+
+    if(m_inputOffset == m_input.size()) {
+        m_input.clear();
+        m_inputOffset = 0;
+    } else if(m_inputOffset >= COMPACT_THRESHOLD) {
+        m_input.erase(m_input.begin(), m_input.begin() + m_inputOffset);
+        m_inputOffset = 0;
+    }
+    return true;
+}
+
+/**
+ * Queues a message, header.size bytes of payload, and starts writing it.
+ *
+ * @return  false if the connection is closed or failed.
+ */
+bool SessionConnection::send(const Header& header, const unsigned char* payload) {
+    if(m_fd < 0) {
+        return false;
+    }
+    frame(header, payload, m_output);
+    return flush();
+}
+
+/**
+ * Queues a message already framed with frame().
+ */
+bool SessionConnection::sendFrame(const std::vector<unsigned char>& frame) {
+    if(m_fd < 0) {
+        return false;
+    }
+    m_output.insert(m_output.end(), frame.begin(), frame.end());
+    return flush();
+}
+
+/**
+ * Writes as much of the queued output as the socket takes.
+ *
+ * @return  false if the connection is closed or failed.
+ */
+bool SessionConnection::flush() {
+    while(m_fd >= 0 && m_outputOffset < m_output.size()) {
+        ssize_t count = ::send(m_fd, &m_output[m_outputOffset], m_output.size() - m_outputOffset, MSG_NOSIGNAL);
+        if(count > 0) {
+            m_outputOffset += count;
+        } else if(count < 0 && errno == EINTR) {
+            continue;
+        } else if(count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            close();
+            return false;
+        }
+    }
+    if(m_outputOffset == m_output.size()) {
+        m_output.clear();
+        m_outputOffset = 0;
+    } else if(m_outputOffset >= COMPACT_THRESHOLD) {
+        m_output.erase(m_output.begin(), m_output.begin() + m_outputOffset);
+        m_outputOffset = 0;
+    }
+    return m_fd >= 0;
+}
+
+bool SessionConnection::hasPendingOutput() const {
+    return m_outputOffset < m_output.size();
+}
+
+/**
+ * Appends header and header.size bytes of payload to out.
+ */
+void SessionConnection::frame(const Header& header, const unsigned char* payload, std::vector<unsigned char>& out) {
+    const unsigned char* bytes = (const unsigned char*) &header;
+    out.insert(out.end(), bytes, bytes + sizeof(Header));
+    if(header.size > 0) {
+        out.insert(out.end(), payload, payload + header.size);
+    }
+}
+
+/**
+ * Connects to the relay listening at path.
+ *
+ * @return  A non-blocking socket, or -1.
+ */
+int SessionConnection::connectTo(const std::string& path) {
+    sockaddr_un address;
+    if(!makeAddress(path, address)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    if(connect(fd, (sockaddr*) &address, sizeof(address)) != 0 || !setNonBlocking(fd)) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Listens at path, replacing a stale socket file left by a relay that
+ * exited, but not one that is still answering.
+ *
+ * @return  A non-blocking listening socket, or -1.
+ */
+int SessionConnection::listenOn(const std::string& path) {
+    sockaddr_un address;
+    if(!makeAddress(path, address)) {
+        return -1;
+    }
+    int live = connectTo(path);
+    if(live >= 0) {
+        ::close(live);
+        return -1;
+    }
+    unlink(path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    if(bind(fd, (sockaddr*) &address, sizeof(address)) != 0 || listen(fd, 16) != 0 || !setNonBlocking(fd)) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @return  The next waiting connection as a non-blocking socket, or -1.
+ */
+int SessionConnection::acceptFrom(int listener) {
+    int fd = accept(listener, 0, 0);
+    if(fd >= 0 && !setNonBlocking(fd)) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,74 @@
+#ifndef SESSIONCONNECTION_HPP
+#define SESSIONCONNECTION_HPP
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * One end of a shared session's Unix socket, framed into messages.
+ *
+ * The socket is non-blocking. receive() reads whatever has arrived and
+ * next() hands out the complete messages in it; send() queues a message
+ * and writes as much as the socket takes, and flush() continues later.
+ * Neither ever waits, so a peer that stops reading only grows its queue.
+ *
+ * A message is a Header followed by size bytes of payload. Both ends run
+ * on the same machine, so headers are in host byte order.
+ */
+class SessionConnection {
+    public:
+        enum Type { WELCOME = 1, BATCH = 2 };
+        enum Flags {
+            COMPRESSED = 1,     ///< Payload is deflated; rawSize is its inflated size
+            SEED = 2            ///< WELCOME to the first peer: send your canvas
+        };
+
+        struct Header {
+            uint32_t size;
+            uint8_t type;
+            uint8_t flags;
+            uint16_t reserved;
+            uint32_t peer;
+            uint32_t sequence;
+            uint32_t rawSize;
+        };
+
+        struct Message {
+            Header header;
+            std::vector<unsigned char> payload;
+        };
+
+        static const size_t MAX_PAYLOAD = 1 << 30;
+
+        SessionConnection(int fd = -1);
+        ~SessionConnection();
+
+        void reset(int fd);
+        void close();
+        bool isOpen() const;
+        int fd() const;
+
+        bool receive();
+        bool next(Message& message);
+        bool send(const Header& header, const unsigned char* payload);
+        bool sendFrame(const std::vector<unsigned char>& frame);
+        bool flush();
+        bool hasPendingOutput() const;
+
+        static void frame(const Header& header, const unsigned char* payload, std::vector<unsigned char>& out);
+        static int connectTo(const std::string& path);
+        static int listenOn(const std::string& path);
+        static int acceptFrom(int listener);
+
+    private:
+        SessionConnection(const SessionConnection&);
+        SessionConnection& operator=(const SessionConnection&);
+
+        int m_fd;
+        std::vector<unsigned char> m_input;
+        size_t m_inputOffset;
+        std::vector<unsigned char> m_output;
+        size_t m_outputOffset;
+};
+#endif
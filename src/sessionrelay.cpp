@@ -0,0 +1,187 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include "sessionrelay.hpp"
+#include "tracer.hpp"
+
+namespace {
+    SessionRelay* signalledRelay = 0;
+
+    void stopOnSignal(int) {
+        if(signalledRelay) {
+            signalledRelay->stop();
+        }
+    }
+};
+
+SessionRelay::SessionRelay(const std::string& socketPath) :
+    m_socketPath(socketPath), m_listener(-1), m_running(false), m_nextPeer(1), m_sequence(0), m_logBytes(0) {
+    m_wake[0] = -1;
+    m_wake[1] = -1;
+}
+
+SessionRelay::~SessionRelay() {
+    m_peers.clear();
+    if(m_listener >= 0) {
+        close(m_listener);
+        unlink(m_socketPath.c_str());
+    }
+    for(int i = 0; i < 2; i++) {
+        if(m_wake[i] >= 0) {
+            close(m_wake[i]);
+        }
+    }
+}
+
+/**
+ * @return  false if the socket could not be created, or another relay
+ *          is already serving it.
+ */
+bool SessionRelay::listen() {
+    if(m_wake[0] < 0 && pipe(m_wake) != 0) {
+        return false;
+    }
+    fcntl(m_wake[1], F_SETFL, O_NONBLOCK);
+    m_listener = SessionConnection::listenOn(m_socketPath);
+    return m_listener >= 0;
+}
+
+/**
+ * Serves peers until stop() is called.
+ */
+void SessionRelay::run() {
+    Tracer::setThreadName("session relay");
+    m_running = true;
+    std::vector<pollfd> fds;
+    while(m_running) {
+        fds.clear();
+        pollfd wake = { m_wake[0], POLLIN, 0 };
+        pollfd listener = { m_listener, POLLIN, 0 };
+        fds.push_back(wake);
+        fds.push_back(listener);
+        for(size_t i = 0; i < m_peers.size(); i++) {
+            SessionConnection& connection = *m_peers[i].connection;
+            pollfd peer = { connection.fd(), (short) (POLLIN | (connection.hasPendingOutput() ? POLLOUT : 0)), 0 };
+            fds.push_back(peer);
+        }
+        if(poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+            break;
+        }
+
+        if(fds[1].revents & POLLIN) {
+            accept();
+        }
+        size_t polled = fds.size() - 2;
+        for(size_t i = 0; i < polled && i < m_peers.size(); i++) {
+            short events = fds[i + 2].revents;
+            if(events & (POLLIN | POLLHUP | POLLERR)) {
+                serve(m_peers[i]);
+            }
+            if(events & POLLOUT) {
+                m_peers[i].connection->flush();
+            }
+        }
+        for(size_t i = 0; i < m_peers.size();) {
+            if(m_peers[i].connection->isOpen()) {
+                i++;
+                continue;
+            }
+            Tracer::message("SessionRelay: peer %u left", m_peers[i].id);
+            m_peers.erase(m_peers.begin() + i);
+        }
+    }
+    m_running = false;
+}
+
+/**
+ * Makes run() return. Safe to call from another thread or a signal
+ * handler.
+ */
+void SessionRelay::stop() {
+    m_running = false;
+    if(m_wake[1] >= 0) {
+        char byte = 0;
+        ssize_t written = write(m_wake[1], &byte, 1);
+        (void) written;
+    }
+}
+
+int SessionRelay::main(int argc, char* argv[]) {
+    if(argc != 1 || argv[0][0] == '-') {
+        printUsage(stderr);
+        return 2;
+    }
+    SessionRelay relay(argv[0]);
+    if(!relay.listen()) {
+        fprintf(stderr, "Cannot listen on %s; is another relay serving it?\n", argv[0]);
+        return 1;
+    }
+    signalledRelay = &relay;
+    signal(SIGINT, stopOnSignal);
+    signal(SIGTERM, stopOnSignal);
+    signal(SIGPIPE, SIG_IGN);
+    relay.run();
+    signalledRelay = 0;
+    return 0;
+}
+
+void SessionRelay::printUsage(FILE* out) {
+    fprintf(out,
+            "usage: Bixel --relay <socket>\n"
+            "\n"
+            "Relays a shared editing session between the Bixel instances\n"
+            "that connect to the Unix socket <socket>.\n");
+}
+
+//-Private-//
+
+/**
+ * Admits waiting peers: a WELCOME, then the log so far.
+ */
+void SessionRelay::accept() {
+    int fd;
+    while((fd = SessionConnection::acceptFrom(m_listener)) >= 0) {
+        Peer peer;
+        peer.connection.reset(new SessionConnection(fd));
+        peer.id = m_nextPeer++;
+
+        SessionConnection::Header welcome;
+        memset(&welcome, 0, sizeof(welcome));
+        welcome.type = SessionConnection::WELCOME;
+        welcome.flags = m_log.empty() && m_peers.empty() ? SessionConnection::SEED : 0;
+        welcome.peer = peer.id;
+        welcome.sequence = m_sequence;
+        peer.connection->send(welcome, 0);
+        for(size_t i = 0; i < m_log.size(); i++) {
+            peer.connection->sendFrame(m_log[i]);
+        }
+        Tracer::message("SessionRelay: peer %u joined, %zu batches replayed", peer.id, m_log.size());
+        m_peers.push_back(std::move(peer));
+    }
+}
+
+/**
+ * Sequences and forwards every complete batch from peer.
+ */
+void SessionRelay::serve(Peer& peer) {
+    peer.connection->receive();
+    SessionConnection::Message message;
+    while(peer.connection->next(message)) {
+        if(message.header.type != SessionConnection::BATCH) {
+            continue;
+        }
+        message.header.peer = peer.id;
+        message.header.sequence = ++m_sequence;
+        std::vector<unsigned char> frame;
+        SessionConnection::frame(message.header, message.payload.data(), frame);
+        for(size_t i = 0; i < m_peers.size(); i++) {
+            m_peers[i].connection->sendFrame(frame);
+        }
+        m_logBytes += frame.size();
+        m_log.push_back(std::move(frame));
+        Tracer::counter("session_log_bytes", m_logBytes);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef SESSIONRELAY_HPP
+#define SESSIONRELAY_HPP
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "sessionconnection.hpp"
+
+/**
+ * The hub of a shared editing session, run as its own process with
+ *
+ *      Bixel --relay <socket>
+ *
+ * Peers connect to the Unix socket. Each gets a WELCOME with its peer id;
+ * the first one is asked to seed the session with its canvas. Every
+ * BATCH a peer sends is stamped with the sender and the next sequence
+ * number and forwarded to all peers, the sender included, whose copy
+ * serves as the acknowledgement. Since every peer sees the same batches
+ * in the same order, they all end up with the same canvas.
+ *
+ * Batches are also kept in a log that is replayed to peers joining
+ * later, after their WELCOME. The log is never compacted, so a long
+ * session grows it; the relay exits and removes the socket when
+ * stopped or sent SIGINT or SIGTERM.
+ *
+ * The relay is one thread that waits in poll() and never decodes a
+ * batch, so forwarding costs a copy per peer.
+ */
+class SessionRelay {
+    public:
+        SessionRelay(const std::string& socketPath);
+        ~SessionRelay();
+
+        bool listen();
+        void run();
+        void stop();
+
+        static int main(int argc, char* argv[]);
+        static void printUsage(FILE* out);
+
+    private:
+        struct Peer {
+            std::unique_ptr<SessionConnection> connection;
+            uint32_t id;
+        };
+
+        SessionRelay(const SessionRelay&);
+        SessionRelay& operator=(const SessionRelay&);
+
+        void accept();
+        void serve(Peer& peer);
+
+        std::string m_socketPath;
+        int m_listener;
+        int m_wake[2];
+        std::atomic<bool> m_running;
+        std::vector<Peer> m_peers;
+        uint32_t m_nextPeer;
+        uint32_t m_sequence;
+        std::vector<std::vector<unsigned char> > m_log;
+        size_t m_logBytes;
+};
+#endif
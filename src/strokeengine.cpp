@@ -0,0 +1,298 @@
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include "strokeengine.hpp"
+#include "tracer.hpp"
+
+StrokeEngine::StrokeEngine() :
+    m_pixels(0), m_history(0), m_color(0), m_brushSize(1), m_mirror(MIRROR_NONE), m_hasLast(false), m_queued(0) {
+}
+
+/**
+ * @param size  Width of the square brush in bixels.
+ */
+void StrokeEngine::setBrushSize(int size) {
+    m_brushSize = std::max(1, size);
+}
+
+int StrokeEngine::brushSize() const {
+    return m_brushSize;
+}
+
+/**
+ * @param mirror    MIRROR_NONE, or MIRROR_HORIZONTAL and MIRROR_VERTICAL
+ *                  or'd together to paint two or four copies of each
+ *                  stroke. Takes effect from the next flush.
+ */
+void StrokeEngine::setMirror(int mirror) {
+    m_mirror = mirror & (MIRROR_HORIZONTAL | MIRROR_VERTICAL);
+}
+
+int StrokeEngine::mirror() const {
+    return m_mirror;
+}
+
+/**
+ * Starts a stroke at bixel. Erasing is painting with transparent.
+ *
+ * @param pixels    The canvas; must outlive the stroke.
+ * @param history   Receives the stroke as one step; may be 0.
+ */
+void StrokeEngine::begin(PixelBuffer& pixels, History* history, Rgba color, ivec2 bixel) {
+    end();
+    m_pixels = &pixels;
+    m_history = history;
+    m_color = color;
+    m_hasLast = false;
+    m_queued = 0;
+    if(m_history) {
+        m_history->endStep();
+    }
+    moveTo(bixel);
+}
+
+/**
+ * Queues the next stroke position. Repeats of the previous position,
+ * common at high event rates, are dropped here.
+ */
+void StrokeEngine::moveTo(ivec2 bixel) {
+    if(!m_pixels) {
+        return;
+    }
+    ivec2 previous = m_queued > 0 ? m_queue[m_queued - 1] : m_last;
+    if((m_queued > 0 || m_hasLast) && bixel == previous) {
+        return;
+    }
+    if(m_queued == QUEUE_CAPACITY) {
+        flush();
+    }
+    m_queue[m_queued++] = bixel;
+}
+
+/**
+ * Draws everything queued since the last flush.
+ *
+ * @return  true if any bixels were written.
+ */
+bool StrokeEngine::flush() {
+    if(!m_pixels || m_queued == 0) {
+        return false;
+    }
+    Tracer::Zone zone("stroke_flush");
+
+    m_spans.clear();
+    for(int i = 0; i < m_queued; i++) {
+        if(m_hasLast) {
+            line(m_last, m_queue[i]);
+        } else {
+            stamp(m_queue[i]);
+        }
+        m_last = m_queue[i];
+        m_hasLast = true;
+    }
+    m_queued = 0;
+
+    reflect();
+    write();
+    return !m_spans.empty();
+}
+
+/**
+ * Flushes and closes the stroke's undo step.
+ */
+void StrokeEngine::end() {
+    if(!m_pixels) {
+        return;
+    }
+    flush();
+    if(m_history) {
+        m_history->endStep();
+    }
+    m_pixels = 0;
+    m_history = 0;
+}
+
+bool StrokeEngine::isActive() const {
+    return m_pixels != 0;
+}
+
+/**
+ * Converts a widget position to the bixel under it. Positions outside
+ * the widget give bixels outside the grid, which keeps the line from
+ * the last position inside correct when a stroke leaves and re-enters.
+ */
+ivec2 StrokeEngine::toBixel(double x, double y, int widgetWidth, int widgetHeight,
+                            int gridWidth, int gridHeight) {
+    if(widgetWidth <= 0 || widgetHeight <= 0) {
+        return ivec2(-1, -1);
+    }
+    return ivec2((int) floor(x * gridWidth / widgetWidth),
+                 (int) floor(y * gridHeight / widgetHeight));
+}
+
+//-Private-//
+
+/**
+ * Adds the brush's row spans at bixel. A stamp on the same row as the
+ * previous one, as along the flat runs of a line, widens the previous
+ * stamp's spans instead of adding more.
+ */
+void StrokeEngine::stamp(ivec2 bixel) {
+    int x = bixel.x - (m_brushSize - 1) / 2;
+    int y = bixel.y - (m_brushSize - 1) / 2;
+    size_t previous = m_spans.size() - m_brushSize;
+    if(m_spans.size() >= (size_t) m_brushSize && m_spans[previous].y == y
+       && abs(m_spans[previous].x - x) <= m_spans[previous].length) {
+        for(int row = 0; row < m_brushSize; row++) {
+            Span& span = m_spans[previous + row];
+            int end = std::max(span.x + span.length, x + m_brushSize);
+            span.x = std::min(span.x, x);
+            span.length = end - span.x;
+        }
+        return;
+    }
+    for(int row = 0; row < m_brushSize; row++) {
+        Span span = { x, y + row, m_brushSize };
+        m_spans.push_back(span);
+    }
+}
+
+/**
+ * Stamps every bixel of the Bresenham line from from to to, except
+ * from itself, which the previous segment already drew.
+ */
+void StrokeEngine::line(ivec2 from, ivec2 to) {
+    int dx = abs(to.x - from.x);
+    int dy = -abs(to.y - from.y);
+    int stepX = from.x < to.x ? 1 : -1;
+    int stepY = from.y < to.y ? 1 : -1;
+    int error = dx + dy;
+    ivec2 point = from;
+    while(point != to) {
+        int doubled = 2 * error;
+        if(doubled >= dy) {
+            error += dy;
+            point.x += stepX;
+        }
+        if(doubled <= dx) {
+            error += dx;
+            point.y += stepY;
+        }
+        stamp(point);
+    }
+}
+
+/**
+ * Appends the reflections of the stamped spans that the mirror asks for:
+ * across the vertical center line for MIRROR_HORIZONTAL, across the
+ * horizontal one for MIRROR_VERTICAL, and across both for the fourth
+ * copy when both are set.
+ */
+void StrokeEngine::reflect() {
+    if(m_mirror == MIRROR_NONE) {
+        return;
+    }
+    int width = m_pixels->width();
+    int height = m_pixels->height();
+    size_t stamped = m_spans.size();
+    for(size_t i = 0; i < stamped; i++) {
+        Span span = m_spans[i];
+        Span flipped = { width - span.x - span.length, span.y, span.length };
+        if(m_mirror & MIRROR_HORIZONTAL) {
+            m_spans.push_back(flipped);
+        }
+        if(m_mirror & MIRROR_VERTICAL) {
+            span.y = height - 1 - span.y;
+            flipped.y = span.y;
+            m_spans.push_back(span);
+            if(m_mirror & MIRROR_HORIZONTAL) {
+                m_spans.push_back(flipped);
+            }
+        }
+    }
+}
+
+/**
+ * Sorts the stamped spans by row (a counting sort over the rows they
+ * cover, then by x within each row), merges them into disjoint spans,
+ * clips them to the canvas and writes each one once.
+ */
+void StrokeEngine::write() {
+    int height = m_pixels->height();
+    int top = height;
+    int bottom = -1;
+    for(size_t i = 0; i < m_spans.size(); i++) {
+        if(m_spans[i].y >= 0 && m_spans[i].y < height) {
+            top = std::min(top, m_spans[i].y);
+            bottom = std::max(bottom, m_spans[i].y);
+        }
+    }
+    if(bottom < top) {
+        m_spans.clear();
+        return;
+    }
+
+    // Only rows top to bottom are counted, so the cost does not grow
+    // with the height of the canvas.
+    int rows = bottom - top + 1;
+    if((int) m_rowStarts.size() < rows + 1) {
+        m_rowStarts.resize(rows + 1);
+    }
+    std::fill(m_rowStarts.begin(), m_rowStarts.begin() + rows + 1, 0);
+    for(size_t i = 0; i < m_spans.size(); i++) {
+        if(m_spans[i].y >= top && m_spans[i].y <= bottom) {
+            m_rowStarts[m_spans[i].y - top + 1]++;
+        }
+    }
+    for(int row = 0; row < rows; row++) {
+        m_rowStarts[row + 1] += m_rowStarts[row];
+    }
+    m_sorted.resize(m_rowStarts[rows]);
+    for(size_t i = 0; i < m_spans.size(); i++) {
+        if(m_spans[i].y >= top && m_spans[i].y <= bottom) {
+            m_sorted[m_rowStarts[m_spans[i].y - top]++] = m_spans[i];
+        }
+    }
+
+    // m_rowStarts[y - top] now holds the end of row y; rows are short,
+    // so an insertion sort orders each one.
+    m_spans.clear();
+    int rowBegin = 0;
+    for(int y = top; y <= bottom; y++) {
+        int rowEnd = m_rowStarts[y - top];
+        for(int i = rowBegin + 1; i < rowEnd; i++) {
+            Span span = m_sorted[i];
+            int j = i;
+            for(; j > rowBegin && span.x < m_sorted[j - 1].x; j--) {
+                m_sorted[j] = m_sorted[j - 1];
+            }
+            m_sorted[j] = span;
+        }
+
+        for(int i = rowBegin; i < rowEnd; i++) {
+            Span span = m_sorted[i];
+            int x0 = std::max(0, span.x);
+            int x1 = std::min(m_pixels->width(), span.x + span.length);
+            if(x0 >= x1) {
+                continue;
+            }
+            if(!m_spans.empty() && m_spans.back().y == y && x0 <= m_spans.back().x + m_spans.back().length) {
+                Span& last = m_spans.back();
+                last.length = std::max(last.length, x1 - last.x);
+            } else {
+                Span clipped = { x0, y, x1 - x0 };
+                m_spans.push_back(clipped);
+            }
+        }
+        rowBegin = rowEnd;
+    }
+
+    for(size_t i = 0; i < m_spans.size(); i++) {
+        const Span& span = m_spans[i];
+        if(m_history) {
+            m_history->touch(*m_pixels, span.x, span.y, span.length);
+        }
+        PixelBuffer::fillSpan(m_pixels->row(span.y) + span.x, span.length, m_color);
+        m_pixels->markDirty(span.x, span.y, span.length, 1);
+    }
+}
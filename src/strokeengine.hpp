@@ -0,0 +1,79 @@
+#ifndef STROKEENGINE_HPP
+#define STROKEENGINE_HPP
+#include <vector>
+#include "rgba.hpp"
+#include "ivec2.hpp"
+#include "pixelbuffer.hpp"
+#include "history.hpp"
+
+/**
+ * Paints brush and eraser strokes.
+ *
+ * Mouse or tablet positions are converted to bixels with toBixel() and
+ * queued with moveTo() as they arrive; nothing is drawn until flush(),
+ * which the canvas calls once per frame. flush() joins the queued
+ * points with Bresenham lines, so fast strokes leave no gaps, stamps
+ * the brush along them, and writes the result as row spans sorted and
+ * merged so every bixel is touched once per frame.
+ *
+ * The point queue is a fixed array and the span buffers keep their
+ * capacity between strokes, as does the History's record of the step
+ * being painted. Once a stroke like it has been painted before, a
+ * stroke allocates only when end() closes its undo step and the
+ * History stores a copy of it, whatever the event rate. If more points
+ * arrive in one frame than the queue holds, the queue is flushed early.
+ *
+ * With a mirror set, the stamped spans are reflected across the middle
+ * of the canvas before the write, so the brush and its reflections are
+ * sorted, merged and written together, each bixel still once.
+ *
+ * A stroke from begin() to end() is one undo step.
+ */
+class StrokeEngine {
+    public:
+        enum Mirror { MIRROR_NONE = 0, MIRROR_HORIZONTAL = 1, MIRROR_VERTICAL = 2 };
+
+        static const int QUEUE_CAPACITY = 256;
+
+        StrokeEngine();
+
+        void setBrushSize(int size);
+        int brushSize() const;
+        void setMirror(int mirror);
+        int mirror() const;
+
+        void begin(PixelBuffer& pixels, History* history, Rgba color, ivec2 bixel);
+        void moveTo(ivec2 bixel);
+        bool flush();
+        void end();
+        bool isActive() const;
+
+        static ivec2 toBixel(double x, double y, int widgetWidth, int widgetHeight,
+                             int gridWidth, int gridHeight);
+
+    private:
+        struct Span {
+            int x;
+            int y;
+            int length;
+        };
+
+        void stamp(ivec2 bixel);
+        void line(ivec2 from, ivec2 to);
+        void reflect();
+        void write();
+
+        PixelBuffer* m_pixels;
+        History* m_history;
+        Rgba m_color;
+        int m_brushSize;
+        int m_mirror;
+        bool m_hasLast;
+        ivec2 m_last;
+        ivec2 m_queue[QUEUE_CAPACITY];
+        int m_queued;
+        std::vector<Span> m_spans;
+        std::vector<Span> m_sorted;
+        std::vector<int> m_rowStarts;
+};
+#endif
@@ -0,0 +1,40 @@
+#include <algorithm>
+#include "swatchbar.hpp"
+
+SwatchBar::SwatchBar(QWidget* parent) : QWidget(parent) {
+    m_layout = new QVBoxLayout();
+    m_layout->setSpacing(0);
+    m_layout->setContentsMargins(0, 0, 0, 0);
+    setLayout(m_layout);
+
+    QVector<QRgb> defaults;
+    defaults << qRgb(0x58, 0x8C, 0x7E) << qRgb(0xF2, 0xE3, 0x94) << qRgb(0xF2, 0xAE, 0x72)
+             << qRgb(0xD9, 0x64, 0x59) << qRgb(0x8C, 0x46, 0x46);
+    setColors(defaults);
+}
+
+QVector<QRgb> SwatchBar::colors() const {
+    return m_colors;
+}
+
+/**
+ * Shows colors, up to MAX_SWATCHES of them. Swatches are reused, so
+ * refilling the bar does not reconnect anything.
+ */
+void SwatchBar::setColors(const QVector<QRgb>& colors) {
+    int count = std::min(colors.size(), (int) MAX_SWATCHES);
+    while(m_swatches.size() < count) {
+        Swatch* swatch = new Swatch();
+        m_layout->addWidget(swatch);
+        QObject::connect(swatch, SIGNAL(swatchPicked(QColor)), this, SIGNAL(swatchPicked(QColor)));
+        m_swatches.append(swatch);
+    }
+    for(int i = 0; i < m_swatches.size(); i++) {
+        if(i < count) {
+            m_swatches[i]->setColor(colors[i]);
+        }
+        m_swatches[i]->setVisible(i < count);
+    }
+    m_colors = colors.mid(0, count);
+    emit colorsChanged(m_colors);
+}
@@ -0,0 +1,38 @@
+#ifndef SWATCHBAR_HPP
+#define SWATCHBAR_HPP
+#include <QWidget>
+#include <QVBoxLayout>
+#include <QVector>
+#include <QColor>
+#include "swatch.hpp"
+
+/**
+ * A column of Swatches showing a palette, for the tool bar. Clicking
+ * one emits swatchPicked() with its color.
+ *
+ * The bar starts with a default palette and is refilled from the
+ * document's palette whenever one is opened.
+ */
+class SwatchBar : public QWidget {
+    Q_OBJECT
+
+    public:
+        static const int MAX_SWATCHES = 16;
+
+        SwatchBar(QWidget* parent = 0);
+
+        QVector<QRgb> colors() const;
+
+    public slots:
+        void setColors(const QVector<QRgb>& colors);
+
+    signals:
+        void swatchPicked(const QColor& color);
+        void colorsChanged(const QVector<QRgb>& colors);
+
+    private:
+        QVBoxLayout* m_layout;
+        QVector<Swatch*> m_swatches;
+        QVector<QRgb> m_colors;
+};
+#endif
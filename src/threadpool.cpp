@@ -0,0 +1,197 @@
+#include <algorithm>
+#include "threadpool.hpp"
+#include "tracer.hpp"
+
+namespace {
+    // The pool and queue index of the worker running on this thread.
+    thread_local const ThreadPool* currentPool = 0;
+    thread_local int currentQueue = -1;
+};
+
+/**
+ * @param threadCount   Number of workers; 0 picks defaultThreadCount().
+ */
+ThreadPool::ThreadPool(int threadCount) :
+    m_nextQueue(0), m_queued(0), m_running(0), m_stopping(false) {
+    if(threadCount <= 0) {
+        threadCount = defaultThreadCount();
+    }
+    for(int i = 0; i < threadCount; i++) {
+        m_queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for(int i = 0; i < threadCount; i++) {
+        m_threads.push_back(std::thread(&ThreadPool::run, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_taskAvailable.notify_all();
+    for(size_t i = 0; i < m_threads.size(); i++) {
+        m_threads[i].join();
+    }
+}
+
+int ThreadPool::threadCount() const {
+    return m_threads.size();
+}
+
+void ThreadPool::submit(const Task& task) {
+    int index = currentPool == this ? currentQueue : m_nextQueue++ % m_queues.size();
+    // Counted before it is published, so a worker that takes the task
+    // at once cannot bring m_queued below zero and fool wait().
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queued++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+        m_queues[index]->tasks.push_back(task);
+    }
+    m_taskAvailable.notify_one();
+}
+
+/**
+ * Runs one queued task on the calling thread, preferring the caller's
+ * own deque when it is a worker. The task may belong to unrelated work,
+ * so callers that time themselves should not help this way.
+ *
+ * @return  false if no task was queued.
+ */
+bool ThreadPool::runPendingTask() {
+    Task task;
+    if(!take(currentPool == this ? currentQueue : -1, task)) {
+        return false;
+    }
+    execute(task);
+    return true;
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this]() { return m_queued == 0 && m_running == 0; });
+}
+
+/**
+ * Calls body(chunkBegin, chunkEnd) over [begin, end) in chunks of at
+ * least minimumChunk indices. Chunks are handed out dynamically, so
+ * uneven work balances itself.
+ */
+void ThreadPool::parallelFor(int begin, int end, const std::function<void(int, int)>& body,
+                             int minimumChunk) {
+    if(end <= begin) {
+        return;
+    }
+    int workers = threadCount() + 1;
+    int chunk = std::max(minimumChunk, (end - begin + workers * 4 - 1) / (workers * 4));
+    if(end - begin <= chunk) {
+        body(begin, end);
+        return;
+    }
+
+    // Helpers may start after every chunk is done (or not at all while
+    // the workers are busy with an enclosing parallelFor), so the caller
+    // waits for the chunks rather than the helpers, and the state they
+    // share outlives this call.
+    struct State {
+        std::atomic<int> next;
+        std::atomic<int> completed;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->next = begin;
+    state->completed = 0;
+    int chunkCount = (end - begin + chunk - 1) / chunk;
+
+    std::function<void()> work = [state, &body, end, chunk, chunkCount]() {
+        int start;
+        while((start = state->next.fetch_add(chunk)) < end) {
+            body(start, std::min(end, start + chunk));
+            if(++state->completed == chunkCount) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->done.notify_all();
+            }
+        }
+    };
+
+    int helpers = std::min(threadCount(), chunkCount - 1);
+    for(int i = 0; i < helpers; i++) {
+        submit(work);
+    }
+    work();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&]() { return state->completed == chunkCount; });
+}
+
+int ThreadPool::defaultThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+//-Private-//
+
+void ThreadPool::run(int index) {
+    Tracer::setThreadName("pool worker " + std::to_string(index));
+    currentPool = this;
+    currentQueue = index;
+    while(true) {
+        Task task;
+        if(take(index, task)) {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_taskAvailable.wait(lock, [this]() { return m_stopping || m_queued > 0; });
+        if(m_stopping && m_queued == 0) {
+            return;
+        }
+    }
+}
+
+/**
+ * Pops the newest task of queue index, or failing that steals the
+ * oldest task of another queue. index -1 only steals.
+ */
+bool ThreadPool::take(int index, Task& task) {
+    int count = m_queues.size();
+    bool found = false;
+    if(index >= 0) {
+        Queue& own = *m_queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            found = true;
+        }
+    }
+    for(int i = 1; i <= count && !found; i++) {
+        Queue& victim = *m_queues[(std::max(index, 0) + i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            found = true;
+        }
+    }
+    if(found) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queued--;
+        m_running++;
+    }
+    return found;
+}
+
+void ThreadPool::execute(const Task& task) {
+    task();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running--;
+    if(m_queued == 0 && m_running == 0) {
+        m_idle.notify_all();
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of worker threads running queued tasks.
+ *
+ * Every worker owns a deque. Tasks submitted from a worker go on its
+ * own deque and are taken back newest first, which keeps related work
+ * on the thread whose cache holds it; tasks submitted from outside are
+ * dealt round robin. A worker whose deque is empty steals the oldest
+ * task from another.
+ *
+ * wait() blocks until every task submitted so far has finished.
+ * parallelFor() splits an index range into chunks, runs them on the
+ * workers and the calling thread, and returns when all are done.
+ * A task that has to block on other tasks should run them itself if
+ * no worker has started them (as parallelFor() and PngExporter do), or
+ * call runPendingTask() while it waits, so a pool whose workers are all
+ * waiting cannot deadlock. runPendingTask() may run any queued task,
+ * so its time is charged to the caller.
+ */
+class ThreadPool {
+    public:
+        typedef std::function<void()> Task;
+
+        ThreadPool(int threadCount = 0);
+        ~ThreadPool();
+
+        int threadCount() const;
+        void submit(const Task& task);
+        bool runPendingTask();
+        void wait();
+        void parallelFor(int begin, int end, const std::function<void(int, int)>& body,
+                         int minimumChunk = 1);
+
+        static int defaultThreadCount();
+
+    private:
+        ThreadPool(const ThreadPool&);
+        ThreadPool& operator=(const ThreadPool&);
+
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void run(int index);
+        bool take(int index, Task& task);
+        void execute(const Task& task);
+
+        std::vector<std::thread> m_threads;
+        std::vector<std::unique_ptr<Queue> > m_queues;
+        std::atomic<unsigned> m_nextQueue;
+        std::mutex m_mutex;
+        std::condition_variable m_taskAvailable;
+        std::condition_variable m_idle;
+        int m_queued;
+        int m_running;
+        bool m_stopping;
+};
+#endif
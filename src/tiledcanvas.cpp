@@ -0,0 +1,416 @@
+#include <string.h>
+#include <algorithm>
+#include "tiledcanvas.hpp"
+#include "bixlfile.hpp"
+#include "mappedbixlfile.hpp"
+#include "tracer.hpp"
+
+TiledCanvas::TiledCanvas(int width, int height, int dimension) :
+    m_width(std::max(0, width)), m_height(std::max(0, height)), m_dimension(dimension) {
+}
+
+int TiledCanvas::width() const {
+    return m_width;
+}
+
+int TiledCanvas::height() const {
+    return m_height;
+}
+
+int TiledCanvas::dimension() const {
+    return m_dimension;
+}
+
+void TiledCanvas::setDimension(int dimension) {
+    m_dimension = dimension;
+}
+
+int TiledCanvas::tilesX() const {
+    return (m_width + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+int TiledCanvas::tilesY() const {
+    return (m_height + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+size_t TiledCanvas::storedTileCount() const {
+    return m_tiles.size();
+}
+
+/**
+ * @return  The bytes of bixel data held, counting shared tiles in full.
+ */
+size_t TiledCanvas::byteSize() const {
+    return m_tiles.size() * sizeof(Tile);
+}
+
+/**
+ * Changes the canvas size, keeping the overlap. Bixels that come into
+ * view are transparent.
+ */
+void TiledCanvas::resize(int width, int height) {
+    width = std::max(0, width);
+    height = std::max(0, height);
+    if(width < m_width || height < m_height) {
+        int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+        for(TileMap::iterator i = m_tiles.begin(); i != m_tiles.end();) {
+            int tx = i->first & 0xFFFFFFFF;
+            int ty = i->first >> 32;
+            if(tx >= tilesX || ty >= tilesY) {
+                i = m_tiles.erase(i);
+            } else {
+                ++i;
+            }
+        }
+
+        // The tiles on the new edge keep bixels past it; clear them so
+        // growing again shows transparency rather than old paint.
+        m_width = std::max(width, m_width);
+        m_height = std::max(height, m_height);
+        if(width % TILE_SIZE != 0) {
+            fillRect(width, 0, TILE_SIZE - width % TILE_SIZE, m_height, 0);
+        }
+        if(height % TILE_SIZE != 0) {
+            fillRect(0, height, m_width, TILE_SIZE - height % TILE_SIZE, 0);
+        }
+    }
+    m_width = width;
+    m_height = height;
+}
+
+/**
+ * Makes every bixel transparent, releasing all tiles.
+ */
+void TiledCanvas::clear() {
+    m_tiles.clear();
+}
+
+/**
+ * Releases the tiles that have been painted back to transparent.
+ */
+void TiledCanvas::compact() {
+    for(TileMap::iterator i = m_tiles.begin(); i != m_tiles.end();) {
+        if(isTransparent(*i->second)) {
+            i = m_tiles.erase(i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void TiledCanvas::setPixel(int x, int y, Rgba color) {
+    if(x < 0 || y < 0 || x >= m_width || y >= m_height) {
+        return;
+    }
+    mutableTile(x / TILE_SIZE, y / TILE_SIZE)[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE] = color;
+}
+
+/**
+ * Fills a rectangle, clipped to the canvas. Tiles that end up wholly
+ * transparent are released instead of written.
+ */
+void TiledCanvas::fillRect(int x, int y, int width, int height, Rgba color) {
+    int x0 = std::max(0, x);
+    int y0 = std::max(0, y);
+    int x1 = std::min(m_width, x + width);
+    int y1 = std::min(m_height, y + height);
+    if(x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    for(int ty = y0 / TILE_SIZE; ty <= (y1 - 1) / TILE_SIZE; ty++) {
+        for(int tx = x0 / TILE_SIZE; tx <= (x1 - 1) / TILE_SIZE; tx++) {
+            int left = std::max(x0, tx * TILE_SIZE) - tx * TILE_SIZE;
+            int top = std::max(y0, ty * TILE_SIZE) - ty * TILE_SIZE;
+            int right = std::min(x1, (tx + 1) * TILE_SIZE) - tx * TILE_SIZE;
+            int bottom = std::min(y1, (ty + 1) * TILE_SIZE) - ty * TILE_SIZE;
+            bool whole = left == 0 && top == 0 && right == TILE_SIZE && bottom == TILE_SIZE;
+
+            if(color == 0 && (whole || !tile(tx, ty))) {
+                m_tiles.erase(key(tx, ty));
+                continue;
+            }
+            Rgba* data = mutableTile(tx, ty);
+            for(int row = top; row < bottom; row++) {
+                PixelBuffer::fillSpan(data + row * TILE_SIZE + left, right - left, color);
+            }
+        }
+    }
+}
+
+/**
+ * Copies a rectangle of bixels into out. Parts outside the canvas read
+ * as transparent.
+ */
+void TiledCanvas::readRegion(int x, int y, int width, int height, Rgba* out, int outStride) const {
+    for(int row = 0; row < height; row++) {
+        Rgba* line = out + (size_t) row * outStride;
+        int py = y + row;
+        if(py < 0 || py >= m_height) {
+            memset(line, 0, width * sizeof(Rgba));
+            continue;
+        }
+        int column = 0;
+        while(column < width) {
+            int px = x + column;
+            if(px < 0 || px >= m_width) {
+                line[column++] = 0;
+                continue;
+            }
+            int run = std::min(width - column, TILE_SIZE - px % TILE_SIZE);
+            run = std::min(run, m_width - px);
+            const Rgba* data = tile(px / TILE_SIZE, py / TILE_SIZE);
+            if(data) {
+                memcpy(line + column, data + (py % TILE_SIZE) * TILE_SIZE + px % TILE_SIZE,
+                       run * sizeof(Rgba));
+            } else {
+                memset(line + column, 0, run * sizeof(Rgba));
+            }
+            column += run;
+        }
+    }
+}
+
+/**
+ * Copies a rectangle of bixels from in, clipped to the canvas. Runs of
+ * transparent bixels over empty tiles leave them empty.
+ */
+void TiledCanvas::writeRegion(int x, int y, int width, int height, const Rgba* in, int inStride) {
+    int x0 = std::max(0, x);
+    int y0 = std::max(0, y);
+    int x1 = std::min(m_width, x + width);
+    int y1 = std::min(m_height, y + height);
+
+    for(int py = y0; py < y1; py++) {
+        const Rgba* line = in + (size_t) (py - y) * inStride - x;
+        for(int px = x0; px < x1;) {
+            int run = std::min(x1 - px, TILE_SIZE - px % TILE_SIZE);
+            int tx = px / TILE_SIZE;
+            int ty = py / TILE_SIZE;
+            bool transparent = !tile(tx, ty)
+                && std::find_if(line + px, line + px + run, [](Rgba c) { return c != 0; }) == line + px + run;
+            if(!transparent) {
+                memcpy(mutableTile(tx, ty) + (py % TILE_SIZE) * TILE_SIZE + px % TILE_SIZE,
+                       line + px, run * sizeof(Rgba));
+            }
+            px += run;
+        }
+    }
+}
+
+/**
+ * @return  The bixels of tile (tx, ty), TILE_SIZE per row, or 0 if the
+ *          tile is transparent and not stored.
+ */
+const Rgba* TiledCanvas::tile(int tx, int ty) const {
+    TileMap::const_iterator found = m_tiles.find(key(tx, ty));
+    return found == m_tiles.end() ? 0 : found->second->pixels;
+}
+
+/**
+ * @return  The bixels of tile (tx, ty) for writing, allocating the tile
+ *          or unsharing it from other canvases first.
+ */
+Rgba* TiledCanvas::mutableTile(int tx, int ty) {
+    std::shared_ptr<Tile>& slot = m_tiles[key(tx, ty)];
+    if(!slot) {
+        slot = std::make_shared<Tile>();    // value initialized, transparent
+    } else if(slot.use_count() > 1) {
+        slot = std::make_shared<Tile>(*slot);
+    }
+    return slot->pixels;
+}
+
+void TiledCanvas::toPixelBuffer(PixelBuffer& pixels) const {
+    pixels.resize(m_width, m_height);
+    readRegion(0, 0, m_width, m_height, pixels.data(), pixels.stride());
+    pixels.markDirty(0, 0, m_width, m_height);
+}
+
+void TiledCanvas::fromPixelBuffer(const PixelBuffer& pixels) {
+    m_tiles.clear();
+    m_width = pixels.width();
+    m_height = pixels.height();
+    writeRegion(0, 0, m_width, m_height, pixels.data(), pixels.stride());
+}
+
+/**
+ * Makes the canvas a copy of pixels, sharing as much as it can. Tiles
+ * whose bixels did not change are kept as they are, still shared with
+ * any copies, and changed tiles are replaced by the tile in cache with
+ * the same bixels if there is one. Storing an edited frame back thus
+ * costs a compare of every tile and a hash of the changed ones.
+ */
+void TiledCanvas::fromPixelBuffer(const PixelBuffer& pixels, TileCache& cache) {
+    if(pixels.width() != m_width || pixels.height() != m_height) {
+        resize(pixels.width(), pixels.height());
+    }
+    for(int ty = 0; ty < tilesY(); ty++) {
+        for(int tx = 0; tx < tilesX(); tx++) {
+            int x = tx * TILE_SIZE;
+            int y = ty * TILE_SIZE;
+            int width = std::min((int) TILE_SIZE, m_width - x);
+            int height = std::min((int) TILE_SIZE, m_height - y);
+            TileMap::iterator found = m_tiles.find(key(tx, ty));
+            const Tile* current = found == m_tiles.end() ? 0 : found->second.get();
+
+            bool same = true;
+            for(int row = 0; row < height && same; row++) {
+                const Rgba* line = pixels.row(y + row) + x;
+                same = current ? memcmp(current->pixels + row * TILE_SIZE, line, width * sizeof(Rgba)) == 0
+                               : std::find_if(line, line + width, [](Rgba c) { return c != 0; }) == line + width;
+            }
+            if(same) {
+                continue;
+            }
+
+            std::shared_ptr<Tile> tile = std::make_shared<Tile>();
+            for(int row = 0; row < height; row++) {
+                memcpy(tile->pixels + row * TILE_SIZE, pixels.row(y + row) + x, width * sizeof(Rgba));
+            }
+            if(isTransparent(*tile)) {
+                m_tiles.erase(key(tx, ty));
+                continue;
+            }
+            cache.intern(tile);
+            m_tiles[key(tx, ty)] = tile;
+        }
+    }
+}
+
+/**
+ * Replaces every stored tile that has the same bixels as a tile in cache
+ * by that tile, and adds the rest to cache. Tiles painted back to
+ * transparent are released.
+ */
+void TiledCanvas::deduplicate(TileCache& cache) {
+    for(TileMap::iterator i = m_tiles.begin(); i != m_tiles.end();) {
+        if(isTransparent(*i->second)) {
+            i = m_tiles.erase(i);
+        } else {
+            cache.intern(i->second);
+            ++i;
+        }
+    }
+}
+
+/**
+ * Loads a .bixl file a tile at a time, so the whole canvas is never
+ * held densely. Transparent tiles are not stored. Layered files load
+ * as drawn, flattened into one canvas.
+ */
+bool TiledCanvas::read(const std::string& fileName) {
+    Tracer::Zone zone("tiled_read");
+    MappedBixlFile file;
+    if(!file.open(fileName)) {
+        return false;
+    }
+
+    TiledCanvas loaded(file.width(), file.height(), file.dimension());
+    std::vector<Rgba> band((size_t) loaded.m_width * TILE_SIZE);
+    for(int y = 0; y < loaded.m_height; y += TILE_SIZE) {
+        int rows = std::min(loaded.m_height - y, (int) TILE_SIZE);
+        if(!file.readRegion(0, y, loaded.m_width, rows, &band[0], loaded.m_width)) {
+            return false;
+        }
+        loaded.writeRegion(0, y, loaded.m_width, rows, &band[0], loaded.m_width);
+    }
+    *this = loaded;
+    return true;
+}
+
+bool TiledCanvas::write(const std::string& fileName) const {
+    return BixlFile::writeTiled(fileName, m_width, m_height, m_dimension,
+                                [this](int x, int y, int width, int height, Rgba* out) {
+        readRegion(x, y, width, height, out, width);
+    });
+}
+
+//-Private-//
+
+bool TiledCanvas::isTransparent(const Tile& tile) {
+    for(int i = 0; i < TILE_AREA; i++) {
+        if(tile.pixels[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * A 64 bit hash of a tile's bixels, eight at a time in four independent
+ * lanes so the multiplies overlap.
+ */
+uint64_t TiledCanvas::hash(const Tile& tile) {
+    const uint64_t prime = 0x9E3779B97F4A7C15ull;
+    uint64_t lanes[4] = { 1, 2, 3, 4 };
+    const unsigned char* bytes = (const unsigned char*) tile.pixels;
+    for(size_t offset = 0; offset < sizeof(tile.pixels); offset += 32) {
+        for(int lane = 0; lane < 4; lane++) {
+            uint64_t word;
+            memcpy(&word, bytes + offset + lane * 8, 8);
+            lanes[lane] = (lanes[lane] ^ word) * prime;
+            lanes[lane] ^= lanes[lane] >> 29;
+        }
+    }
+    uint64_t h = lanes[0];
+    for(int lane = 1; lane < 4; lane++) {
+        h = (h ^ lanes[lane]) * prime;
+    }
+    return h ^ (h >> 32);
+}
+
+//-TileCache-//
+
+/**
+ * @return  The number of entries, including those of tiles that have
+ *          since been freed.
+ */
+size_t TiledCanvas::TileCache::size() const {
+    return m_tiles.size();
+}
+
+/**
+ * Drops the entries of tiles that are no longer used by any canvas.
+ */
+void TiledCanvas::TileCache::prune() {
+    for(HashMap::iterator i = m_tiles.begin(); i != m_tiles.end();) {
+        if(i->second.expired()) {
+            i = m_tiles.erase(i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void TiledCanvas::TileCache::clear() {
+    m_tiles.clear();
+}
+
+/**
+ * Points tile at the cached tile with the same bixels, or adds it to the
+ * cache if there is none. A tile painted after it was added is still
+ * filed under its old hash, which only costs a missed match: bixels are
+ * always compared before sharing.
+ */
+void TiledCanvas::TileCache::intern(std::shared_ptr<Tile>& tile) {
+    uint64_t h = hash(*tile);
+    std::pair<HashMap::iterator, HashMap::iterator> range = m_tiles.equal_range(h);
+    for(HashMap::iterator i = range.first; i != range.second;) {
+        std::shared_ptr<Tile> cached = i->second.lock();
+        if(!cached) {
+            i = m_tiles.erase(i);
+            continue;
+        }
+        if(cached == tile) {
+            return;
+        }
+        if(memcmp(cached->pixels, tile->pixels, sizeof(Tile)) == 0) {
+            tile = cached;
+            return;
+        }
+        ++i;
+    }
+    m_tiles.insert(std::make_pair(h, std::weak_ptr<Tile>(tile)));
+}
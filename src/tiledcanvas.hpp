@@ -0,0 +1,122 @@
+#ifndef TILEDCANVAS_HPP
+#define TILEDCANVAS_HPP
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <stdint.h>
+#include <stddef.h>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+
+/**
+ * Sparse canvas storage made of TILE_SIZE x TILE_SIZE tiles.
+ *
+ * Only tiles that have been painted are stored; a missing tile reads as
+ * transparent, so a mostly empty 16k x 16k canvas costs a few tiles
+ * rather than a gigabyte. Growing the canvas only changes its size.
+ * Shrinking drops the stored tiles that fall outside and clears the cut
+ * off part of the tiles on the new edge, so it costs in proportion to
+ * what was painted there, never to the area.
+ *
+ * Tiles are shared between copies of a canvas and copied on the first
+ * write (copy on write), so copying a canvas, for a snapshot or an undo
+ * step, costs one pointer per stored tile.
+ *
+ * Canvases are not thread safe, but different copies sharing tiles may
+ * be used from different threads.
+ *
+ * Canvases that are mostly alike, such as the frames of an animation,
+ * can also share tiles that were painted separately but ended up the
+ * same, through a TileCache that indexes tiles by a hash of their
+ * bixels; see deduplicate().
+ */
+class TiledCanvas {
+    public:
+        static const int TILE_SIZE = 64;
+        static const int TILE_AREA = TILE_SIZE * TILE_SIZE;
+
+        class TileCache;
+
+        TiledCanvas(int width = 0, int height = 0, int dimension = 0);
+
+        int width() const;
+        int height() const;
+        int dimension() const;
+        void setDimension(int dimension);
+        int tilesX() const;
+        int tilesY() const;
+        size_t storedTileCount() const;
+        size_t byteSize() const;
+
+        void resize(int width, int height);
+        void clear();
+        void compact();
+
+        Rgba pixel(int x, int y) const;
+        void setPixel(int x, int y, Rgba color);
+        void fillRect(int x, int y, int width, int height, Rgba color);
+        void readRegion(int x, int y, int width, int height, Rgba* out, int outStride) const;
+        void writeRegion(int x, int y, int width, int height, const Rgba* in, int inStride);
+
+        const Rgba* tile(int tx, int ty) const;
+        Rgba* mutableTile(int tx, int ty);
+
+        void toPixelBuffer(PixelBuffer& pixels) const;
+        void fromPixelBuffer(const PixelBuffer& pixels);
+        void fromPixelBuffer(const PixelBuffer& pixels, TileCache& cache);
+        void deduplicate(TileCache& cache);
+
+        bool read(const std::string& fileName);
+        bool write(const std::string& fileName) const;
+
+    private:
+        struct Tile {
+            Rgba pixels[TILE_AREA];
+        };
+
+        typedef std::unordered_map<uint64_t, std::shared_ptr<Tile> > TileMap;
+
+        static uint64_t key(int tx, int ty);
+        static bool isTransparent(const Tile& tile);
+        static uint64_t hash(const Tile& tile);
+
+        TileMap m_tiles;
+        int m_width;
+        int m_height;
+        int m_dimension;
+};
+
+/**
+ * Tiles indexed by content, for sharing identical tiles between
+ * canvases. The cache only holds weak references: a tile is freed once
+ * no canvas uses it, and its entry is dropped on the next lookup that
+ * meets it or by prune().
+ */
+class TiledCanvas::TileCache {
+    public:
+        size_t size() const;
+        void prune();
+        void clear();
+
+    private:
+        friend class TiledCanvas;
+
+        typedef std::unordered_multimap<uint64_t, std::weak_ptr<Tile> > HashMap;
+
+        void intern(std::shared_ptr<Tile>& tile);
+
+        HashMap m_tiles;
+};
+
+inline uint64_t TiledCanvas::key(int tx, int ty) {
+    return ((uint64_t) (uint32_t) ty << 32) | (uint32_t) tx;
+}
+
+inline Rgba TiledCanvas::pixel(int x, int y) const {
+    if(x < 0 || y < 0 || x >= m_width || y >= m_height) {
+        return 0;
+    }
+    const Rgba* data = tile(x / TILE_SIZE, y / TILE_SIZE);
+    return data ? data[(y % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE] : 0;
+}
+#endif
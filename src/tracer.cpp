@@ -0,0 +1,399 @@
+#include <stdarg.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "tracer.hpp"
+
+std::atomic<bool> Tracer::s_enabled(false);
+
+namespace {
+    enum EventType { ZONE, COUNTER };
+
+    const int RING_CAPACITY = 1 << 14;
+    const size_t MESSAGE_CAPACITY = 1024;
+
+    /**
+     * One recorded zone or counter. Fields are written by the owning
+     * thread and read by writeChromeTrace() on another; sequence is odd
+     * while the slot is being written and 2 * (index + 1) once event
+     * number index is complete, so the reader can tell a torn or
+     * overwritten slot from a good one.
+     */
+    struct Event {
+        std::atomic<uint64_t> sequence;
+        std::atomic<const char*> name;
+        std::atomic<int64_t> start;
+        std::atomic<int64_t> value;
+        std::atomic<int> type;
+    };
+
+    /**
+     * A thread that recorded into a buffer, from event number first on.
+     */
+    struct Owner {
+        uint64_t first;
+        int id;
+        std::string name;
+    };
+
+    /**
+     * owners and inUse are guarded by registryMutex; the events belong
+     * to the thread currently using the buffer.
+     */
+    struct ThreadBuffer {
+        std::vector<Owner> owners;
+        bool inUse;
+        std::atomic<uint64_t> head;
+        Event events[RING_CAPACITY];
+    };
+
+    /**
+     * The calling thread's buffer. Its destructor runs when the thread
+     * exits and hands the buffer back for the next thread to reuse.
+     */
+    struct CurrentBuffer {
+        ThreadBuffer* buffer;
+        int id;
+
+        ~CurrentBuffer();
+    };
+
+    struct Message {
+        int64_t time;
+        int thread;
+        std::string text;
+    };
+
+    // Buffers outlive their threads, so a dump still shows the work of
+    // threads that have exited, and are reused by threads started later,
+    // so a program that keeps starting short lived threads (a ThreadPool
+    // per export) needs no more buffers than it ever had threads at once.
+    std::mutex registryMutex;
+    std::vector<std::shared_ptr<ThreadBuffer> > buffers;
+    std::deque<Message> messages;
+    std::atomic<int64_t> sessionStart(0);
+    int threadCount = 0;
+
+    thread_local CurrentBuffer current = { 0, 0 };
+    thread_local std::string currentName;
+
+    // Upper bounds in milliseconds; the last bucket has none.
+    const double bucketLimits[Tracer::FRAME_BUCKETS - 1] = { 2, 4, 8, 12, 16.7, 20, 33.3, 50, 100 };
+    std::atomic<uint64_t> frameCounts[Tracer::FRAME_BUCKETS];
+
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    CurrentBuffer::~CurrentBuffer() {
+        if(buffer) {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            buffer->inUse = false;
+            buffer = 0;
+        }
+    }
+
+    /**
+     * Takes a buffer left by a finished thread, or makes a new one. A
+     * reused buffer keeps its events; the new owner's start from head,
+     * and owners whose events have all been overwritten are dropped.
+     */
+    ThreadBuffer* threadBuffer() {
+        if(!current.buffer) {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            std::shared_ptr<ThreadBuffer> buffer;
+            for(size_t i = 0; i < buffers.size() && !buffer; i++) {
+                if(!buffers[i]->inUse) {
+                    buffer = buffers[i];
+                }
+            }
+            if(!buffer) {
+                buffer = std::make_shared<ThreadBuffer>();
+                buffer->head.store(0);
+                for(int i = 0; i < RING_CAPACITY; i++) {
+                    buffer->events[i].sequence.store(0);
+                }
+                buffers.push_back(buffer);
+            }
+
+            uint64_t head = buffer->head.load(std::memory_order_relaxed);
+            std::vector<Owner>& owners = buffer->owners;
+            while(owners.size() > 1 && owners[1].first + RING_CAPACITY <= head) {
+                owners.erase(owners.begin());
+            }
+            current.id = ++threadCount;
+            Owner owner = { head, current.id,
+                            currentName.empty() ? "thread " + std::to_string(current.id) : currentName };
+            owners.push_back(owner);
+            buffer->inUse = true;
+            current.buffer = buffer.get();
+        }
+        return current.buffer;
+    }
+
+    void record(EventType type, const char* name, int64_t start, int64_t value) {
+        ThreadBuffer* buffer = threadBuffer();
+        uint64_t index = buffer->head.load(std::memory_order_relaxed);
+        Event& event = buffer->events[index % RING_CAPACITY];
+        event.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        event.name.store(name, std::memory_order_relaxed);
+        event.start.store(start, std::memory_order_relaxed);
+        event.value.store(value, std::memory_order_relaxed);
+        event.type.store(type, std::memory_order_relaxed);
+        event.sequence.store(2 * index + 2, std::memory_order_release);
+        buffer->head.store(index + 1, std::memory_order_release);
+    }
+
+    /**
+     * Copies event number index out of buffer.
+     *
+     * @return  false if the slot was overwritten or is being written.
+     */
+    bool readEvent(const ThreadBuffer& buffer, uint64_t index, const char*& name,
+                   int64_t& start, int64_t& value, int& type) {
+        const Event& event = buffer.events[index % RING_CAPACITY];
+        uint64_t before = event.sequence.load(std::memory_order_acquire);
+        name = event.name.load(std::memory_order_relaxed);
+        start = event.start.load(std::memory_order_relaxed);
+        value = event.value.load(std::memory_order_relaxed);
+        type = event.type.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = event.sequence.load(std::memory_order_relaxed);
+        return before == 2 * index + 2 && after == before;
+    }
+
+    void writeEscaped(FILE* out, const char* text) {
+        for(; *text; text++) {
+            unsigned char c = *text;
+            if(c == '"' || c == '\\') {
+                fprintf(out, "\\%c", c);
+            } else if(c < 0x20) {
+                fprintf(out, "\\u%04x", c);
+            } else {
+                fputc(c, out);
+            }
+        }
+    }
+
+    int64_t doubleBits(double value) {
+        int64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+
+    double bitsDouble(int64_t bits) {
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+};
+
+//-Public-//
+
+/**
+ * Turns recording on or off. Turning it on discards the previous
+ * recording and the frame time histogram.
+ */
+void Tracer::setEnabled(bool enabled) {
+    if(enabled && !isEnabled()) {
+        sessionStart.store(now());
+        for(int i = 0; i < FRAME_BUCKETS; i++) {
+            frameCounts[i].store(0);
+        }
+        std::lock_guard<std::mutex> lock(registryMutex);
+        messages.clear();
+    }
+    s_enabled.store(enabled);
+}
+
+/**
+ * Names the calling thread in traces. Cheap enough to call at thread
+ * start whether or not recording is on.
+ */
+void Tracer::setThreadName(const std::string& name) {
+    currentName = name;
+    if(current.buffer) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        current.buffer->owners.back().name = name;
+    }
+}
+
+/**
+ * Records a printf style message in the trace. Builds with LOG defined
+ * also print it to stderr, as olilog::log used to.
+ */
+void Tracer::message(const char* format, ...) {
+    #ifndef LOG
+    if(!isEnabled()) {
+        return;
+    }
+    #endif
+
+    char text[512];
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(text, sizeof(text), format, arguments);
+    va_end(arguments);
+
+    #ifdef LOG
+        fprintf(stderr, "%s\n", text);
+    #endif
+
+    if(isEnabled()) {
+        threadBuffer();
+        Message message = { now(), current.id, text };
+        std::lock_guard<std::mutex> lock(registryMutex);
+        if(messages.size() == MESSAGE_CAPACITY) {
+            messages.pop_front();
+        }
+        messages.push_back(message);
+    }
+}
+
+/**
+ * Copies the number of frames recorded in each bucket.
+ *
+ * @see frameBucketLimit()
+ */
+void Tracer::frameHistogram(uint64_t counts[FRAME_BUCKETS]) {
+    for(int i = 0; i < FRAME_BUCKETS; i++) {
+        counts[i] = frameCounts[i].load(std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @return  The longest frame time in milliseconds counted in bucket, or
+ *          -1 for the last bucket, which has no limit.
+ */
+double Tracer::frameBucketLimit(int bucket) {
+    return bucket < FRAME_BUCKETS - 1 ? bucketLimits[bucket] : -1;
+}
+
+bool Tracer::writeChromeTrace(const std::string& fileName) {
+    FILE* out = fopen(fileName.c_str(), "w");
+    if(!out) {
+        return false;
+    }
+    writeChromeTrace(out);
+    bool success = !ferror(out);
+    return fclose(out) == 0 && success;
+}
+
+/**
+ * Writes everything recorded since recording was last turned on in the
+ * Chrome trace event format. Zones are complete ("X") events, counters
+ * "C" events and messages instant events; the frame time histogram is
+ * in otherData. Recording can go on while this runs.
+ */
+void Tracer::writeChromeTrace(FILE* out) {
+    std::vector<std::shared_ptr<ThreadBuffer> > threads;
+    std::vector<std::vector<Owner> > owners;
+    std::vector<uint64_t> heads;
+    std::vector<Message> recordedMessages;
+    {
+        // Events recorded after this are left out, so a thread that
+        // takes over a buffer meanwhile is not mistaken for its owner.
+        std::lock_guard<std::mutex> lock(registryMutex);
+        threads = buffers;
+        for(size_t t = 0; t < threads.size(); t++) {
+            owners.push_back(threads[t]->owners);
+            heads.push_back(threads[t]->head.load(std::memory_order_acquire));
+        }
+        recordedMessages.assign(messages.begin(), messages.end());
+    }
+    int64_t since = sessionStart.load();
+
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    const char* separator = "";
+    for(size_t t = 0; t < threads.size(); t++) {
+        const ThreadBuffer& buffer = *threads[t];
+        const std::vector<Owner>& bufferOwners = owners[t];
+        for(size_t o = 0; o < bufferOwners.size(); o++) {
+            fprintf(out, "%s{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %d, "
+                         "\"args\": {\"name\": \"", separator, bufferOwners[o].id);
+            writeEscaped(out, bufferOwners[o].name.c_str());
+            fprintf(out, "\"}}");
+            separator = ",\n";
+        }
+        if(bufferOwners.empty()) {
+            continue;
+        }
+
+        uint64_t head = heads[t];
+        uint64_t first = head > (uint64_t) RING_CAPACITY ? head - RING_CAPACITY : 0;
+        first = std::max(first, bufferOwners[0].first);
+        size_t owner = 0;
+        for(uint64_t i = first; i < head; i++) {
+            while(owner + 1 < bufferOwners.size() && bufferOwners[owner + 1].first <= i) {
+                owner++;
+            }
+            int id = bufferOwners[owner].id;
+            const char* name;
+            int64_t start, value;
+            int type;
+            if(!readEvent(buffer, i, name, start, value, type) || start < since) {
+                continue;
+            }
+            fprintf(out, "%s{\"ph\": \"%s\", \"name\": \"", separator, type == ZONE ? "X" : "C");
+            writeEscaped(out, name);
+            if(type == ZONE) {
+                fprintf(out, "\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                        id, (start - since) / 1000.0, value / 1000.0);
+            } else {
+                fprintf(out, "\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"args\": {\"value\": %g}}",
+                        id, (start - since) / 1000.0, bitsDouble(value));
+            }
+        }
+    }
+
+    for(size_t i = 0; i < recordedMessages.size(); i++) {
+        const Message& message = recordedMessages[i];
+        fprintf(out, "%s{\"ph\": \"i\", \"s\": \"t\", \"name\": \"", separator);
+        writeEscaped(out, message.text.c_str());
+        fprintf(out, "\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f}",
+                message.thread, (message.time - since) / 1000.0);
+        separator = ",\n";
+    }
+
+    uint64_t counts[FRAME_BUCKETS];
+    frameHistogram(counts);
+    fprintf(out, "\n], \"otherData\": {\"frame_time_histogram\": {");
+    for(int i = 0; i < FRAME_BUCKETS; i++) {
+        if(i < FRAME_BUCKETS - 1) {
+            fprintf(out, "%s\"<=%gms\": %llu", i == 0 ? "" : ", ", bucketLimits[i], (unsigned long long) counts[i]);
+        } else {
+            fprintf(out, ", \">%gms\": %llu", bucketLimits[i - 1], (unsigned long long) counts[i]);
+        }
+    }
+    fprintf(out, "}}}\n");
+}
+
+/**
+ * @return  Nanoseconds on a monotonic clock.
+ */
+int64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - epoch).count();
+}
+
+//-Private-//
+
+void Tracer::finishZone(const char* name, int64_t start, bool frame) {
+    int64_t duration = now() - start;
+    record(ZONE, name, start, duration);
+    if(frame) {
+        double milliseconds = duration / 1e6;
+        int bucket = 0;
+        while(bucket < FRAME_BUCKETS - 1 && milliseconds > bucketLimits[bucket]) {
+            bucket++;
+        }
+        frameCounts[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Tracer::recordCounter(const char* name, double value) {
+    record(COUNTER, name, now(), doubleBits(value));
+}
@@ -0,0 +1,87 @@
+#ifndef TRACER_HPP
+#define TRACER_HPP
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+
+/**
+ * Records timing zones, counters and messages for profiling, and writes
+ * them as Chrome trace JSON (chrome://tracing, Perfetto).
+ *
+ *      Tracer::Zone zone("open");          // times the enclosing scope
+ *      Tracer::counter("history_bytes", history.byteSize());
+ *      Tracer::message("open %s failed", fileName.c_str());
+ *
+ * Every thread records into its own fixed size ring buffer, so
+ * recording takes no lock and allocates nothing once the buffer exists;
+ * when the ring is full the oldest events are overwritten. When a
+ * thread exits, its buffer, events and all, passes to the next thread
+ * to start. Names must be string literals, as only the pointer is
+ * stored.
+ *
+ * Recording is off until setEnabled(true). While off, a Zone costs one
+ * relaxed atomic load and nothing is allocated. Enabling starts a fresh
+ * recording: events and frame times from before are left out of the
+ * next writeChromeTrace().
+ *
+ * A Zone constructed with frame set also adds its duration to the frame
+ * time histogram.
+ */
+class Tracer {
+    public:
+        static const int FRAME_BUCKETS = 10;
+
+        class Zone {
+            public:
+                explicit Zone(const char* name, bool frame = false) :
+                    m_name(name), m_frame(frame), m_start(isEnabled() ? now() : -1) {
+                }
+
+                ~Zone() {
+                    if(m_start >= 0) {
+                        finishZone(m_name, m_start, m_frame);
+                    }
+                }
+
+            private:
+                Zone(const Zone&);
+                Zone& operator=(const Zone&);
+
+                const char* m_name;
+                bool m_frame;
+                int64_t m_start;
+        };
+
+        static void setEnabled(bool enabled);
+
+        static bool isEnabled() {
+            return s_enabled.load(std::memory_order_relaxed);
+        }
+
+        static void setThreadName(const std::string& name);
+
+        static void counter(const char* name, double value) {
+            if(isEnabled()) {
+                recordCounter(name, value);
+            }
+        }
+
+        static void message(const char* format, ...)
+            __attribute__((format(printf, 1, 2)));
+
+        static void frameHistogram(uint64_t counts[FRAME_BUCKETS]);
+        static double frameBucketLimit(int bucket);
+
+        static bool writeChromeTrace(const std::string& fileName);
+        static void writeChromeTrace(FILE* out);
+
+        static int64_t now();
+
+    private:
+        static void finishZone(const char* name, int64_t start, bool frame);
+        static void recordCounter(const char* name, double value);
+
+        static std::atomic<bool> s_enabled;
+};
+#endif
@@ -0,0 +1,518 @@
+#include <string.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "transformengine.hpp"
+#include "tracer.hpp"
+
+namespace {
+    // Rows per task for the row by row kernels.
+    const int ROW_CHUNK = 16;
+
+#ifdef __SSE2__
+    /**
+     * Transposes the 4 x 4 bixels held a row per register.
+     */
+    inline void transpose(__m128i& a, __m128i& b, __m128i& c, __m128i& d) {
+        __m128i ab01 = _mm_unpacklo_epi32(a, b);
+        __m128i cd01 = _mm_unpacklo_epi32(c, d);
+        __m128i ab23 = _mm_unpackhi_epi32(a, b);
+        __m128i cd23 = _mm_unpackhi_epi32(c, d);
+        a = _mm_unpacklo_epi64(ab01, cd01);
+        b = _mm_unpackhi_epi64(ab01, cd01);
+        c = _mm_unpacklo_epi64(ab23, cd23);
+        d = _mm_unpackhi_epi64(ab23, cd23);
+    }
+
+    inline __m128i load(const Rgba* p) {
+        return _mm_loadu_si128((const __m128i*) p);
+    }
+
+    inline void store(Rgba* p, __m128i v) {
+        _mm_storeu_si128((__m128i*) p, v);
+    }
+#endif
+
+    /**
+     * Fills rows r0 to r1, columns c0 to c1 of a quarter turn of the
+     * width x height source. Clockwise, destination (r, c) is source
+     * (height - 1 - c, r); anticlockwise it is (c, width - 1 - r).
+     */
+    void turnBlock(const Rgba* source, size_t sourceStride, int width, int height, bool clockwise,
+                   Rgba* out, size_t outStride, int r0, int r1, int c0, int c1) {
+        int r4 = r0;
+        int c4 = c0;
+#ifdef __SSE2__
+        r4 = r0 + (r1 - r0) / 4 * 4;
+        c4 = c0 + (c1 - c0) / 4 * 4;
+        for(int r = r0; r < r4; r += 4) {
+            for(int c = c0; c < c4; c += 4) {
+                if(clockwise) {
+                    __m128i a = load(source + (size_t) (height - 1 - c) * sourceStride + r);
+                    __m128i b = load(source + (size_t) (height - 2 - c) * sourceStride + r);
+                    __m128i d2 = load(source + (size_t) (height - 3 - c) * sourceStride + r);
+                    __m128i d3 = load(source + (size_t) (height - 4 - c) * sourceStride + r);
+                    transpose(a, b, d2, d3);
+                    store(out + (size_t) r * outStride + c, a);
+                    store(out + (size_t) (r + 1) * outStride + c, b);
+                    store(out + (size_t) (r + 2) * outStride + c, d2);
+                    store(out + (size_t) (r + 3) * outStride + c, d3);
+                } else {
+                    const Rgba* column = source + (width - 4 - r);
+                    __m128i a = load(column + (size_t) c * sourceStride);
+                    __m128i b = load(column + (size_t) (c + 1) * sourceStride);
+                    __m128i d2 = load(column + (size_t) (c + 2) * sourceStride);
+                    __m128i d3 = load(column + (size_t) (c + 3) * sourceStride);
+                    transpose(a, b, d2, d3);
+                    store(out + (size_t) r * outStride + c, d3);
+                    store(out + (size_t) (r + 1) * outStride + c, d2);
+                    store(out + (size_t) (r + 2) * outStride + c, b);
+                    store(out + (size_t) (r + 3) * outStride + c, a);
+                }
+            }
+        }
+#endif
+        for(int r = r0; r < r1; r++) {
+            Rgba* row = out + (size_t) r * outStride;
+            for(int c = r < r4 ? c4 : c0; c < c1; c++) {
+                row[c] = clockwise ? source[(size_t) (height - 1 - c) * sourceStride + r]
+                                   : source[(size_t) c * sourceStride + (width - 1 - r)];
+            }
+        }
+    }
+};
+
+/**
+ * @param pool  Threads to transform large regions on; the engine makes
+ *              its own if none is given.
+ */
+TransformEngine::TransformEngine(ThreadPool* pool) : m_pool(pool), m_ownsPool(pool == 0) {
+    if(m_ownsPool) {
+        m_pool = new ThreadPool();
+    }
+}
+
+TransformEngine::~TransformEngine() {
+    if(m_ownsPool) {
+        delete m_pool;
+    }
+}
+
+/**
+ * Transforms the whole canvas and the selection with it, as one undo
+ * step. Quarter turns swap the canvas's width and height.
+ */
+void TransformEngine::transformCanvas(PixelBuffer& pixels, Selection& selection, History* history,
+                                      Operation operation) {
+    Tracer::Zone zone("transform_canvas");
+    if(history) {
+        history->endStep();
+    }
+    applyToCanvas(pixels, selection, operation);
+    if(history) {
+        Operation undo = inverse(operation);
+        history->recordAction([this, undo](PixelBuffer& p, Selection& s) { applyToCanvas(p, s, undo); },
+                              [this, operation](PixelBuffer& p, Selection& s) { applyToCanvas(p, s, operation); });
+    }
+}
+
+/**
+ * Enlarges the whole canvas and the selection factor times, as one
+ * undo step.
+ *
+ * @return  false, changing nothing, if factor is below 2 or the canvas
+ *          would grow past MAX_SIZE.
+ */
+bool TransformEngine::scaleCanvas(PixelBuffer& pixels, Selection& selection, History* history, int factor) {
+    if(factor < 2 || pixels.width() > MAX_SIZE / factor || pixels.height() > MAX_SIZE / factor) {
+        return false;
+    }
+    Tracer::Zone zone("scale_canvas");
+    if(history) {
+        history->endStep();
+    }
+    applyScale(pixels, selection, factor);
+    if(history) {
+        history->recordAction([this, factor](PixelBuffer& p, Selection& s) { applyShrink(p, s, factor); },
+                              [this, factor](PixelBuffer& p, Selection& s) { applyScale(p, s, factor); });
+    }
+    return true;
+}
+
+/**
+ * Transforms the selected bixels and the selection in place, turning
+ * them about the center of the selection's bounding box.
+ *
+ * @return  false if nothing is selected.
+ */
+bool TransformEngine::transformSelection(PixelBuffer& pixels, Selection& selection, History* history,
+                                         Operation operation) {
+    int x, y, width, height;
+    if(!bounds(selection, x, y, width, height)) {
+        return false;
+    }
+    if(selection.count() == (size_t) pixels.width() * pixels.height()
+       && (!swapsSides(operation) || pixels.width() == pixels.height())) {
+        transformCanvas(pixels, selection, history, operation);
+        return true;
+    }
+    Tracer::Zone zone("transform_selection");
+
+    PixelBuffer lifted(width, height);
+    Selection liftedMask(width, height);
+    selection.forEachSpan([&](int sx, int sy, int length) {
+        memcpy(lifted.row(sy - y) + (sx - x), pixels.row(sy) + sx, length * sizeof(Rgba));
+        liftedMask.setSpan(sx - x, sy - y, length);
+    });
+    PixelBuffer moved;
+    transform(lifted, 0, 0, width, height, operation, moved);
+    Selection movedMask = transformMask(liftedMask, operation);
+    return replaceSelected(pixels, selection, history, moved, movedMask,
+                           x + (width - moved.width()) / 2, y + (height - moved.height()) / 2);
+}
+
+/**
+ * Enlarges the selected bixels and the selection factor times away
+ * from the top left corner of their bounding box.
+ *
+ * @return  false if nothing is selected, factor is below 2 or the
+ *          result would be larger than MAX_SIZE.
+ */
+bool TransformEngine::scaleSelection(PixelBuffer& pixels, Selection& selection, History* history, int factor) {
+    int x, y, width, height;
+    if(factor < 2 || !bounds(selection, x, y, width, height)
+       || width > MAX_SIZE / factor || height > MAX_SIZE / factor) {
+        return false;
+    }
+    Tracer::Zone zone("scale_selection");
+
+    PixelBuffer lifted(width, height);
+    Selection liftedMask(width, height);
+    selection.forEachSpan([&](int sx, int sy, int length) {
+        memcpy(lifted.row(sy - y) + (sx - x), pixels.row(sy) + sx, length * sizeof(Rgba));
+        liftedMask.setSpan(sx - x, sy - y, length);
+    });
+    PixelBuffer moved;
+    scale(lifted, 0, 0, width, height, factor, moved);
+    return replaceSelected(pixels, selection, history, moved, scaleMask(liftedMask, factor), x, y);
+}
+
+/**
+ * Writes the given region of source, transformed, into out, resizing
+ * out to fit.
+ */
+void TransformEngine::transform(const PixelBuffer& source, int x, int y, int width, int height,
+                                Operation operation, PixelBuffer& out) {
+    Tracer::Zone zone("transform");
+    bool swapped = swapsSides(operation);
+    int outWidth = swapped ? height : width;
+    int outHeight = swapped ? width : height;
+    if(out.width() != outWidth || out.height() != outHeight) {
+        out = PixelBuffer(outWidth, outHeight);
+    }
+    if(out.isEmpty()) {
+        return;
+    }
+
+    const Rgba* base = source.row(y) + x;
+    size_t stride = source.stride();
+    if(swapped) {
+        quarterTurn(base, stride, width, height, operation == ROTATE_90, out);
+    } else {
+        m_pool->parallelFor(0, outHeight, [&](int begin, int end) {
+            for(int r = begin; r < end; r++) {
+                const Rgba* in = base + (size_t) (operation == FLIP_HORIZONTAL ? r : height - 1 - r) * stride;
+                if(operation == FLIP_VERTICAL) {
+                    memcpy(out.row(r), in, width * sizeof(Rgba));
+                } else {
+                    reverseRow(in, out.row(r), width);
+                }
+            }
+        }, ROW_CHUNK);
+    }
+    out.markDirty(0, 0, outWidth, outHeight);
+}
+
+/**
+ * Writes the given region of source into out, each bixel repeated
+ * factor x factor times, resizing out to fit.
+ */
+void TransformEngine::scale(const PixelBuffer& source, int x, int y, int width, int height, int factor,
+                            PixelBuffer& out) {
+    Tracer::Zone zone("scale");
+    int outWidth = width * factor;
+    int outHeight = height * factor;
+    if(out.width() != outWidth || out.height() != outHeight) {
+        out = PixelBuffer(outWidth, outHeight);
+    }
+    if(out.isEmpty()) {
+        return;
+    }
+
+    m_pool->parallelFor(0, height, [&](int begin, int end) {
+        for(int sy = begin; sy < end; sy++) {
+            const Rgba* in = source.row(y + sy) + x;
+            Rgba* first = out.row(sy * factor);
+            int sx = 0;
+#ifdef __SSE2__
+            if(factor == 2) {
+                for(; sx + 4 <= width; sx += 4) {
+                    __m128i v = load(in + sx);
+                    store(first + sx * 2, _mm_unpacklo_epi32(v, v));
+                    store(first + sx * 2 + 4, _mm_unpackhi_epi32(v, v));
+                }
+            }
+#endif
+            for(; sx < width; sx++) {
+                Rgba* repeated = first + sx * factor;
+                for(int k = 0; k < factor; k++) {
+                    repeated[k] = in[sx];
+                }
+            }
+            for(int k = 1; k < factor; k++) {
+                memcpy(out.row(sy * factor + k), first, outWidth * sizeof(Rgba));
+            }
+        }
+    }, ROW_CHUNK);
+    out.markDirty(0, 0, outWidth, outHeight);
+}
+
+/**
+ * Keeps every factor-th bixel of every factor-th row of source, which
+ * undoes scale() exactly.
+ */
+void TransformEngine::shrink(const PixelBuffer& source, int factor, PixelBuffer& out) {
+    Tracer::Zone zone("shrink");
+    int outWidth = source.width() / factor;
+    int outHeight = source.height() / factor;
+    if(out.width() != outWidth || out.height() != outHeight) {
+        out = PixelBuffer(outWidth, outHeight);
+    }
+    m_pool->parallelFor(0, outHeight, [&](int begin, int end) {
+        for(int y = begin; y < end; y++) {
+            const Rgba* in = source.row(y * factor);
+            Rgba* row = out.row(y);
+            for(int x = 0; x < outWidth; x++) {
+                row[x] = in[(size_t) x * factor];
+            }
+        }
+    }, ROW_CHUNK);
+    out.markDirty(0, 0, outWidth, outHeight);
+}
+
+/**
+ * @return  mask transformed the same way transform() moves bixels.
+ */
+Selection TransformEngine::transformMask(const Selection& mask, Operation operation) {
+    int width = mask.width();
+    int height = mask.height();
+    bool swapped = swapsSides(operation);
+    Selection out(swapped ? height : width, swapped ? width : height);
+    mask.forEachSpan([&](int x, int y, int length) {
+        switch(operation) {
+            case FLIP_HORIZONTAL:
+                out.setSpan(width - x - length, y, length);
+            break;
+
+            case FLIP_VERTICAL:
+                out.setSpan(x, height - 1 - y, length);
+            break;
+
+            case ROTATE_180:
+                out.setSpan(width - x - length, height - 1 - y, length);
+            break;
+
+            //A row becomes a column, one bit per row
+            case ROTATE_90:
+                for(int i = 0; i < length; i++) {
+                    out.set(height - 1 - y, x + i);
+                }
+            break;
+
+            case ROTATE_270:
+                for(int i = 0; i < length; i++) {
+                    out.set(y, width - 1 - x - i);
+                }
+            break;
+        }
+    });
+    return out;
+}
+
+Selection TransformEngine::scaleMask(const Selection& mask, int factor) {
+    Selection out(mask.width() * factor, mask.height() * factor);
+    mask.forEachSpan([&](int x, int y, int length) {
+        for(int k = 0; k < factor; k++) {
+            out.setSpan(x * factor, y * factor + k, length * factor);
+        }
+    });
+    return out;
+}
+
+/**
+ * Samples mask like shrink() samples bixels.
+ */
+Selection TransformEngine::shrinkMask(const Selection& mask, int factor) {
+    Selection out(mask.width() / factor, mask.height() / factor);
+    for(int y = 0; y < out.height(); y++) {
+        mask.forEachSpanInRow(y * factor, [&](int x, int, int length) {
+            int first = (x + factor - 1) / factor;
+            int end = std::min(out.width(), (x + length + factor - 1) / factor);
+            if(first < end) {
+                out.setSpan(first, y, end - first);
+            }
+        });
+    }
+    return out;
+}
+
+TransformEngine::Operation TransformEngine::inverse(Operation operation) {
+    switch(operation) {
+        case ROTATE_90:
+            return ROTATE_270;
+        case ROTATE_270:
+            return ROTATE_90;
+        default:
+            return operation;
+    }
+}
+
+/**
+ * @return  true for quarter turns, which exchange width and height.
+ */
+bool TransformEngine::swapsSides(Operation operation) {
+    return operation == ROTATE_90 || operation == ROTATE_270;
+}
+
+/**
+ * Finds the bounding box of the selected bixels.
+ *
+ * @return  false if nothing is selected.
+ */
+bool TransformEngine::bounds(const Selection& selection, int& x, int& y, int& width, int& height) {
+    int left = selection.width();
+    int right = 0;
+    int top = -1;
+    int bottom = -1;
+    selection.forEachSpan([&](int spanX, int spanY, int length) {
+        if(top < 0) {
+            top = spanY;
+        }
+        bottom = spanY;
+        left = std::min(left, spanX);
+        right = std::max(right, spanX + length);
+    });
+    if(top < 0) {
+        return false;
+    }
+    x = left;
+    y = top;
+    width = right - left;
+    height = bottom - top + 1;
+    return true;
+}
+
+//-Private-//
+
+void TransformEngine::applyToCanvas(PixelBuffer& pixels, Selection& selection, Operation operation) {
+    PixelBuffer out;
+    transform(pixels, 0, 0, pixels.width(), pixels.height(), operation, out);
+    pixels.swap(out);
+    selection = selection.isEmpty() ? Selection(pixels.width(), pixels.height())
+                                    : transformMask(selection, operation);
+}
+
+void TransformEngine::applyScale(PixelBuffer& pixels, Selection& selection, int factor) {
+    PixelBuffer out;
+    scale(pixels, 0, 0, pixels.width(), pixels.height(), factor, out);
+    pixels.swap(out);
+    selection = selection.isEmpty() ? Selection(pixels.width(), pixels.height())
+                                    : scaleMask(selection, factor);
+}
+
+void TransformEngine::applyShrink(PixelBuffer& pixels, Selection& selection, int factor) {
+    PixelBuffer out;
+    shrink(pixels, factor, out);
+    pixels.swap(out);
+    selection = selection.isEmpty() ? Selection(pixels.width(), pixels.height())
+                                    : shrinkMask(selection, factor);
+}
+
+/**
+ * Quarter turn of the width x height bixels at source into out, which
+ * is height x width, one row of BLOCK_SIZE blocks per task.
+ */
+void TransformEngine::quarterTurn(const Rgba* source, size_t sourceStride, int width, int height,
+                                  bool clockwise, PixelBuffer& out) {
+    int outWidth = height;
+    int outHeight = width;
+    int blockRows = (outHeight + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    Rgba* target = out.data();
+    size_t targetStride = out.stride();
+    m_pool->parallelFor(0, blockRows, [&](int begin, int end) {
+        for(int block = begin; block < end; block++) {
+            int r0 = block * BLOCK_SIZE;
+            int r1 = std::min(outHeight, r0 + (int) BLOCK_SIZE);
+            for(int c0 = 0; c0 < outWidth; c0 += BLOCK_SIZE) {
+                turnBlock(source, sourceStride, width, height, clockwise, target, targetStride,
+                          r0, r1, c0, std::min(outWidth, c0 + (int) BLOCK_SIZE));
+            }
+        }
+    });
+}
+
+/**
+ * Clears the selected bixels and puts moved down with its top left
+ * corner at (x, y), where movedMask is set and the canvas reaches. The
+ * selection becomes the part of movedMask that landed on the canvas.
+ */
+bool TransformEngine::replaceSelected(PixelBuffer& pixels, Selection& selection, History* history,
+                                      const PixelBuffer& moved, const Selection& movedMask, int x, int y) {
+    if(history) {
+        history->endStep();
+        history->touchSelection(pixels, selection);
+    }
+    selection.forEachSpan([&](int spanX, int spanY, int length) {
+        PixelBuffer::fillSpan(pixels.row(spanY) + spanX, length, 0);
+        pixels.markDirty(spanX, spanY, length, 1);
+    });
+
+    Selection after(selection.width(), selection.height());
+    movedMask.forEachSpan([&](int spanX, int spanY, int length) {
+        int row = y + spanY;
+        int x0 = std::max(0, x + spanX);
+        int x1 = std::min(pixels.width(), x + spanX + length);
+        if(row < 0 || row >= pixels.height() || x0 >= x1) {
+            return;
+        }
+        if(history) {
+            history->touch(pixels, x0, row, x1 - x0);
+        }
+        memcpy(pixels.row(row) + x0, moved.row(spanY) + (x0 - x), (x1 - x0) * sizeof(Rgba));
+        pixels.markDirty(x0, row, x1 - x0, 1);
+        after.setSpan(x0, row, x1 - x0);
+    });
+
+    if(history) {
+        history->selectionChanged(selection, after);
+        history->endStep();
+    }
+    selection = after;
+    return true;
+}
+
+/**
+ * out[c] = in[width - 1 - c]; in and out must not overlap.
+ */
+void TransformEngine::reverseRow(const Rgba* in, Rgba* out, int width) {
+    int c = 0;
+#ifdef __SSE2__
+    for(; c + 4 <= width; c += 4) {
+        store(out + c, _mm_shuffle_epi32(load(in + width - 4 - c), _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+#endif
+    for(; c < width; c++) {
+        out[c] = in[width - 1 - c];
+    }
+}
@@ -0,0 +1,81 @@
+#ifndef TRANSFORMENGINE_HPP
+#define TRANSFORMENGINE_HPP
+#include <stddef.h>
+#include "rgba.hpp"
+#include "pixelbuffer.hpp"
+#include "selection.hpp"
+#include "history.hpp"
+#include "threadpool.hpp"
+
+/**
+ * Rotates, flips and scales the whole canvas or the selected bixels.
+ *
+ * Quarter turns walk the destination in BLOCK_SIZE square blocks, so
+ * the source rows a block reads and the destination rows it writes
+ * both stay in cache, and move bixels in 4 x 4 groups that are loaded
+ * as rows, transposed in SSE2 registers and stored as rows. Half turns
+ * and flips reverse or copy whole rows. Scaling repeats each bixel
+ * factor times across and copies the widened row factor times down.
+ * Rows of blocks, or rows, are spread over the thread pool.
+ *
+ * A canvas transform is one undo step that stores no bixels: undoing
+ * it applies the inverse transform, which is exact for all of these.
+ * The selection is carried along with the bixels.
+ *
+ * A selection transform lifts the selected bixels, leaving transparent
+ * ones behind, and drops the transformed bixels and mask back, turned
+ * about the center of the selection's bounding box, or scaled away
+ * from its top left corner. Anything pushed past the canvas edge is
+ * lost. It is one undo step recorded as touched bixels and selection
+ * flips. When everything is selected and the canvas keeps its size,
+ * the canvas transform is used instead.
+ *
+ * The engine must outlive any History it records canvas transforms in.
+ */
+class TransformEngine {
+    public:
+        enum Operation { ROTATE_90, ROTATE_180, ROTATE_270, FLIP_HORIZONTAL, FLIP_VERTICAL };
+
+        static const int BLOCK_SIZE = 64;
+        static const int MAX_SIZE = 1 << 15;
+
+        TransformEngine(ThreadPool* pool = 0);
+        ~TransformEngine();
+
+        void transformCanvas(PixelBuffer& pixels, Selection& selection, History* history, Operation operation);
+        bool scaleCanvas(PixelBuffer& pixels, Selection& selection, History* history, int factor);
+        bool transformSelection(PixelBuffer& pixels, Selection& selection, History* history,
+                                Operation operation);
+        bool scaleSelection(PixelBuffer& pixels, Selection& selection, History* history, int factor);
+
+        void transform(const PixelBuffer& source, int x, int y, int width, int height,
+                       Operation operation, PixelBuffer& out);
+        void scale(const PixelBuffer& source, int x, int y, int width, int height, int factor,
+                   PixelBuffer& out);
+        void shrink(const PixelBuffer& source, int factor, PixelBuffer& out);
+
+        static Selection transformMask(const Selection& mask, Operation operation);
+        static Selection scaleMask(const Selection& mask, int factor);
+        static Selection shrinkMask(const Selection& mask, int factor);
+        static Operation inverse(Operation operation);
+        static bool swapsSides(Operation operation);
+        static bool bounds(const Selection& selection, int& x, int& y, int& width, int& height);
+
+    private:
+        TransformEngine(const TransformEngine&);
+        TransformEngine& operator=(const TransformEngine&);
+
+        void applyToCanvas(PixelBuffer& pixels, Selection& selection, Operation operation);
+        void applyScale(PixelBuffer& pixels, Selection& selection, int factor);
+        void applyShrink(PixelBuffer& pixels, Selection& selection, int factor);
+        void quarterTurn(const Rgba* source, size_t sourceStride, int width, int height, bool clockwise,
+                         PixelBuffer& out);
+        bool replaceSelected(PixelBuffer& pixels, Selection& selection, History* history,
+                             const PixelBuffer& moved, const Selection& movedMask, int x, int y);
+
+        static void reverseRow(const Rgba* in, Rgba* out, int width);
+
+        ThreadPool* m_pool;
+        bool m_ownsPool;
+};
+#endif
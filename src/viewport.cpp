@@ -0,0 +1,187 @@
+#include <math.h>
+#include <algorithm>
+#include "viewport.hpp"
+
+namespace {
+    // Screen pixels per bixel at the limits of zooming.
+    const double MIN_ZOOM = 1.0 / 64;
+    const double MAX_ZOOM = 256;
+
+    // Screen pixels of grid that panning always leaves in view.
+    const double MIN_VISIBLE = 32;
+};
+
+Viewport::Viewport() :
+    m_viewWidth(0), m_viewHeight(0), m_gridWidth(0), m_gridHeight(0),
+    m_zoom(1), m_originX(0), m_originY(0) {
+}
+
+/**
+ * Resizes the view, keeping the grid point at its center in place.
+ */
+void Viewport::setViewSize(int width, int height) {
+    width = std::max(0, width);
+    height = std::max(0, height);
+    m_originX += (m_viewWidth - width) * 0.5 / m_zoom;
+    m_originY += (m_viewHeight - height) * 0.5 / m_zoom;
+    m_viewWidth = width;
+    m_viewHeight = height;
+    clampOrigin();
+}
+
+/**
+ * Sets the grid size and fits the view to it if it changed.
+ */
+void Viewport::setGridSize(int width, int height) {
+    width = std::max(0, width);
+    height = std::max(0, height);
+    if(width == m_gridWidth && height == m_gridHeight) {
+        return;
+    }
+    m_gridWidth = width;
+    m_gridHeight = height;
+    fit();
+}
+
+int Viewport::viewWidth() const {
+    return m_viewWidth;
+}
+
+int Viewport::viewHeight() const {
+    return m_viewHeight;
+}
+
+int Viewport::gridWidth() const {
+    return m_gridWidth;
+}
+
+int Viewport::gridHeight() const {
+    return m_gridHeight;
+}
+
+/**
+ * @return  Screen pixels per bixel.
+ */
+double Viewport::zoom() const {
+    return m_zoom;
+}
+
+/**
+ * Zooms around the center of the view.
+ */
+void Viewport::setZoom(double zoom) {
+    zoomAt(zoom / m_zoom, m_viewWidth * 0.5, m_viewHeight * 0.5);
+}
+
+/**
+ * Multiplies the zoom by factor, keeping the grid point under screen
+ * position (x, y) where it is.
+ */
+void Viewport::zoomAt(double factor, double x, double y) {
+    if(!(factor > 0)) {
+        return;
+    }
+    vec2 anchor = toGrid(x, y);
+    m_zoom = std::max(MIN_ZOOM, std::min(MAX_ZOOM, m_zoom * factor));
+    m_originX = anchor.x - x / m_zoom;
+    m_originY = anchor.y - y / m_zoom;
+    clampOrigin();
+}
+
+/**
+ * Moves the grid by (dx, dy) screen pixels.
+ */
+void Viewport::panBy(double dx, double dy) {
+    m_originX -= dx / m_zoom;
+    m_originY -= dy / m_zoom;
+    clampOrigin();
+}
+
+/**
+ * Zooms so the whole grid fits the view, and centers it.
+ */
+void Viewport::fit() {
+    if(m_gridWidth > 0 && m_gridHeight > 0 && m_viewWidth > 0 && m_viewHeight > 0) {
+        double fitted = std::min((double) m_viewWidth / m_gridWidth, (double) m_viewHeight / m_gridHeight);
+        m_zoom = std::max(MIN_ZOOM, std::min(MAX_ZOOM, fitted));
+    }
+    m_originX = (m_gridWidth - m_viewWidth / m_zoom) * 0.5;
+    m_originY = (m_gridHeight - m_viewHeight / m_zoom) * 0.5;
+}
+
+double Viewport::minZoom() {
+    return MIN_ZOOM;
+}
+
+double Viewport::maxZoom() {
+    return MAX_ZOOM;
+}
+
+/**
+ * @return  The grid x coordinate at the left edge of the view.
+ */
+double Viewport::originX() const {
+    return m_originX;
+}
+
+/**
+ * @return  The grid y coordinate at the top edge of the view.
+ */
+double Viewport::originY() const {
+    return m_originY;
+}
+
+vec2 Viewport::toGrid(double x, double y) const {
+    return vec2(m_originX + x / m_zoom, m_originY + y / m_zoom);
+}
+
+vec2 Viewport::toScreen(double gridX, double gridY) const {
+    return vec2((gridX - m_originX) * m_zoom, (gridY - m_originY) * m_zoom);
+}
+
+/**
+ * @return  The bixel under screen position (x, y), which may lie
+ *          outside the grid.
+ */
+ivec2 Viewport::toBixel(double x, double y) const {
+    vec2 position = toGrid(x, y);
+    return ivec2((int) floor(position.x), (int) floor(position.y));
+}
+
+/**
+ * Finds the bixels that are at least partly in view.
+ *
+ * @return  false if none are.
+ */
+bool Viewport::visibleRect(int& x, int& y, int& width, int& height) const {
+    int left = std::max(0, (int) floor(m_originX));
+    int top = std::max(0, (int) floor(m_originY));
+    int right = std::min(m_gridWidth, (int) ceil(m_originX + m_viewWidth / m_zoom));
+    int bottom = std::min(m_gridHeight, (int) ceil(m_originY + m_viewHeight / m_zoom));
+    x = left;
+    y = top;
+    width = std::max(0, right - left);
+    height = std::max(0, bottom - top);
+    return width > 0 && height > 0;
+}
+
+/**
+ * @return  The mip level whose texels are closest to one screen pixel:
+ *          0 when zoomed in, 1 when a screen pixel covers 2 bixels, and
+ *          so on.
+ */
+int Viewport::mipLevel() const {
+    return m_zoom >= 1 ? 0 : (int) floor(log2(1 / m_zoom));
+}
+
+//-Private-//
+
+void Viewport::clampOrigin() {
+    if(m_gridWidth == 0 || m_gridHeight == 0) {
+        return;
+    }
+    double marginX = std::min(MIN_VISIBLE, m_gridWidth * m_zoom) / m_zoom;
+    double marginY = std::min(MIN_VISIBLE, m_gridHeight * m_zoom) / m_zoom;
+    m_originX = std::max(marginX - m_viewWidth / m_zoom, std::min(m_gridWidth - marginX, m_originX));
+    m_originY = std::max(marginY - m_viewHeight / m_zoom, std::min(m_gridHeight - marginY, m_originY));
+}
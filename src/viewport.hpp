@@ -0,0 +1,59 @@
+#ifndef VIEWPORT_HPP
+#define VIEWPORT_HPP
+#include "vec2.hpp"
+#include "ivec2.hpp"
+
+/**
+ * The view transform between the canvas widget and the grid: how many
+ * screen pixels a bixel covers, and which grid position sits at the top
+ * left corner of the view.
+ *
+ * The GL surface stays the size of the view and the transform is
+ * applied in the shader, so zooming in costs nothing extra and zooming
+ * out reads a smaller mip level. visibleRect() gives the bixels that
+ * are at least partly on screen; the renderer draws only those.
+ *
+ * Zooming keeps a chosen screen point fixed over the same grid point,
+ * so wheel zoom follows the cursor. Panning is limited so some of the
+ * grid always stays in view.
+ */
+class Viewport {
+    public:
+        Viewport();
+
+        void setViewSize(int width, int height);
+        void setGridSize(int width, int height);
+        int viewWidth() const;
+        int viewHeight() const;
+        int gridWidth() const;
+        int gridHeight() const;
+
+        double zoom() const;
+        void setZoom(double zoom);
+        void zoomAt(double factor, double x, double y);
+        void panBy(double dx, double dy);
+        void fit();
+
+        static double minZoom();
+        static double maxZoom();
+
+        double originX() const;
+        double originY() const;
+        vec2 toGrid(double x, double y) const;
+        vec2 toScreen(double gridX, double gridY) const;
+        ivec2 toBixel(double x, double y) const;
+        bool visibleRect(int& x, int& y, int& width, int& height) const;
+        int mipLevel() const;
+
+    private:
+        void clampOrigin();
+
+        int m_viewWidth;
+        int m_viewHeight;
+        int m_gridWidth;
+        int m_gridHeight;
+        double m_zoom;
+        double m_originX;
+        double m_originY;
+};
+#endif